@@ -4,6 +4,7 @@
 
 #include <framework/colorconstants.hpp>
 #include <framework/errorcheck.hpp>
+#include <framework/filesystem.hpp>
 #include <framework/resourcemanager2.hpp>
 
 #include <ztype/ztype.hpp>
@@ -281,7 +282,17 @@ namespace RenderingKit
                         nullptr),
                         false;
 
-            rasterizer.reset(ztype::Rasterizer::Create(is.get(), size));
+            // Mapped fonts are handed to FreeType in place instead of being copied
+            auto mapped = dynamic_cast<IMappedInputStream*>(is.get());
+
+            if (mapped != nullptr && is->getSize() <= SIZE_MAX)
+            {
+                const size_t fileSize = (size_t) is->getSize();
+                const uint8_t* data = mapped->GetView(0, fileSize);
+                rasterizer.reset(ztype::Rasterizer::Create(data, fileSize, size, move(is)));
+            }
+            else
+                rasterizer.reset(ztype::Rasterizer::Create(is.get(), size));
 
             if (rasterizer == nullptr)
                 return ErrorBuffer::SetError(eb, EX_ASSET_OPEN_ERR, "desc", (const char*) sprintf_t<255>("Failed to open font '%s'.", path),
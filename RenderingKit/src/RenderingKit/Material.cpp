@@ -45,6 +45,8 @@ namespace RenderingKit
                 return DefaultStateTransitionTo(this, targetState, resMgr);
             }
 
+            virtual void GetMemoryUsage(size_t* cpuBytes_out, size_t* gpuBytes_out) final override;
+
         private:
             void BuiltinUniformsInitialize();
             void BuiltinUniformsSetup(const glm::mat4x4& projection, const glm::mat4x4& modelView);
@@ -137,6 +139,26 @@ namespace RenderingKit
             program->SetUniformMat4x4(u_ProjectionMatrix, projection);
     }
 
+    void GLMaterial::GetMemoryUsage(size_t* cpuBytes_out, size_t* gpuBytes_out)
+    {
+        size_t cpuBytes = 0, gpuBytes = 0, cpu, gpu;
+
+        // Textures set by pointer belong to the resource manager, which accounts for them itself;
+        // only count those that would go away with this material
+        for (unsigned int i = 0; i < numTextures; i++)
+        {
+            if (textures[i].textureHandle != nullptr && textures[i].textureHandle.use_count() == 1)
+            {
+                textures[i].textureHandle->GetMemoryUsage(&cpu, &gpu);
+                cpuBytes += cpu;
+                gpuBytes += gpu;
+            }
+        }
+
+        *cpuBytes_out = cpuBytes;
+        *gpuBytes_out = gpuBytes;
+    }
+
     void GLMaterial::GLSetup(const MaterialSetupOptions& options, const glm::mat4x4& projection, const glm::mat4x4& modelView)
     {
         program->GLSetup();
@@ -64,6 +64,14 @@ namespace RenderingKit
                 return DefaultStateTransitionTo(this, targetState, resMgr);
             }
 
+            virtual void GetMemoryUsage(size_t* cpuBytes_out, size_t* gpuBytes_out) final override
+            {
+                *cpuBytes_out = pm.pixelData.size();
+
+                // assume 32 bits per texel; mipmaps add roughly one third
+                *gpuBytes_out = (handle != 0) ? (size_t) size.x * size.y * 4 * 4 / 3 : 0;
+            }
+
         private:
             // Private methods
             GLuint p_CreateEmptyTexture(int flags, const RKTextureWrap_t wrap[2], bool isDepthTexture);
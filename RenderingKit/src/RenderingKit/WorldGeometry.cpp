@@ -64,6 +64,8 @@ namespace RenderingKit {
             return DefaultStateTransitionTo(this, targetState, resMgr);
         }
 
+        virtual void GetMemoryUsage(size_t* cpuBytes_out, size_t* gpuBytes_out) final override;
+
     private:
         State_t state = CREATED;
         zfw::ErrorBuffer_t* eb;
@@ -103,6 +105,7 @@ namespace RenderingKit {
         zombie_assert(matIndex < matGrps.size());
 
         auto& group = matGrps[matIndex];
+        group.numVertices = numVertices;
         group.geometry.reset(gb->CreateGeomChunk());
         return group.geometry;
     }
@@ -119,6 +122,19 @@ namespace RenderingKit {
         }
     }
 
+    void WorldGeometry::GetMemoryUsage(size_t* cpuBytes_out, size_t* gpuBytes_out) {
+        // Vertices are streamed straight from the file into the geometry buffer; nothing is kept on the CPU side
+        size_t gpuBytes = 0;
+
+        for (const auto& group : matGrps) {
+            if (group.geometry != nullptr && group.vertexFormat != nullptr)
+                gpuBytes += group.numVertices * group.vertexFormat->GetVertexSize();
+        }
+
+        *cpuBytes_out = 0;
+        *gpuBytes_out = gpuBytes;
+    }
+
     shared_ptr<IVertexFormat> WorldGeometry::GetMatGrpVertexFormat(size_t matIndex) {
         auto& grp = matGrps[matIndex];
         return grp.vertexFormat;
@@ -93,6 +93,8 @@ namespace zfw
     // structs
     struct ErrorBuffer_t;
     struct FSStat_t;
+    struct Job_t;
+    struct JobCounter_t;
     struct MessageHeader;
     struct Pixmap_t;
     struct PixmapInfo_t;
@@ -110,6 +112,7 @@ namespace zfw
     class IFSUnion;
     class IGeneric;
     class IGraphics;
+    class IJobSystem;
     class ILuaScriptContext;
     class IMediaCodecHandler;
     class IModuleHandler;
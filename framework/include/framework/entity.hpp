@@ -108,6 +108,31 @@ namespace zfw
             virtual void            OnRemoveEntity(EntityWorld* world, IEntity* ent) = 0;
     };
 
+    enum EntityUpdatePhase
+    {
+        kEntityPhaseEarly,
+        kEntityPhaseDefault,
+        kEntityPhaseLate,
+
+        kNumEntityPhases
+    };
+
+    // Entities not implementing this are updated in kEntityPhaseDefault, one at a time on the calling thread.
+    // Queried once, when the entity is added to a world.
+    class IEntityUpdatePolicy
+    {
+        protected:
+            ~IEntityUpdatePolicy() {}
+
+        public:
+            virtual EntityUpdatePhase GetUpdatePhase() = 0;
+
+            // True if OnTick/OnFrame only modify the entity itself, so that it can be updated concurrently
+            // with the other thread-safe entities of its phase. Changes to the world or to other entities
+            // must then go through EntityWorld::QueueAddEntity/QueueRemoveEntity/QueueCommand.
+            virtual bool IsUpdateThreadSafe() = 0;
+    };
+
     class IEntityReflection
     {
         protected:
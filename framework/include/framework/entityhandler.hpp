@@ -1,6 +1,7 @@
 #pragma once
 
 #include <framework/base.hpp>
+#include <framework/entitypool.hpp>
 #include <framework/errorbuffer.hpp>
 
 namespace zfw
@@ -26,7 +27,22 @@ namespace zfw
             virtual bool Register(const char* className, IEntity* (*Instantiate)()) = 0;
             virtual bool RegisterExternal(const char* path, int flags) = 0;
 
+            // Entities of classes registered with InstantiatePooled (normally &CreatePooledInstance<C>) are allocated
+            // together with their shared_ptr control block, from a pool of the class (see EntityPool).
+            // This applies to InstantiateEntityByID/InstantiateEntitiesByID; InstantiateEntity uses Instantiate.
+            virtual bool Register(const char* className, IEntity* (*Instantiate)(),
+                    shared_ptr<IEntity> (*InstantiatePooled)(const shared_ptr<EntityPool>& pool)) = 0;
+
             virtual IEntity* InstantiateEntity(const char* className, int flags) = 0;
             virtual int IterateEntityClasses(IEntityClassListener* listener) = 0;
+
+            // Class IDs skip the name lookup when spawning many entities. They stay valid for the lifetime
+            // of the handler, including redefinition of the class. Returns -1 if undefined.
+            virtual int GetEntityClassID(const char* className, int flags) = 0;
+            virtual shared_ptr<IEntity> InstantiateEntityByID(int classID, int flags) = 0;
+
+            // Fills ents_out with 'count' new entities, allocating pool memory for all of them at once.
+            // Returns 'count', or 0 on failure.
+            virtual size_t InstantiateEntitiesByID(int classID, shared_ptr<IEntity>* ents_out, size_t count, int flags) = 0;
     };
 }
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <framework/base.hpp>
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/*
+    EntityPool hands out fixed-size blocks for the entities of one class, recycling freed blocks through
+    a free list. Blocks are carved out of larger chunks, so spawning and removing many short-lived entities
+    (projectiles, debris) neither fragments the heap nor goes to the system allocator each time.
+
+    Entities are allocated together with their shared_ptr control block (see CreatePooledInstance),
+    and keep the pool alive through their allocator, so chunks are only released once the pool
+    and every entity allocated from it are gone.
+
+    All functions are thread-safe; entities may be created and released from job workers.
+*/
+
+namespace zfw
+{
+    class EntityPool
+    {
+        public:
+            EntityPool(size_t blocksPerChunk = 64) : blocksPerChunk(blocksPerChunk) {}
+            ~EntityPool();
+
+            // The first allocation sets the block size; later ones must not be larger
+            void* Alloc(size_t size);
+            void Free(void* block);
+
+            // Allocates up front whatever the next 'numBlocks' allocations would need.
+            // Before the first allocation the block size is not known yet; the first chunk is then made large enough.
+            void Reserve(size_t numBlocks);
+
+            size_t GetBlockSize() const { return blockSize; }
+            size_t GetNumBlocks();
+            size_t GetNumFreeBlocks();
+
+        protected:
+            struct FreeBlock_t
+            {
+                FreeBlock_t* next;
+            };
+
+            void p_AllocChunk(size_t numBlocks);
+
+            size_t blocksPerChunk;
+            size_t blockSize = 0;
+
+            std::mutex mutex;
+            std::vector<void*> chunks;
+            FreeBlock_t* freeList = nullptr;
+            size_t numBlocks = 0, numFreeBlocks = 0;
+            size_t numReserved = 0;                 // requested before the block size was known
+
+        private:
+            EntityPool(const EntityPool&) = delete;
+    };
+
+    template <typename T>
+    class EntityPoolAllocator
+    {
+        public:
+            typedef T value_type;
+
+            EntityPoolAllocator(shared_ptr<EntityPool> pool) : pool(move(pool)) {}
+            template <typename U> EntityPoolAllocator(const EntityPoolAllocator<U>& other) : pool(other.pool) {}
+
+            T* allocate(size_t n)
+            {
+                static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types can't be pooled");
+
+                return static_cast<T*>(pool->Alloc(n * sizeof(T)));
+            }
+
+            void deallocate(T* p, size_t n) { pool->Free(p); }
+
+            template <typename U> bool operator==(const EntityPoolAllocator<U>& other) const { return pool == other.pool; }
+            template <typename U> bool operator!=(const EntityPoolAllocator<U>& other) const { return pool != other.pool; }
+
+            shared_ptr<EntityPool> pool;
+    };
+
+    // For IEntityHandler::Register
+    template <class C>
+    shared_ptr<IEntity> CreatePooledInstance(const shared_ptr<EntityPool>& pool)
+    {
+        return std::allocate_shared<C>(EntityPoolAllocator<C>(pool));
+    }
+}
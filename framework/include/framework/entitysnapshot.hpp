@@ -0,0 +1,118 @@
+#pragma once
+
+#include <framework/base.hpp>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+/*
+    Snapshots hold the serialized state (see IEntity::Serialize) of every entity in an EntityWorld,
+    as taken by EntityWorld::TakeSnapshot. A diff between two snapshots holds only the entities
+    which were added or removed, and the byte ranges which changed in the others.
+
+    Diffs are only meaningful between snapshots of the same world: the class table is shared
+    by all snapshots of a world, and only ever grows.
+
+    Typical use (rewind):
+
+        world->TakeSnapshot(snapshot, 0);
+        history.Push(snapshot);                 // hands back an old snapshot to reuse next time
+        ...
+        history.Get(ticksBack, snapshot);
+        world->RestoreSnapshot(snapshot, 0);
+*/
+
+namespace zfw
+{
+    class EntityWorldSnapshot
+    {
+        friend class EntityWorld;
+        friend class EntityWorldDiff;
+
+        public:
+            void Clear();
+            size_t GetNumEntities() const { return entities.size(); }
+            size_t GetSize() const;             // in bytes, approximately
+
+        protected:
+            struct Entity_t
+            {
+                int32_t entID;
+                uint32_t classIndex;
+                uint32_t offset, length;        // into 'data'
+            };
+
+            std::vector<Entity_t> entities;     // in slot order (see EntityWorld::GetEntityIndex)
+            std::vector<uint8_t> data;
+            shared_ptr<const std::vector<std::string>> classNames;
+    };
+
+    class EntityWorldDiff
+    {
+        public:
+            // 'from' and 'to' must be snapshots of the same world
+            static void Create(const EntityWorldSnapshot& from, const EntityWorldSnapshot& to, EntityWorldDiff& diff_out);
+
+            // Builds the 'to' snapshot out of the 'from' one
+            void Apply(const EntityWorldSnapshot& from, EntityWorldSnapshot& to_out) const;
+
+            void Clear();
+            bool IsEmpty() const { return changes.empty(); }
+            size_t GetNumChanges() const { return changes.size(); }
+            size_t GetSize() const;             // in bytes, approximately
+
+        protected:
+            friend class EntityWorld;
+
+            enum { kAdded, kChanged, kRemoved };
+
+            struct Change_t
+            {
+                int32_t entID;
+                uint32_t classIndex;            // kAdded, kChanged
+                uint32_t length;                // kAdded, kChanged: new length of the entity data
+                uint32_t firstRun, numRuns;     // kChanged; kAdded has a single run with all of the data
+                uint8_t type;
+            };
+
+            struct Run_t
+            {
+                uint32_t offset, length;        // within the entity data
+                uint32_t dataOffset;            // into 'data'
+            };
+
+            void p_Patch(const Change_t& change, const uint8_t* base, uint32_t baseLength,
+                    std::vector<uint8_t>& data_out) const;
+
+            std::vector<Change_t> changes;      // in slot order
+            std::vector<Run_t> runs;
+            std::vector<uint8_t> data;
+            shared_ptr<const std::vector<std::string>> classNames;
+    };
+
+    // The latest snapshot in full, plus backward diffs for the older ones
+    class EntityWorldHistory
+    {
+        public:
+            EntityWorldHistory(size_t maxLength) : maxLength(maxLength) {}
+
+            void Clear();
+
+            // Returns the snapshot's previous contents (in 'snapshot') for reuse
+            void Push(EntityWorldSnapshot& snapshot);
+
+            // 0 is the latest snapshot
+            bool Get(size_t stepsBack, EntityWorldSnapshot& snapshot_out) const;
+            size_t GetLength() const { return hasLatest ? diffs.size() + 1 : 0; }
+            size_t GetSize() const;             // in bytes, approximately
+
+        protected:
+            size_t maxLength;
+
+            EntityWorldSnapshot latest;
+            bool hasLatest = false;
+
+            std::deque<EntityWorldDiff> diffs;  // diffs[i] goes from i steps back to i + 1 steps back
+    };
+}
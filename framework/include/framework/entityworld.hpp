@@ -1,37 +1,110 @@
 #pragma once
 
 #include <framework/entity.hpp>
+#include <framework/spatialindex.hpp>
+#include <framework/transformstore.hpp>
 
 #include <littl/List.hpp>
 
-#if ZOMBIE_API_VERSION >= 201601
 #include <functional>
-#endif
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace zfw
 {
+    class EntityWorldDiff;
+    class EntityWorldSnapshot;
+
+    // Entities are kept in a generational slot map: an entity ID is the index of its slot
+    // (low kEntityIndexBits bits) plus the slot's generation, which is bumped whenever the slot is freed.
+    // IDs of removed entities therefore never resolve to whatever reuses their slot.
+    // Iteration goes over a dense array, whose order changes when entities are removed.
+    //
+    // Entities implementing ITransformStoreUser are attached to the world's TransformStore;
+    // OnTick integrates their speed (in units per tick) after ticking all entities.
+    //
+    // OnTick and OnFrame update the entities phase by phase (see IEntityUpdatePolicy). Within a phase,
+    // thread-safe entities are updated in parallel on the job system, then the rest one by one.
+    // Changes queued during a phase are applied at its end, in a deterministic order.
+    //
+    // The bounds of every IPointEntity are kept in a SpatialIndex for the Query* functions.
+    // Bounds of TransformStore users are refreshed after integration; other entities which move
+    // must be reported with UpdateEntityBounds (typically from their movement listener).
     class EntityWorld
     {
         public:
+            enum
+            {
+                kEntityIndexBits = 20,
+                kEntityIndexMask = (1 << kEntityIndexBits) - 1,
+                kEntityGenerationMask = (1 << (31 - kEntityIndexBits)) - 1,
+
+                kMaxEntities = kEntityIndexMask + 1,
+            };
+
             EntityWorld(ISystem* sys) : sys(sys) {}
             
             bool AddEntity(shared_ptr<IEntity> ent);
             void AddEntityFilter(IEntityFilter* filter);
             void Draw(const UUID_t* modeOrNull);
             IEntity* GetEntityByID(int entID);
+
+            // Lookup by slot index alone, for when only kEntityIndexBits bits can be stored (e.g. picking)
+            IEntity* GetEntityByIndex(int index);
+            static int GetEntityIndex(int entID) { return entID & kEntityIndexMask; }
+
             size_t GetNumEntities() const { return entities.getLength(); }
+            SpatialIndex* GetSpatialIndex() { return &spatialIndex; }     // to tune the cell size
+            TransformStore* GetTransformStore() { return &transforms; }
 			bool InitAllEntities();
             void OnFrame(double delta);
             void OnTick();
             void RemoveAllEntities(bool destroy);
-            void RemoveEntity(IEntity* ent);
+            void RemoveEntity(IEntity* ent);                // deferred when called during an update
             void RemoveEntity(shared_ptr<IEntity> ent) { RemoveEntity(ent.get()); }
             void RemoveEntityFilter(IEntityFilter* filter);
+
+            // Format: a class table, then one length-prefixed record per entity (see kSerializationFormat).
+            // Unserialize also reads the older format, in which every entity carries its class name.
+            // Entities of undefined classes are skipped with a warning.
 			bool Serialize(OutputStream* output, int flags);
 			bool Unserialize(InputStream* input, int flags);
 
+            // Snapshots (see entitysnapshot.hpp) hold what FullSerialize writes, so entities which opt out
+            // of serialization are neither captured nor touched by a restore. TakeSnapshot reuses the storage
+            // of 'snapshot_out'.
+            // Entities still in the world are restored in place, keeping their identity, which requires their
+            // Unserialize to work on an entity that is already initialized; the rest are removed or re-created.
+            // An entity whose slot has since been taken by one that snapshots don't capture gets a new ID.
+            bool TakeSnapshot(EntityWorldSnapshot& snapshot_out, int flags);
+            bool RestoreSnapshot(const EntityWorldSnapshot& snapshot, int flags);
+
+            // Same as restoring the snapshot the diff leads to, for a world currently in the state 'from',
+            // but only touches the entities which the diff changes
+            bool ApplyDiff(const EntityWorldSnapshot& from, const EntityWorldDiff& diff, int flags);
+
             void WalkEntities(IEntityVisitor* visitor);
 
+            // Point entities whose bounds (the AABB, or just the position if there is none) overlap the query;
+            // the results are appended. Safe to call from any entity update.
+            void QueryAABB(const Float3& min, const Float3& max, std::vector<IEntity*>& results);
+            void QueryRadius(const Float3& centre, float radius, std::vector<IEntity*>& results);
+            IEntity* QueryRay(const Float3& origin, const Float3& dir, float maxDistance, float* distance_out,
+                    IEntity* ignore = nullptr);
+
+            // Not safe to call from entities updated in parallel
+            void UpdateEntityBounds(IEntity* ent);
+
+            // During an update, changes queued by an entity are applied at the end of the current phase,
+            // ordered by the entity's position in the phase and then by call order, so the outcome does not
+            // depend on thread scheduling. Only call these from the updating entity's own OnTick/OnFrame.
+            // Outside of an update, they take effect immediately.
+            void QueueAddEntity(shared_ptr<IEntity> ent);
+            void QueueCommand(std::function<void()> command);
+            void QueueRemoveEntity(IEntity* ent);
+
 #if ZOMBIE_API_VERSION >= 201601
             // Identical in function to WalkEntities, but this name seems better
             // Iterates over every single entity in the world, think twice or thrice whether this is what you want
@@ -44,11 +117,103 @@ namespace zfw
 #endif
 
         protected:
+            enum
+            {
+                kUpdatePhaseMask = 0x7F,
+                kUpdateThreadSafe = 0x80,
+            };
+
+            enum
+            {
+                // u8 0x10, then per entity: class name, i32 ID, entity data, u8 0xDD; terminated by an empty name
+                kSerializationFormatLegacy = 0x10,
+
+                // u8 0x20, u32 numClasses, class names, u32 numEntities, u64 recordsLength,
+                // then per entity: u16 class index, i32 ID, u32 length, entity data
+                kSerializationFormat = 0x20,
+            };
+
+            struct EntitySlot_t
+            {
+                uint32_t generation;
+                uint32_t denseIndex;                        // into 'entities', kFreeSlot if unused
+            };
+
+            static const uint32_t kFreeSlot = UINT32_MAX;
+
+            struct QueuedCommand_t
+            {
+                uint32_t order;                             // position of the issuing entity in the phase
+                std::function<void()> command;
+            };
+
+            struct UpdateContext_t
+            {
+                EntityWorld* world;
+                std::vector<QueuedCommand_t>* commands;
+                uint32_t order;
+            };
+
+            struct UpdatePhase_t
+            {
+                std::vector<IEntity*> parallel, serial;
+            };
+
+            bool p_AddEntity(shared_ptr<IEntity>&& ent, int entID);
+            bool p_AddUnserializedEntity(shared_ptr<IEntity>&& ent, int32_t entID, const char* className);
+            void p_GetBounds(uint32_t denseIndex, Float3& min, Float3& max);
+            uint32_t p_GetSnapshotClass(const char* className, const uint8_t* header, size_t headerLength);
+            uint32_t p_GetSnapshotClassOf(IEntity* ent, int flags);
+            bool p_LinkEntities(const std::vector<IEntity*>& ents, int flags);
+            bool p_RestoreEntity(int32_t entID, uint32_t classIndex, const std::string& className, int& classID,
+                    const uint8_t* data, uint32_t length, int flags, std::vector<IEntity*>& restored);
+            bool p_ClaimSlot(uint32_t index, uint32_t generation);
+            uint32_t p_AllocateSlot();
+
+            void p_ApplyQueuedCommands();
+            void p_BuildPhases();
+            void p_Queue(std::function<void()>&& command);
+            bool p_UnserializeEntities(InputStream* input, int flags);
+            bool p_UnserializeEntitiesLegacy(InputStream* input, int flags);
+            template <typename Func> void p_Update(Func&& update);
+
+            static UpdateContext_t*& p_CurrentContext();
+
             ISystem* sys;
 
+            // dense storage; entitySlots[i], entityPoints[i], entityTransforms[i] and entityUpdate[i] belong to entities[i]
             li::List<shared_ptr<IEntity>> entities;
+            std::vector<uint32_t>       entitySlots;
+            std::vector<IPointEntity*>  entityPoints;       // nullptr if not a point entity
+            std::vector<uint32_t>       entityTransforms;   // TransformStore handles, kInvalidHandle if not a user
+            std::vector<uint8_t>        entityUpdate;       // phase | kUpdateThreadSafe
+
+            TransformStore              transforms;
+            std::vector<uint32_t>       transformSlots;     // by TransformStore handle
+            std::vector<uint32_t>       movedTransforms;
+
+            SpatialIndex                spatialIndex;       // point entities, keyed by slot index
+
+            std::vector<EntitySlot_t>   slots;
+            std::vector<uint32_t>       freeSlots;          // may contain slots claimed since (see p_ClaimSlot)
+
             li::List<IEntityFilter*>    entityFilters;
 
+            // Class table of all snapshots taken; only ever grows, and is replaced rather than modified
+            // so that older snapshots can keep sharing it
+            shared_ptr<std::vector<std::string>> snapshotClassNames;
+            std::unordered_map<std::string, uint32_t> snapshotClassIndices;
+            std::vector<std::string>    snapshotClassHeaders;   // by class: the name as FullSerialize writes it
+            std::vector<uint32_t>       snapshotSlotClasses;    // by slot: class of the entity there, or kFreeSlot if unknown
+            std::vector<uint8_t>        snapshotScratch;
+
+            UpdatePhase_t               phases[kNumEntityPhases];
+            bool                        phasesDirty = true;
+            bool                        updating = false;
+
+            std::mutex                  queueMutex;
+            std::vector<QueuedCommand_t> queuedCommands;
+
         private:
             EntityWorld(const EntityWorld&) = delete;
     };
@@ -2,6 +2,8 @@
 
 #include <framework/base.hpp>
 
+#include <littl/Stream.hpp>
+
 #include <ctime>
 
 namespace zfw
@@ -39,6 +41,15 @@ namespace zfw
         FS_NEITHER_FOUND =      3
     };
 
+    struct FSUnionCacheStats_t
+    {
+        uint64_t hits;              // lookups answered by the path cache
+        uint64_t negativeHits;      // ...of which the path was known to be missing
+        uint64_t misses;            // lookups which probed the mounted file systems
+        uint64_t invalidations;
+        size_t numEntries;
+    };
+
     struct FSStat_t
     {
         uint64_t sizeInBytes;
@@ -46,6 +57,36 @@ namespace zfw
         bool isDirectory;
     };
 
+    // Input stream whose whole contents are directly addressable in memory (e.g. a mapped file).
+    // Views remain valid for the lifetime of the stream. Use dynamic_cast to check for support.
+    class IMappedInputStream : public li::InputStream
+    {
+        public:
+            // Returns nullptr if [offset, offset + length) is out of range
+            virtual const uint8_t* GetView(uint64_t offset, size_t length) = 0;
+    };
+
+    class IAsyncRead;
+
+    // Called on an I/O thread once the read has completed (successfully or not).
+    // Must not block for long and must not delete the read.
+    typedef void (*AsyncReadCallback_t)(IAsyncRead* read, void* userData);
+
+    // Pending (or completed) asynchronous read; see IFileSystem::ReadAsync.
+    // Deleting it waits for the read to finish.
+    class IAsyncRead
+    {
+        public:
+            virtual ~IAsyncRead() {}
+
+            virtual bool IsDone() = 0;
+            virtual void Wait() = 0;
+
+            // Waits for completion. On failure, returns false and copies the error into the calling thread's error buffer.
+            // The data is owned by the caller's buffer, or by this object if none was provided.
+            virtual bool GetResult(const uint8_t** data_out, size_t* length_out) = 0;
+    };
+
     class IDirectory
     {
         public:
@@ -54,6 +95,8 @@ namespace zfw
             virtual const char* ReadDir() = 0;
     };
 
+    // Implementations must allow concurrent calls from multiple threads
+    // (System::OpenFileStream doesn't serialize them)
     class IFileSystem
     {
         public:
@@ -68,6 +111,13 @@ namespace zfw
 
             virtual int CompareTimestamps(const char* leftPath, const char* rightPath, int64_t* diff_out, int flags) = 0;
             virtual const char* GetNativeAbsoluteFilename(const char* normalizedPath) = 0;
+
+            // Reads [offset, offset + length) of a file in the background; the range is clipped to the end of the file
+            // (pass SIZE_MAX to read everything). If 'buffer' is null, one is allocated; otherwise it must hold 'length' bytes.
+            // Returns nullptr (with error set) if the read can't even be started. The file system must outlive the read.
+            // The default implementation does a blocking OpenFileStream + read on an I/O thread.
+            virtual IAsyncRead* ReadAsync(const char* normalizedPath, uint64_t offset, size_t length, void* buffer,
+                    AsyncReadCallback_t callback, void* userData);
     };
 
     class IFSUnion
@@ -81,6 +131,11 @@ namespace zfw
             virtual void AddFileSystem(shared_ptr<IFileSystem>&& fs, int priority, const char* mountPoint) = 0;
             virtual bool RemoveFileSystem(IFileSystem* fs) = 0;
 
+            // Lookups are cached per path; call InvalidateCache after modifying mounted
+            // file systems directly (not through the union)
+            virtual void GetCacheStats(FSUnionCacheStats_t* stats_out) = 0;
+            virtual void InvalidateCache() = 0;
+
             void AddFileSystem(shared_ptr<IFileSystem>&& fs, int priority)
             {
                 AddFileSystem(std::forward<shared_ptr<IFileSystem>>(fs), priority, nullptr);
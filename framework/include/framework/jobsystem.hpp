@@ -0,0 +1,154 @@
+#pragma once
+
+#include <framework/base.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <type_traits>
+#include <vector>
+
+/*
+    IJobSystem runs short, non-blocking jobs on a pool of worker threads (one per spare core).
+
+    Every worker owns a work-stealing deque; jobs submitted from a worker go to its own deque,
+    jobs submitted from any other thread go to a shared injection queue. Idle workers steal from
+    each other. A thread waiting on a JobCounter_t helps out by executing queued jobs.
+
+    To run a batch of jobs and wait for it:
+
+        JobCounter_t counter;
+        Job_t jobs[] = { {DecodeTexture, &tex1}, {DecodeTexture, &tex2} };
+
+        jobSystem->Submit(jobs, 2, &counter);
+        jobSystem->WaitForCounter(&counter);
+
+    To run a job only after another batch has completed:
+
+        jobSystem->SubmitAfter(&decodeCounter, &uploadJob, 1, &uploadCounter);
+
+    To process a range in parallel:
+
+        jobSystem->ParallelFor(0, numEntities, 64, [&](size_t i) { Update(i); });
+*/
+
+namespace zfw
+{
+    typedef void (*JobFunc_t)(void* userData);
+
+    struct Job_t
+    {
+        JobFunc_t func;
+        void* userData;
+    };
+
+    struct JobCounter_t
+    {
+        // Number of pending jobs in the low 32 bits. The high 32 bits are an epoch, renewed whenever
+        // the count rises from zero, so that jobs released by SubmitAfter are only ever matched with
+        // the batch they waited for, even if the counter has been reused or another one took its address.
+        std::atomic<uint64_t> state;
+
+        JobCounter_t() : state((uint64_t) NewEpoch() << 32) {}
+        JobCounter_t(const JobCounter_t&) = delete;
+
+        bool IsDone() const { return (uint32_t) state.load(std::memory_order_acquire) == 0; }
+
+        static uint32_t NewEpoch();
+    };
+
+    class IJobSystem
+    {
+        public:
+            // Runs any jobs still queued before stopping the workers
+            virtual ~IJobSystem() {}
+
+            // Number of background worker threads (the waiting thread is not counted)
+            virtual unsigned int GetNumWorkers() = 0;
+
+            // counter may be null for fire-and-forget jobs
+            virtual void Submit(const Job_t* jobs, size_t numJobs, JobCounter_t* counter) = 0;
+
+            // Jobs are queued once 'dependency' drops to zero. 'counter' is raised immediately,
+            // so waiting on it also covers the deferred jobs.
+            // The dependency counter may be destroyed or reused as soon as it is done.
+            virtual void SubmitAfter(JobCounter_t* dependency, const Job_t* jobs, size_t numJobs,
+                    JobCounter_t* counter) = 0;
+
+            // Executes queued jobs on the calling thread until the counter reaches zero
+            virtual void WaitForCounter(JobCounter_t* counter) = 0;
+
+            void Submit(const Job_t& job, JobCounter_t* counter) { Submit(&job, 1, counter); }
+
+            // func(size_t rangeBegin, size_t rangeEnd)
+            // grainSize = 0 picks a chunk size based on the number of workers
+            template <typename Func>
+            void ParallelForRange(size_t begin, size_t end, size_t grainSize, Func&& func);
+
+            // func(size_t index)
+            template <typename Func>
+            void ParallelFor(size_t begin, size_t end, size_t grainSize, Func&& func);
+
+        private:
+            template <typename Func>
+            struct ParallelForChunk_t
+            {
+                Func* func;
+                size_t begin, end;
+
+                static void Run(void* userData)
+                {
+                    auto chunk = static_cast<ParallelForChunk_t*>(userData);
+                    (*chunk->func)(chunk->begin, chunk->end);
+                }
+            };
+    };
+
+    template <typename Func>
+    void IJobSystem::ParallelForRange(size_t begin, size_t end, size_t grainSize, Func&& func)
+    {
+        typedef typename std::remove_reference<Func>::type Func_t;
+
+        if (end <= begin)
+            return;
+
+        const size_t count = end - begin;
+
+        if (grainSize == 0)
+            grainSize = std::max<size_t>(count / ((GetNumWorkers() + 1) * 4), 1);
+
+        if (count <= grainSize || GetNumWorkers() == 0)
+        {
+            func(begin, end);
+            return;
+        }
+
+        const size_t numChunks = (count + grainSize - 1) / grainSize;
+
+        std::vector<ParallelForChunk_t<Func_t>> chunks(numChunks);
+        std::vector<Job_t> jobs(numChunks);
+
+        for (size_t i = 0; i < numChunks; i++)
+        {
+            chunks[i].func = &func;
+            chunks[i].begin = begin + i * grainSize;
+            chunks[i].end = std::min(chunks[i].begin + grainSize, end);
+
+            jobs[i].func = &ParallelForChunk_t<Func_t>::Run;
+            jobs[i].userData = &chunks[i];
+        }
+
+        JobCounter_t counter;
+        Submit(&jobs[0], numChunks, &counter);
+        WaitForCounter(&counter);
+    }
+
+    template <typename Func>
+    void IJobSystem::ParallelFor(size_t begin, size_t end, size_t grainSize, Func&& func)
+    {
+        ParallelForRange(begin, end, grainSize, [&func](size_t rangeBegin, size_t rangeEnd)
+        {
+            for (size_t i = rangeBegin; i < rangeEnd; i++)
+                func(i);
+        });
+    }
+}
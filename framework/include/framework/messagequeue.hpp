@@ -7,15 +7,16 @@
 /*
     A few more or less important notes about MessageQueue:
         - At any given time, NO MORE THAN ONE THREAD should be attempting to call Retrieve.
-        - Internally, MessageQueue uses 2 buffers. Using more should be possible (in theory),
-            but there doesn't seem to be any advantage in doing that.
-        - MessageQueueImpl uses a single shared mutex to lock cycle+realloc operations.
-            This shouldn't be a performance problem as it is not expected for the buffers
-            to be realloc'd very often.
-            Anyway, there seems to be no easy way of doing this "properly". The problem is
-            to make sure all DoAllocMessages started before a certain TryRetrieve have ended
-            before that TryRetrieve invokation returns a pointer pointing inside what used to
-            be a write buffer.
+        - A retrieved message stays valid until the next call to Retrieve/RetrieveBatch.
+        - MessageQueue::Create returns a lock-free implementation: messages are bump-allocated
+            in a chain of fixed-size segments (one atomic add per message in the common case)
+            and the consumer walks the chain in order. Exhausted segments are recycled
+            once no producer can still be looking at them.
+        - CreateDoubleBuffered returns the older implementation, which uses 2 buffers and a single
+            shared mutex to lock cycle+realloc operations (taken on every AllocMessage).
+            The problem it solves with the mutex is to make sure all DoAllocMessages started
+            before a certain TryRetrieve have ended before that TryRetrieve invokation returns
+            a pointer pointing inside what used to be a write buffer.
 
     To declare your own message struct:
 
@@ -46,6 +47,17 @@
         static void DoSomething();
             ...
         msgQueue->PostCall(DoSomething);
+
+    To process everything that is ready at once:
+
+        MessageHeader* messages[64];
+        size_t count = msgQueue->RetrieveBatch(messages, 64, li::Timeout(0));
+
+        for (size_t i = 0; i < count; i++)
+        {
+            ...
+            messages[i]->Release();
+        }
 */
 
 // Uncomment to enable checking against memory corruption
@@ -94,12 +106,17 @@ namespace zfw
     {
         public:
             static MessageQueue* Create();
+            static MessageQueue* CreateDoubleBuffered();
             virtual ~MessageQueue() {}
 
             virtual void Post(int messageType) = 0;
             virtual void PostCall(MessageQueueCallable callback) = 0;
             virtual MessageHeader* Retrieve(li::Timeout timeout) = 0;
 
+            // Retrieves up to maxMessages messages (waiting only for the first one).
+            // All of them stay valid until the next call to Retrieve/RetrieveBatch.
+            virtual size_t RetrieveBatch(MessageHeader** headers_out, size_t maxMessages, li::Timeout timeout) = 0;
+
             // These shouldn't be used directly, unless you know for sure what you're doing
             virtual void* AllocMessage(size_t length, int type, void (*releaseFunc)(void *messageBody)) = 0;
             virtual void FinishMessage(void* body) = 0;
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <framework/base.hpp>
+
+/*
+    Pack file layout (all integers little-endian; the index is used in place, so packs can only be
+    opened on little-endian hosts):
+
+        PackHeader_t
+        uint32_t buckets[numBuckets]        index into entries; kPackEmptyBucket if unused
+        PackEntry_t entries[numEntries]     sorted by path
+        char strings[stringsSize]           paths, not NUL-terminated
+        file data                           every file starts at a multiple of 'alignment'
+
+    Paths are normalized (no leading slash, '/' as separator). The bucket table is an open-addressed
+    hash table with linear probing; numBuckets is a power of 2 and at least twice numEntries,
+    and at least one bucket must be empty.
+*/
+
+namespace zfw
+{
+    static const char kPackMagic[8] = {'Z', 'F', 'W', 'P', 'A', 'C', 'K', '1'};
+
+    enum
+    {
+        kPackVersion = 1,
+        kPackDefaultAlignment = 4096,
+    };
+
+    static const uint32_t kPackEmptyBucket = 0xFFFFFFFF;
+
+    struct PackHeader_t
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t alignment;
+
+        uint32_t numEntries;
+        uint32_t numBuckets;
+
+        uint64_t bucketsOffset;
+        uint64_t entriesOffset;
+        uint64_t stringsOffset;
+        uint64_t stringsSize;
+
+        int64_t timestamp;                  // time of packing, reported as the creation/modification time
+    };
+
+    struct PackEntry_t
+    {
+        uint64_t offset;
+        uint64_t size;
+
+        uint32_t pathHash;
+        uint32_t nameOffset;                // relative to stringsOffset
+        uint32_t nameLength;
+        uint32_t flags;                     // reserved, must be 0
+    };
+
+    static_assert(sizeof(PackHeader_t) == 64, "PackHeader_t layout");
+    static_assert(sizeof(PackEntry_t) == 32, "PackEntry_t layout");
+
+    // 32-bit FNV-1a
+    inline uint32_t HashPackPath(const char* path, size_t length)
+    {
+        uint32_t hash = 2166136261u;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            hash ^= (uint8_t) path[i];
+            hash *= 16777619u;
+        }
+
+        return hash;
+    }
+}
@@ -2,10 +2,55 @@
 
 #include <framework/base.hpp>
 
+/*
+    Profiler supports two modes of operation:
+
+    Single-frame profiling (see ISystem::ProfileFrame) builds a tree of static ProfilingSection_t
+    objects for one frame on the main thread and prints it.
+
+    Zone recording is always on and works on any thread. Each thread records into its own
+    fixed-size ring buffer, so only the most recent events are kept (several seconds' worth
+    at typical zone counts). The recorded history can be exported in the Chrome trace event
+    format (load it in chrome://tracing or ui.perfetto.dev):
+
+        void Renderer::DrawWorld()
+        {
+            ZFW_PROFILE_ZONE("Renderer::DrawWorld");
+            ...
+        }
+
+        unique_ptr<OutputStream> output(sys->OpenOutput("trace.json"));
+        sys->GetProfiler()->WriteChromeTrace(output.get(), 5 * 1000000);
+
+    Zone names must be string literals (or otherwise outlive the profiler).
+
+    Finally, Profiler aggregates per-section timings across frames (System feeds it the phases
+    of every frame); see AddSample and GetSectionStats.
+*/
+
+#define ZFW_PROFILE_ZONE_NAME2(line_) profileZone_##line_
+#define ZFW_PROFILE_ZONE_NAME(line_) ZFW_PROFILE_ZONE_NAME2(line_)
+#define ZFW_PROFILE_ZONE(name_) zfw::ProfileZone ZFW_PROFILE_ZONE_NAME(__LINE__)(name_)
+
+#define PROFILER_STATS_WINDOW       1024
+#define PROFILER_HISTOGRAM_BUCKETS  12
+
 namespace zfw
 {
     typedef unsigned int TimeUnit_t;
 
+    struct ProfilerSectionStats_t
+    {
+        const char* name;
+        uint64_t numSamples;                // since startup (or ResetStats)
+
+        // over the last PROFILER_STATS_WINDOW samples
+        float minMs, meanMs, p95Ms, p99Ms, maxMs;
+
+        // since startup; see Profiler::GetHistogramBucketLimitsMs
+        uint64_t histogram[PROFILER_HISTOGRAM_BUCKETS];
+    };
+
     struct ProfilingSection_t
     {
         const char* name;
@@ -29,5 +74,37 @@ namespace zfw
             virtual void EndProfiling() = 0;
 
             virtual void PrintProfile() = 0;
+
+            // Writes zones recorded during the last 'lastMicros' microseconds (on all threads)
+            virtual bool WriteChromeTrace(OutputStream* output, uint64_t lastMicros) = 0;
+
+            // Per-section statistics (thread-safe)
+            virtual void AddSample(const char* section, uint64_t micros) = 0;
+            virtual size_t GetNumStatsSections() = 0;
+            virtual bool GetSectionStats(const char* section, ProfilerSectionStats_t* stats_out) = 0;
+            virtual bool GetSectionStatsByIndex(size_t index, ProfilerSectionStats_t* stats_out) = 0;
+            virtual void ResetStats() = 0;
+            virtual bool WriteStatsCsv(OutputStream* output) = 0;
+
+            // Upper limit of each histogram bucket; the last one is infinity
+            static const float* GetHistogramBucketLimitsMs();
+
+            // Zone recording; these can be called from any thread, even before a Profiler is created
+            static void BeginZone(const char* name);
+            static void EndZone();
+            static void MarkFrame();
+
+            // Shows up in exported traces; the string is copied
+            static void SetThreadName(const char* name);
+            static void SetRecording(bool enabled);
+    };
+
+    class ProfileZone
+    {
+        public:
+            explicit ProfileZone(const char* name) { Profiler::BeginZone(name); }
+            ~ProfileZone() { Profiler::EndZone(); }
+
+            ProfileZone(const ProfileZone&) = delete;
     };
 }
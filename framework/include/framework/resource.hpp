@@ -22,8 +22,17 @@ namespace zfw
             virtual void* Cast(const TypeID& resourceClass) = 0;
             //virtual const char* GetRecipe() const = 0;
             virtual State_t GetState() const = 0;
+
+            // Transitions to PRELOADED may happen on a worker thread; Preload() must not call back into resMgr
             virtual bool StateTransitionTo(State_t targetState, IResourceManager2* resMgr) = 0;
 
+            // Approximate memory held in the current state (used for eviction budgeting)
+            virtual void GetMemoryUsage(size_t* cpuBytes_out, size_t* gpuBytes_out)
+            {
+                *cpuBytes_out = 0;
+                *gpuBytes_out = 0;
+            }
+
         protected:
             template <class C>
             void* DefaultCast(C* res, const TypeID& resourceClass)
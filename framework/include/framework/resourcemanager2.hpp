@@ -6,6 +6,7 @@
 #include <framework/utility/errorbuffer.hpp>
 #include <framework/utility/params.hpp>
 
+#include <atomic>
 #include <cstddef>
 
 // TODO: should it be possible to register multiple providers for one resource type?
@@ -19,6 +20,96 @@ namespace zfw
         size_t numOwnedResources;
     };
 
+    // Interned recipe string; see IResourceManager2::InternRecipe
+    typedef uint32_t RecipeID_t;
+
+    // Owned by the resource manager; the address stays valid for its whole lifetime.
+    // The generation is bumped whenever the resource in the slot is destroyed.
+    struct ResourceSlot_t
+    {
+        IResource2* res;
+        uint32_t generation;
+
+        // eviction bookkeeping (see IResourceManager2::SetMemoryBudget)
+        IResourceManager2* resMgr;
+        uint32_t lastUsedFrame;
+        std::atomic<bool> touched;      // the only field written by ResourceHandle::GetIfResident
+        bool evicted;
+        bool pinned;                    // has been handed out as a raw pointer; never evicted
+    };
+
+    // Stable reference to a resource which resolves in O(1) without going through the resource manager.
+    // Resolves to nullptr once the resource has been destroyed (e.g. its section was cleared).
+    //
+    // Get() may have to restore an evicted resource (which can mean talking to the GPU), so like the resource
+    // manager itself, it must only be used on the thread that owns it. Code running on worker threads
+    // (e.g. entities updated in parallel) should use GetIfResident() instead.
+    template <class C>
+    class ResourceHandle
+    {
+        public:
+            ResourceHandle() : slot(nullptr), generation(0) {}
+            explicit ResourceHandle(ResourceSlot_t* slot) : slot(slot), generation(slot ? slot->generation : 0) {}
+
+            C* Get() const;
+
+            // Never restores; returns nullptr while the resource is evicted and lets the next
+            // EnforceMemoryBudget bring it back. Safe to call from any thread, but not concurrently
+            // with the owning thread calling into the resource manager.
+            C* GetIfResident() const;
+
+            bool IsValid() const { return Get() != nullptr; }
+
+            C* operator-> () const { return Get(); }
+            explicit operator bool() const { return IsValid(); }
+
+        private:
+            ResourceSlot_t* slot;
+            uint32_t generation;
+    };
+
+    struct ResourceMemoryStats_t
+    {
+        size_t cpuBytes, gpuBytes;
+        size_t cpuBudget, gpuBudget;
+        size_t numEvictedLastFrame;
+        size_t numEvictedTotal;
+        size_t numRestoredTotal;        // evicted resources that had to be brought back
+    };
+
+    struct ResourceStreamingStats_t
+    {
+        size_t numQueuedForPreload;         // waiting for or undergoing Preload on a worker
+        size_t numQueuedForRealize;         // preloaded, waiting for the per-frame realize budget
+        size_t numRealizedLastFrame;
+        uint64_t realizeMicrosLastFrame;
+        uint64_t stallMicrosTotal;          // time the calling thread spent blocked on unfinished requests
+        uint64_t maxRequestLatencyMicros;   // longest time from request to completion
+    };
+
+    // Asynchronous resource request; see IResourceManager2::RequestResource
+    class IResourceRequest
+    {
+        public:
+            enum Status_t { kPending, kReady, kFailed };
+
+            virtual ~IResourceRequest() {}
+
+            virtual Status_t GetStatus() = 0;
+
+            // nullptr unless the status is kReady
+            virtual IResource2* GetResource() = 0;
+
+            // Higher priority requests are preloaded and realized first
+            virtual int GetPriority() = 0;
+            virtual void SetPriority(int priority) = 0;
+
+            template <class C> C* Get()
+            {
+                return static_cast<C*>(GetResource());
+            }
+    };
+
     class IResourceManager2
     {
         public:
@@ -37,6 +128,50 @@ namespace zfw
             // see GetResourceFlag_t for possible flags
             virtual IResource2* GetResource(const char* recipe, const TypeID& resourceClass, int flags) = 0;
 
+            // Same as GetResource, but skips hashing the recipe string
+            virtual IResource2* GetResourceByID(RecipeID_t recipe, const TypeID& resourceClass, int flags) = 0;
+
+            // Returns the slot holding the resource (which is created if necessary), or nullptr on failure.
+            // Wrap it in a ResourceHandle; kResourcePrivate is not supported here.
+            virtual ResourceSlot_t* GetResourceSlot(RecipeID_t recipe, const TypeID& resourceClass, int flags) = 0;
+
+            // A recipe ID remains valid for as long as a (non-private) resource created from it exists.
+            // Once the last one is destroyed, or creating it fails, the ID may be reused for another recipe.
+            virtual RecipeID_t InternRecipe(const char* recipe) = 0;
+            virtual const char* GetRecipeString(RecipeID_t recipe) = 0;
+
+            // Asynchronous alternative to GetResource: the resource is created and bound immediately,
+            // preloaded in the background and realized in ProcessRequests. Same flags as GetResource.
+            // Calling GetResource on a pending resource completes its request synchronously.
+            virtual shared_ptr<IResourceRequest> RequestResource(const char* recipe, const TypeID& resourceClass,
+                    int flags, int priority) = 0;
+
+            // Call once per frame on the rendering thread. Realizes preloaded resources
+            // until the time budget is used up (but always at least one).
+            virtual void ProcessRequests(uint64_t realizeBudgetMicros) = 0;
+
+            // Blocks until the request is complete; returns true if the resource is ready
+            virtual bool WaitForRequest(IResourceRequest* request) = 0;
+
+            virtual void GetStreamingStats(ResourceStreamingStats_t* stats_out) = 0;
+
+            // Resources referenced through a ResourceHandle which have not been accessed for at least
+            // minIdleFrames are demoted (REALIZED -> PRELOADED -> BOUND), least recently used first,
+            // while usage exceeds the budget. A budget of 0 means unlimited.
+            // Evicted resources are restored transparently the next time they are accessed through
+            // ResourceHandle::Get, or by the following EnforceMemoryBudget if only GetIfResident asked for them.
+            // Raw pointers can't be tracked, so a resource that has ever been handed out as one (by GetResource,
+            // an IResourceRequest or to another resource's BindDependencies) is pinned and never evicted.
+            virtual void SetMemoryBudget(size_t cpuBytes, size_t gpuBytes, uint32_t minIdleFrames) = 0;
+
+            // Call once per frame (after rendering), on the thread that owns the resource manager
+            virtual void EnforceMemoryBudget() = 0;
+
+            virtual void GetMemoryStats(ResourceMemoryStats_t* stats_out) = 0;
+
+            // Used by ResourceHandle::Get; brings an evicted resource back to the target state. Owning thread only.
+            virtual bool RestoreEvictedResource(ResourceSlot_t* slot) = 0;
+
             virtual bool RegisterResourceProvider(const TypeID* resourceClasses, size_t numResourceClasses,
                     IResourceProvider2* provider) = 0;
 
@@ -47,6 +182,8 @@ namespace zfw
             virtual void LeaveResourceSection() = 0;
             virtual void ClearResourceSection(ResourceSection_t* sect) = 0;
 
+            // When moving to PRELOADED or REALIZED, Preload() is executed on job system workers.
+            // BindDependencies() and Realize() always run on the calling thread.
             virtual bool MakeAllResourcesState(IResource2::State_t state, bool propagateError) = 0;
             virtual bool MakeResourcesInSectionState(ResourceSection_t* sect, IResource2::State_t state, bool propagateError) = 0;
 
@@ -67,6 +204,28 @@ namespace zfw
                 return GetResource<C>(params, flags);
             }
 
+            template <class C> ResourceHandle<C> GetResourceHandle(const char* recipe, int flags)
+            {
+                return ResourceHandle<C>(GetResourceSlot(InternRecipe(recipe), typeID<C>(), flags));
+            }
+
+            template <class C>
+            ResourceHandle<C> GetResourceHandleByPath(const char* normpath, int flags)
+            {
+                char params[4096];
+
+                if (!Params::BuildIntoBuffer(params, sizeof(params), 1, "path", normpath))
+                    return ErrorBuffer::SetBufferOverflowError(g_essentials->GetErrorBuffer(), li_functionName),
+                            ResourceHandle<C>();
+
+                return GetResourceHandle<C>(params, flags);
+            }
+
+            template <class C> shared_ptr<IResourceRequest> RequestResource(const char* recipe, int flags, int priority)
+            {
+                return RequestResource(recipe, typeID<C>(), flags, priority);
+            }
+
             template <class C> void Resource(C** res_out, const char* recipe, int flags = kResourceRequired)
             {
                 *res_out = GetResource<C>(recipe, flags);
@@ -90,6 +249,34 @@ namespace zfw
             }
     };
 
+    template <class C>
+    C* ResourceHandle<C>::Get() const
+    {
+        if (slot == nullptr || slot->generation != generation)
+            return nullptr;
+
+        slot->touched.store(true, std::memory_order_relaxed);
+
+        if (slot->evicted && !slot->resMgr->RestoreEvictedResource(slot))
+            return nullptr;
+
+        return static_cast<C*>(slot->res);
+    }
+
+    template <class C>
+    C* ResourceHandle<C>::GetIfResident() const
+    {
+        if (slot == nullptr || slot->generation != generation)
+            return nullptr;
+
+        slot->touched.store(true, std::memory_order_relaxed);
+
+        if (slot->evicted)
+            return nullptr;
+
+        return static_cast<C*>(slot->res);
+    }
+
     class IResourceProvider2
     {
         public:
@@ -121,29 +308,30 @@ namespace zfw
 			IResourceManager2* backup;
 	};
 
+	// Held through a ResourceHandle, so the resource stays a candidate for eviction (see SetMemoryBudget)
 	template <typename T>
 	class Resource
 	{
 		public:
-			T* operator* () { return res; }
-            T* operator-> () { return res; }
-            operator T* () { return res; }
+			T* operator* () { return res.Get(); }
+            T* operator-> () { return res.Get(); }
+            operator T* () { return res.Get(); }
 
             bool ByPath(const char* path, int flags = IResourceManager2::kResourceRequired)
 			{
 				auto resMgr = ResourceManagerScope::GetScopedResourceManager(true);
-				res = resMgr->GetResourceByPath<T>(path, flags);
-				return (res != nullptr);
+				res = resMgr->GetResourceHandleByPath<T>(path, flags);
+				return res.IsValid();
 			}
 
             bool ByRecipe(const char* recipe, int flags = IResourceManager2::kResourceRequired)
             {
                 auto resMgr = ResourceManagerScope::GetScopedResourceManager(true);
-                res = resMgr->GetResource<T>(recipe, flags);
-                return (res != nullptr);
+                res = resMgr->GetResourceHandle<T>(recipe, flags);
+                return res.IsValid();
             }
 
 		private:
-			T* res;
+			ResourceHandle<T> res;
 	};
 }
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <framework/datamodel.hpp>
+
+#include <unordered_map>
+#include <vector>
+
+/*
+    SpatialIndex is a loose uniform grid over axis-aligned bounding boxes, identified by small integer keys.
+
+    Every box is filed under the grid cell containing its centre, so moving a box within a cell costs nothing
+    but storing the new bounds. Boxes no larger than a cell can overlap the neighbouring cells by at most
+    half a cell, which queries account for by looking half a cell further. Larger boxes are kept in a
+    separate list that every query scans.
+
+    Only occupied cells are stored (in a hash map), so the grid is unbounded.
+    Queries are const and may run concurrently, as long as nothing modifies the index meanwhile.
+*/
+
+namespace zfw
+{
+    class SpatialIndex
+    {
+        public:
+            SpatialIndex(float cellSize = 256.0f) : cellSize(cellSize), invCellSize(1.0f / cellSize) {}
+
+            void Clear();
+            bool Contains(uint32_t key) const { return key < items.size() && items[key].where != kNowhere; }
+            void Insert(uint32_t key, const Float3& min, const Float3& max);
+            void Remove(uint32_t key);
+            void Update(uint32_t key, const Float3& min, const Float3& max);
+
+            // Should be about the size of a typical query; re-files everything
+            float GetCellSize() const { return cellSize; }
+            void SetCellSize(float cellSize);
+
+            // These append the keys of all boxes overlapping the query (touching counts) to 'keys'
+            void QueryAABB(const Float3& min, const Float3& max, std::vector<uint32_t>& keys) const;
+            void QueryRadius(const Float3& centre, float radius, std::vector<uint32_t>& keys) const;
+
+            // Nearest box hit by the ray origin + dir * t, 0 <= t <= maxDistance (box containing the origin: t = 0).
+            // maxDistance must be finite.
+            bool QueryRay(const Float3& origin, const Float3& dir, float maxDistance, uint32_t ignoreKey,
+                    uint32_t& key_out, float& distance_out) const;
+
+        protected:
+            enum { kNowhere, kInCell, kLarge };
+
+            struct Item_t
+            {
+                Float3 min, max;
+                uint64_t cell;
+                uint32_t indexInCell;                   // into the cell's list, or 'large'
+                uint8_t where;
+            };
+
+            void p_File(uint32_t key);
+            void p_Unfile(uint32_t key);
+            uint64_t p_GetCell(const Float3& pos) const;
+            bool p_IsLarge(const Float3& min, const Float3& max) const;
+
+            float cellSize, invCellSize;
+
+            std::vector<Item_t> items;                  // by key
+            std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+            std::vector<uint32_t> large;
+    };
+}
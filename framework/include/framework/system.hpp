@@ -29,6 +29,9 @@ namespace zfw
         public:
             // public variables:
             //  sys_tickrate                (int)
+            //  sys_numworkers              (int)   job system worker threads; 0 = one per spare core
+            //  sys_profilecsv              (str)   if set, per-section frame statistics are written here on shutdown
+            //  sys_logfile                 (str)   if set, the log is streamed here by a background thread
 
             virtual bool Init(ErrorBuffer_t* eb, int flags) = 0;
             virtual void Shutdown() = 0;
@@ -43,6 +46,7 @@ namespace zfw
             // Core Handlers
             virtual IEntityHandler*     GetEntityHandler(bool createIfNull) = 0;
             virtual IFileSystem*        GetFileSystem() = 0;
+            virtual IJobSystem*         GetJobSystem() = 0;
             virtual IMediaCodecHandler* GetMediaCodecHandler(bool createIfNull) = 0;
             virtual IModuleHandler*     GetModuleHandler(bool createIfNull) = 0;
             virtual IFSUnion*           GetFSUnion() = 0;
@@ -53,6 +57,14 @@ namespace zfw
 
             virtual shared_ptr<IFileSystem> CreateStdFileSystem(const char* basePath, int access) = 0;
 
+            // Like CreateStdFileSystem, but files opened for reading only are memory-mapped
+            // and their streams implement IMappedInputStream
+            virtual shared_ptr<IFileSystem> CreateMappedFileSystem(const char* basePath, int access) = 0;
+
+            // Read-only file system backed by a single pack file (see tools/packer);
+            // returns nullptr if the pack can't be opened or is malformed
+            virtual shared_ptr<IFileSystem> CreatePackFileSystem(const char* path, int access) = 0;
+
 #ifdef ZOMBIE_WITH_BLEB
             virtual shared_ptr<IFileSystem> CreateBlebFileSystem(const char* path, int access) = 0;
 #endif
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <framework/datamodel.hpp>
+
+#include <vector>
+
+/*
+    TransformStore keeps the position, speed, orientation and bounding box of point entities
+    in structure-of-arrays form, so that per-tick movement can run as one batched pass over
+    contiguous floats (which the compiler vectorises) instead of virtual calls on every entity.
+
+    Entities opt in by implementing ITransformStoreUser. EntityWorld attaches them to its store
+    when they are added, detaches them when removed, and integrates the whole store every tick:
+
+        pos += speed * delta
+
+    Handles are stable for the lifetime of the attachment; the arrays themselves are kept dense
+    (a removal moves the last element into the hole).
+*/
+
+namespace zfw
+{
+    class TransformStore;
+
+    class ITransformStoreUser
+    {
+        protected:
+            ~ITransformStoreUser() {}
+
+        public:
+            // The entity should copy its current state into the store here.
+            // Also called again when the world restores the entity's state (see EntityWorld::RestoreSnapshot).
+            virtual void OnTransformAttach(TransformStore* store, uint32_t handle) = 0;
+            virtual void OnTransformDetach() = 0;
+
+            // Called after Integrate() has moved the entity, if it asked for it with SetMoveNotification.
+            // Must not add or remove entities.
+            virtual void OnTransformMoved() {}
+    };
+
+    class TransformStore
+    {
+        public:
+            static const uint32_t kInvalidHandle = UINT32_MAX;
+
+            TransformStore() {}
+
+            uint32_t Allocate(ITransformStoreUser* user);
+            void Clear();
+            void Free(uint32_t handle);
+
+            Float3 GetPos(uint32_t handle) const                                { return p_Get(pos, dense[handle]); }
+            Float3 GetSpeed(uint32_t handle) const                              { return p_Get(speed, dense[handle]); }
+            Float3 GetOrientation(uint32_t handle) const                        { return p_Get(orientation, dense[handle]); }
+            void SetPos(uint32_t handle, const Float3& value)                   { p_Set(pos, dense[handle], value); }
+            void SetSpeed(uint32_t handle, const Float3& value)                 { p_Set(speed, dense[handle], value); }
+            void SetOrientation(uint32_t handle, const Float3& value)           { p_Set(orientation, dense[handle], value); }
+
+            // Entities which read their transform from the store only don't need to be told when they move;
+            // every notification is a virtual call, so keep this off where possible
+            void SetMoveNotification(uint32_t handle, bool enable);
+
+            // Entities which keep their own copy of the position can have Move write it back, during the world's
+            // serial step and without a virtual call. The copy can then be read from any thread. Null to disable.
+            void SetPosMirror(uint32_t handle, Float3* mirror);
+
+            // World-space bounding box; false if the entity has none
+            bool GetAABB(uint32_t handle, Float3& min, Float3& max) const
+            {
+                const uint32_t i = dense[handle];
+
+                min = p_Get(pos, i) + p_Get(localAabbMin, i);
+                max = p_Get(pos, i) + p_Get(localAabbMax, i);
+                return min.x <= max.x;
+            }
+
+            // Bounding box relative to the entity position; min > max means none
+            void SetLocalAABB(uint32_t handle, const Float3& min, const Float3& max);
+
+            size_t GetNumTransforms() const { return users.size(); }
+
+            // Advances every position by speed * delta, then notifies the entities which moved (see SetMoveNotification)
+            void Integrate(float delta);
+
+            // The two halves of Integrate, for callers which need to act in between.
+            // Move updates the position mirrors and appends the handles of everything that moved
+            // to movedHandles, unless it is null.
+            void Move(float delta, std::vector<uint32_t>* movedHandles);
+            void NotifyMoved();
+
+        protected:
+            struct Component_t
+            {
+                std::vector<float> x, y, z;
+            };
+
+            static Float3 p_Get(const Component_t& c, uint32_t i) { return Float3(c.x[i], c.y[i], c.z[i]); }
+            static void p_Set(Component_t& c, uint32_t i, const Float3& value) { c.x[i] = value.x; c.y[i] = value.y; c.z[i] = value.z; }
+
+            // dense arrays, all of the same length
+            Component_t pos, speed, orientation;
+            Component_t localAabbMin, localAabbMax;
+            std::vector<ITransformStoreUser*> users;
+            std::vector<uint32_t> handles;              // handles[i] is the handle of element i
+            std::vector<uint8_t> notify;
+            size_t numNotify = 0;
+            std::vector<Float3*> posMirror;
+            size_t numPosMirrors = 0;
+
+            // handle -> dense index (kInvalidHandle if free)
+            std::vector<uint32_t> dense;
+            std::vector<uint32_t> freeHandles;
+
+            std::vector<ITransformStoreUser*> moved;
+
+        private:
+            TransformStore(const TransformStore&) = delete;
+    };
+}
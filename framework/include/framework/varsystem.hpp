@@ -4,8 +4,88 @@
 
 #include <littl/Stream.hpp>
 
+#include <functional>
+#include <memory>
+#include <typeindex>
+#include <utility>
+#include <vector>
+
 namespace zfw
 {
+    // Cached, typed copy of a variable's value, shared by all of its VarHandles
+    class ITypedVariable
+    {
+        public:
+            virtual ~ITypedVariable() {}
+
+            // Returns false if the value can't be converted
+            virtual bool SetFromString(const char* value) = 0;
+    };
+
+    template <typename T>
+    class TypedVariable : public ITypedVariable
+    {
+        public:
+            virtual bool SetFromString(const char* value) override
+            {
+                T newValue = this->value;
+
+                if (!reflection::reflectFromString(newValue, value))
+                    return false;
+
+                this->value = std::move(newValue);
+
+                // A copy, so that callbacks can add or remove callbacks
+                auto callbacks = this->callbacks;
+
+                for (const auto& callback : callbacks)
+                    callback.second(this->value);
+
+                return true;
+            }
+
+            T value = T();
+
+            std::vector<std::pair<int, std::function<void(const T&)>>> callbacks;
+            int nextCallbackID = 0;
+    };
+
+    // Resolved once (see IVarSystem::GetVariableHandle), then read directly. The value is kept up to date
+    // whenever the variable is set through the var system; the storage of a bound variable written to directly
+    // is only picked up after IVarSystem::OnBoundVariableChanged.
+    template <typename T>
+    class VarHandle
+    {
+        public:
+            const T& Get() const { return var->value; }
+            operator const T&() const { return var->value; }
+            bool IsValid() const { return var != nullptr; }
+
+            // Called every time the variable is set; returns an ID for RemoveCallback
+            int AddCallback(std::function<void(const T&)> callback)
+            {
+                var->callbacks.emplace_back(var->nextCallbackID, std::move(callback));
+                return var->nextCallbackID++;
+            }
+
+            void RemoveCallback(int id)
+            {
+                for (auto it = var->callbacks.begin(); it != var->callbacks.end(); ++it)
+                {
+                    if (it->first == id)
+                    {
+                        var->callbacks.erase(it);
+                        break;
+                    }
+                }
+            }
+
+        protected:
+            std::shared_ptr<TypedVariable<T>> var;
+
+            friend class IVarSystem;
+    };
+
     class IVarSystem
     {
         public:
@@ -40,6 +120,15 @@ namespace zfw
             virtual bool BindVariable(const char* name, reflection::ReflectedValue_t var, int access, int flags) = 0;
             //virtual bool UnbindVariable(const char* name, bool rememberValue) = 0;
 
+            // To be called after writing to the storage of a bound variable directly, so that VarHandles follow
+            virtual void OnBoundVariableChanged(const char* name) = 0;
+
+            // Backs GetVariableHandle: returns the variable's typed copy, creating it with 'create' if needed.
+            // Fails if the variable has a typed copy of another type already.
+            // see VariableAccessFlag_t for possible flags
+            virtual std::shared_ptr<ITypedVariable> GetTypedVariable(const char* name, std::type_index type,
+                    std::shared_ptr<ITypedVariable> (*create)(), int flags) = 0;
+
             // see SerializationFlag_t for possible flags
             virtual bool SerializeVariables(li::OutputStream* output, const char* outputNameOrNull, int flags,
                     const char** names, size_t numNames) = 0;
@@ -57,6 +146,20 @@ namespace zfw
                     return false;
             }
 
+            // For reading variables often, e.g. every frame. Until the variable is first set, the value is T().
+            // see VariableAccessFlag_t for possible flags
+            template <typename T>
+            bool GetVariableHandle(const char* name, VarHandle<T>* handle_out, int flags)
+            {
+                auto var = GetTypedVariable(name, typeid(T), &p_CreateTypedVariable<T>, flags);
+
+                if (var == nullptr)
+                    return false;
+
+                handle_out->var = std::static_pointer_cast<TypedVariable<T>>(std::move(var));
+                return true;
+            }
+
             template <typename T>
             T GetVariableOrDefault(const char* name, const T& default_)
             {
@@ -77,5 +180,12 @@ namespace zfw
                 else
                     return "";
             }
+
+        private:
+            template <typename T>
+            static std::shared_ptr<ITypedVariable> p_CreateTypedVariable()
+            {
+                return std::make_shared<TypedVariable<T>>();
+            }
     };
 }
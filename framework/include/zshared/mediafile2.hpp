@@ -52,6 +52,8 @@ namespace zshared
                     const uint8_t compression[4], uint64_t data_length, uint64_t compressed_length) = 0;
     };
 
+    // Section streams of a MediaFile opened read-only can be read from several threads at once
+    // (each has its own position; reads are positional). Everything else is single-threaded.
     class MediaFile
     {
         public:
@@ -77,5 +79,10 @@ namespace zshared
             virtual uint64_t GetFileSize() = 0;
             virtual uint32_t GetSectorSize() = 0;
             virtual bool SetSectorSize(uint32_t sectorSize) = 0;
+
+            // Sections created from now on are compressed with zlib at this level (1..9, 0 = no compression).
+            // Compressed sections are written sequentially and only once; OpenOrCreateSection replaces them
+            virtual int GetCompressionLevel() = 0;
+            virtual bool SetCompressionLevel(int level) = 0;
     };
 }
@@ -107,6 +107,9 @@ namespace ztype
 
             static Rasterizer* Create(const char *ttfFile, int pxsize);
             static Rasterizer* Create(li::InputStream* ttfFile, int pxsize);
+
+            // Uses the font data in place; 'owner' (if any) is kept alive as long as the Rasterizer
+            static Rasterizer* Create(const void* ttfData, size_t size, int pxsize, std::unique_ptr<li::InputStream>&& owner);
             virtual ~Rasterizer() {}
 
             virtual bool GetChar(uint32_t cp, int flags, const GlyphBitmap** bitmap_ptr, const GlyphMetrics** metrics_ptr) = 0;
@@ -0,0 +1,773 @@
+#include <framework/errorbuffer.hpp>
+#include <framework/filesystem.hpp>
+#include <framework/profiler.hpp>
+
+#include "private.hpp"
+
+#include <littl/Thread.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef ZOMBIE_WITH_IO_URING
+#include <cerrno>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define ASYNC_IO_NUM_THREADS    4
+
+// Submission queue size; also the maximum number of reads in flight in the kernel
+#define ASYNC_IO_URING_ENTRIES  256
+
+// Longer reads are split up (the kernel interface takes a 32-bit length)
+#define ASYNC_IO_MAX_CHUNK      (1u << 30)
+
+/*
+    Asynchronous reads are queued to a small pool of I/O threads, which is started on first use.
+
+    Reads through a generic IFileSystem are simply performed by an I/O thread, one at a time, using the
+    blocking stream API. Reads of native files (FileSystemStd) are handed to io_uring where the kernel
+    supports it: the I/O threads only open the file and submit the request, and a reaper thread picks up
+    the completions, so the number of reads in flight is not limited by the number of threads.
+    Without io_uring (old kernel, seccomp policy, ...) native reads fall back to pread on the I/O threads.
+
+    I/O threads have private error buffers; a failed read keeps a copy of the error, which is handed over
+    to the caller's buffer in GetResult.
+*/
+
+namespace zfw
+{
+    using namespace li;
+
+    class AsyncIO;
+    class IOThread;
+
+    // ====================================================================== //
+    //  class declarations
+    // ====================================================================== //
+
+    class AsyncRead : public IAsyncRead
+    {
+        friend class AsyncIO;
+        friend class IOUring;
+
+        public:
+            AsyncRead(IFileSystem* fs, const char* path, uint64_t offset, size_t length, void* buffer,
+                    AsyncReadCallback_t callback, void* userData);
+            virtual ~AsyncRead();
+
+            virtual bool IsDone() override { return done.load(std::memory_order_acquire); }
+            virtual void Wait() override;
+            virtual bool GetResult(const uint8_t** data_out, size_t* length_out) override;
+
+        private:
+            bool p_AllocBuffer(uint64_t fileSize);
+            void p_Complete();
+            void p_ExecuteStream();
+            void p_Fail();
+
+#ifdef ZOMBIE_WITH_IO_URING
+            bool p_OpenNative();
+            void p_ReadNative();
+#endif
+
+            // request
+            IFileSystem* fs;            // nullptr for native files
+            std::string path;
+            uint64_t offset;
+            size_t length;
+            AsyncReadCallback_t callback;
+            void* userData;
+
+            // state
+            uint8_t* data;
+            bool ownsData;
+            size_t numRead;
+            int fd;
+
+            bool succeeded;
+            int errorCode;
+            char errorTimestamp[20];
+            std::string errorParams;
+
+            std::mutex doneMutex;
+            std::condition_variable doneCondition;
+            std::atomic<bool> done;
+    };
+
+#ifdef ZOMBIE_WITH_IO_URING
+    class IOUring : private li::Thread
+    {
+        public:
+            // Returns nullptr if io_uring isn't available
+            static IOUring* Create();
+            ~IOUring();
+
+            // Submits the first chunk of a read; blocks while the ring is full
+            void Submit(AsyncRead* read);
+
+        protected:
+            virtual void run() override;
+
+        private:
+            IOUring(int ringFd, const io_uring_params& params);
+
+            void p_FailQueuedLocked();
+            bool p_FlushLocked();
+            void p_QueueLocked(uint8_t opcode, AsyncRead* read);
+            void p_Resubmit(AsyncRead* read);
+
+            int ringFd;
+
+            void* sqRing;
+            size_t sqRingSize;
+            void* cqRing;
+            io_uring_sqe* sqes;
+            size_t sqesSize;
+
+            unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+            unsigned *cqHead, *cqTail, *cqMask;
+            io_uring_cqe* cqes;
+            unsigned numEntries;
+
+            std::mutex submitMutex;
+            std::condition_variable spaceCondition;
+            unsigned numInFlight;
+            bool shutdown;
+    };
+#endif
+
+    class AsyncIO
+    {
+        public:
+            AsyncIO();
+            ~AsyncIO();
+
+            void Submit(AsyncRead* read);
+
+            // Called by the I/O threads
+            void WorkerMain();
+
+        private:
+            std::mutex queueMutex;
+            std::condition_variable queueCondition;
+            std::deque<AsyncRead*> queue;
+            bool shutdown;
+
+            std::vector<unique_ptr<IOThread>> threads;
+
+#ifdef ZOMBIE_WITH_IO_URING
+            unique_ptr<IOUring> uring;
+#endif
+    };
+
+    class IOThread : public li::Thread
+    {
+        public:
+            IOThread(AsyncIO* asyncIO, unsigned int index) : asyncIO(asyncIO), index(index) {}
+
+        protected:
+            virtual void run() override;
+
+        private:
+            AsyncIO* asyncIO;
+            unsigned int index;
+    };
+
+    static std::mutex s_asyncIOMutex;
+    static AsyncIO* s_asyncIO;
+
+    static AsyncIO* GetAsyncIO()
+    {
+        std::lock_guard<std::mutex> lg(s_asyncIOMutex);
+
+        if (s_asyncIO == nullptr)
+            s_asyncIO = new AsyncIO();
+
+        return s_asyncIO;
+    }
+
+    // ====================================================================== //
+    //  class AsyncRead
+    // ====================================================================== //
+
+    AsyncRead::AsyncRead(IFileSystem* fs, const char* path, uint64_t offset, size_t length, void* buffer,
+            AsyncReadCallback_t callback, void* userData)
+            : fs(fs), path(path), offset(offset), length(length), callback(callback), userData(userData),
+            data(static_cast<uint8_t*>(buffer)), ownsData(false), numRead(0), fd(-1),
+            succeeded(false), errorCode(EX_NO_ERROR), done(false)
+    {
+    }
+
+    AsyncRead::~AsyncRead()
+    {
+        Wait();
+
+        if (ownsData)
+            free(data);
+    }
+
+    bool AsyncRead::GetResult(const uint8_t** data_out, size_t* length_out)
+    {
+        Wait();
+
+        if (!succeeded)
+        {
+            ErrorBuffer_t* eb = GetErrorBuffer();
+            eb->errorCode = errorCode;
+            ErrorBuffer::SetParams(eb, errorParams.c_str());
+            memcpy(eb->timestamp, errorTimestamp, sizeof(errorTimestamp));
+            return false;
+        }
+
+        *data_out = data;
+        *length_out = numRead;
+        return true;
+    }
+
+    bool AsyncRead::p_AllocBuffer(uint64_t fileSize)
+    {
+        if (offset > fileSize)
+            return ErrorBuffer::SetError3(EX_INVALID_ARGUMENT, 2,
+                    "desc", sprintf_4095("Read offset past the end of '%s'", path.c_str()),
+                    "functionName", li_functionName
+                    ), false;
+
+        length = (size_t) std::min<uint64_t>(length, fileSize - offset);
+
+        if (data == nullptr)
+        {
+            // +1 so that zero-length reads still produce a valid pointer
+            data = static_cast<uint8_t*>(malloc(length + 1));
+
+            if (data == nullptr)
+                return ErrorBuffer::SetError3(EX_ALLOC_ERR, 0), false;
+
+            ownsData = true;
+        }
+
+        return true;
+    }
+
+    void AsyncRead::p_Complete()
+    {
+#ifdef ZOMBIE_WITH_IO_URING
+        if (fd >= 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+#endif
+
+        if (callback != nullptr)
+            callback(this, userData);
+
+        // Notified under the lock, since the waiter is free to delete us as soon as it sees 'done'
+        std::lock_guard<std::mutex> lg(doneMutex);
+        done.store(true, std::memory_order_release);
+        doneCondition.notify_all();
+    }
+
+    void AsyncRead::p_ExecuteStream()
+    {
+        InputStream* is;
+
+        if (!fs->OpenFileStream(path.c_str(), 0, &is, nullptr, nullptr))
+            return p_Fail();
+
+        unique_ptr<InputStream> stream(is);
+
+        if (!p_AllocBuffer(stream->getSize()) || (offset != 0 && !stream->setPos(offset)))
+            return p_Fail();
+
+        while (numRead < length)
+        {
+            const size_t count = stream->read(data + numRead, length - numRead);
+
+            if (count == 0)
+                break;
+
+            numRead += count;
+        }
+
+        succeeded = true;
+        p_Complete();
+    }
+
+    void AsyncRead::p_Fail()
+    {
+        // Keep a copy of the error from this I/O thread's buffer
+        ErrorBuffer_t* eb = GetErrorBuffer();
+
+        errorCode = (eb->errorCode != EX_NO_ERROR) ? eb->errorCode : EX_IO_ERROR;
+        errorParams = (eb->params != nullptr) ? eb->params : "";
+        memcpy(errorTimestamp, eb->timestamp, sizeof(errorTimestamp));
+
+        succeeded = false;
+        p_Complete();
+    }
+
+#ifdef ZOMBIE_WITH_IO_URING
+    bool AsyncRead::p_OpenNative()
+    {
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+            return ErrorBuffer::SetError3(EX_NOT_FOUND, 2,
+                    "desc", sprintf_4095("File not found: '%s'", path.c_str()),
+                    "functionName", li_functionName
+                    ), false;
+
+        struct stat st;
+
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+            return ErrorBuffer::SetError3(EX_IO_ERROR, 2,
+                    "desc", sprintf_4095("Not a regular file: '%s'", path.c_str()),
+                    "functionName", li_functionName
+                    ), false;
+
+        return p_AllocBuffer((uint64_t) st.st_size);
+    }
+
+    void AsyncRead::p_ReadNative()
+    {
+        while (numRead < length)
+        {
+            const ssize_t count = pread(fd, data + numRead, std::min<size_t>(length - numRead, ASYNC_IO_MAX_CHUNK),
+                    (off_t)(offset + numRead));
+
+            if (count < 0 && errno == EINTR)
+                continue;
+
+            if (count < 0)
+            {
+                ErrorBuffer::SetReadError(path.c_str(), li_functionName);
+                return p_Fail();
+            }
+
+            if (count == 0)
+                break;
+
+            numRead += count;
+        }
+
+        succeeded = true;
+        p_Complete();
+    }
+#endif
+
+    void AsyncRead::Wait()
+    {
+        // Always goes through the mutex, so that p_Complete is done with it before we return
+        std::unique_lock<std::mutex> lock(doneMutex);
+        doneCondition.wait(lock, [this] { return done.load(std::memory_order_acquire); });
+    }
+
+    // ====================================================================== //
+    //  class IOUring
+    // ====================================================================== //
+
+#ifdef ZOMBIE_WITH_IO_URING
+    IOUring* IOUring::Create()
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+
+        const int ringFd = (int) syscall(__NR_io_uring_setup, ASYNC_IO_URING_ENTRIES, &params);
+
+        if (ringFd < 0)
+            return nullptr;
+
+        // IORING_OP_READ arrived in the same kernel version (5.6) as this flag
+        if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0 || (params.features & IORING_FEAT_RW_CUR_POS) == 0)
+        {
+            close(ringFd);
+            return nullptr;
+        }
+
+        auto uring = new IOUring(ringFd, params);
+
+        if (uring->sqRing == MAP_FAILED || uring->sqes == MAP_FAILED)
+        {
+            delete uring;
+            return nullptr;
+        }
+
+        uring->start();
+        return uring;
+    }
+
+    IOUring::IOUring(int ringFd, const io_uring_params& params)
+            : ringFd(ringFd), numEntries(params.sq_entries), numInFlight(0), shutdown(false)
+    {
+        // Both rings share a single mapping
+        sqRingSize = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        cqRing = sqRing;
+
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ringFd, IORING_OFF_SQES));
+
+        if (sqRing == MAP_FAILED)
+            return;
+
+        auto sq = static_cast<uint8_t*>(sqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        auto cq = static_cast<uint8_t*>(cqRing);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    IOUring::~IOUring()
+    {
+        if (sqRing != MAP_FAILED && sqes != MAP_FAILED)
+        {
+            // Wait for everything in flight, then wake the reaper with a NOP carrying no read
+            std::unique_lock<std::mutex> lock(submitMutex);
+            spaceCondition.wait(lock, [this] { return numInFlight == 0; });
+
+            shutdown = true;
+            p_QueueLocked(IORING_OP_NOP, nullptr);
+            p_FlushLocked();
+            lock.unlock();
+
+            waitFor();
+        }
+
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesSize);
+
+        if (sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+
+        close(ringFd);
+    }
+
+    void IOUring::p_FailQueuedLocked()
+    {
+        // Only ever called with submitMutex held, and the kernel consumes entries only in io_uring_enter
+        // calls made under it, so nothing can take these entries from under us
+        const unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        const unsigned tail = *sqTail;
+
+        for (unsigned i = head; i != tail; i++)
+        {
+            auto read = reinterpret_cast<AsyncRead*>(sqes[sqArray[i & *sqMask]].user_data);
+            numInFlight--;
+
+            if (read != nullptr)
+            {
+                ErrorBuffer::SetReadError(read->path.c_str(), li_functionName);
+                read->p_Fail();
+            }
+        }
+
+        __atomic_store_n(sqTail, head, __ATOMIC_RELEASE);
+        spaceCondition.notify_all();
+    }
+
+    bool IOUring::p_FlushLocked()
+    {
+        for (;;)
+        {
+            const unsigned numQueued = *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+
+            if (numQueued == 0)
+                return true;
+
+            const long numSubmitted = syscall(__NR_io_uring_enter, ringFd, numQueued, 0, 0, nullptr, 0);
+
+            if (numSubmitted >= 0)
+                return (unsigned long) numSubmitted >= numQueued;
+
+            if (errno == EINTR)
+                continue;
+
+            // Out of memory, or completions have to be reaped first; whatever is queued stays in the ring
+            if (errno == EAGAIN || errno == EBUSY)
+                return false;
+
+            // The ring is unusable; fail the reads the kernel never saw, rather than leave them waiting forever
+            p_FailQueuedLocked();
+            return true;
+        }
+    }
+
+    void IOUring::p_Resubmit(AsyncRead* read)
+    {
+        // Must not wait for space: only this thread frees it up. The submission queue itself is drained
+        // by every io_uring_enter, and the completion queue has room for twice the limit, so going over is harmless.
+        // If the kernel refuses the entry for now, run() retries before it goes to sleep.
+        std::lock_guard<std::mutex> lg(submitMutex);
+        p_QueueLocked(IORING_OP_READ, read);
+        p_FlushLocked();
+    }
+
+    void IOUring::p_QueueLocked(uint8_t opcode, AsyncRead* read)
+    {
+        const unsigned tail = *sqTail;
+        const unsigned index = tail & *sqMask;
+
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->user_data = reinterpret_cast<uint64_t>(read);
+
+        if (read != nullptr)
+        {
+            sqe->fd = read->fd;
+            sqe->addr = reinterpret_cast<uint64_t>(read->data + read->numRead);
+            sqe->len = (uint32_t) std::min<size_t>(read->length - read->numRead, ASYNC_IO_MAX_CHUNK);
+            sqe->off = read->offset + read->numRead;
+        }
+
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        numInFlight++;
+    }
+
+    void IOUring::run()
+    {
+        Profiler::SetThreadName("AsyncIO Reaper");
+        p_CreateThreadErrorBuffer();
+
+        for (;;)
+        {
+            unsigned head = __atomic_load_n(cqHead, __ATOMIC_RELAXED);
+
+            if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+            {
+                bool flushed;
+
+                // Entries refused earlier have to go in before we sleep, or nothing might ever wake us up
+                {
+                    std::lock_guard<std::mutex> lg(submitMutex);
+                    flushed = p_FlushLocked();
+
+                    if (shutdown && numInFlight == 0)
+                        break;
+                }
+
+                if (!flushed || (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+                        && errno != EINTR))
+                    pauseThread(1);
+
+                continue;
+            }
+
+            const io_uring_cqe cqe = cqes[head & *cqMask];
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+            auto read = reinterpret_cast<AsyncRead*>(cqe.user_data);
+
+            {
+                std::lock_guard<std::mutex> lg(submitMutex);
+                numInFlight--;
+
+                if (read == nullptr && shutdown)
+                    break;
+            }
+
+            spaceCondition.notify_all();
+
+            if (read == nullptr)
+                continue;
+
+            if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+            {
+                p_Resubmit(read);
+                continue;
+            }
+
+            if (cqe.res < 0)
+            {
+                ErrorBuffer::SetReadError(read->path.c_str(), li_functionName);
+                read->p_Fail();
+                continue;
+            }
+
+            read->numRead += cqe.res;
+
+            // Short reads are continued; reading nothing means the file was truncated in the meantime
+            if (cqe.res > 0 && read->numRead < read->length)
+                p_Resubmit(read);
+            else
+            {
+                read->succeeded = true;
+                read->p_Complete();
+            }
+        }
+
+        p_ReleaseThreadErrorBuffer();
+    }
+
+    void IOUring::Submit(AsyncRead* read)
+    {
+        std::unique_lock<std::mutex> lock(submitMutex);
+
+        // The completion queue is twice as large, so it can't overflow either
+        spaceCondition.wait(lock, [this] { return numInFlight < numEntries; });
+
+        p_QueueLocked(IORING_OP_READ, read);
+
+        // Refused for now; the reaper needs the mutex to keep draining completions in the meantime
+        while (!p_FlushLocked())
+        {
+            lock.unlock();
+            pauseThread(1);
+            lock.lock();
+        }
+    }
+#endif
+
+    // ====================================================================== //
+    //  class AsyncIO
+    // ====================================================================== //
+
+    AsyncIO::AsyncIO() : shutdown(false)
+    {
+#ifdef ZOMBIE_WITH_IO_URING
+        uring.reset(IOUring::Create());
+#endif
+
+        for (unsigned int i = 0; i < ASYNC_IO_NUM_THREADS; i++)
+        {
+            threads.emplace_back(new IOThread(this, i));
+            threads.back()->start();
+        }
+    }
+
+    AsyncIO::~AsyncIO()
+    {
+        {
+            std::lock_guard<std::mutex> lg(queueMutex);
+            shutdown = true;
+        }
+
+        queueCondition.notify_all();
+
+        // Threads only quit once the queue is empty
+        for (auto& thread : threads)
+            thread->waitFor();
+
+#ifdef ZOMBIE_WITH_IO_URING
+        uring.reset();
+#endif
+    }
+
+    void AsyncIO::Submit(AsyncRead* read)
+    {
+        {
+            std::lock_guard<std::mutex> lg(queueMutex);
+            queue.push_back(read);
+        }
+
+        queueCondition.notify_one();
+    }
+
+    void AsyncIO::WorkerMain()
+    {
+        for (;;)
+        {
+            AsyncRead* read;
+
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueCondition.wait(lock, [this] { return shutdown || !queue.empty(); });
+
+                if (queue.empty())
+                    break;
+
+                read = queue.front();
+                queue.pop_front();
+            }
+
+            GetErrorBuffer()->errorCode = EX_NO_ERROR;
+
+            if (read->fs != nullptr)
+            {
+                read->p_ExecuteStream();
+                continue;
+            }
+
+#ifdef ZOMBIE_WITH_IO_URING
+            if (!read->p_OpenNative())
+                read->p_Fail();
+            else if (read->length == 0)
+            {
+                read->succeeded = true;
+                read->p_Complete();
+            }
+            else if (uring != nullptr)
+                uring->Submit(read);
+            else
+                read->p_ReadNative();
+#endif
+        }
+    }
+
+    // ====================================================================== //
+    //  class IOThread
+    // ====================================================================== //
+
+    void IOThread::run()
+    {
+        Profiler::SetThreadName(sprintf_t<31>("AsyncIO %u", index));
+        p_CreateThreadErrorBuffer();
+
+        asyncIO->WorkerMain();
+
+        p_ReleaseThreadErrorBuffer();
+    }
+
+    // ====================================================================== //
+    //  functions
+    // ====================================================================== //
+
+    IAsyncRead* IFileSystem::ReadAsync(const char* normalizedPath, uint64_t offset, size_t length, void* buffer,
+            AsyncReadCallback_t callback, void* userData)
+    {
+        auto read = new AsyncRead(this, normalizedPath, offset, length, buffer, callback, userData);
+        GetAsyncIO()->Submit(read);
+        return read;
+    }
+
+#ifdef ZOMBIE_WITH_IO_URING
+    IAsyncRead* p_ReadNativeAsync(const char* nativePath, uint64_t offset, size_t length, void* buffer,
+            AsyncReadCallback_t callback, void* userData)
+    {
+        auto read = new AsyncRead(nullptr, nativePath, offset, length, buffer, callback, userData);
+        GetAsyncIO()->Submit(read);
+        return read;
+    }
+#endif
+
+    void p_ShutdownAsyncIO()
+    {
+        std::lock_guard<std::mutex> lg(s_asyncIOMutex);
+
+        delete s_asyncIO;
+        s_asyncIO = nullptr;
+    }
+}
@@ -12,6 +12,8 @@
 
 #include "../private.hpp"
 
+#include <mutex>
+
 namespace zfw
 {
     using namespace li;
@@ -22,6 +24,49 @@ namespace zfw
     //  class declarations
     // ====================================================================== //
 
+    // Wraps a stream opened from a bleb repository so that it can be used concurrently with other streams
+    // of the same repository (each on its own thread, as usual)
+    class BlebLockedStream : public IOStream
+    {
+        public:
+            BlebLockedStream(std::mutex& repoMutex, unique_ptr<IOStream>&& stream)
+                    : repoMutex(repoMutex), stream(move(stream))
+            {
+            }
+
+            virtual ~BlebLockedStream()
+            {
+                std::lock_guard<std::mutex> lg(repoMutex);
+                stream.reset();
+            }
+
+            virtual bool finite() override { return stream->finite(); }
+            virtual bool seekable() override { return stream->seekable(); }
+
+            virtual bool eof() override { std::lock_guard<std::mutex> lg(repoMutex); return stream->eof(); }
+            virtual void flush() { std::lock_guard<std::mutex> lg(repoMutex); stream->flush(); }
+
+            virtual uint64_t getPos() override { std::lock_guard<std::mutex> lg(repoMutex); return stream->getPos(); }
+            virtual uint64_t getSize() override { std::lock_guard<std::mutex> lg(repoMutex); return stream->getSize(); }
+            virtual bool setPos(uint64_t pos) override { std::lock_guard<std::mutex> lg(repoMutex); return stream->setPos(pos); }
+
+            virtual size_t read(void* out, size_t length) override
+            {
+                std::lock_guard<std::mutex> lg(repoMutex);
+                return stream->read(out, length);
+            }
+
+            virtual size_t write(const void* in, size_t length) override
+            {
+                std::lock_guard<std::mutex> lg(repoMutex);
+                return stream->write(in, length);
+            }
+
+        private:
+            std::mutex& repoMutex;
+            unique_ptr<IOStream> stream;
+    };
+
     class FileSystemBleb : public IFileSystem
     {
         public:
@@ -42,6 +87,9 @@ namespace zfw
             ISystem* sys;
             String path;
 
+            // bleb::Repository is not thread-safe, and all of its streams read through the same FILE*.
+            // Every access to the repository, including I/O on streams opened from it, holds this.
+            std::mutex repoMutex;
             bleb::StdioFileByteIO bio;
             bleb::Repository repo;
 
@@ -121,7 +169,7 @@ namespace zfw
 
         const char* fullPath = normalizedPath;
 
-        unique_ptr<ByteIOStream> file;
+        unique_ptr<IOStream> file;
 
         int blebFlags = 0;
 
@@ -131,11 +179,16 @@ namespace zfw
         if (flags & kFileTruncate)
             blebFlags |= bleb::kStreamTruncate;
 
-        file = ByteIOStream::createFrom(repo.openStream(fullPath, blebFlags).release(), true);
+        {
+            std::lock_guard<std::mutex> lg(repoMutex);
+            file = ByteIOStream::createFrom(repo.openStream(fullPath, blebFlags).release(), true);
+        }
 
         if (file == nullptr)
             return ErrorBuffer::SetError3(EX_NOT_FOUND, 0), false;
 
+        file.reset(new BlebLockedStream(repoMutex, move(file)));
+
         if (is_out != nullptr)
         {
             zombie_assert(os_out == nullptr && io_out == nullptr);
@@ -165,6 +218,8 @@ namespace zfw
 
         const char* fullPath = normalizedPath;
 
+        std::lock_guard<std::mutex> lg(repoMutex);
+
         if (auto stream = repo.openStream(fullPath, 0))
         {
             stat_out->isDirectory = false;
@@ -8,6 +8,8 @@
 #include <littl/cfx2.hpp>
 #include <littl/HashMap.hpp>
 
+#include <vector>
+
 namespace zfw
 {
     using namespace li;
@@ -18,24 +20,36 @@ namespace zfw
             struct EntityDef_t
             {
                 IEntity*    (*Instantiate)();
+                shared_ptr<IEntity> (*InstantiatePooled)(const shared_ptr<EntityPool>& pool);
+                shared_ptr<EntityPool> pool;
                 cfx2::Node  properties;
             };
 
             ErrorBuffer_t* eb;
             ISystem* sys;
-            HashMap<String, EntityDef_t> registeredEntities;
+            HashMap<String, int> registeredEntities;    // class IDs into 'entityClasses'
+            std::vector<EntityDef_t> entityClasses;
+
+            EntityDef_t* p_GetEntityClass(int classID, int flags);
 
         public:
             EntityHandler(ErrorBuffer_t* eb, ISystem* sys) : eb(eb), sys(sys) {}
             virtual ~EntityHandler();
 
             virtual bool Register(const char* className, IEntity* (*Instantiate)()) override;
+            virtual bool Register(const char* className, IEntity* (*Instantiate)(),
+                    shared_ptr<IEntity> (*InstantiatePooled)(const shared_ptr<EntityPool>& pool)) override;
             virtual bool RegisterExternal(const char* path, int flags) override;
 
             virtual IEntity* InstantiateEntity(const char* className, int flags) override;
             virtual int IterateEntityClasses(IEntityClassListener* listener) override;
 
-            bool RegisterEntityClass(const char* className, IEntity* (*Instantiate)(), cfx2::Node properties);
+            virtual int GetEntityClassID(const char* className, int flags) override;
+            virtual shared_ptr<IEntity> InstantiateEntityByID(int classID, int flags) override;
+            virtual size_t InstantiateEntitiesByID(int classID, shared_ptr<IEntity>* ents_out, size_t count, int flags) override;
+
+            bool RegisterEntityClass(const char* className, IEntity* (*Instantiate)(),
+                    shared_ptr<IEntity> (*InstantiatePooled)(const shared_ptr<EntityPool>& pool), cfx2::Node properties);
     };
 
     IEntityHandler* p_CreateEntityHandler(ErrorBuffer_t* eb, ISystem* sys)
@@ -45,25 +59,57 @@ namespace zfw
 
     EntityHandler::~EntityHandler()
     {
-        iterate2 (i, registeredEntities)
+        for (auto& entdef : entityClasses)
         {
-            if (!(*i).value.properties.isNull())
-                (*i).value.properties.release();
+            if (!entdef.properties.isNull())
+                entdef.properties.release();
         }
     }
 
-    IEntity* EntityHandler::InstantiateEntity(const char* className, int flags)
+    int EntityHandler::GetEntityClassID(const char* className, int flags)
     {
-        EntityDef_t* entdef = registeredEntities.find(className);
+        int* classID = registeredEntities.find(className);
 
-        if (entdef == nullptr)
+        if (classID == nullptr)
             return ((flags & ENTITY_REQUIRED) && ErrorBuffer::SetError(eb, EX_OBJECT_UNDEFINED,
                     "desc", (const char*) sprintf_t<255>("Failed to create undefined entity '%s'.", className),
                     "function", li_functionName,
                     nullptr)),
-                    nullptr;
+                    -1;
+
+        return *classID;
+    }
+
+    IEntity* EntityHandler::InstantiateEntity(const char* className, int flags)
+    {
+        const int classID = GetEntityClassID(className, flags);
+
+        if (classID < 0)
+            return nullptr;
+
+        EntityDef_t& entdef = entityClasses[classID];
+
+        IEntity* ent = entdef.Instantiate();
 
-        IEntity* ent = entdef->Instantiate();
+        if (!entdef.properties.isNull())
+            ent->ApplyProperties(entdef.properties.node);
+
+        return ent;
+    }
+
+    shared_ptr<IEntity> EntityHandler::InstantiateEntityByID(int classID, int flags)
+    {
+        EntityDef_t* entdef = p_GetEntityClass(classID, flags);
+
+        if (entdef == nullptr)
+            return nullptr;
+
+        shared_ptr<IEntity> ent;
+
+        if (entdef->InstantiatePooled != nullptr)
+            ent = entdef->InstantiatePooled(entdef->pool);
+        else
+            ent.reset(entdef->Instantiate());
 
         if (!entdef->properties.isNull())
             ent->ApplyProperties(entdef->properties.node);
@@ -71,6 +117,32 @@ namespace zfw
         return ent;
     }
 
+    size_t EntityHandler::InstantiateEntitiesByID(int classID, shared_ptr<IEntity>* ents_out, size_t count, int flags)
+    {
+        EntityDef_t* entdef = p_GetEntityClass(classID, flags);
+
+        if (entdef == nullptr)
+            return 0;
+
+        if (entdef->pool != nullptr)
+            entdef->pool->Reserve(count);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            ents_out[i] = InstantiateEntityByID(classID, flags);
+
+            if (ents_out[i] == nullptr)
+            {
+                for (size_t j = 0; j < i; j++)
+                    ents_out[j].reset();
+
+                return 0;
+            }
+        }
+
+        return count;
+    }
+
     int EntityHandler::IterateEntityClasses(IEntityClassListener* listener)
     {
         iterate2 (i, registeredEntities)
@@ -84,20 +156,58 @@ namespace zfw
         return 0;
     }
 
+    EntityHandler::EntityDef_t* EntityHandler::p_GetEntityClass(int classID, int flags)
+    {
+        if (classID < 0 || (size_t) classID >= entityClasses.size())
+            return ((flags & ENTITY_REQUIRED) && ErrorBuffer::SetError(eb, EX_OBJECT_UNDEFINED,
+                    "desc", (const char*) sprintf_t<255>("Failed to create entity of undefined class #%i.", classID),
+                    "function", li_functionName,
+                    nullptr)),
+                    nullptr;
+
+        return &entityClasses[classID];
+    }
+
     bool EntityHandler::Register(const char* className, IEntity* (*Instantiate)())
     {
-        return RegisterEntityClass(className, Instantiate, cfx2::Node());
+        return RegisterEntityClass(className, Instantiate, nullptr, cfx2::Node());
     }
 
-    bool EntityHandler::RegisterEntityClass(const char* className, IEntity* (*Instantiate)(), cfx2::Node properties)
+    bool EntityHandler::Register(const char* className, IEntity* (*Instantiate)(),
+            shared_ptr<IEntity> (*InstantiatePooled)(const shared_ptr<EntityPool>& pool))
     {
-        if (registeredEntities.find(className) != nullptr)
-            sys->Printf(kLogWarning, "Entity: redefinition of '%s'", className);
+        return RegisterEntityClass(className, Instantiate, InstantiatePooled, cfx2::Node());
+    }
 
+    bool EntityHandler::RegisterEntityClass(const char* className, IEntity* (*Instantiate)(),
+            shared_ptr<IEntity> (*InstantiatePooled)(const shared_ptr<EntityPool>& pool), cfx2::Node properties)
+    {
         EntityDef_t entdef;
         entdef.Instantiate = Instantiate;
+        entdef.InstantiatePooled = InstantiatePooled;
         entdef.properties = properties;
-        registeredEntities.set(String(className), (EntityDef_t&&) entdef);
+
+        // Each class gets its own pool, even if it shares the C++ type of another one
+        if (InstantiatePooled != nullptr)
+            entdef.pool = std::make_shared<EntityPool>();
+
+        int* classID = registeredEntities.find(className);
+
+        // A redefinition keeps the class ID; entities already allocated from the old pool keep it alive
+        if (classID != nullptr)
+        {
+            sys->Printf(kLogWarning, "Entity: redefinition of '%s'", className);
+
+            if (!entityClasses[*classID].properties.isNull())
+                entityClasses[*classID].properties.release();
+
+            entityClasses[*classID] = move(entdef);
+        }
+        else
+        {
+            registeredEntities.set(String(className), (int) entityClasses.size());
+            entityClasses.push_back(move(entdef));
+        }
 
         return true;
     }
@@ -140,9 +250,9 @@ namespace zfw
         cfx2::Node node = doc[0];
         const char* baseEntity = node.getText();
         
-        EntityDef_t* entdef = registeredEntities.find(baseEntity);
+        int* baseClassID = registeredEntities.find(baseEntity);
 
-        if (entdef == nullptr)
+        if (baseClassID == nullptr)
         {
             sys->Printf(kLogError, "Entity: undefined baseent '%s' in '%s'", baseEntity, filename.c_str());
 
@@ -157,6 +267,7 @@ namespace zfw
 
         doc.removeChild(node);
 
-        return RegisterEntityClass(node.getName(), entdef->Instantiate, node);
+        const EntityDef_t& entdef = entityClasses[*baseClassID];
+        return RegisterEntityClass(node.getName(), entdef.Instantiate, entdef.InstantiatePooled, node);
     }
 }
@@ -0,0 +1,98 @@
+#include <framework/entitypool.hpp>
+
+#include <framework/utility/essentials.hpp>
+
+#include <algorithm>
+
+namespace zfw
+{
+    EntityPool::~EntityPool()
+    {
+        zombie_assert(numFreeBlocks == numBlocks);
+
+        for (void* chunk : chunks)
+            ::operator delete(chunk);
+    }
+
+    void* EntityPool::Alloc(size_t size)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (blockSize == 0)
+        {
+            // Blocks double as free list entries, and must keep everything after them aligned
+            const size_t alignment = alignof(std::max_align_t);
+            blockSize = (std::max(size, sizeof(FreeBlock_t)) + alignment - 1) / alignment * alignment;
+        }
+
+        zombie_assert(size <= blockSize);
+
+        if (freeList == nullptr)
+        {
+            p_AllocChunk(std::max(numReserved, blocksPerChunk));
+            numReserved = 0;
+        }
+
+        FreeBlock_t* block = freeList;
+        freeList = block->next;
+        numFreeBlocks--;
+        return block;
+    }
+
+    void EntityPool::Free(void* block)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        FreeBlock_t* freeBlock = static_cast<FreeBlock_t*>(block);
+        freeBlock->next = freeList;
+        freeList = freeBlock;
+        numFreeBlocks++;
+    }
+
+    size_t EntityPool::GetNumBlocks()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        return numBlocks;
+    }
+
+    size_t EntityPool::GetNumFreeBlocks()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        return numFreeBlocks;
+    }
+
+    void EntityPool::p_AllocChunk(size_t numBlocks)
+    {
+        uint8_t* chunk = static_cast<uint8_t*>(::operator new(blockSize * numBlocks));
+        chunks.push_back(chunk);
+
+        // Thread the new blocks onto the free list in address order
+        for (size_t i = numBlocks; i > 0; i--)
+        {
+            FreeBlock_t* block = reinterpret_cast<FreeBlock_t*>(chunk + (i - 1) * blockSize);
+            block->next = freeList;
+            freeList = block;
+        }
+
+        this->numBlocks += numBlocks;
+        numFreeBlocks += numBlocks;
+    }
+
+    void EntityPool::Reserve(size_t numBlocks)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (blockSize == 0)
+        {
+            numReserved = std::max(numReserved, numBlocks);
+            return;
+        }
+
+        if (numFreeBlocks >= numBlocks)
+            return;
+
+        p_AllocChunk(std::max(numBlocks - numFreeBlocks, blocksPerChunk));
+    }
+}
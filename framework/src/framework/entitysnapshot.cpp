@@ -0,0 +1,289 @@
+#include <framework/entitysnapshot.hpp>
+#include <framework/entityworld.hpp>
+
+#include <framework/utility/essentials.hpp>
+
+#include <cstring>
+
+namespace zfw
+{
+    // Changed bytes closer than this are stored as a single run
+    static const uint32_t kMinRunGap = 8;
+
+    static uint32_t SlotOf(int32_t entID)
+    {
+        return (uint32_t) EntityWorld::GetEntityIndex(entID);
+    }
+
+    // ====================================================================== //
+    //  class EntityWorldSnapshot
+    // ====================================================================== //
+
+    void EntityWorldSnapshot::Clear()
+    {
+        entities.clear();
+        data.clear();
+        classNames.reset();
+    }
+
+    size_t EntityWorldSnapshot::GetSize() const
+    {
+        return entities.size() * sizeof(Entity_t) + data.size();
+    }
+
+    // ====================================================================== //
+    //  class EntityWorldDiff
+    // ====================================================================== //
+
+    void EntityWorldDiff::Apply(const EntityWorldSnapshot& from, EntityWorldSnapshot& to_out) const
+    {
+        to_out.entities.clear();
+        to_out.data.clear();
+        to_out.classNames = classNames;
+
+        auto copy = [&from, &to_out](const EntityWorldSnapshot::Entity_t& entity)
+        {
+            const uint32_t offset = (uint32_t) to_out.data.size();
+            to_out.data.insert(to_out.data.end(), from.data.begin() + entity.offset,
+                    from.data.begin() + entity.offset + entity.length);
+            to_out.entities.push_back(EntityWorldSnapshot::Entity_t { entity.entID, entity.classIndex, offset, entity.length });
+        };
+
+        size_t i = 0;
+
+        for (const auto& change : changes)
+        {
+            // Everything up to the change is unchanged
+            while (i < from.entities.size() && SlotOf(from.entities[i].entID) < SlotOf(change.entID))
+                copy(from.entities[i++]);
+
+            const EntityWorldSnapshot::Entity_t* base = nullptr;
+
+            if (change.type != kAdded)
+            {
+                // The diff must have been created from this snapshot
+                zombie_assert(i < from.entities.size() && from.entities[i].entID == change.entID);
+                base = &from.entities[i++];
+            }
+
+            if (change.type == kRemoved)
+                continue;
+
+            const uint32_t offset = (uint32_t) to_out.data.size();
+
+            if (base != nullptr)
+                p_Patch(change, from.data.data() + base->offset, base->length, to_out.data);
+            else
+                p_Patch(change, nullptr, 0, to_out.data);
+
+            to_out.entities.push_back(EntityWorldSnapshot::Entity_t { change.entID, change.classIndex, offset, change.length });
+        }
+
+        while (i < from.entities.size())
+            copy(from.entities[i++]);
+    }
+
+    void EntityWorldDiff::Clear()
+    {
+        changes.clear();
+        runs.clear();
+        data.clear();
+        classNames.reset();
+    }
+
+    void EntityWorldDiff::Create(const EntityWorldSnapshot& from, const EntityWorldSnapshot& to, EntityWorldDiff& diff_out)
+    {
+        diff_out.Clear();
+        diff_out.classNames = to.classNames;
+
+        auto addRun = [&diff_out](const uint8_t* bytes, uint32_t offset, uint32_t length)
+        {
+            diff_out.runs.push_back(Run_t { offset, length, (uint32_t) diff_out.data.size() });
+            diff_out.data.insert(diff_out.data.end(), bytes + offset, bytes + offset + length);
+        };
+
+        auto added = [&](const EntityWorldSnapshot::Entity_t& entity)
+        {
+            diff_out.changes.push_back(Change_t { entity.entID, entity.classIndex, entity.length,
+                    (uint32_t) diff_out.runs.size(), 1, kAdded });
+            addRun(to.data.data() + entity.offset, 0, entity.length);
+        };
+
+        auto removed = [&diff_out](const EntityWorldSnapshot::Entity_t& entity)
+        {
+            diff_out.changes.push_back(Change_t { entity.entID, 0, 0, 0, 0, kRemoved });
+        };
+
+        auto changed = [&](const EntityWorldSnapshot::Entity_t& a, const EntityWorldSnapshot::Entity_t& b)
+        {
+            const uint8_t* before = from.data.data() + a.offset;
+            const uint8_t* after = to.data.data() + b.offset;
+
+            if (a.length == b.length && memcmp(before, after, a.length) == 0)
+                return;
+
+            Change_t change { b.entID, b.classIndex, b.length, (uint32_t) diff_out.runs.size(), 0, kChanged };
+
+            const uint32_t common = std::min(a.length, b.length);
+            uint32_t pos = 0;
+
+            while (pos < common)
+            {
+                if (before[pos] == after[pos])
+                {
+                    pos++;
+                    continue;
+                }
+
+                // Extend the run until kMinRunGap bytes in a row are the same again
+                const uint32_t start = pos;
+                uint32_t end = pos + 1, same = 0;
+
+                for (pos = end; pos < common && same < kMinRunGap; pos++)
+                {
+                    if (before[pos] == after[pos])
+                        same++;
+                    else
+                    {
+                        same = 0;
+                        end = pos + 1;
+                    }
+                }
+
+                addRun(to.data.data() + b.offset, start, end - start);
+                change.numRuns++;
+            }
+
+            // Whatever the entity appended
+            if (b.length > common)
+            {
+                Run_t* last = change.numRuns > 0 ? &diff_out.runs.back() : nullptr;
+
+                if (last != nullptr && last->offset + last->length + kMinRunGap >= common)
+                {
+                    const uint32_t lastEnd = last->offset + last->length;
+                    last->length = b.length - last->offset;
+                    diff_out.data.insert(diff_out.data.end(), after + lastEnd, after + b.length);
+                }
+                else
+                {
+                    addRun(to.data.data() + b.offset, common, b.length - common);
+                    change.numRuns++;
+                }
+            }
+
+            diff_out.changes.push_back(change);
+        };
+
+        size_t i = 0, j = 0;
+
+        while (i < from.entities.size() || j < to.entities.size())
+        {
+            const uint32_t a = (i < from.entities.size()) ? SlotOf(from.entities[i].entID) : UINT32_MAX;
+            const uint32_t b = (j < to.entities.size()) ? SlotOf(to.entities[j].entID) : UINT32_MAX;
+
+            if (a < b)
+                removed(from.entities[i++]);
+            else if (b < a)
+                added(to.entities[j++]);
+            else
+            {
+                const auto& before = from.entities[i++];
+                const auto& after = to.entities[j++];
+
+                // A slot reused by a different entity (or class) is a removal and an addition
+                if (before.entID != after.entID || before.classIndex != after.classIndex)
+                {
+                    removed(before);
+                    added(after);
+                }
+                else
+                    changed(before, after);
+            }
+        }
+    }
+
+    size_t EntityWorldDiff::GetSize() const
+    {
+        return changes.size() * sizeof(Change_t) + runs.size() * sizeof(Run_t) + data.size();
+    }
+
+    void EntityWorldDiff::p_Patch(const Change_t& change, const uint8_t* base, uint32_t baseLength,
+            std::vector<uint8_t>& data_out) const
+    {
+        const size_t offset = data_out.size();
+        data_out.resize(offset + change.length);
+
+        uint8_t* out = data_out.data() + offset;
+
+        if (base != nullptr)
+            memcpy(out, base, std::min(baseLength, change.length));
+
+        for (uint32_t i = 0; i < change.numRuns; i++)
+        {
+            const Run_t& run = runs[change.firstRun + i];
+            memcpy(out + run.offset, data.data() + run.dataOffset, run.length);
+        }
+    }
+
+    // ====================================================================== //
+    //  class EntityWorldHistory
+    // ====================================================================== //
+
+    void EntityWorldHistory::Clear()
+    {
+        latest.Clear();
+        hasLatest = false;
+        diffs.clear();
+    }
+
+    bool EntityWorldHistory::Get(size_t stepsBack, EntityWorldSnapshot& snapshot_out) const
+    {
+        if (stepsBack >= GetLength())
+            return false;
+
+        snapshot_out = latest;
+
+        EntityWorldSnapshot older;
+
+        for (size_t i = 0; i < stepsBack; i++)
+        {
+            diffs[i].Apply(snapshot_out, older);
+            std::swap(snapshot_out, older);
+        }
+
+        return true;
+    }
+
+    size_t EntityWorldHistory::GetSize() const
+    {
+        size_t size = latest.GetSize();
+
+        for (const auto& diff : diffs)
+            size += diff.GetSize();
+
+        return size;
+    }
+
+    void EntityWorldHistory::Push(EntityWorldSnapshot& snapshot)
+    {
+        if (hasLatest && maxLength > 1)
+        {
+            // Reuse the storage of the oldest diff once the history is full
+            EntityWorldDiff diff;
+
+            if (diffs.size() >= maxLength - 1)
+            {
+                diff = std::move(diffs.back());
+                diffs.pop_back();
+            }
+
+            // Backward, from the new snapshot to the previous one
+            EntityWorldDiff::Create(snapshot, latest, diff);
+            diffs.push_front(std::move(diff));
+        }
+
+        std::swap(latest, snapshot);
+        hasLatest = true;
+    }
+}
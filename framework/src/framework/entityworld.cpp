@@ -1,30 +1,167 @@
 
 #include <framework/entityhandler.hpp>
+#include <framework/entitysnapshot.hpp>
 #include <framework/entityworld.hpp>
+#include <framework/jobsystem.hpp>
 #include <framework/system.hpp>
 
 #include <littl/cfx2.hpp>
 
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+
 namespace zfw
 {
-    bool EntityWorld::AddEntity(shared_ptr<IEntity> ent)
+    const uint32_t EntityWorld::kFreeSlot;
+
+    // Snapshot classes are resolved to handler class IDs on first use
+    static const int kUnresolvedClass = -2;
+
+    static void GetTransformBounds(const TransformStore& transforms, uint32_t handle, Float3& min, Float3& max)
     {
-        for (const auto& filter : entityFilters)
-        {
-            if (!filter->OnAddEntity(this, ent.get()))
-                return false;
-        }
+        if (!transforms.GetAABB(handle, min, max))
+            min = max = transforms.GetPos(handle);
+    }
 
-        ent->SetID((int) entities.getLength());
-        entities.add(move(ent));
+    // In-memory streams for entity blobs, so that entities can keep using their stream-based
+    // Serialize/Unserialize while the world does its I/O in bulk
+    class EntityBlobReader : public InputStream
+    {
+        protected:
+            const uint8_t* data;
+            size_t length, pos;
+
+        public:
+            EntityBlobReader(const uint8_t* data, size_t length) : data(data), length(length), pos(0) {}
+
+            virtual bool finite() override { return true; }
+            virtual bool seekable() override { return true; }
+
+            virtual bool eof() override { return pos >= length; }
+
+            virtual uint64_t getPos() override { return pos; }
+            virtual uint64_t getSize() override { return length; }
+            virtual bool setPos(uint64_t pos) override
+            {
+                if (pos > length)
+                    return false;
+
+                this->pos = (size_t) pos;
+                return true;
+            }
+
+            virtual size_t read(void* out, size_t count) override
+            {
+                count = std::min(count, length - pos);
+                memcpy(out, data + pos, count);
+                pos += count;
+                return count;
+            }
+    };
+
+    class EntityBlobWriter : public OutputStream
+    {
+        protected:
+            std::vector<uint8_t>& buffer;
+
+        public:
+            EntityBlobWriter(std::vector<uint8_t>& buffer) : buffer(buffer) {}
+
+            virtual bool finite() override { return true; }
+            virtual bool seekable() override { return false; }
+
+            virtual bool eof() override { return true; }
+
+            virtual uint64_t getPos() override { return buffer.size(); }
+            virtual uint64_t getSize() override { return buffer.size(); }
+            virtual bool setPos(uint64_t pos) override { return pos == buffer.size(); }
+
+            virtual size_t write(const void* in, size_t count) override
+            {
+                const uint8_t* bytes = static_cast<const uint8_t*>(in);
+                buffer.insert(buffer.end(), bytes, bytes + count);
+                return count;
+            }
+    };
+
+    template <typename T>
+    static void AppendLE(std::vector<uint8_t>& buffer, T value)
+    {
+        const size_t pos = buffer.size();
+        buffer.resize(pos + sizeof(T));
+        memcpy(&buffer[pos], &value, sizeof(T));
+    }
+
+    template <typename T>
+    static bool ReadLE(const std::vector<uint8_t>& buffer, size_t& pos, T& value_out)
+    {
+        if (buffer.size() - pos < sizeof(T))
+            return false;
+
+        memcpy(&value_out, &buffer[pos], sizeof(T));
+        pos += sizeof(T);
         return true;
     }
 
+    bool EntityWorld::AddEntity(shared_ptr<IEntity> ent)
+    {
+        return p_AddEntity(move(ent), -1);
+    }
+
     void EntityWorld::AddEntityFilter(IEntityFilter* filter)
     {
         entityFilters.add(filter);
     }
     
+    bool EntityWorld::ApplyDiff(const EntityWorldSnapshot& from, const EntityWorldDiff& diff, int flags)
+    {
+        ZFW_ASSERT(!updating)
+
+        std::vector<IEntity*> restored;
+        std::vector<int> classIDs(diff.classNames != nullptr ? diff.classNames->size() : 0, kUnresolvedClass);
+        size_t i = 0;
+
+        for (const auto& change : diff.changes)
+        {
+            while (i < from.entities.size() && GetEntityIndex(from.entities[i].entID) < GetEntityIndex(change.entID))
+                i++;
+
+            const EntityWorldSnapshot::Entity_t* base = nullptr;
+
+            if (change.type != EntityWorldDiff::kAdded)
+            {
+                // The diff must have been created from this snapshot
+                zombie_assert(i < from.entities.size() && from.entities[i].entID == change.entID);
+                base = &from.entities[i++];
+            }
+
+            if (change.type == EntityWorldDiff::kRemoved)
+            {
+                IEntity* ent = GetEntityByID(change.entID);
+
+                if (ent != nullptr)
+                    RemoveEntity(ent);
+
+                continue;
+            }
+
+            snapshotScratch.clear();
+
+            if (base != nullptr)
+                diff.p_Patch(change, from.data.data() + base->offset, base->length, snapshotScratch);
+            else
+                diff.p_Patch(change, nullptr, 0, snapshotScratch);
+
+            if (!p_RestoreEntity(change.entID, change.classIndex, (*diff.classNames)[change.classIndex],
+                    classIDs[change.classIndex], snapshotScratch.data(), (uint32_t) snapshotScratch.size(), flags, restored))
+                return false;
+        }
+
+        return p_LinkEntities(restored, flags);
+    }
+
     void EntityWorld::Draw(const UUID_t* modeOrNull)
     {
         for (const auto& ent : entities)
@@ -33,13 +170,28 @@ namespace zfw
     
     IEntity* EntityWorld::GetEntityByID(int entID)
     {
-        for (const auto& ent : entities)
-        {
-            if (ent->GetID() == entID)
-                return ent.get();
-        }
+        if (entID < 0)
+            return nullptr;
+
+        const uint32_t index = (uint32_t) entID & kEntityIndexMask;
+
+        if (index >= slots.size())
+            return nullptr;
+
+        const EntitySlot_t& slot = slots[index];
+
+        if (slot.denseIndex == kFreeSlot || slot.generation != ((uint32_t) entID >> kEntityIndexBits))
+            return nullptr;
+
+        return entities[slot.denseIndex].get();
+    }
 
-        return nullptr;
+    IEntity* EntityWorld::GetEntityByIndex(int index)
+    {
+        if (index < 0 || (size_t) index >= slots.size() || slots[index].denseIndex == kFreeSlot)
+            return nullptr;
+
+        return entities[slots[index].denseIndex].get();
     }
 
 	bool EntityWorld::InitAllEntities()
@@ -60,37 +212,496 @@ namespace zfw
     }
 #endif
 
+    bool EntityWorld::p_AddEntity(shared_ptr<IEntity>&& ent, int entID)
+    {
+        // Checked up front, so that filters never see an entity which is then not added
+        if (entities.getLength() >= kMaxEntities)
+            return ErrorBuffer::SetError3(EX_INVALID_OPERATION, 2,
+                    "desc", sprintf_255("Too many entities (limit is %i).", (int) kMaxEntities),
+                    "function", li_functionName
+                    ), false;
+
+        for (const auto& filter : entityFilters)
+        {
+            if (!filter->OnAddEntity(this, ent.get()))
+                return false;
+        }
+
+        uint32_t index;
+
+        if (entID >= 0 && p_ClaimSlot((uint32_t) entID & kEntityIndexMask, (uint32_t) entID >> kEntityIndexBits))
+            index = (uint32_t) entID & kEntityIndexMask;
+        else
+            index = p_AllocateSlot();
+
+        EntitySlot_t& slot = slots[index];
+        slot.denseIndex = (uint32_t) entities.getLength();
+
+        // Whichever class the snapshots last saw in this slot, it wasn't this entity's
+        if (index < snapshotSlotClasses.size())
+            snapshotSlotClasses[index] = kFreeSlot;
+
+        ent->SetID((int) ((slot.generation << kEntityIndexBits) | index));
+
+        ITransformStoreUser* transformUser = dynamic_cast<ITransformStoreUser*>(ent.get());
+        uint32_t transform = TransformStore::kInvalidHandle;
+
+        if (transformUser != nullptr)
+        {
+            transform = transforms.Allocate(transformUser);
+            transformUser->OnTransformAttach(&transforms, transform);
+        }
+
+        IEntityUpdatePolicy* policy = dynamic_cast<IEntityUpdatePolicy*>(ent.get());
+        uint8_t update = kEntityPhaseDefault;
+
+        if (policy != nullptr)
+        {
+            update = (uint8_t) policy->GetUpdatePhase();
+            zombie_assert(update < kNumEntityPhases);
+
+            if (policy->IsUpdateThreadSafe())
+                update |= kUpdateThreadSafe;
+        }
+
+        IPointEntity* pe = dynamic_cast<IPointEntity*>(ent.get());
+
+        // Only point entities need their bounds refreshed when the store moves them
+        if (transform != TransformStore::kInvalidHandle)
+        {
+            if (transform >= transformSlots.size())
+                transformSlots.resize(transform + 1, kFreeSlot);
+
+            transformSlots[transform] = (pe != nullptr) ? index : kFreeSlot;
+        }
+
+        entities.add(move(ent));
+        entitySlots.push_back(index);
+        entityPoints.push_back(pe);
+        entityTransforms.push_back(transform);
+        entityUpdate.push_back(update);
+        phasesDirty = true;
+
+        if (pe != nullptr)
+        {
+            Float3 min, max;
+            p_GetBounds(slot.denseIndex, min, max);
+            spatialIndex.Insert(index, min, max);
+        }
+
+        return true;
+    }
+
+    uint32_t EntityWorld::p_AllocateSlot()
+    {
+        while (!freeSlots.empty())
+        {
+            const uint32_t index = freeSlots.back();
+            freeSlots.pop_back();
+
+            if (slots[index].denseIndex == kFreeSlot)
+                return index;
+        }
+
+        // p_AddEntity guarantees that there is room, as long as freeSlots covers every unused slot
+        zombie_assert(slots.size() < kMaxEntities);
+
+        slots.push_back(EntitySlot_t { 0, kFreeSlot });
+        return (uint32_t) slots.size() - 1;
+    }
+
+    bool EntityWorld::p_ClaimSlot(uint32_t index, uint32_t generation)
+    {
+        // Slots skipped over become free; claiming one of those later leaves a stale entry in freeSlots,
+        // which p_AllocateSlot will skip
+        while (slots.size() <= index)
+        {
+            if (slots.size() < index)
+                freeSlots.push_back((uint32_t) slots.size());
+
+            slots.push_back(EntitySlot_t { 0, kFreeSlot });
+        }
+
+        if (slots[index].denseIndex != kFreeSlot)
+            return false;
+
+        slots[index].generation = generation & kEntityGenerationMask;
+        return true;
+    }
+
+    void EntityWorld::p_GetBounds(uint32_t denseIndex, Float3& min, Float3& max)
+    {
+        const uint32_t transform = entityTransforms[denseIndex];
+
+        if (transform != TransformStore::kInvalidHandle)
+            GetTransformBounds(transforms, transform, min, max);
+        else if (!entityPoints[denseIndex]->GetAABB(min, max))
+            min = max = entities[denseIndex]->GetPos();
+    }
+
+    uint32_t EntityWorld::p_GetSnapshotClass(const char* className, const uint8_t* header, size_t headerLength)
+    {
+        auto it = snapshotClassIndices.find(className);
+
+        if (it == snapshotClassIndices.end())
+        {
+            auto classNames = std::make_shared<std::vector<std::string>>(*snapshotClassNames);
+            classNames->push_back(className);
+            snapshotClassNames = move(classNames);
+
+            snapshotClassHeaders.emplace_back(reinterpret_cast<const char*>(header), headerLength);
+            it = snapshotClassIndices.emplace(className, (uint32_t) snapshotClassNames->size() - 1).first;
+        }
+
+        return it->second;
+    }
+
+    uint32_t EntityWorld::p_GetSnapshotClassOf(IEntity* ent, int flags)
+    {
+        const uint32_t index = GetEntityIndex(ent->GetID());
+
+        if (index < snapshotSlotClasses.size() && snapshotSlotClasses[index] != kFreeSlot)
+            return snapshotSlotClasses[index];
+
+        // Not captured by a snapshot since it was added; go by the header it writes
+        std::vector<uint8_t> data;
+        EntityBlobWriter blobWriter(data);
+
+        if (ent->FullSerialize(this, &blobWriter, flags) <= 0)
+            return kFreeSlot;
+
+        EntityBlobReader header(data.data(), data.size());
+        auto it = snapshotClassIndices.find(header.readString().c_str());
+
+        return (it != snapshotClassIndices.end()) ? it->second : kFreeSlot;
+    }
+
+    bool EntityWorld::p_LinkEntities(const std::vector<IEntity*>& ents, int flags)
+    {
+        for (IEntity* ent : ents)
+        {
+            int r = ent->Unserialize(this, nullptr, flags);
+
+            if (r == 0)
+                return ErrorBuffer::SetError3(EX_SERIALIZATION_ERR, 2,
+                "desc", sprintf_255("Failed to link entity #%i.", ent->GetID()),
+                "function", li_functionName
+                ), false;
+        }
+
+        return true;
+    }
+
     void EntityWorld::OnFrame(double delta)
     {
-        for (const auto& ent : entities)
-            ent->OnFrame(delta);
+        p_Update([delta](IEntity* ent) { ent->OnFrame(delta); });
     }
 
     void EntityWorld::OnTick()
     {
-        for (const auto& ent : entities)
-            ent->OnTick();
+        p_Update([](IEntity* ent) { ent->OnTick(); });
+
+        movedTransforms.clear();
+        transforms.Move(1.0f, &movedTransforms);
+
+        // Before the notifications, so that the entities can already query their new surroundings
+        for (uint32_t transform : movedTransforms)
+        {
+            const uint32_t index = transformSlots[transform];
+
+            if (index != kFreeSlot)
+            {
+                Float3 min, max;
+                GetTransformBounds(transforms, transform, min, max);
+                spatialIndex.Update(index, min, max);
+            }
+        }
+
+        transforms.NotifyMoved();
     }
 
-    void EntityWorld::RemoveAllEntities(bool destroy)
+    void EntityWorld::p_ApplyQueuedCommands()
     {
-        entities.clear();
+        if (queuedCommands.empty())
+            return;
+
+        std::vector<QueuedCommand_t> commands;
+        commands.swap(queuedCommands);
+
+        // Every entity's commands are already contiguous and in call order, only the batches need ordering
+        std::stable_sort(commands.begin(), commands.end(), [](const QueuedCommand_t& a, const QueuedCommand_t& b)
+        {
+            return a.order < b.order;
+        });
+
+        for (const auto& command : commands)
+            command.command();
     }
 
-    void EntityWorld::RemoveEntity(IEntity* ent)
+    void EntityWorld::p_BuildPhases()
     {
+        for (auto& phase : phases)
+        {
+            phase.parallel.clear();
+            phase.serial.clear();
+        }
+
         for (size_t i = 0; i < entities.getLength(); i++)
         {
-            if (entities[i].get() == ent)
+            UpdatePhase_t& phase = phases[entityUpdate[i] & kUpdatePhaseMask];
+
+            if (entityUpdate[i] & kUpdateThreadSafe)
+                phase.parallel.push_back(entities[i].get());
+            else
+                phase.serial.push_back(entities[i].get());
+        }
+
+        phasesDirty = false;
+    }
+
+    EntityWorld::UpdateContext_t*& EntityWorld::p_CurrentContext()
+    {
+        // Set while the thread is updating an entity (of any world)
+        static thread_local UpdateContext_t* context = nullptr;
+        return context;
+    }
+
+    void EntityWorld::p_Queue(std::function<void()>&& command)
+    {
+        UpdateContext_t* context = p_CurrentContext();
+
+        if (context == nullptr || context->world != this)
+        {
+            command();
+            return;
+        }
+
+        context->commands->push_back(QueuedCommand_t { context->order, move(command) });
+    }
+
+    template <typename Func>
+    void EntityWorld::p_Update(Func&& update)
+    {
+        ZFW_ASSERT(!updating)
+
+        IJobSystem* jobSystem = sys->GetJobSystem();
+        UpdateContext_t*& current = p_CurrentContext();
+        UpdateContext_t* const outer = current;
+
+        updating = true;
+
+        for (int i = 0; i < kNumEntityPhases; i++)
+        {
+            // Entities added or removed by the previous phase
+            if (phasesDirty)
+                p_BuildPhases();
+
+            const auto& parallel = phases[i].parallel;
+            const auto& serial = phases[i].serial;
+
+            auto updateRange = [this, &update, &parallel](size_t begin, size_t end)
             {
-                entities.remove(i);
+                std::vector<QueuedCommand_t> commands;
+                UpdateContext_t context { this, &commands, 0 };
 
-                for (const auto& filter : entityFilters)
-                    filter->OnRemoveEntity(this, ent);
+                // Workers may be waiting on a nested job, so restore whatever was there
+                UpdateContext_t*& current = p_CurrentContext();
+                UpdateContext_t* const saved = current;
+                current = &context;
 
-                break;
+                for (size_t j = begin; j < end; j++)
+                {
+                    context.order = (uint32_t) j;
+                    update(parallel[j]);
+                }
+
+                current = saved;
+
+                if (!commands.empty())
+                {
+                    std::lock_guard<std::mutex> lock(queueMutex);
+                    std::move(commands.begin(), commands.end(), std::back_inserter(queuedCommands));
+                }
+            };
+
+            if (jobSystem != nullptr)
+                jobSystem->ParallelForRange(0, parallel.size(), 0, updateRange);
+            else
+                updateRange(0, parallel.size());
+
+            // Everything else on this thread, after the parallel part
+            UpdateContext_t context { this, &queuedCommands, 0 };
+            current = &context;
+
+            for (size_t j = 0; j < serial.size(); j++)
+            {
+                context.order = (uint32_t) (parallel.size() + j);
+                update(serial[j]);
             }
+
+            current = outer;
+
+            p_ApplyQueuedCommands();
         }
+
+        updating = false;
+    }
+
+    void EntityWorld::QueryAABB(const Float3& min, const Float3& max, std::vector<IEntity*>& results)
+    {
+        std::vector<uint32_t> keys;
+        spatialIndex.QueryAABB(min, max, keys);
+
+        for (uint32_t index : keys)
+            results.push_back(entities[slots[index].denseIndex].get());
+    }
+
+    void EntityWorld::QueryRadius(const Float3& centre, float radius, std::vector<IEntity*>& results)
+    {
+        std::vector<uint32_t> keys;
+        spatialIndex.QueryRadius(centre, radius, keys);
+
+        for (uint32_t index : keys)
+            results.push_back(entities[slots[index].denseIndex].get());
+    }
+
+    IEntity* EntityWorld::QueryRay(const Float3& origin, const Float3& dir, float maxDistance, float* distance_out,
+            IEntity* ignore)
+    {
+        const uint32_t ignoreKey = (ignore != nullptr && GetEntityByID(ignore->GetID()) == ignore)
+                ? (uint32_t) GetEntityIndex(ignore->GetID()) : kFreeSlot;
+
+        uint32_t index;
+        float distance;
+
+        if (!spatialIndex.QueryRay(origin, dir, maxDistance, ignoreKey, index, distance))
+            return nullptr;
+
+        if (distance_out != nullptr)
+            *distance_out = distance;
+
+        return entities[slots[index].denseIndex].get();
+    }
+
+    void EntityWorld::QueueAddEntity(shared_ptr<IEntity> ent)
+    {
+        p_Queue([this, ent]() { AddEntity(ent); });
+    }
+
+    void EntityWorld::QueueCommand(std::function<void()> command)
+    {
+        p_Queue(move(command));
+    }
+
+    void EntityWorld::QueueRemoveEntity(IEntity* ent)
+    {
+        const int entID = ent->GetID();
+
+        if (GetEntityByID(entID) != ent)
+            return;
+
+        // Keep a reference, in case an earlier command removes the entity too
+        shared_ptr<IEntity> ref = entities[slots[entID & kEntityIndexMask].denseIndex];
+
+        p_Queue([this, ref]() { RemoveEntity(ref.get()); });
+    }
+
+    void EntityWorld::RemoveAllEntities(bool destroy)
+    {
+        ZFW_ASSERT(!updating)
+
+        for (size_t i = 0; i < entities.getLength(); i++)
+        {
+            if (entityTransforms[i] != TransformStore::kInvalidHandle)
+                dynamic_cast<ITransformStoreUser*>(entities[i].get())->OnTransformDetach();
+        }
+
+        transforms.Clear();
+        transformSlots.clear();
+        spatialIndex.Clear();
+
+        entities.clear();
+        entitySlots.clear();
+        entityPoints.clear();
+        entityTransforms.clear();
+        entityUpdate.clear();
+
+        // The slots are kept (and the used ones retired like in RemoveEntity), so that IDs of the removed
+        // entities never resolve to new ones. Free slots are listed in reverse, to hand out index 0 first.
+        freeSlots.clear();
+
+        for (uint32_t index = (uint32_t) slots.size(); index-- > 0; )
+        {
+            EntitySlot_t& slot = slots[index];
+
+            if (slot.denseIndex != kFreeSlot)
+            {
+                slot.denseIndex = kFreeSlot;
+                slot.generation = (slot.generation + 1) & kEntityGenerationMask;
+            }
+
+            freeSlots.push_back(index);
+        }
+
+        phasesDirty = true;
+    }
+
+    void EntityWorld::RemoveEntity(IEntity* ent)
+    {
+        const UpdateContext_t* context = p_CurrentContext();
+
+        // Removing entities while the phase lists are being walked would be fatal
+        if (context != nullptr && context->world == this)
+        {
+            QueueRemoveEntity(ent);
+            return;
+        }
+
+        const int entID = ent->GetID();
+
+        if (GetEntityByID(entID) != ent)
+            return;
+
+        const uint32_t index = (uint32_t) entID & kEntityIndexMask;
+        const uint32_t denseIndex = slots[index].denseIndex;
+        const uint32_t last = (uint32_t) entities.getLength() - 1;
+
+        // Keep the entity alive until the filters have been notified
+        shared_ptr<IEntity> removed = move(entities[denseIndex]);
+
+        if (entityTransforms[denseIndex] != TransformStore::kInvalidHandle)
+        {
+            dynamic_cast<ITransformStoreUser*>(ent)->OnTransformDetach();
+            transforms.Free(entityTransforms[denseIndex]);
+        }
+
+        if (entityPoints[denseIndex] != nullptr)
+            spatialIndex.Remove(index);
+
+        // Fill the hole with the last entity
+        if (denseIndex != last)
+        {
+            entities[denseIndex] = move(entities[last]);
+            entitySlots[denseIndex] = entitySlots[last];
+            entityPoints[denseIndex] = entityPoints[last];
+            entityTransforms[denseIndex] = entityTransforms[last];
+            entityUpdate[denseIndex] = entityUpdate[last];
+            slots[entitySlots[denseIndex]].denseIndex = denseIndex;
+        }
+
+        entities.remove(last);
+        entitySlots.pop_back();
+        entityPoints.pop_back();
+        entityTransforms.pop_back();
+        entityUpdate.pop_back();
+        phasesDirty = true;
+
+        slots[index].denseIndex = kFreeSlot;
+        slots[index].generation = (slots[index].generation + 1) & kEntityGenerationMask;
+        freeSlots.push_back(index);
+
+        for (const auto& filter : entityFilters)
+            filter->OnRemoveEntity(this, ent);
     }
 
     void EntityWorld::RemoveEntityFilter(IEntityFilter* filter)
@@ -98,41 +709,242 @@ namespace zfw
         entityFilters.removeItem(filter);
     }
 
-    bool EntityWorld::Serialize(OutputStream* output, int flags)
+    bool EntityWorld::p_RestoreEntity(int32_t entID, uint32_t classIndex, const std::string& className, int& classID,
+            const uint8_t* data, uint32_t length, int flags, std::vector<IEntity*>& restored)
     {
-        output->writeLE<uint8_t>(0x10);
+        EntityBlobReader blob(data, length);
+        IEntity* ent = GetEntityByID(entID);
 
-        for (const auto& ent : entities)
+        // Compared by the snapshot class, i.e. the name the entity serializes under; GetName() can differ or be null
+        if (ent != nullptr && p_GetSnapshotClassOf(ent, flags) != classIndex)
         {
-            int r = ent->FullSerialize(this, output, flags);
-            
-            if (r == 0)
+            RemoveEntity(ent);
+            ent = nullptr;
+        }
+
+        if (ent != nullptr)
+        {
+            if (ent->Unserialize(this, &blob, flags) == 0)
+                return ErrorBuffer::SetError3(EX_SERIALIZATION_ERR, 2,
+                        "desc", sprintf_255("Failed to unserialize entity '%s'.", className.c_str()),
+                        "function", li_functionName
+                        ), false;
+
+            // Store users have just overwritten their own copy of the transform
+            const uint32_t transform = entityTransforms[slots[GetEntityIndex(entID)].denseIndex];
+
+            if (transform != TransformStore::kInvalidHandle)
+                dynamic_cast<ITransformStoreUser*>(ent)->OnTransformAttach(&transforms, transform);
+
+            UpdateEntityBounds(ent);
+        }
+        else
+        {
+            IEntityHandler* ieh = sys->GetEntityHandler(true);
+
+            if (classID == kUnresolvedClass)
+                classID = ieh->GetEntityClassID(className.c_str(), ENTITY_REQUIRED);
+
+            if (classID < 0)
+                return false;
+
+            shared_ptr<IEntity> created = ieh->InstantiateEntityByID(classID, ENTITY_REQUIRED);
+
+            if (created == nullptr)
+                return false;
+
+            if (created->Unserialize(this, &blob, flags) == 0)
+                return ErrorBuffer::SetError3(EX_SERIALIZATION_ERR, 2,
+                        "desc", sprintf_255("Failed to unserialize entity '%s'.", className.c_str()),
+                        "function", li_functionName
+                        ), false;
+
+            ent = created.get();
+
+            if (!p_AddUnserializedEntity(move(created), entID, className.c_str()))
+                return false;
+
+            // The class is known, so a restore right after doesn't need to find it out again
+            const uint32_t index = GetEntityIndex(ent->GetID());
+
+            if (snapshotClassNames != nullptr && classIndex < snapshotClassNames->size())
             {
-                // FIXME: better reporting when possible
+                if (index >= snapshotSlotClasses.size())
+                    snapshotSlotClasses.resize(slots.size(), kFreeSlot);
+
+                snapshotSlotClasses[index] = classIndex;
+            }
+        }
+
+        restored.push_back(ent);
+        return true;
+    }
+
+    bool EntityWorld::RestoreSnapshot(const EntityWorldSnapshot& snapshot, int flags)
+    {
+        ZFW_ASSERT(!updating)
+
+        // Remove whatever the snapshot doesn't have, except entities it could not have captured
+        std::vector<IEntity*> removed;
+        size_t next = 0;
+
+        for (uint32_t index = 0; index < slots.size(); index++)
+        {
+            if (slots[index].denseIndex == kFreeSlot)
+                continue;
+
+            IEntity* ent = entities[slots[index].denseIndex].get();
+
+            while (next < snapshot.entities.size() && (uint32_t) GetEntityIndex(snapshot.entities[next].entID) < index)
+                next++;
+
+            if (next < snapshot.entities.size() && snapshot.entities[next].entID == ent->GetID())
+                continue;
+
+            snapshotScratch.clear();
+            EntityBlobWriter blobWriter(snapshotScratch);
+
+            if (ent->FullSerialize(this, &blobWriter, flags) >= 0)
+                removed.push_back(ent);
+        }
+
+        for (IEntity* ent : removed)
+            RemoveEntity(ent);
+
+        std::vector<IEntity*> restored;
+        std::vector<int> classIDs(snapshot.classNames != nullptr ? snapshot.classNames->size() : 0, kUnresolvedClass);
+
+        for (const auto& entity : snapshot.entities)
+        {
+            if (!p_RestoreEntity(entity.entID, entity.classIndex, (*snapshot.classNames)[entity.classIndex],
+                    classIDs[entity.classIndex], snapshot.data.data() + entity.offset, entity.length, flags, restored))
+                return false;
+        }
+
+        return p_LinkEntities(restored, flags);
+    }
+
+    bool EntityWorld::p_AddUnserializedEntity(shared_ptr<IEntity>&& ent, int32_t entID, const char* className)
+    {
+        ent->Init();
+
+        // Keep the saved ID, so that links resolve; maps saved before IDs were unique can contain duplicates
+        if (entID < 0 || GetEntityByIndex(GetEntityIndex(entID)) != nullptr)
+            sys->Printf(kLogWarning, "World: entity '%s' has a duplicate ID %i, assigning a new one",
+                    className, entID);
+
+        return p_AddEntity(move(ent), entID);
+    }
+
+    bool EntityWorld::p_UnserializeEntities(InputStream* input, int flags)
+    {
+        // Class table; indices are u16 and every name takes at least its terminator,
+        // so a count beyond either bound can only come from corrupted data
+        uint32_t numClasses;
+
+        if (!input->readLE<uint32_t>(&numClasses) || numClasses > UINT16_MAX + 1
+                || (input->finite() && numClasses > input->getSize() - input->getPos()))
+            return ErrorBuffer::SetError3(EX_SERIALIZATION_ERR, 2,
+                    "desc", "Unexpected end of world data.",
+                    "function", li_functionName
+                    ), false;
+
+        IEntityHandler* ieh = sys->GetEntityHandler(true);
+        std::vector<li::String> classNames;
+        std::vector<int> classIDs;
+
+        for (uint32_t i = 0; i < numClasses; i++)
+        {
+            classNames.push_back(input->readString());
+
+            // readString can't report EOF; an empty name is never written, though
+            if (classNames.back().isEmpty())
                 return ErrorBuffer::SetError3(EX_SERIALIZATION_ERR, 2,
-                    "desc", sprintf_255("Failed to serialize entity #%i ('%s')", ent->GetID(), ent->GetName()),
+                        "desc", sprintf_255("Corrupted world data at class #%u.", i),
+                        "function", li_functionName
+                        ), false;
+
+            classIDs.push_back(ieh->GetEntityClassID(classNames.back(), 0));
+        }
+
+        // Everything else in one read
+        uint32_t numEntities;
+        uint64_t recordsLength;
+
+        if (!input->readLE<uint32_t>(&numEntities) || !input->readLE<uint64_t>(&recordsLength)
+                || recordsLength > SIZE_MAX
+                || (input->finite() && recordsLength > input->getSize() - input->getPos()))
+            return ErrorBuffer::SetError3(EX_SERIALIZATION_ERR, 2,
+                    "desc", "Unexpected end of world data.",
                     "function", li_functionName
                     ), false;
-            }
-            else if (r > 0)
+
+        // The length of a stream of unknown size can't be checked up front; grow the buffer as the data arrives
+        // instead, so that a corrupted length fails at the end of the stream rather than in the allocation
+        static const size_t kRecordsChunk = 1024 * 1024;
+
+        std::vector<uint8_t> records;
+
+        while (records.size() < recordsLength)
+        {
+            const size_t offset = records.size();
+            const size_t count = input->finite() ? (size_t) recordsLength
+                    : (size_t) std::min<uint64_t>(kRecordsChunk, recordsLength - offset);
+
+            records.resize(offset + count);
+
+            if (input->read(&records[offset], count) != count)
+                return ErrorBuffer::SetError3(EX_SERIALIZATION_ERR, 2,
+                        "desc", "Unexpected end of world data.",
+                        "function", li_functionName
+                        ), false;
+        }
+
+        size_t pos = 0;
+
+        for (uint32_t i = 0; i < numEntities; i++)
+        {
+            uint16_t classIndex;
+            int32_t entID;
+            uint32_t length;
+
+            if (!ReadLE(records, pos, classIndex) || !ReadLE(records, pos, entID) || !ReadLE(records, pos, length)
+                    || classIndex >= classNames.size() || length > records.size() - pos)
+                return ErrorBuffer::SetError3(EX_SERIALIZATION_ERR, 2,
+                        "desc", sprintf_255("Corrupted world data at entity #%u.", i),
+                        "function", li_functionName
+                        ), false;
+
+            const char* className = classNames[classIndex].c_str();
+            EntityBlobReader blob(records.data() + pos, length);
+            pos += length;
+
+            // Every record is length-prefixed, so a class that is gone only loses its own entities
+            if (classIDs[classIndex] < 0)
             {
-                output->writeLE<uint8_t>(0xDD);
+                sys->Printf(kLogWarning, "World: skipping entity %i of undefined class '%s'", entID, className);
+                continue;
             }
+
+            shared_ptr<IEntity> ent = ieh->InstantiateEntityByID(classIDs[classIndex], ENTITY_REQUIRED);
+
+            if (ent == nullptr)
+                return false;
+
+            if (ent->Unserialize(this, &blob, flags) == 0)
+                return ErrorBuffer::SetError3(EX_SERIALIZATION_ERR, 2,
+                        "desc", sprintf_255("Failed to unserialize entity '%s'.", className),
+                        "function", li_functionName
+                        ), false;
+
+            p_AddUnserializedEntity(move(ent), entID, className);
         }
-        
-        output->writeLE<uint8_t>(0);
+
         return true;
     }
 
-    bool EntityWorld::Unserialize(InputStream* input, int flags)
+    bool EntityWorld::p_UnserializeEntitiesLegacy(InputStream* input, int flags)
     {
-        ZFW_ASSERT(entities.getLength() == 0)
-        
-        uint8_t v = 0;
-        input->readLE<uint8_t>(&v);
-
-        ZFW_ASSERT(v == 0x10)
-
         IEntityHandler* ieh = sys->GetEntityHandler(true);
 
         for (;;)
@@ -145,7 +957,12 @@ namespace zfw
             int32_t entID;
             input->readLE<int32_t>(&entID);
             
-            shared_ptr<IEntity> ent(ieh->InstantiateEntity(entName, ENTITY_REQUIRED));
+            const int classID = ieh->GetEntityClassID(entName, ENTITY_REQUIRED);
+
+            if (classID < 0)
+                return false;
+
+            shared_ptr<IEntity> ent = ieh->InstantiateEntityByID(classID, ENTITY_REQUIRED);
 
             if (ent == nullptr)
                 return false;
@@ -162,11 +979,187 @@ namespace zfw
             
             uint8_t marker;
             zombie_assert(input->readByte(&marker) && marker == 0xDD);
+
+            p_AddUnserializedEntity(move(ent), entID, entName.c_str());
+        }
+
+        return true;
+    }
+
+    bool EntityWorld::Serialize(OutputStream* output, int flags)
+    {
+        std::vector<uint8_t> records, blob;
+        std::vector<std::string> classNames;
+        std::unordered_map<std::string, uint16_t> classIndices;
+        uint32_t numEntities = 0;
+
+        for (const auto& ent : entities)
+        {
+            // Entities write their class name and ID first (see SERIALIZE_BEGIN); these go into the class table
+            // and the record header instead
+            blob.clear();
+            EntityBlobWriter blobWriter(blob);
+
+            int r = ent->FullSerialize(this, &blobWriter, flags);
             
-            ent->Init();
-            AddEntity(ent);
-            ent->SetID(entID);
+            if (r == 0)
+            {
+                // FIXME: better reporting when possible
+                return ErrorBuffer::SetError3(EX_SERIALIZATION_ERR, 2,
+                    "desc", sprintf_255("Failed to serialize entity #%i ('%s')", ent->GetID(), ent->GetName()),
+                    "function", li_functionName
+                    ), false;
+            }
+            else if (r < 0)
+                continue;
+
+            EntityBlobReader header(blob.data(), blob.size());
+            li::String className = header.readString();
+            int32_t entID;
+
+            if (!header.readLE<int32_t>(&entID))
+                return ErrorBuffer::SetError3(EX_SERIALIZATION_ERR, 2,
+                    "desc", sprintf_255("Entity #%i ('%s') wrote no header", ent->GetID(), ent->GetName()),
+                    "function", li_functionName
+                    ), false;
+
+            auto it = classIndices.find(className.c_str());
+
+            if (it == classIndices.end())
+            {
+                if (classNames.size() > UINT16_MAX)
+                    return ErrorBuffer::SetError3(EX_SERIALIZATION_ERR, 2,
+                        "desc", "Too many entity classes in one world.",
+                        "function", li_functionName
+                        ), false;
+
+                it = classIndices.emplace(className.c_str(), (uint16_t) classNames.size()).first;
+                classNames.push_back(className.c_str());
+            }
+
+            const size_t payload = (size_t) header.getPos();
+
+            AppendLE<uint16_t>(records, it->second);
+            AppendLE<int32_t>(records, entID);
+            AppendLE<uint32_t>(records, (uint32_t) (blob.size() - payload));
+            records.insert(records.end(), blob.begin() + payload, blob.end());
+            numEntities++;
         }
+
+        output->writeLE<uint8_t>(kSerializationFormat);
+        output->writeLE<uint32_t>((uint32_t) classNames.size());
+
+        for (const auto& className : classNames)
+            output->writeString(className.c_str());
+
+        output->writeLE<uint32_t>(numEntities);
+        output->writeLE<uint64_t>(records.size());
+
+        if (!records.empty() && output->write(&records[0], records.size()) != records.size())
+            return ErrorBuffer::SetError3(EX_WRITE_ERR, 2,
+                "desc", "Failed to write world data.",
+                "function", li_functionName
+                ), false;
+
+        return true;
+    }
+
+    bool EntityWorld::TakeSnapshot(EntityWorldSnapshot& snapshot_out, int flags)
+    {
+        ZFW_ASSERT(!updating)
+
+        if (snapshotClassNames == nullptr)
+            snapshotClassNames = std::make_shared<std::vector<std::string>>();
+
+        snapshot_out.entities.clear();
+        snapshot_out.data.clear();
+
+        auto& data = snapshot_out.data;
+        EntityBlobWriter blobWriter(data);
+
+        // In slot order, so that diffs can merge snapshots in one pass
+        for (uint32_t index = 0; index < slots.size(); index++)
+        {
+            if (slots[index].denseIndex == kFreeSlot)
+                continue;
+
+            IEntity* ent = entities[slots[index].denseIndex].get();
+            const size_t offset = data.size();
+
+            int r = ent->FullSerialize(this, &blobWriter, flags);
+
+            if (r == 0)
+                return ErrorBuffer::SetError3(EX_SERIALIZATION_ERR, 2,
+                    "desc", sprintf_255("Failed to serialize entity #%i ('%s')", ent->GetID(), ent->GetName()),
+                    "function", li_functionName
+                    ), false;
+            else if (r < 0)
+            {
+                data.resize(offset);
+                continue;
+            }
+
+            // Like in Serialize, the class name goes into the class table; the header is left in place, unused.
+            // Parsing the name is the slow part, so first check for the class last seen in this slot.
+            const uint8_t* blob = data.data() + offset;
+            const size_t length = data.size() - offset;
+            uint32_t classIndex = (index < snapshotSlotClasses.size()) ? snapshotSlotClasses[index] : kFreeSlot;
+            size_t headerLength;
+
+            if (classIndex != kFreeSlot && length >= snapshotClassHeaders[classIndex].size() + sizeof(int32_t)
+                    && memcmp(blob, snapshotClassHeaders[classIndex].data(), snapshotClassHeaders[classIndex].size()) == 0)
+                headerLength = snapshotClassHeaders[classIndex].size() + sizeof(int32_t);
+            else
+            {
+                EntityBlobReader header(blob, length);
+                li::String className = header.readString();
+                int32_t entID;
+
+                if (!header.readLE<int32_t>(&entID))
+                    return ErrorBuffer::SetError3(EX_SERIALIZATION_ERR, 2,
+                        "desc", sprintf_255("Entity #%i ('%s') wrote no header", ent->GetID(), ent->GetName()),
+                        "function", li_functionName
+                        ), false;
+
+                headerLength = (size_t) header.getPos();
+                classIndex = p_GetSnapshotClass(className.c_str(), blob, headerLength - sizeof(int32_t));
+
+                if (index >= snapshotSlotClasses.size())
+                    snapshotSlotClasses.resize(slots.size(), kFreeSlot);
+
+                snapshotSlotClasses[index] = classIndex;
+            }
+
+            snapshot_out.entities.push_back(EntityWorldSnapshot::Entity_t { ent->GetID(), classIndex,
+                    (uint32_t) (offset + headerLength), (uint32_t) (length - headerLength) });
+        }
+
+        snapshot_out.classNames = snapshotClassNames;
+        return true;
+    }
+
+    bool EntityWorld::Unserialize(InputStream* input, int flags)
+    {
+        ZFW_ASSERT(entities.getLength() == 0)
+        
+        uint8_t v = 0;
+        input->readLE<uint8_t>(&v);
+
+        if (v == kSerializationFormat)
+        {
+            if (!p_UnserializeEntities(input, flags))
+                return false;
+        }
+        else if (v == kSerializationFormatLegacy)
+        {
+            if (!p_UnserializeEntitiesLegacy(input, flags))
+                return false;
+        }
+        else
+            return ErrorBuffer::SetError3(EX_ASSET_FORMAT_UNSUPPORTED, 2,
+                    "desc", sprintf_255("Unsupported world format 0x%02X.", v),
+                    "function", li_functionName
+                    ), false;
         
         // Link the entities now
         for (const auto& ent : entities)
@@ -183,6 +1176,25 @@ namespace zfw
         return true;
     }
 
+    void EntityWorld::UpdateEntityBounds(IEntity* ent)
+    {
+        const int entID = ent->GetID();
+
+        // Also called for entities which are yet to be added
+        if (GetEntityByID(entID) != ent)
+            return;
+
+        const uint32_t index = (uint32_t) entID & kEntityIndexMask;
+        const uint32_t denseIndex = slots[index].denseIndex;
+
+        if (entityPoints[denseIndex] == nullptr)
+            return;
+
+        Float3 min, max;
+        p_GetBounds(denseIndex, min, max);
+        spatialIndex.Update(index, min, max);
+    }
+
     void EntityWorld::WalkEntities(IEntityVisitor* visitor)
     {
         for (auto ent : entities)
@@ -0,0 +1,298 @@
+#include <framework/errorbuffer.hpp>
+#include <framework/filesystem.hpp>
+
+#include "private.hpp"
+
+#include <cstring>
+#include <string>
+
+#ifdef ZOMBIE_WINNT
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+    FileSystemMapped behaves like FileSystemStd, except that files opened for reading only
+    are mapped into memory instead of going through stdio. The returned streams implement
+    IMappedInputStream, so their contents can be consumed in place (straight from the page cache).
+
+    Everything else (writes, directories, stat) is forwarded to a FileSystemStd.
+*/
+
+namespace zfw
+{
+    using namespace li;
+
+    // Returned for views into empty files
+    static const uint8_t s_emptyView[1] = {0};
+
+    // ====================================================================== //
+    //  class declarations
+    // ====================================================================== //
+
+    class FileMapping : public IFileMapping
+    {
+        public:
+            FileMapping(const uint8_t* data, uint64_t size) : data(data), size(size) {}
+            virtual ~FileMapping();
+
+            virtual const uint8_t* GetData() override { return (size != 0) ? data : s_emptyView; }
+            virtual uint64_t GetSize() override { return size; }
+
+        private:
+            const uint8_t* data;
+            uint64_t size;
+    };
+
+    class MappedInputStream : public IMappedInputStream
+    {
+        public:
+            MappedInputStream(shared_ptr<IFileMapping>&& mapping, uint64_t offset, uint64_t size)
+                    : mapping(move(mapping)), size(size), pos(0)
+            {
+                data = this->mapping->GetData() + offset;
+            }
+
+            virtual bool finite() override { return true; }
+            virtual bool seekable() override { return true; }
+
+            virtual bool eof() override { return pos >= size; }
+
+            virtual uint64_t getPos() override { return pos; }
+            virtual uint64_t getSize() override { return size; }
+            virtual bool setPos(uint64_t pos) override;
+
+            virtual size_t read(void* out, size_t length) override;
+
+            virtual const uint8_t* GetView(uint64_t offset, size_t length) override;
+
+        private:
+            shared_ptr<IFileMapping> mapping;
+            const uint8_t* data;
+            uint64_t size, pos;
+    };
+
+    class FileSystemMapped : public IFileSystem
+    {
+        public:
+            FileSystemMapped(ErrorBuffer_t* eb, const char* basePath, int access);
+
+            virtual IDirectory* OpenDirectory(const char* normalizedPath, int flags) override;
+            virtual bool OpenFileStream(const char* normalizedPath, int flags,
+                    InputStream** is_out,
+                    OutputStream** os_out,
+                    IOStream** io_out) override;
+            virtual bool Stat(const char* normalizedPath, FSStat_t* stat_out) override;
+
+            virtual int CompareTimestamps(const char* leftPath, const char* rightPath, int64_t* diff_out, int flags) override;
+            virtual const char* GetNativeAbsoluteFilename(const char* normalizedPath) override;
+
+            virtual IAsyncRead* ReadAsync(const char* normalizedPath, uint64_t offset, size_t length, void* buffer,
+                    AsyncReadCallback_t callback, void* userData) override;
+
+        protected:
+            std::string basePath;
+            int access;
+
+            shared_ptr<IFileSystem> stdFs;
+    };
+
+    // ====================================================================== //
+    //  class FileMapping
+    // ====================================================================== //
+
+    shared_ptr<IFileMapping> p_MapFile(const char* path)
+    {
+#ifdef ZOMBIE_WINNT
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        if (file == INVALID_HANDLE_VALUE)
+            return nullptr;
+
+        LARGE_INTEGER size;
+
+        if (!GetFileSizeEx(file, &size) || (uint64_t) size.QuadPart > SIZE_MAX)
+        {
+            CloseHandle(file);
+            return nullptr;
+        }
+
+        if (size.QuadPart == 0)
+        {
+            CloseHandle(file);
+            return std::make_shared<FileMapping>(nullptr, 0);
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+
+        if (mapping == nullptr)
+            return nullptr;
+
+        // The view keeps the mapping object alive
+        const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+
+        if (data == nullptr)
+            return nullptr;
+
+        return std::make_shared<FileMapping>(static_cast<const uint8_t*>(data), (uint64_t) size.QuadPart);
+#else
+        const int fd = open(path, O_RDONLY);
+
+        if (fd < 0)
+            return nullptr;
+
+        struct stat st;
+
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t) st.st_size > SIZE_MAX)
+        {
+            close(fd);
+            return nullptr;
+        }
+
+        if (st.st_size == 0)
+        {
+            close(fd);
+            return std::make_shared<FileMapping>(nullptr, 0);
+        }
+
+        // The mapping stays valid after the descriptor is closed
+        void* data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (data == MAP_FAILED)
+            return nullptr;
+
+        return std::make_shared<FileMapping>(static_cast<const uint8_t*>(data), (uint64_t) st.st_size);
+#endif
+    }
+
+    FileMapping::~FileMapping()
+    {
+        if (size == 0)
+            return;
+
+#ifdef ZOMBIE_WINNT
+        UnmapViewOfFile(data);
+#else
+        munmap(const_cast<uint8_t*>(data), (size_t) size);
+#endif
+    }
+
+    // ====================================================================== //
+    //  class MappedInputStream
+    // ====================================================================== //
+
+    IMappedInputStream* p_CreateMappedInputStream(shared_ptr<IFileMapping> mapping, uint64_t offset, uint64_t length)
+    {
+        zombie_assert(offset <= mapping->GetSize() && length <= mapping->GetSize() - offset);
+
+        return new MappedInputStream(move(mapping), offset, length);
+    }
+
+    const uint8_t* MappedInputStream::GetView(uint64_t offset, size_t length)
+    {
+        if (offset > size || length > size - offset)
+            return nullptr;
+
+        return data + offset;
+    }
+
+    size_t MappedInputStream::read(void* out, size_t length)
+    {
+        if (pos >= size)
+            return 0;
+
+        if (length > size - pos)
+            length = (size_t)(size - pos);
+
+        memcpy(out, data + pos, length);
+        pos += length;
+        return length;
+    }
+
+    bool MappedInputStream::setPos(uint64_t pos)
+    {
+        if (pos > size)
+            return false;
+
+        this->pos = pos;
+        return true;
+    }
+
+    // ====================================================================== //
+    //  class FileSystemMapped
+    // ====================================================================== //
+
+    shared_ptr<IFileSystem> p_CreateMappedFileSystem(ErrorBuffer_t* eb, const char* absolutePathPrefix, int access)
+    {
+        // Require Stat access at the very least (other methods assume it)
+        ZFW_ASSERT(access & kFSAccessStat)
+
+        return std::make_shared<FileSystemMapped>(eb, absolutePathPrefix, access);
+    }
+
+    FileSystemMapped::FileSystemMapped(ErrorBuffer_t* eb, const char* basePath, int access)
+            : basePath(basePath), access(access)
+    {
+        stdFs = p_CreateStdFileSystem(eb, basePath, access);
+    }
+
+    int FileSystemMapped::CompareTimestamps(const char* leftPath, const char* rightPath, int64_t* diff_out, int flags)
+    {
+        return stdFs->CompareTimestamps(leftPath, rightPath, diff_out, flags);
+    }
+
+    const char* FileSystemMapped::GetNativeAbsoluteFilename(const char* normalizedPath)
+    {
+        return stdFs->GetNativeAbsoluteFilename(normalizedPath);
+    }
+
+    IAsyncRead* FileSystemMapped::ReadAsync(const char* normalizedPath, uint64_t offset, size_t length, void* buffer,
+            AsyncReadCallback_t callback, void* userData)
+    {
+        // Copying out of a mapping would just trade the read for page faults on an I/O thread
+        return stdFs->ReadAsync(normalizedPath, offset, length, buffer, callback, userData);
+    }
+
+    IDirectory* FileSystemMapped::OpenDirectory(const char* normalizedPath, int flags)
+    {
+        return stdFs->OpenDirectory(normalizedPath, flags);
+    }
+
+    bool FileSystemMapped::OpenFileStream(const char* normalizedPath, int flags,
+            InputStream** is_out,
+            OutputStream** os_out,
+            IOStream** io_out)
+    {
+        // Only plain reads are mapped; creation, truncation and writes are left to stdio
+        if (is_out == nullptr || (access & kFSAccessRead) == 0 || (flags & kFileTruncate))
+            return stdFs->OpenFileStream(normalizedPath, flags, is_out, os_out, io_out);
+
+        zombie_assert(os_out == nullptr && io_out == nullptr);
+
+        const std::string fullPath = basePath + normalizedPath;
+        auto mapping = p_MapFile(fullPath.c_str());
+
+        if (mapping == nullptr)
+        {
+            // Missing file (maybe to be created), a directory or a failed mapping
+            return stdFs->OpenFileStream(normalizedPath, flags, is_out, os_out, io_out);
+        }
+
+        const uint64_t size = mapping->GetSize();
+        *is_out = p_CreateMappedInputStream(move(mapping), 0, size);
+        return true;
+    }
+
+    bool FileSystemMapped::Stat(const char* normalizedPath, FSStat_t* stat_out)
+    {
+        return stdFs->Stat(normalizedPath, stat_out);
+    }
+}
@@ -0,0 +1,338 @@
+#include <framework/errorbuffer.hpp>
+#include <framework/filesystem.hpp>
+#include <framework/packfile.hpp>
+
+#include "private.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+    FileSystemPack serves files out of a single pack (see packfile.hpp) created by tools/packer.
+
+    The whole pack is mapped into memory once and its index is validated up front; after that,
+    opening a file is a hash lookup and the returned stream is a view into the shared mapping
+    (no syscalls, no copies). The file system is read-only and immutable, so all methods are
+    trivially safe to call concurrently.
+*/
+
+namespace zfw
+{
+    using namespace li;
+
+    class FileSystemPack;
+
+    // ====================================================================== //
+    //  class declarations
+    // ====================================================================== //
+
+    class DirectoryPack : public IDirectory
+    {
+        public:
+            DirectoryPack(std::vector<std::string>&& names) : names(move(names)), index(0) {}
+
+            virtual const char* ReadDir() override;
+
+        protected:
+            std::vector<std::string> names;
+            size_t index;
+    };
+
+    class FileSystemPack : public IFileSystem
+    {
+        public:
+            FileSystemPack(shared_ptr<IFileMapping>&& mapping, int access);
+
+            virtual IDirectory* OpenDirectory(const char* normalizedPath, int flags) override;
+            virtual bool OpenFileStream(const char* normalizedPath, int flags,
+                    InputStream** is_out,
+                    OutputStream** os_out,
+                    IOStream** io_out) override;
+            virtual bool Stat(const char* normalizedPath, FSStat_t* stat_out) override;
+
+            virtual int CompareTimestamps(const char* leftPath, const char* rightPath, int64_t* diff_out, int flags) override;
+            virtual const char* GetNativeAbsoluteFilename(const char* normalizedPath) override;
+
+            static bool ValidateIndex(ErrorBuffer_t* eb, const char* path, IFileMapping* mapping);
+
+        protected:
+            const PackEntry_t* p_Find(const char* normalizedPath);
+            size_t p_LowerBound(const char* prefix, size_t prefixLength);
+
+            const char* p_GetName(const PackEntry_t& entry) { return strings + entry.nameOffset; }
+
+            shared_ptr<IFileMapping> mapping;
+            int access;
+
+            const PackHeader_t* header;
+            const uint32_t* buckets;
+            const PackEntry_t* entries;
+            const char* strings;
+    };
+
+    // ====================================================================== //
+    //  class DirectoryPack
+    // ====================================================================== //
+
+    const char* DirectoryPack::ReadDir()
+    {
+        if (index < names.size())
+            return names[index++].c_str();
+
+        return nullptr;
+    }
+
+    // ====================================================================== //
+    //  class FileSystemPack
+    // ====================================================================== //
+
+    shared_ptr<IFileSystem> p_CreatePackFileSystem(ErrorBuffer_t* eb, const char* path, int access)
+    {
+        // Require Stat access at the very least (other methods assume it)
+        ZFW_ASSERT(access & kFSAccessStat)
+
+        auto mapping = p_MapFile(path);
+
+        if (mapping == nullptr)
+            return ErrorBuffer::SetError2(eb, EX_ASSET_OPEN_ERR, 1,
+                    "desc", (const char*) sprintf_t<255>("Failed to open pack file '%s'.", path)
+                    ), nullptr;
+
+        if (!FileSystemPack::ValidateIndex(eb, path, mapping.get()))
+            return nullptr;
+
+        return std::make_shared<FileSystemPack>(move(mapping), access);
+    }
+
+    FileSystemPack::FileSystemPack(shared_ptr<IFileMapping>&& mapping, int access)
+            : mapping(move(mapping)), access(access)
+    {
+        const uint8_t* data = this->mapping->GetData();
+
+        header = reinterpret_cast<const PackHeader_t*>(data);
+        buckets = reinterpret_cast<const uint32_t*>(data + header->bucketsOffset);
+        entries = reinterpret_cast<const PackEntry_t*>(data + header->entriesOffset);
+        strings = reinterpret_cast<const char*>(data + header->stringsOffset);
+    }
+
+    int FileSystemPack::CompareTimestamps(const char* leftPath, const char* rightPath, int64_t* diff_out, int flags)
+    {
+        // Everything in the pack shares the same timestamp
+        const bool haveLeft = p_Find(leftPath) != nullptr;
+        const bool haveRight = p_Find(rightPath) != nullptr;
+
+        if (!haveLeft || !haveRight)
+            return (haveLeft ? 0 : FS_LEFT_NOT_FOUND) | (haveRight ? 0 : FS_RIGHT_NOT_FOUND);
+
+        *diff_out = 0;
+        return 0;
+    }
+
+    const char* FileSystemPack::GetNativeAbsoluteFilename(const char* normalizedPath)
+    {
+        return ErrorBuffer::SetError3(EX_NOT_FOUND, 0), nullptr;
+    }
+
+    size_t FileSystemPack::p_LowerBound(const char* prefix, size_t prefixLength)
+    {
+        // Entries are sorted by path (bytewise), so everything under a directory is contiguous
+        size_t first = 0, count = header->numEntries;
+
+        while (count > 0)
+        {
+            const size_t step = count / 2;
+            const PackEntry_t& entry = entries[first + step];
+
+            const int cmp = memcmp(p_GetName(entry), prefix, std::min<size_t>(entry.nameLength, prefixLength));
+
+            if (cmp < 0 || (cmp == 0 && entry.nameLength < prefixLength))
+            {
+                first += step + 1;
+                count -= step + 1;
+            }
+            else
+                count = step;
+        }
+
+        return first;
+    }
+
+    const PackEntry_t* FileSystemPack::p_Find(const char* normalizedPath)
+    {
+        const size_t length = strlen(normalizedPath);
+        const uint32_t hash = HashPackPath(normalizedPath, length);
+        const uint32_t mask = header->numBuckets - 1;
+
+        for (uint32_t i = hash & mask; ; i = (i + 1) & mask)
+        {
+            const uint32_t index = buckets[i];
+
+            if (index == kPackEmptyBucket)
+                return nullptr;
+
+            const PackEntry_t& entry = entries[index];
+
+            if (entry.pathHash == hash && entry.nameLength == length
+                    && memcmp(p_GetName(entry), normalizedPath, length) == 0)
+                return &entry;
+        }
+    }
+
+    IDirectory* FileSystemPack::OpenDirectory(const char* normalizedPath, int flags)
+    {
+        std::string prefix = normalizedPath;
+
+        if (!prefix.empty() && prefix.back() != '/')
+            prefix += '/';
+
+        std::vector<std::string> names;
+
+        for (size_t i = p_LowerBound(prefix.c_str(), prefix.length()); i < header->numEntries; i++)
+        {
+            const PackEntry_t& entry = entries[i];
+            const char* name = p_GetName(entry);
+
+            if (entry.nameLength < prefix.length() || memcmp(name, prefix.c_str(), prefix.length()) != 0)
+                break;
+
+            // Immediate children only; subdirectories show up once, since their contents are contiguous
+            const char* child = name + prefix.length();
+            const size_t childLength = entry.nameLength - prefix.length();
+            const char* slash = (const char*) memchr(child, '/', childLength);
+            const size_t length = (slash != nullptr) ? slash - child : childLength;
+
+            if (names.empty() || names.back().compare(0, std::string::npos, child, length) != 0)
+                names.emplace_back(child, length);
+        }
+
+        if (names.empty())
+            return ErrorBuffer::SetError3(EX_NOT_FOUND, 0), nullptr;
+
+        return new DirectoryPack(move(names));
+    }
+
+    bool FileSystemPack::OpenFileStream(const char* normalizedPath, int flags,
+            InputStream** is_out,
+            OutputStream** os_out,
+            IOStream** io_out)
+    {
+        if (os_out != nullptr || io_out != nullptr || (flags & kFileTruncate) || (access & kFSAccessRead) == 0)
+            return ErrorBuffer::SetError3(EX_ACCESS_DENIED, 0), false;
+
+        zombie_assert(is_out != nullptr);
+
+        const PackEntry_t* entry = p_Find(normalizedPath);
+
+        if (entry == nullptr)
+            return ErrorBuffer::SetError3(EX_NOT_FOUND, 0), false;
+
+        *is_out = p_CreateMappedInputStream(mapping, entry->offset, entry->size);
+        return true;
+    }
+
+    bool FileSystemPack::Stat(const char* normalizedPath, FSStat_t* stat_out)
+    {
+        if (const PackEntry_t* entry = p_Find(normalizedPath))
+        {
+            stat_out->sizeInBytes = entry->size;
+            stat_out->isDirectory = false;
+        }
+        else
+        {
+            std::string prefix = normalizedPath;
+
+            if (!prefix.empty() && prefix.back() != '/')
+                prefix += '/';
+
+            const size_t i = p_LowerBound(prefix.c_str(), prefix.length());
+
+            if (i >= header->numEntries || entries[i].nameLength < prefix.length()
+                    || memcmp(p_GetName(entries[i]), prefix.c_str(), prefix.length()) != 0)
+                return ErrorBuffer::SetError3(EX_NOT_FOUND, 0), false;
+
+            stat_out->sizeInBytes = 0;
+            stat_out->isDirectory = true;
+        }
+
+        stat_out->creationTime = (time_t) header->timestamp;
+        stat_out->modificationTime = (time_t) header->timestamp;
+        return true;
+    }
+
+    bool FileSystemPack::ValidateIndex(ErrorBuffer_t* eb, const char* path, IFileMapping* mapping)
+    {
+        const uint64_t size = mapping->GetSize();
+        const uint8_t* data = mapping->GetData();
+
+        auto fail = [eb, path](const char* what)
+        {
+            return ErrorBuffer::SetError2(eb, EX_ASSET_CORRUPTED, 1,
+                    "desc", (const char*) sprintf_t<255>("Pack file '%s' is invalid: %s.", path, what)
+                    ), false;
+        };
+
+        auto inRange = [size](uint64_t offset, uint64_t length)
+        {
+            return offset <= size && length <= size - offset;
+        };
+
+        // The index is used in place, straight out of the mapping, so it is only readable in native byte order
+        const uint32_t one = 1;
+
+        if (*reinterpret_cast<const uint8_t*>(&one) != 1)
+            return fail("big-endian hosts are not supported");
+
+        if (size < sizeof(PackHeader_t))
+            return fail("truncated header");
+
+        auto header = reinterpret_cast<const PackHeader_t*>(data);
+
+        if (memcmp(header->magic, kPackMagic, sizeof(kPackMagic)) != 0)
+            return fail("bad magic");
+
+        if (header->version != kPackVersion)
+            return fail("unsupported version");
+
+        if (header->numBuckets == 0 || (header->numBuckets & (header->numBuckets - 1)) != 0
+                || header->numBuckets <= header->numEntries)
+            return fail("bad bucket count");
+
+        if (!inRange(header->bucketsOffset, (uint64_t) header->numBuckets * sizeof(uint32_t))
+                || !inRange(header->entriesOffset, (uint64_t) header->numEntries * sizeof(PackEntry_t))
+                || !inRange(header->stringsOffset, header->stringsSize)
+                || header->bucketsOffset % alignof(uint32_t) != 0
+                || header->entriesOffset % alignof(PackEntry_t) != 0)
+            return fail("index out of bounds");
+
+        auto buckets = reinterpret_cast<const uint32_t*>(data + header->bucketsOffset);
+        auto entries = reinterpret_cast<const PackEntry_t*>(data + header->entriesOffset);
+
+        uint32_t numEmptyBuckets = 0;
+
+        for (uint32_t i = 0; i < header->numBuckets; i++)
+        {
+            if (buckets[i] == kPackEmptyBucket)
+                numEmptyBuckets++;
+            else if (buckets[i] >= header->numEntries)
+                return fail("bad bucket");
+        }
+
+        // p_Find probes until it hits a free bucket (several buckets may point to the same entry,
+        // so the bucket count alone doesn't guarantee one)
+        if (numEmptyBuckets == 0)
+            return fail("no free bucket");
+
+        for (uint32_t i = 0; i < header->numEntries; i++)
+        {
+            const PackEntry_t& entry = entries[i];
+
+            if (!inRange(entry.offset, entry.size)
+                    || (uint64_t) entry.nameOffset + entry.nameLength > header->stringsSize)
+                return fail("entry out of bounds");
+        }
+
+        return true;
+    }
+}
@@ -7,12 +7,17 @@
 
 #include "private.hpp"
 
+#include <string>
+
 namespace zfw
 {
     using namespace li;
 
     class FileSystemStd;
 
+    // Backing storage for GetNativeAbsoluteFilename; valid until the next call on the same thread
+    static thread_local std::string tls_nativeFilename;
+
     // ====================================================================== //
     //  class declarations
     // ====================================================================== //
@@ -34,6 +39,7 @@ namespace zfw
             size_t index;
     };
 
+    // All methods may be called concurrently; no state is modified after construction
     class FileSystemStd : public IFileSystem
     {
         public:
@@ -49,12 +55,17 @@ namespace zfw
             virtual int CompareTimestamps(const char* leftPath, const char* rightPath, int64_t* diff_out, int flags) override;
             const char* GetNativeAbsoluteFilename(const char* normalizedPath) override;
 
+#ifdef ZOMBIE_WITH_IO_URING
+            virtual IAsyncRead* ReadAsync(const char* normalizedPath, uint64_t offset, size_t length, void* buffer,
+                    AsyncReadCallback_t callback, void* userData) override;
+#endif
+
         protected:
+            ErrorBuffer_t* p_GetErrorBuffer();
+
             ErrorBuffer_t* eb;
             String basePath;
             int access;
-
-            String tempString;
     };
 
     // ====================================================================== //
@@ -143,14 +154,22 @@ namespace zfw
 
         if (File::statFileOrDirectory(fullPath, &stat))
         {
-            tempString = fullPath;
-            return tempString.c_str();
+            tls_nativeFilename = fullPath.c_str();
+            return tls_nativeFilename.c_str();
         }
         else
-            return ErrorBuffer::SetError(eb, EX_NOT_FOUND, nullptr),
+            return ErrorBuffer::SetError(p_GetErrorBuffer(), EX_NOT_FOUND, nullptr),
                     nullptr;
     }
 
+    ErrorBuffer_t* FileSystemStd::p_GetErrorBuffer()
+    {
+        // Job workers have private error buffers
+        ErrorBuffer_t* workerEb = p_GetJobWorkerErrorBuffer();
+
+        return (workerEb != nullptr) ? workerEb : eb;
+    }
+
     IDirectory* FileSystemStd::OpenDirectory(const char* normalizedPath, int flags)
     {
         if ((kFSAccessCreateFile & ~access) == 0)
@@ -174,7 +193,7 @@ namespace zfw
                 return new DirectoryStd(eb, this, dir);
         }
 
-        return ErrorBuffer::SetError2(eb, EX_NOT_FOUND, 0), nullptr;
+        return ErrorBuffer::SetError2(p_GetErrorBuffer(), EX_NOT_FOUND, 0), nullptr;
     }
 
     bool FileSystemStd::OpenFileStream(const char* normalizedPath, int flags,
@@ -193,7 +212,7 @@ namespace zfw
 
         // Test permissions
         if ((reqAccess & ~access) != 0)
-            return ErrorBuffer::SetError2(eb, EX_ACCESS_DENIED, 0), false;
+            return ErrorBuffer::SetError2(p_GetErrorBuffer(), EX_ACCESS_DENIED, 0), false;
 
         if (((reqAccess | kFSAccessCreateFile) & ~access) != 0)
             flags &= ~kFileMayCreate;
@@ -262,7 +281,7 @@ namespace zfw
         }
 
         if (file == nullptr)
-            return ErrorBuffer::SetError2(eb, EX_NOT_FOUND, 0), false;
+            return ErrorBuffer::SetError2(p_GetErrorBuffer(), EX_NOT_FOUND, 0), false;
 
         if (is_out != nullptr)
         {
@@ -287,6 +306,19 @@ namespace zfw
         return true;
     }
 
+#ifdef ZOMBIE_WITH_IO_URING
+    IAsyncRead* FileSystemStd::ReadAsync(const char* normalizedPath, uint64_t offset, size_t length, void* buffer,
+            AsyncReadCallback_t callback, void* userData)
+    {
+        if ((kFSAccessRead & ~access) != 0)
+            return ErrorBuffer::SetError2(p_GetErrorBuffer(), EX_ACCESS_DENIED, 0), nullptr;
+
+        String fullPath = basePath + normalizedPath;
+
+        return p_ReadNativeAsync(fullPath, offset, length, buffer, callback, userData);
+    }
+#endif
+
     bool FileSystemStd::Stat(const char* normalizedPath, FSStat_t* stat_out)
     {
         String fullPath = basePath + normalizedPath;
@@ -294,7 +326,7 @@ namespace zfw
         FileStat stat;
         
         if (!File::statFileOrDirectory(fullPath, &stat))
-            return ErrorBuffer::SetError(eb, EX_NOT_FOUND, nullptr), false;
+            return ErrorBuffer::SetError(p_GetErrorBuffer(), EX_NOT_FOUND, nullptr), false;
 
         stat_out->sizeInBytes = (stat.flags & FileStat::is_file) ? stat.sizeInBytes : 0;
         stat_out->creationTime = stat.creationTime;
@@ -2,12 +2,38 @@
 #include <framework/errorbuffer.hpp>
 #include <framework/filesystem.hpp>
 
+#include "private.hpp"
+
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+// Per lookup kind; the cache is simply flushed when full (one shard at a time)
+#define FSUNION_CACHE_MAX_ENTRIES   16384
+
+// Must be a power of 2
+#define FSUNION_CACHE_SHARDS        16
+
 // FIXME: SetErrors
 
+/*
+    FSUnion is safe for concurrent use without any global lock.
+
+    The list of mounted file systems is immutable once published; AddFileSystem and RemoveFileSystem
+    build a modified copy and swap it in. Every operation works on the snapshot it loaded at the start,
+    which also keeps removed file systems alive until in-flight operations are done with them.
+
+    Read-only opens and Stat calls remember which mount resolved a path, or that none did.
+    The cache is split into shards by path hash, each with its own lock, so that lookups from
+    many threads (resource preloading, asset streaming) don't queue up behind a single mutex.
+    Cache entries are tagged with the generation of the mount table they were resolved against,
+    so mounting/unmounting invalidates everything at once. Writes through the union invalidate
+    the affected path; changes made behind FSUnion's back require an explicit InvalidateCache.
+*/
+
 namespace zfw
 {
     using namespace li;
@@ -39,6 +65,9 @@ namespace zfw
             virtual void AddFileSystem(shared_ptr<IFileSystem>&& fs, int priority, const char* mountPoint) override;
             virtual bool RemoveFileSystem(IFileSystem* fs) override;
 
+            virtual void GetCacheStats(FSUnionCacheStats_t* stats_out) override;
+            virtual void InvalidateCache() override;
+
             // IFSHandler
             virtual IDirectory* OpenDirectory(const char* normalizedPath, int flags) override;
             virtual bool OpenFileStream(const char* normalizedPath, int flags,
@@ -50,6 +79,9 @@ namespace zfw
             virtual int CompareTimestamps(const char* leftPath, const char* rightPath, int64_t* diff_out, int flags) override;
             virtual const char* GetNativeAbsoluteFilename(const char* normalizedPath) override;
 
+            virtual IAsyncRead* ReadAsync(const char* normalizedPath, uint64_t offset, size_t length, void* buffer,
+                    AsyncReadCallback_t callback, void* userData) override;
+
         protected:
             struct FileSystem_t
             {
@@ -58,9 +90,47 @@ namespace zfw
                 std::string mountPoint;
             };
 
+            struct MountTable_t
+            {
+                std::vector<FileSystem_t> fileSystems;
+                uint64_t generation;
+            };
+
+            enum { kCacheOpen, kCacheStat, kNumCacheKinds };
+
+            struct CacheEntry_t
+            {
+                uint64_t generation;
+                int fsIndex;            // -1 if the path couldn't be resolved
+            };
+
+            struct CacheShard_t
+            {
+                std::mutex mutex;
+                std::unordered_map<std::string, CacheEntry_t> maps[kNumCacheKinds];
+            };
+
+            ErrorBuffer_t* p_GetErrorBuffer();
+            shared_ptr<const MountTable_t> p_GetMounts() { return std::atomic_load(&mounts); }
+            void p_PublishMounts(shared_ptr<MountTable_t>&& newMounts);
+
+            void p_CacheClear();
+            CacheShard_t& p_CacheGetShard(const std::string& normalizedPath);
+            bool p_CacheLookup(int kind, const char* normalizedPath, uint64_t generation, int* fsIndex_out);
+            void p_CacheStore(int kind, const char* normalizedPath, uint64_t generation, int fsIndex);
+            void p_CacheInvalidate(const char* normalizedPath);
+
             ErrorBuffer_t* eb;
 
-            std::vector<FileSystem_t> fileSystems;
+            // Serializes writers only; readers use p_GetMounts
+            std::mutex modifyMutex;
+            shared_ptr<const MountTable_t> mounts;
+
+            // resolution cache
+            CacheShard_t cacheShards[FSUNION_CACHE_SHARDS];
+            std::atomic<uint64_t> cacheGeneration;
+
+            std::atomic<uint64_t> numHits, numNegativeHits, numMisses, numInvalidations;
     };
 
     // ====================================================================== //
@@ -96,19 +166,27 @@ namespace zfw
     }
 
     FSUnion::FSUnion(ErrorBuffer_t* eb)
+            : mounts(std::make_shared<MountTable_t>()), cacheGeneration(0),
+            numHits(0), numNegativeHits(0), numMisses(0), numInvalidations(0)
     {
         this->eb = eb;
     }
 
     void FSUnion::AddFileSystem(shared_ptr<IFileSystem>&& fs, int priority, const char* mountPoint)
     {
-        auto it = fileSystems.begin();
+        std::lock_guard<std::mutex> lg(modifyMutex);
 
-        for (; it != fileSystems.end(); it++)
+        auto newMounts = std::make_shared<MountTable_t>(*mounts);
+        auto& list = newMounts->fileSystems;
+        auto it = list.begin();
+
+        for (; it != list.end(); it++)
             if (it->priority < priority)
                 break;
 
-        fileSystems.emplace(it, FileSystem_t{ move(fs), priority, mountPoint ? mountPoint : "" });
+        list.emplace(it, FileSystem_t{ move(fs), priority, mountPoint ? mountPoint : "" });
+
+        p_PublishMounts(move(newMounts));
     }
 
     int FSUnion::CompareTimestamps(const char* leftPath, const char* rightPath, int64_t* diff_out, int flags)
@@ -143,8 +221,9 @@ namespace zfw
     const char* FSUnion::GetNativeAbsoluteFilename(const char* normalizedPath)
     {
         bool breakOnError = false;
+        ErrorBuffer_t* eb = p_GetErrorBuffer();
 
-        for (auto& fs : fileSystems)
+        for (auto& fs : p_GetMounts()->fileSystems)
         {
             if (strncmp(fs.mountPoint.c_str(), normalizedPath, fs.mountPoint.length()) != 0)
                 continue;
@@ -163,9 +242,13 @@ namespace zfw
     IDirectory* FSUnion::OpenDirectory(const char* normalizedPath, int flags)
     {
         bool breakOnError = false;
+        ErrorBuffer_t* eb = p_GetErrorBuffer();
         std::vector<unique_ptr<IDirectory>> dirList;
 
-        for (auto& fs : fileSystems)
+        if (flags & kDirectoryMayCreate)
+            p_CacheInvalidate(normalizedPath);
+
+        for (auto& fs : p_GetMounts()->fileSystems)
         {
             if (strncmp(fs.mountPoint.c_str(), normalizedPath, fs.mountPoint.length()) != 0)
                 continue;
@@ -190,36 +273,246 @@ namespace zfw
             IOStream** io_out)
     {
         bool breakOnError = false;
+        ErrorBuffer_t* eb = p_GetErrorBuffer();
+        auto mounts = p_GetMounts();
+        auto& fileSystems = mounts->fileSystems;
+
+        // Anything which might create or modify a file bypasses (and invalidates) the cache
+        const bool cacheable = (os_out == nullptr && io_out == nullptr && (flags & (kFileMayCreate | kFileTruncate)) == 0);
+        int fsIndex;
+
+        if (cacheable && p_CacheLookup(kCacheOpen, normalizedPath, mounts->generation, &fsIndex))
+        {
+            if (fsIndex < 0)
+                return ErrorBuffer::SetError3(EX_NOT_FOUND, 3,
+                        "desc", sprintf_4095("File not found: '%s'", normalizedPath),
+                        "normalizedPath", normalizedPath,
+                        "flags", sprintf_15("%d", flags)
+                        ), false;
+
+            auto& fs = fileSystems[fsIndex];
+
+            if (fs.fs->OpenFileStream(normalizedPath + fs.mountPoint.length(), flags, is_out, os_out, io_out))
+                return true;
+
+            // The file must have disappeared behind our back; do a full lookup
+        }
 
-        for (auto& fs : fileSystems)
+        for (size_t i = 0; i < fileSystems.size(); i++)
         {
+            auto& fs = fileSystems[i];
+
             if (strncmp(fs.mountPoint.c_str(), normalizedPath, fs.mountPoint.length()) != 0)
                 continue;
 
             if (fs.fs->OpenFileStream(normalizedPath + fs.mountPoint.length(), flags, is_out, os_out, io_out))
+            {
+                if (cacheable)
+                    p_CacheStore(kCacheOpen, normalizedPath, mounts->generation, (int) i);
+                else
+                    p_CacheInvalidate(normalizedPath);
+
                 return true;
+            }
             else if (breakOnError && eb->errorCode != EX_NOT_FOUND)
                 break;
         }
 
         if (fileSystems.empty() || eb->errorCode == EX_NOT_FOUND)
+        {
+            if (cacheable)
+                p_CacheStore(kCacheOpen, normalizedPath, mounts->generation, -1);
+
             return ErrorBuffer::SetError3(eb->errorCode, 3,
                     "desc", sprintf_4095("File not found: '%s'", normalizedPath),
                     "normalizedPath", normalizedPath,
                     "flags", sprintf_15("%d", flags)
                     ), false;
+        }
+
+        return false;
+    }
+
+    void FSUnion::p_CacheClear()
+    {
+        for (auto& shard : cacheShards)
+        {
+            std::lock_guard<std::mutex> lg(shard.mutex);
+
+            for (auto& map : shard.maps)
+                map.clear();
+        }
+    }
 
+    FSUnion::CacheShard_t& FSUnion::p_CacheGetShard(const std::string& normalizedPath)
+    {
+        return cacheShards[std::hash<std::string>()(normalizedPath) & (FSUNION_CACHE_SHARDS - 1)];
+    }
+
+    bool FSUnion::p_CacheLookup(int kind, const char* normalizedPath, uint64_t generation, int* fsIndex_out)
+    {
+        // Build the key outside of the lock
+        const std::string key(normalizedPath);
+        auto& shard = p_CacheGetShard(key);
+
+        {
+            std::lock_guard<std::mutex> lg(shard.mutex);
+
+            auto it = shard.maps[kind].find(key);
+
+            if (it != shard.maps[kind].end() && it->second.generation == generation)
+            {
+                *fsIndex_out = it->second.fsIndex;
+
+                numHits.fetch_add(1, std::memory_order_relaxed);
+
+                if (it->second.fsIndex < 0)
+                    numNegativeHits.fetch_add(1, std::memory_order_relaxed);
+
+                return true;
+            }
+        }
+
+        numMisses.fetch_add(1, std::memory_order_relaxed);
         return false;
     }
 
+    void FSUnion::p_CacheInvalidate(const char* normalizedPath)
+    {
+        const std::string key(normalizedPath);
+        auto& shard = p_CacheGetShard(key);
+
+        {
+            std::lock_guard<std::mutex> lg(shard.mutex);
+
+            for (auto& map : shard.maps)
+                map.erase(key);
+        }
+
+        numInvalidations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void FSUnion::p_CacheStore(int kind, const char* normalizedPath, uint64_t generation, int fsIndex)
+    {
+        std::string key(normalizedPath);
+        auto& shard = p_CacheGetShard(key);
+
+        std::lock_guard<std::mutex> lg(shard.mutex);
+
+        // Resolved against a mount table which has been replaced in the meantime
+        // (p_PublishMounts bumps the generation before it clears each shard under its lock)
+        if (generation != cacheGeneration.load(std::memory_order_relaxed))
+            return;
+
+        auto& map = shard.maps[kind];
+
+        if (map.size() >= FSUNION_CACHE_MAX_ENTRIES / FSUNION_CACHE_SHARDS)
+            map.clear();
+
+        map[move(key)] = CacheEntry_t{ generation, fsIndex };
+    }
+
+    void FSUnion::GetCacheStats(FSUnionCacheStats_t* stats_out)
+    {
+        stats_out->hits = numHits.load(std::memory_order_relaxed);
+        stats_out->negativeHits = numNegativeHits.load(std::memory_order_relaxed);
+        stats_out->misses = numMisses.load(std::memory_order_relaxed);
+        stats_out->invalidations = numInvalidations.load(std::memory_order_relaxed);
+
+        stats_out->numEntries = 0;
+
+        for (auto& shard : cacheShards)
+        {
+            std::lock_guard<std::mutex> lg(shard.mutex);
+
+            for (auto& map : shard.maps)
+                stats_out->numEntries += map.size();
+        }
+    }
+
+    void FSUnion::InvalidateCache()
+    {
+        p_CacheClear();
+
+        numInvalidations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ErrorBuffer_t* FSUnion::p_GetErrorBuffer()
+    {
+        // Job workers have private error buffers
+        ErrorBuffer_t* workerEb = p_GetJobWorkerErrorBuffer();
+
+        return (workerEb != nullptr) ? workerEb : eb;
+    }
+
+    void FSUnion::p_PublishMounts(shared_ptr<MountTable_t>&& newMounts)
+    {
+        // Entries resolved against the previous table become unreachable
+        // (writers are serialized by modifyMutex, so the generation can't be bumped concurrently)
+        newMounts->generation = cacheGeneration.load(std::memory_order_relaxed) + 1;
+        cacheGeneration.store(newMounts->generation, std::memory_order_relaxed);
+
+        p_CacheClear();
+        numInvalidations.fetch_add(1, std::memory_order_relaxed);
+
+        std::atomic_store(&mounts, shared_ptr<const MountTable_t>(move(newMounts)));
+    }
+
+    IAsyncRead* FSUnion::ReadAsync(const char* normalizedPath, uint64_t offset, size_t length, void* buffer,
+            AsyncReadCallback_t callback, void* userData)
+    {
+        // The mount is picked right away (normally from the cache), so that the owning file system
+        // can do the actual read in the most efficient way it knows
+        auto mounts = p_GetMounts();
+        auto& fileSystems = mounts->fileSystems;
+        int fsIndex;
+
+        if (!p_CacheLookup(kCacheStat, normalizedPath, mounts->generation, &fsIndex))
+        {
+            FSStat_t stat;
+            fsIndex = -1;
+
+            for (size_t i = 0; i < fileSystems.size(); i++)
+            {
+                auto& fs = fileSystems[i];
+
+                if (strncmp(fs.mountPoint.c_str(), normalizedPath, fs.mountPoint.length()) != 0)
+                    continue;
+
+                if (fs.fs->Stat(normalizedPath + fs.mountPoint.length(), &stat))
+                {
+                    fsIndex = (int) i;
+                    break;
+                }
+            }
+
+            p_CacheStore(kCacheStat, normalizedPath, mounts->generation, fsIndex);
+        }
+
+        if (fsIndex < 0)
+            return ErrorBuffer::SetError3(EX_NOT_FOUND, 2,
+                    "desc", sprintf_4095("File not found: '%s'", normalizedPath),
+                    "normalizedPath", normalizedPath
+                    ), nullptr;
+
+        auto& fs = fileSystems[fsIndex];
+        return fs.fs->ReadAsync(normalizedPath + fs.mountPoint.length(), offset, length, buffer, callback, userData);
+    }
+
     bool FSUnion::RemoveFileSystem(IFileSystem* fs)
     {
-        for (size_t i = 0; i < fileSystems.size(); i++)
+        std::lock_guard<std::mutex> lg(modifyMutex);
+
+        auto& list = mounts->fileSystems;
+
+        for (size_t i = 0; i < list.size(); i++)
         {
-            if (fileSystems[i].fs.get() == fs)
+            if (list[i].fs.get() == fs)
             {
-                fileSystems[i].fs.reset();
-                fileSystems.erase(fileSystems.begin() + i);
+                auto newMounts = std::make_shared<MountTable_t>(*mounts);
+                newMounts->fileSystems.erase(newMounts->fileSystems.begin() + i);
+
+                p_PublishMounts(move(newMounts));
                 return true;
             }
         }
@@ -230,18 +523,41 @@ namespace zfw
     bool FSUnion::Stat(const char* normalizedPath, FSStat_t* stat_out)
     {
         bool breakOnError = false;
+        ErrorBuffer_t* eb = p_GetErrorBuffer();
+        auto mounts = p_GetMounts();
+        auto& fileSystems = mounts->fileSystems;
+        int fsIndex;
 
-        for (auto& fs : fileSystems)
+        if (p_CacheLookup(kCacheStat, normalizedPath, mounts->generation, &fsIndex))
         {
+            if (fsIndex < 0)
+                return ErrorBuffer::SetError(eb, EX_NOT_FOUND, nullptr), false;
+
+            auto& fs = fileSystems[fsIndex];
+
+            if (fs.fs->Stat(normalizedPath + fs.mountPoint.length(), stat_out))
+                return true;
+        }
+
+        for (size_t i = 0; i < fileSystems.size(); i++)
+        {
+            auto& fs = fileSystems[i];
+
             if (strncmp(fs.mountPoint.c_str(), normalizedPath, fs.mountPoint.length()) != 0)
                 continue;
 
             if (fs.fs->Stat(normalizedPath + fs.mountPoint.length(), stat_out))
+            {
+                p_CacheStore(kCacheStat, normalizedPath, mounts->generation, (int) i);
                 return true;
+            }
             else if (breakOnError && eb->errorCode != EX_NOT_FOUND)
                 break;
         }
 
+        if (fileSystems.empty() || eb->errorCode == EX_NOT_FOUND)
+            p_CacheStore(kCacheStat, normalizedPath, mounts->generation, -1);
+
         return false;
     }
 }
@@ -0,0 +1,525 @@
+#include "private.hpp"
+
+#include <framework/jobsystem.hpp>
+#include <framework/profiler.hpp>
+#include <framework/system.hpp>
+#include <framework/utility/errorbuffer.hpp>
+
+#include <littl/Thread.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Capacity of each worker's deque; overflowing jobs spill into the shared injection queue
+#define JOB_DEQUE_CAPACITY      4096
+
+namespace zfw
+{
+    class JobSystem;
+    class JobWorkerThread;
+
+    struct QueuedJob_t
+    {
+        Job_t job;
+        JobCounter_t* counter;
+    };
+
+    // Thread that is currently executing inside a JobSystem worker (nullptr for any other thread)
+    static thread_local JobWorkerThread* tls_currentWorker = nullptr;
+
+    // Workers report errors into their own buffer so that they don't trample over the main one
+    static thread_local ErrorBuffer_t* tls_workerErrorBuffer = nullptr;
+
+    // ====================================================================== //
+    //  class declaration(s)
+    // ====================================================================== //
+
+    // Chase-Lev work-stealing deque (fixed capacity).
+    // Push/Pop may only be called by the owning worker, Steal by anybody.
+    class WorkStealingDeque
+    {
+        public:
+            WorkStealingDeque() : top(0), bottom(0) {}
+
+            bool Push(const QueuedJob_t& job);
+            bool Pop(QueuedJob_t* job_out);
+            bool Steal(QueuedJob_t* job_out);
+
+        private:
+            // Slots are read by thieves concurrently with the owner, hence the atomics
+            struct Slot_t
+            {
+                std::atomic<JobFunc_t> func;
+                std::atomic<void*> userData;
+                std::atomic<JobCounter_t*> counter;
+            };
+
+            void p_Load(int64_t index, QueuedJob_t* job_out)
+            {
+                auto& slot = slots[index & (JOB_DEQUE_CAPACITY - 1)];
+                job_out->job.func = slot.func.load(std::memory_order_relaxed);
+                job_out->job.userData = slot.userData.load(std::memory_order_relaxed);
+                job_out->counter = slot.counter.load(std::memory_order_relaxed);
+            }
+
+            // Keep the two ends on separate cache lines
+            std::atomic<int64_t> top;
+            uint8_t padding[64];
+            std::atomic<int64_t> bottom;
+
+            Slot_t slots[JOB_DEQUE_CAPACITY];
+    };
+
+    class JobWorkerThread : public li::Thread
+    {
+        public:
+            JobWorkerThread(JobSystem* jobSystem, unsigned int index) : jobSystem(jobSystem), index(index) {}
+
+        protected:
+            virtual void run() override;
+
+        private:
+            JobSystem* jobSystem;
+            unsigned int index;
+
+            WorkStealingDeque deque;
+
+            friend class JobSystem;
+    };
+
+    class JobSystem : public IJobSystem
+    {
+        public:
+            JobSystem(ISystem* sys, unsigned int numWorkers);
+            virtual ~JobSystem();
+
+            virtual unsigned int GetNumWorkers() final override { return (unsigned int) workers.size(); }
+
+            virtual void Submit(const Job_t* jobs, size_t numJobs, JobCounter_t* counter) final override;
+            virtual void SubmitAfter(JobCounter_t* dependency, const Job_t* jobs, size_t numJobs,
+                    JobCounter_t* counter) final override;
+            virtual void WaitForCounter(JobCounter_t* counter) final override;
+
+            void WorkerMain(JobWorkerThread* worker);
+
+        private:
+            struct Continuation_t
+            {
+                JobCounter_t* dependency;
+                uint32_t epoch;                 // of 'dependency' when the continuation was registered
+                QueuedJob_t job;
+            };
+
+            void p_Dispatch(const QueuedJob_t* jobs, size_t numJobs);
+            void p_Enqueue(const QueuedJob_t& job);
+            void p_Execute(const QueuedJob_t& job);
+            static void p_Raise(JobCounter_t* counter, size_t numJobs);
+            bool p_TryExecuteOne(JobWorkerThread* self);
+            bool p_TryGetJob(JobWorkerThread* self, QueuedJob_t* job_out);
+            void p_WakeWorkers(size_t numJobs);
+
+            ISystem* sys;
+
+            std::vector<unique_ptr<JobWorkerThread>> workers;
+
+            // Number of jobs sitting in any queue; used to put workers to sleep
+            std::atomic<int> numQueued;
+            std::atomic<bool> shutdown;
+
+            // Shared queue for submissions from non-worker threads
+            std::mutex injectionMutex;
+            std::deque<QueuedJob_t> injectionQueue;
+
+            std::mutex sleepMutex;
+            std::condition_variable sleepCondition;
+            int numSleeping;
+
+            std::mutex continuationMutex;
+            std::vector<Continuation_t> continuations;
+            std::atomic<int> numContinuations;
+    };
+
+    // ====================================================================== //
+    //  class WorkStealingDeque
+    // ====================================================================== //
+
+    bool WorkStealingDeque::Push(const QueuedJob_t& job)
+    {
+        const int64_t b = bottom.load(std::memory_order_relaxed);
+        const int64_t t = top.load(std::memory_order_acquire);
+
+        if (b - t >= JOB_DEQUE_CAPACITY)
+            return false;
+
+        auto& slot = slots[b & (JOB_DEQUE_CAPACITY - 1)];
+        slot.func.store(job.job.func, std::memory_order_relaxed);
+        slot.userData.store(job.job.userData, std::memory_order_relaxed);
+        slot.counter.store(job.counter, std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool WorkStealingDeque::Pop(QueuedJob_t* job_out)
+    {
+        const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            // Empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        p_Load(b, job_out);
+
+        if (t == b)
+        {
+            // Last element; race against thieves
+            const bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                    std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+
+        return true;
+    }
+
+    bool WorkStealingDeque::Steal(QueuedJob_t* job_out)
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+            return false;
+
+        p_Load(t, job_out);
+
+        return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    // ====================================================================== //
+    //  struct JobCounter_t
+    // ====================================================================== //
+
+    uint32_t JobCounter_t::NewEpoch()
+    {
+        static std::atomic<uint32_t> nextEpoch(0);
+
+        return nextEpoch.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // ====================================================================== //
+    //  class JobWorkerThread
+    // ====================================================================== //
+
+    void JobWorkerThread::run()
+    {
+        p_CreateThreadErrorBuffer();
+        tls_currentWorker = this;
+
+        Profiler::SetThreadName(sprintf_t<31>("JobWorker %u", index));
+
+        jobSystem->WorkerMain(this);
+
+        tls_currentWorker = nullptr;
+        p_ReleaseThreadErrorBuffer();
+    }
+
+    // ====================================================================== //
+    //  class JobSystem
+    // ====================================================================== //
+
+    ErrorBuffer_t* p_GetJobWorkerErrorBuffer()
+    {
+        return tls_workerErrorBuffer;
+    }
+
+    void p_CreateThreadErrorBuffer()
+    {
+        ErrorBuffer::Create(tls_workerErrorBuffer);
+    }
+
+    void p_ReleaseThreadErrorBuffer()
+    {
+        ErrorBuffer::Release(tls_workerErrorBuffer);
+    }
+
+    IJobSystem* p_CreateJobSystem(ISystem* sys, unsigned int numWorkers)
+    {
+        if (numWorkers == 0)
+        {
+            // One worker per spare core; the main thread helps out while waiting
+            const unsigned int numCores = std::thread::hardware_concurrency();
+            numWorkers = (numCores > 1) ? numCores - 1 : 1;
+        }
+
+        return new JobSystem(sys, numWorkers);
+    }
+
+    JobSystem::JobSystem(ISystem* sys, unsigned int numWorkers)
+            : sys(sys), numQueued(0), shutdown(false), numSleeping(0), numContinuations(0)
+    {
+        for (unsigned int i = 0; i < numWorkers; i++)
+            workers.emplace_back(new JobWorkerThread(this, i));
+
+        for (auto& worker : workers)
+            worker->start();
+
+        sys->Printf(kLogInfo, "JobSystem: started %u worker threads", numWorkers);
+    }
+
+    JobSystem::~JobSystem()
+    {
+        // Run whatever is still queued or deferred instead of dropping it; its owners may be waiting on a counter
+        while (numQueued.load() != 0 || numContinuations.load() != 0)
+        {
+            if (!p_TryExecuteOne(nullptr))
+                std::this_thread::yield();
+        }
+
+        {
+            std::lock_guard<std::mutex> lg(sleepMutex);
+            shutdown.store(true);
+        }
+
+        sleepCondition.notify_all();
+
+        for (auto& worker : workers)
+            worker->waitFor();
+
+        zombie_assert(continuations.empty());
+        zombie_assert(injectionQueue.empty());
+    }
+
+    void JobSystem::p_Dispatch(const QueuedJob_t* jobs, size_t numJobs)
+    {
+        // Degenerate configuration; run synchronously
+        if (workers.empty())
+        {
+            for (size_t i = 0; i < numJobs; i++)
+                p_Execute(jobs[i]);
+
+            return;
+        }
+
+        for (size_t i = 0; i < numJobs; i++)
+            p_Enqueue(jobs[i]);
+
+        p_WakeWorkers(numJobs);
+    }
+
+    void JobSystem::p_Enqueue(const QueuedJob_t& job)
+    {
+        numQueued.fetch_add(1);
+
+        JobWorkerThread* self = tls_currentWorker;
+
+        if (self != nullptr && self->jobSystem == this && self->deque.Push(job))
+            return;
+
+        std::lock_guard<std::mutex> lg(injectionMutex);
+        injectionQueue.push_back(job);
+    }
+
+    void JobSystem::p_Execute(const QueuedJob_t& job)
+    {
+        Profiler::BeginZone("Job");
+        job.job.func(job.job.userData);
+        Profiler::EndZone();
+
+        JobCounter_t* counter = job.counter;
+
+        if (counter == nullptr)
+            return;
+
+        // Past this point, the counter may be destroyed or reused by its owner at any time
+        const uint64_t state = counter->state.fetch_sub(1);
+
+        if ((uint32_t) state != 1 || numContinuations.load() == 0)
+            return;
+
+        // Release everything that was waiting for this batch; only the pointer is compared, never dereferenced
+        const uint32_t epoch = (uint32_t) (state >> 32);
+        std::vector<QueuedJob_t> released;
+
+        {
+            std::lock_guard<std::mutex> lg(continuationMutex);
+
+            for (auto it = continuations.begin(); it != continuations.end(); )
+            {
+                if (it->dependency == counter && it->epoch == epoch)
+                {
+                    released.push_back(it->job);
+                    it = continuations.erase(it);
+                    numContinuations.fetch_sub(1);
+                }
+                else
+                    it++;
+            }
+        }
+
+        if (!released.empty())
+            p_Dispatch(&released[0], released.size());
+    }
+
+    void JobSystem::p_Raise(JobCounter_t* counter, size_t numJobs)
+    {
+        uint64_t state = counter->state.load();
+        uint64_t raised;
+
+        do
+        {
+            // A new batch starts a new epoch
+            if ((uint32_t) state == 0)
+                raised = ((uint64_t) JobCounter_t::NewEpoch() << 32) | numJobs;
+            else
+                raised = state + numJobs;
+        }
+        while (!counter->state.compare_exchange_weak(state, raised));
+    }
+
+    bool JobSystem::p_TryExecuteOne(JobWorkerThread* self)
+    {
+        QueuedJob_t job;
+
+        if (!p_TryGetJob(self, &job))
+            return false;
+
+        numQueued.fetch_sub(1);
+        p_Execute(job);
+        return true;
+    }
+
+    bool JobSystem::p_TryGetJob(JobWorkerThread* self, QueuedJob_t* job_out)
+    {
+        // Own deque first (LIFO, cache-warm)
+        if (self != nullptr && self->deque.Pop(job_out))
+            return true;
+
+        {
+            std::lock_guard<std::mutex> lg(injectionMutex);
+
+            if (!injectionQueue.empty())
+            {
+                *job_out = injectionQueue.front();
+                injectionQueue.pop_front();
+                return true;
+            }
+        }
+
+        // Steal from the others, starting next to ourselves to spread contention
+        const size_t numWorkers = workers.size();
+        const size_t first = (self != nullptr) ? self->index + 1 : 0;
+
+        for (size_t i = 0; i < numWorkers; i++)
+        {
+            auto& victim = workers[(first + i) % numWorkers];
+
+            if (victim.get() != self && victim->deque.Steal(job_out))
+                return true;
+        }
+
+        return false;
+    }
+
+    void JobSystem::p_WakeWorkers(size_t numJobs)
+    {
+        if (numJobs == 0)
+            return;
+
+        std::lock_guard<std::mutex> lg(sleepMutex);
+
+        if (numSleeping == 0)
+            return;
+
+        if (numJobs == 1)
+            sleepCondition.notify_one();
+        else
+            sleepCondition.notify_all();
+    }
+
+    void JobSystem::Submit(const Job_t* jobs, size_t numJobs, JobCounter_t* counter)
+    {
+        if (numJobs == 0)
+            return;
+
+        if (counter != nullptr)
+            p_Raise(counter, numJobs);
+
+        std::vector<QueuedJob_t> queued(numJobs);
+
+        for (size_t i = 0; i < numJobs; i++)
+            queued[i] = QueuedJob_t{ jobs[i], counter };
+
+        p_Dispatch(&queued[0], numJobs);
+    }
+
+    void JobSystem::SubmitAfter(JobCounter_t* dependency, const Job_t* jobs, size_t numJobs, JobCounter_t* counter)
+    {
+        if (numJobs == 0)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lg(continuationMutex);
+
+            // Announce ourselves before checking the dependency (pairs with p_Execute)
+            numContinuations.fetch_add((int) numJobs);
+
+            const uint64_t state = dependency->state.load();
+
+            if ((uint32_t) state != 0)
+            {
+                if (counter != nullptr)
+                    p_Raise(counter, numJobs);
+
+                for (size_t i = 0; i < numJobs; i++)
+                    continuations.push_back(Continuation_t{ dependency, (uint32_t) (state >> 32),
+                            QueuedJob_t{ jobs[i], counter } });
+
+                return;
+            }
+
+            numContinuations.fetch_sub((int) numJobs);
+        }
+
+        // Dependency already satisfied
+        Submit(jobs, numJobs, counter);
+    }
+
+    void JobSystem::WaitForCounter(JobCounter_t* counter)
+    {
+        JobWorkerThread* self = tls_currentWorker;
+
+        if (self != nullptr && self->jobSystem != this)
+            self = nullptr;
+
+        while (!counter->IsDone())
+        {
+            if (!p_TryExecuteOne(self))
+                std::this_thread::yield();
+        }
+    }
+
+    void JobSystem::WorkerMain(JobWorkerThread* worker)
+    {
+        while (!shutdown.load())
+        {
+            if (p_TryExecuteOne(worker))
+                continue;
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+
+            numSleeping++;
+            sleepCondition.wait(lock, [this] { return shutdown.load() || numQueued.load() > 0; });
+            numSleeping--;
+        }
+    }
+}
@@ -0,0 +1,285 @@
+
+#include "private.hpp"
+
+#include <framework/profiler.hpp>
+
+#include <littl/Stream.hpp>
+#include <littl/Thread.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+// Number of records; must be a power of 2
+#define LOG_RING_SIZE           4096
+#define LOG_LINE_LENGTH         256
+#define LOG_HISTORY_SIZE        (64 * 1024)
+
+// How often the writer wakes up on its own
+#define LOG_WRITER_INTERVAL_MS  50
+
+namespace zfw
+{
+    using namespace li;
+
+    struct LogRecord_t
+    {
+        // == position     : free for the producer claiming 'position'
+        // == position + 1 : filled in, waiting for the writer
+        std::atomic<size_t> sequence;
+
+        uint64_t timestamp;
+        LogType_t type;
+        char line[LOG_LINE_LENGTH];
+    };
+
+    // ====================================================================== //
+    //  class declaration(s)
+    // ====================================================================== //
+
+    class LogRing : public ILogRing, private li::Thread
+    {
+        public:
+            LogRing(const char* const* logTypeNames);
+            ~LogRing();
+
+            virtual void Logv(uint64_t timestamp, LogType_t logType, const char* format, va_list args) final override;
+
+            virtual void SetOutput(unique_ptr<OutputStream> output) final override;
+            virtual void Flush() final override;
+            virtual void DumpHistory(OutputStream* stream) final override;
+
+        protected:
+            virtual void run() override;
+
+        private:
+            void p_Drain();
+            void p_DrainLocked();
+            void p_WriteLine(const char* text, size_t length);
+
+            const char* const* logTypeNames;
+
+            // producer side
+            std::atomic<size_t> enqueuePos;
+            uint8_t padding[64];
+
+            std::atomic<unsigned int> numDropped;
+
+            LogRecord_t records[LOG_RING_SIZE];
+
+            // writer side; drainMutex is held by whoever is emptying the ring.
+            // Recursive, since the output stream itself might log an error when the ring is full
+            std::recursive_mutex drainMutex;
+            size_t dequeuePos;
+            unique_ptr<OutputStream> output;
+
+            char history[LOG_HISTORY_SIZE];
+            size_t historyPos;
+            bool historyWrapped;
+
+            std::mutex wakeMutex;
+            std::condition_variable wakeCondition;
+            bool shutdown;
+    };
+
+    // ====================================================================== //
+    //  class LogRing
+    // ====================================================================== //
+
+    ILogRing* p_CreateLogRing(const char* const* logTypeNames)
+    {
+        return new LogRing(logTypeNames);
+    }
+
+    LogRing::LogRing(const char* const* logTypeNames)
+            : logTypeNames(logTypeNames), enqueuePos(0), numDropped(0), dequeuePos(0), historyPos(0),
+            historyWrapped(false), shutdown(false)
+    {
+        for (size_t i = 0; i < LOG_RING_SIZE; i++)
+            records[i].sequence.store(i, std::memory_order_relaxed);
+
+        start();
+    }
+
+    LogRing::~LogRing()
+    {
+        {
+            std::lock_guard<std::mutex> lg(wakeMutex);
+            shutdown = true;
+        }
+
+        wakeCondition.notify_one();
+        waitFor();
+
+        p_Drain();
+    }
+
+    void LogRing::DumpHistory(OutputStream* stream)
+    {
+        Flush();
+
+        std::lock_guard<std::recursive_mutex> lg(drainMutex);
+
+        if (historyWrapped)
+        {
+            // Skip the partially overwritten line
+            const char* oldest = history + historyPos;
+            const char* newline = (const char*) memchr(oldest, '\n', LOG_HISTORY_SIZE - historyPos);
+
+            if (newline != nullptr)
+                stream->write(newline + 1, history + LOG_HISTORY_SIZE - (newline + 1));
+        }
+
+        stream->write(history, historyPos);
+    }
+
+    void LogRing::Flush()
+    {
+        p_Drain();
+    }
+
+    void LogRing::Logv(uint64_t timestamp, LogType_t logType, const char* format, va_list args)
+    {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        LogRecord_t* record;
+
+        for (;;)
+        {
+            record = &records[pos & (LOG_RING_SIZE - 1)];
+            const size_t sequence = record->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                // Ring is full. Informational messages are dropped (the writer will report the loss),
+                // anything more important waits, helping to empty the ring if the writer is busy elsewhere
+                if (logType >= kLogInfo)
+                {
+                    numDropped.fetch_add(1, std::memory_order_relaxed);
+                    wakeCondition.notify_one();
+                    return;
+                }
+
+                if (drainMutex.try_lock())
+                {
+                    p_DrainLocked();
+                    drainMutex.unlock();
+                }
+                else
+                    std::this_thread::yield();
+
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+            else
+                pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+
+        record->timestamp = timestamp;
+        record->type = logType;
+
+        const int length = vsnprintf(record->line, sizeof(record->line), format, args);
+
+        if (length >= (int) sizeof(record->line))
+            memcpy(record->line + sizeof(record->line) - 4, "...", 4);
+        else if (length < 0)
+            record->line[0] = 0;
+
+        record->sequence.store(pos + 1, std::memory_order_release);
+
+        // Wake the writer early every half a ring's worth of messages
+        if ((pos & (LOG_RING_SIZE / 2 - 1)) == 0 && pos != 0)
+            wakeCondition.notify_one();
+    }
+
+    void LogRing::p_Drain()
+    {
+        std::lock_guard<std::recursive_mutex> lg(drainMutex);
+        p_DrainLocked();
+    }
+
+    void LogRing::p_DrainLocked()
+    {
+        for (;;)
+        {
+            LogRecord_t* record = &records[dequeuePos & (LOG_RING_SIZE - 1)];
+
+            if (record->sequence.load(std::memory_order_acquire) != dequeuePos + 1)
+                break;
+
+            const auto t = record->timestamp;
+            sprintf_t<LOG_LINE_LENGTH + 31> line("%-10s[%5u.%04u] %s\n", logTypeNames[record->type],
+                    (int)(t / 1000000), (int)(t % 1000000) / 100, record->line);
+
+            record->sequence.store(dequeuePos + LOG_RING_SIZE, std::memory_order_release);
+            dequeuePos++;
+
+            p_WriteLine(line, strlen(line));
+        }
+
+        const unsigned int dropped = numDropped.exchange(0);
+
+        if (dropped != 0)
+        {
+            sprintf_t<63> line("%-10s%u messages dropped\n", logTypeNames[kLogWarning], dropped);
+            p_WriteLine(line, strlen(line));
+        }
+    }
+
+    void LogRing::p_WriteLine(const char* text, size_t length)
+    {
+        if (output != nullptr)
+            output->write(text, length);
+
+        while (length > 0)
+        {
+            const size_t count = std::min(length, (size_t) LOG_HISTORY_SIZE - historyPos);
+            memcpy(history + historyPos, text, count);
+
+            text += count;
+            length -= count;
+            historyPos += count;
+
+            if (historyPos == LOG_HISTORY_SIZE)
+            {
+                historyPos = 0;
+                historyWrapped = true;
+            }
+        }
+    }
+
+    void LogRing::run()
+    {
+        Profiler::SetThreadName("LogWriter");
+
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(wakeMutex);
+
+                if (shutdown)
+                    break;
+
+                wakeCondition.wait_for(lock, std::chrono::milliseconds(LOG_WRITER_INTERVAL_MS));
+            }
+
+            p_Drain();
+        }
+    }
+
+    void LogRing::SetOutput(unique_ptr<OutputStream> output)
+    {
+        p_Drain();
+
+        std::lock_guard<std::recursive_mutex> lg(drainMutex);
+        this->output = move(output);
+    }
+}
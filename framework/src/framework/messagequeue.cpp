@@ -89,6 +89,7 @@ namespace zfw
             virtual void Post(int messageType) override;
             virtual void PostCall(MessageQueueCallable callback) override;
             virtual MessageHeader* Retrieve(li::Timeout timeout) override;
+            virtual size_t RetrieveBatch(MessageHeader** headers_out, size_t maxMessages, li::Timeout timeout) override;
 
             void InlineFinishMessage(volatile MessageHeader* header)
             {
@@ -267,6 +268,39 @@ namespace zfw
         return nullptr;
     }
 
+    size_t MessageQueueImpl::RetrieveBatch(MessageHeader** headers_out, size_t maxMessages, li::Timeout timeout)
+    {
+        if (maxMessages == 0)
+            return 0;
+
+        MessageHeader* header = Retrieve(timeout);
+
+        if (header == nullptr)
+            return 0;
+
+        headers_out[0] = header;
+        size_t count = 1;
+
+        // Don't let TryRetrieve rotate the buffers; that would hand the messages returned so far back to the producers
+        while (count < maxMessages && buffers[readbuf].index != buffers[readbuf].used)
+        {
+            header = TryRetrieve();
+
+            if (header == nullptr)
+                break;
+
+            if (header->flags & MESSAGE_PAYLOAD_IS_CALLBACK)
+            {
+                (*(header->Data<MessageQueueCallable>()))();
+                continue;
+            }
+
+            headers_out[count++] = header;
+        }
+
+        return count;
+    }
+
     MessageHeader* MessageQueueImpl::TryRetrieve()
     {
         // Make sure nobody tries to realloc() our readbuf!
@@ -333,7 +367,7 @@ namespace zfw
         return header;
     }
 
-    MessageQueue* MessageQueue::Create()
+    MessageQueue* MessageQueue::CreateDoubleBuffered()
     {
         return new MessageQueueImpl();
     }
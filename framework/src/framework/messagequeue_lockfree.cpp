@@ -0,0 +1,379 @@
+
+#include <framework/messagequeue.hpp>
+#include <framework/utility/essentials.hpp>
+
+#include <littl/Thread.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <vector>
+
+#define SEGMENT_MIN_CAPACITY    (64 * 1024)
+#define RECORD_ALIGNMENT        16
+
+namespace zfw
+{
+    using namespace li;
+
+    // Record flags
+    enum
+    {
+        RECORD_IS_CALLBACK = 1
+    };
+
+    // Precedes every MessageHeader in a segment
+    struct RecordPrefix_t
+    {
+        uint32_t size;                  // whole record including this prefix
+        uint32_t flags;
+        std::atomic<uint32_t> ready;    // set by FinishMessage
+        uint32_t preFence;              // only used with MESSAGEQUEUE_USE_FENCES (must immediately precede the header)
+    };
+
+    static_assert(sizeof(RecordPrefix_t) == RECORD_ALIGNMENT, "RecordPrefix_t must keep MessageHeader aligned");
+
+    struct Segment_t
+    {
+        std::atomic<size_t> reserved;   // bumped by producers; may run past capacity
+
+        uint8_t padding[64 - sizeof(std::atomic<size_t>)];
+
+        std::atomic<size_t> sealedEnd;  // end of the last record; SIZE_MAX until the segment fills up
+        std::atomic<Segment_t*> next;
+        size_t capacity;
+
+        uint8_t padding2[RECORD_ALIGNMENT - (sizeof(std::atomic<size_t>) + sizeof(std::atomic<Segment_t*>) + sizeof(size_t)) % RECORD_ALIGNMENT];
+
+        explicit Segment_t(size_t capacity) : reserved(0), sealedEnd(SIZE_MAX), next(nullptr), capacity(capacity) {}
+
+        uint8_t* Data() { return reinterpret_cast<uint8_t*>(this + 1); }
+    };
+
+    static_assert(sizeof(Segment_t) % RECORD_ALIGNMENT == 0, "Segment_t must keep records aligned");
+
+    // ====================================================================== //
+    //  class declaration(s)
+    // ====================================================================== //
+
+    class LockFreeMessageQueue : public MessageQueue
+    {
+        public:
+            LockFreeMessageQueue();
+            ~LockFreeMessageQueue();
+
+            virtual void* AllocMessage(size_t length, int type, void (*releaseFunc)(void *messageBody)) override;
+            virtual void FinishMessage(void* body) override;
+
+            virtual void Post(int messageType) override;
+            virtual void PostCall(MessageQueueCallable callback) override;
+            virtual MessageHeader* Retrieve(li::Timeout timeout) override;
+            virtual size_t RetrieveBatch(MessageHeader** headers_out, size_t maxMessages, li::Timeout timeout) override;
+
+        private:
+#ifndef MESSAGEQUEUE_USE_FENCES
+            static const size_t kBodyOffset = sizeof(MessageHeader);
+            static const size_t kTrailerSize = 0;
+#else
+            // Only the layout is kept compatible with MessageHeader::Data();
+            // the fences themselves are checked by the double-buffered implementation
+            static const size_t kBodyOffset = sizeof(MessageHeader) + sizeof(uint32_t);
+            static const size_t kTrailerSize = 2 * sizeof(uint32_t);
+#endif
+
+            static RecordPrefix_t* ps_GetPrefix(MessageHeader* header) { return reinterpret_cast<RecordPrefix_t*>(header) - 1; }
+
+            MessageHeader* p_AllocMessage(size_t bodyLength, uint32_t recordFlags);
+            Segment_t* p_AllocSegment(size_t minCapacity);
+            void p_FinishMessage(MessageHeader* header);
+            void p_RecycleSegments();
+            MessageHeader* p_TryRetrieve();
+
+            // producer side
+            std::atomic<Segment_t*> writeSegment;
+            std::atomic<int> activeProducers;   // producers which might be holding a pointer to a sealed segment
+            std::atomic<Segment_t*> spareSegment;
+            std::atomic<bool> consumerWaiting;
+
+            li::ConditionVar conditionVar;
+
+            // consumer side
+            Segment_t* readSegment;
+            size_t readPos;
+
+            std::vector<Segment_t*> consumedSegments;   // still referenced by the messages returned most recently
+            std::vector<Segment_t*> retiredSegments;    // waiting for producers to let go of them
+    };
+
+    // ====================================================================== //
+    //  class LockFreeMessageQueue
+    // ====================================================================== //
+
+    LockFreeMessageQueue::LockFreeMessageQueue()
+            : activeProducers(0), spareSegment(nullptr), consumerWaiting(false)
+    {
+        readSegment = p_AllocSegment(0);
+        readPos = 0;
+
+        writeSegment.store(readSegment);
+    }
+
+    LockFreeMessageQueue::~LockFreeMessageQueue()
+    {
+        MessageHeader* header;
+
+        while ((header = p_TryRetrieve()) != nullptr)
+            header->Release();
+
+        for (Segment_t* seg = readSegment; seg != nullptr; )
+        {
+            Segment_t* next = seg->next.load();
+            free(seg);
+            seg = next;
+        }
+
+        for (auto seg : consumedSegments)
+            free(seg);
+
+        for (auto seg : retiredSegments)
+            free(seg);
+
+        free(spareSegment.load());
+    }
+
+    void* LockFreeMessageQueue::AllocMessage(size_t length, int type, void (*releaseFunc)(void *messageBody))
+    {
+        MessageHeader* header = p_AllocMessage(length, 0);
+
+        header->type = type;
+        header->releaseFunc = releaseFunc;
+
+        return reinterpret_cast<uint8_t*>(header) + kBodyOffset;
+    }
+
+    void LockFreeMessageQueue::FinishMessage(void* body)
+    {
+        p_FinishMessage(reinterpret_cast<MessageHeader*>(reinterpret_cast<uint8_t*>(body) - kBodyOffset));
+    }
+
+    MessageHeader* LockFreeMessageQueue::p_AllocMessage(size_t bodyLength, uint32_t recordFlags)
+    {
+        const size_t recordSize = (sizeof(RecordPrefix_t) + kBodyOffset + bodyLength + kTrailerSize + RECORD_ALIGNMENT - 1)
+                & ~(size_t)(RECORD_ALIGNMENT - 1);
+
+        // Must be raised before looking at writeSegment, see p_RecycleSegments
+        activeProducers.fetch_add(1);
+
+        Segment_t* seg = writeSegment.load();
+
+        for (;;)
+        {
+            const size_t pos = seg->reserved.fetch_add(recordSize, std::memory_order_relaxed);
+
+            if (pos + recordSize <= seg->capacity)
+            {
+                // The segment can't go away before the consumer has read this record
+                activeProducers.fetch_sub(1, std::memory_order_release);
+
+                auto prefix = reinterpret_cast<RecordPrefix_t*>(seg->Data() + pos);
+                prefix->size = (uint32_t) recordSize;
+                prefix->flags = recordFlags;
+
+                auto header = reinterpret_cast<MessageHeader*>(prefix + 1);
+                header->length = bodyLength;
+                header->flags = 0;
+                return header;
+            }
+
+            Segment_t* next;
+
+            if (pos <= seg->capacity)
+            {
+                // We're the first one to run past the end; start a new segment.
+                // 'writeSegment' goes first: once 'next' is linked, other producers can fill and seal the new
+                // segment, and a late store would move 'writeSegment' back to it (see p_RecycleSegments).
+                // Consumer relies on both being set before 'sealedEnd'.
+                next = p_AllocSegment(recordSize);
+                writeSegment.store(next);
+                seg->next.store(next);
+                seg->sealedEnd.store(pos, std::memory_order_release);
+            }
+            else
+            {
+                while ((next = seg->next.load(std::memory_order_acquire)) == nullptr)
+                    std::this_thread::yield();
+            }
+
+            seg = next;
+        }
+    }
+
+    Segment_t* LockFreeMessageQueue::p_AllocSegment(size_t minCapacity)
+    {
+        const size_t capacity = std::max<size_t>(minCapacity, SEGMENT_MIN_CAPACITY);
+
+        Segment_t* seg = spareSegment.exchange(nullptr);
+
+        if (seg != nullptr && seg->capacity >= capacity)
+            return seg;
+
+        free(seg);
+
+        void* mem = malloc(sizeof(Segment_t) + capacity);
+        ZFW_ASSERT(mem != nullptr)
+
+        seg = new (mem) Segment_t(capacity);
+        memset(seg->Data(), 0, capacity);
+        return seg;
+    }
+
+    void LockFreeMessageQueue::p_FinishMessage(MessageHeader* header)
+    {
+        ps_GetPrefix(header)->ready.store(1);
+
+        if (consumerWaiting.load())
+            conditionVar.set();
+    }
+
+    void LockFreeMessageQueue::p_RecycleSegments()
+    {
+        retiredSegments.insert(retiredSegments.end(), consumedSegments.begin(), consumedSegments.end());
+        consumedSegments.clear();
+
+        // A producer which registers after this point can only see a newer writeSegment
+        if (retiredSegments.empty() || activeProducers.load() != 0)
+            return;
+
+        for (auto seg : retiredSegments)
+        {
+            memset(seg->Data(), 0, seg->capacity);
+            seg->reserved.store(0, std::memory_order_relaxed);
+            seg->sealedEnd.store(SIZE_MAX, std::memory_order_relaxed);
+            seg->next.store(nullptr, std::memory_order_relaxed);
+
+            free(spareSegment.exchange(seg));
+        }
+
+        retiredSegments.clear();
+    }
+
+    void LockFreeMessageQueue::Post(int messageType)
+    {
+        MessageHeader* header = p_AllocMessage(0, 0);
+
+        header->type = messageType;
+        header->releaseFunc = nullptr;
+
+        p_FinishMessage(header);
+    }
+
+    void LockFreeMessageQueue::PostCall(MessageQueueCallable callback)
+    {
+        MessageHeader* header = p_AllocMessage(sizeof(MessageQueueCallable), RECORD_IS_CALLBACK);
+
+        header->type = -1;
+        header->releaseFunc = nullptr;
+        *(header->Data<MessageQueueCallable>()) = callback;
+
+        p_FinishMessage(header);
+    }
+
+    MessageHeader* LockFreeMessageQueue::Retrieve(li::Timeout timeout)
+    {
+        p_RecycleSegments();
+
+        for ( ; ; )
+        {
+            MessageHeader* header = p_TryRetrieve();
+
+            if (header != nullptr)
+                return header;
+
+            if (timeout.infinite)
+            {
+                // Producers only signal when somebody is waiting, so check once more after announcing ourselves
+                consumerWaiting.store(true);
+                header = p_TryRetrieve();
+
+                if (header == nullptr)
+                {
+                    ZFW_ASSERT(conditionVar.waitFor())
+                }
+
+                consumerWaiting.store(false);
+
+                if (header != nullptr)
+                    return header;
+            }
+            else if (timeout.timedOut())
+                break;
+            else
+                std::this_thread::yield();
+        }
+
+        return nullptr;
+    }
+
+    size_t LockFreeMessageQueue::RetrieveBatch(MessageHeader** headers_out, size_t maxMessages, li::Timeout timeout)
+    {
+        if (maxMessages == 0)
+            return 0;
+
+        MessageHeader* header = Retrieve(timeout);
+
+        if (header == nullptr)
+            return 0;
+
+        headers_out[0] = header;
+        size_t count = 1;
+
+        while (count < maxMessages && (header = p_TryRetrieve()) != nullptr)
+            headers_out[count++] = header;
+
+        return count;
+    }
+
+    MessageHeader* LockFreeMessageQueue::p_TryRetrieve()
+    {
+        for ( ; ; )
+        {
+            if (readPos == readSegment->sealedEnd.load(std::memory_order_acquire))
+            {
+                // Keep the segment around until the next Retrieve; returned messages may still live in it
+                consumedSegments.push_back(readSegment);
+
+                readSegment = readSegment->next.load(std::memory_order_acquire);
+                readPos = 0;
+                continue;
+            }
+
+            // The producer which will seal the segment might not have gotten around to it yet
+            if (readPos + sizeof(RecordPrefix_t) > readSegment->capacity)
+                return nullptr;
+
+            auto prefix = reinterpret_cast<RecordPrefix_t*>(readSegment->Data() + readPos);
+
+            if (prefix->ready.load(std::memory_order_acquire) == 0)
+                return nullptr;
+
+            readPos += prefix->size;
+
+            auto header = reinterpret_cast<MessageHeader*>(prefix + 1);
+
+            if (prefix->flags & RECORD_IS_CALLBACK)
+            {
+                (*(header->Data<MessageQueueCallable>()))();
+                continue;
+            }
+
+            return header;
+        }
+    }
+
+    MessageQueue* MessageQueue::Create()
+    {
+        return new LockFreeMessageQueue();
+    }
+}
@@ -1,14 +1,70 @@
 #pragma once
 
-#include <framework/base.hpp>
+#include <framework/system.hpp>
+
+#include <cstdarg>
 
 namespace zfw
 {
+    class IMappedInputStream;
+
+    // Read-only memory mapping of a whole file (see filesystem_mapped.cpp)
+    class IFileMapping
+    {
+        public:
+            virtual ~IFileMapping() {}
+
+            virtual const uint8_t* GetData() = 0;
+            virtual uint64_t GetSize() = 0;
+    };
+
+    // Returns nullptr if the file can't be opened or mapped (no error is set)
+    shared_ptr<IFileMapping> p_MapFile(const char* path);
+
+    // Stream over [offset, offset + length) of a mapping; keeps the mapping alive
+    IMappedInputStream* p_CreateMappedInputStream(shared_ptr<IFileMapping> mapping, uint64_t offset, uint64_t length);
+
+    // Asynchronous reads of native files (see asyncio.cpp); io_uring where the kernel allows, pread otherwise
+#ifdef ZOMBIE_WITH_IO_URING
+    IAsyncRead* p_ReadNativeAsync(const char* nativePath, uint64_t offset, size_t length, void* buffer,
+            AsyncReadCallback_t callback, void* userData);
+#endif
+
+    // Waits for all pending asynchronous reads and stops the I/O threads (they're restarted on demand)
+    void p_ShutdownAsyncIO();
+
+    // Bounded-memory asynchronous log backing ISystem::Log
+    class ILogRing
+    {
+        public:
+            virtual ~ILogRing() {}
+
+            // Thread-safe, lock-free and allocation-free. Lines are truncated to a fixed length;
+            // if the background writer falls behind, messages are dropped (and the drop is logged)
+            virtual void Logv(uint64_t timestamp, LogType_t logType, const char* format, va_list args) = 0;
+
+            // Lines are streamed to 'output' from the writer thread from now on; nullptr to close
+            virtual void SetOutput(unique_ptr<li::OutputStream> output) = 0;
+
+            // Blocks until everything logged so far has been written out
+            virtual void Flush() = 0;
+
+            // Writes the most recent lines (up to a fixed amount of text)
+            virtual void DumpHistory(li::OutputStream* stream) = 0;
+    };
+
     IConfig*            p_CreateConfig(ErrorBuffer_t* eb);
 
     IEntityHandler*     p_CreateEntityHandler(ErrorBuffer_t* eb, ISystem* sys);
     shared_ptr<IFileSystem> p_CreateStdFileSystem(ErrorBuffer_t* eb, const char* absolutePathPrefix, int access);
+    shared_ptr<IFileSystem> p_CreateMappedFileSystem(ErrorBuffer_t* eb, const char* absolutePathPrefix, int access);
+    shared_ptr<IFileSystem> p_CreatePackFileSystem(ErrorBuffer_t* eb, const char* path, int access);
     IFSUnion*           p_CreateFSUnion(ErrorBuffer_t* eb);
+    IJobSystem*         p_CreateJobSystem(ISystem* sys, unsigned int numWorkers);
+    ErrorBuffer_t*      p_GetJobWorkerErrorBuffer();     // also set for I/O threads; nullptr on other threads
+    void                p_CreateThreadErrorBuffer();
+    void                p_ReleaseThreadErrorBuffer();
+    ILogRing*           p_CreateLogRing(const char* const* logTypeNames);
     IMediaCodecHandler* p_CreateMediaCodecHandler();
     IModuleHandler*     p_CreateModuleHandler(ErrorBuffer_t* eb);
     IResourceManager*   p_CreateResourceManager(ErrorBuffer_t* eb, ISystem* sys, const char* name);
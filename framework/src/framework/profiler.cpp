@@ -2,6 +2,19 @@
 #include <framework/profiler.hpp>
 
 #include <littl/PerfTiming.hpp>
+#include <littl/Stream.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Events per thread; must be a power of 2
+#define ZONE_RING_SIZE          32768
 
 namespace zfw
 {
@@ -9,6 +22,48 @@ namespace zfw
 
     static ProfilingSection_t root = {"_root"};
 
+    enum
+    {
+        kZoneBegin,
+        kZoneEnd,
+        kFrameMark,
+    };
+
+    struct ZoneEvent_t
+    {
+        // Atomic only so that an exporting thread may read them; the owning thread is the only writer
+        std::atomic<const char*> name;
+        std::atomic<uint64_t> timeAndType;     // nanoseconds << 2 | type
+    };
+
+    struct ZoneRing_t
+    {
+        ZoneEvent_t events[ZONE_RING_SIZE];
+        std::atomic<uint64_t> writeIndex;
+
+        std::atomic<bool> inUse;
+        unsigned int threadID;
+        char threadName[32];
+    };
+
+    struct ZoneRingOwner_t
+    {
+        ZoneRing_t* ring = nullptr;
+
+        // Hand the ring over to a future thread; its history remains exportable until then
+        ~ZoneRingOwner_t() { if (ring) ring->inUse.store(false); }
+    };
+
+    static const float s_histogramBucketLimitsMs[PROFILER_HISTOGRAM_BUCKETS] = {
+            1.0f, 2.0f, 4.0f, 8.0f, 12.0f, 16.7f, 20.0f, 25.0f, 33.3f, 50.0f, 100.0f, INFINITY
+    };
+
+    static std::atomic<bool> s_zoneRecording(true);
+    static std::mutex s_zoneRingsMutex;
+    static std::vector<unique_ptr<ZoneRing_t>> s_zoneRings;
+
+    static thread_local ZoneRingOwner_t tls_zoneRing;
+
     // ====================================================================== //
     //  class declaration(s)
     // ====================================================================== //
@@ -23,14 +78,115 @@ namespace zfw
 
             virtual void PrintProfile() final override;
 
+            virtual bool WriteChromeTrace(OutputStream* output, uint64_t lastMicros) final override;
+
+            virtual void AddSample(const char* section, uint64_t micros) final override;
+            virtual size_t GetNumStatsSections() final override;
+            virtual bool GetSectionStats(const char* section, ProfilerSectionStats_t* stats_out) final override;
+            virtual bool GetSectionStatsByIndex(size_t index, ProfilerSectionStats_t* stats_out) final override;
+            virtual void ResetStats() final override;
+            virtual bool WriteStatsCsv(OutputStream* output) final override;
+
         private:
+            struct StatsSection_t
+            {
+                std::string name;
+
+                float window[PROFILER_STATS_WINDOW];    // in milliseconds
+                size_t windowPos;
+
+                uint64_t numSamples;
+                uint64_t histogram[PROFILER_HISTOGRAM_BUCKETS];
+            };
+
+            void p_GetStats(const StatsSection_t& section, ProfilerSectionStats_t* stats_out);
             void p_PrintSectionProfile(ProfilingSection_t* section, int indent);
 
             PerfTimer timer;
 
+            std::mutex statsMutex;
+            std::vector<unique_ptr<StatsSection_t>> statsSections;
+
             ProfilingSection_t* current;
     };
 
+    // ====================================================================== //
+    //  zone recording
+    // ====================================================================== //
+
+    static uint64_t p_GetZoneTime()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static ZoneRing_t* p_GetZoneRing()
+    {
+        if (tls_zoneRing.ring != nullptr)
+            return tls_zoneRing.ring;
+
+        std::lock_guard<std::mutex> lg(s_zoneRingsMutex);
+
+        ZoneRing_t* ring = nullptr;
+
+        for (const auto& candidate : s_zoneRings)
+        {
+            if (!candidate->inUse.load())
+            {
+                ring = candidate.get();
+                break;
+            }
+        }
+
+        if (ring == nullptr)
+        {
+            s_zoneRings.emplace_back(new ZoneRing_t);
+            ring = s_zoneRings.back().get();
+            ring->threadID = (unsigned int) s_zoneRings.size();
+        }
+
+        ring->writeIndex.store(0);
+        ring->inUse.store(true);
+        snprintf(ring->threadName, sizeof(ring->threadName), "Thread %u", ring->threadID);
+
+        tls_zoneRing.ring = ring;
+        return ring;
+    }
+
+    static void p_RecordZoneEvent(const char* name, int type)
+    {
+        if (!s_zoneRecording.load(std::memory_order_relaxed))
+            return;
+
+        ZoneRing_t* ring = p_GetZoneRing();
+
+        const uint64_t index = ring->writeIndex.load(std::memory_order_relaxed);
+        ZoneEvent_t& event = ring->events[index & (ZONE_RING_SIZE - 1)];
+
+        event.name.store(name, std::memory_order_relaxed);
+        event.timeAndType.store((p_GetZoneTime() << 2) | type, std::memory_order_relaxed);
+
+        ring->writeIndex.store(index + 1, std::memory_order_release);
+    }
+
+    static void p_WriteJsonString(OutputStream* output, const char* string)
+    {
+        char buffer[256];
+        size_t length = 0;
+
+        for (; *string && length < sizeof(buffer) - 2; string++)
+        {
+            if (*string == '"' || *string == '\\')
+                buffer[length++] = '\\';
+
+            buffer[length++] = ((uint8_t) *string < 0x20) ? ' ' : *string;
+        }
+
+        output->write("\"");
+        output->write(buffer, length);
+        output->write("\"");
+    }
+
     // ====================================================================== //
     //  class Profiler
     // ====================================================================== //
@@ -40,6 +196,78 @@ namespace zfw
         return new ProfilerImpl();
     }
 
+    void Profiler::BeginZone(const char* name)
+    {
+        p_RecordZoneEvent(name, kZoneBegin);
+    }
+
+    void Profiler::EndZone()
+    {
+        p_RecordZoneEvent(nullptr, kZoneEnd);
+    }
+
+    const float* Profiler::GetHistogramBucketLimitsMs()
+    {
+        return s_histogramBucketLimitsMs;
+    }
+
+    void Profiler::MarkFrame()
+    {
+        p_RecordZoneEvent("Frame", kFrameMark);
+    }
+
+    void Profiler::SetRecording(bool enabled)
+    {
+        s_zoneRecording.store(enabled);
+    }
+
+    void Profiler::SetThreadName(const char* name)
+    {
+        ZoneRing_t* ring = p_GetZoneRing();
+
+        std::lock_guard<std::mutex> lg(s_zoneRingsMutex);
+        snprintf(ring->threadName, sizeof(ring->threadName), "%s", name);
+    }
+
+    void ProfilerImpl::AddSample(const char* section, uint64_t micros)
+    {
+        const float ms = micros / 1000.0f;
+
+        std::lock_guard<std::mutex> lg(statsMutex);
+
+        StatsSection_t* stats = nullptr;
+
+        for (const auto& candidate : statsSections)
+        {
+            if (candidate->name == section)
+            {
+                stats = candidate.get();
+                break;
+            }
+        }
+
+        if (stats == nullptr)
+        {
+            statsSections.emplace_back(new StatsSection_t);
+            stats = statsSections.back().get();
+            stats->name = section;
+            stats->windowPos = 0;
+            stats->numSamples = 0;
+            memset(stats->histogram, 0, sizeof(stats->histogram));
+        }
+
+        stats->window[stats->windowPos] = ms;
+        stats->windowPos = (stats->windowPos + 1) % PROFILER_STATS_WINDOW;
+        stats->numSamples++;
+
+        size_t bucket = 0;
+
+        while (ms > s_histogramBucketLimitsMs[bucket])
+            bucket++;
+
+        stats->histogram[bucket]++;
+    }
+
     void ProfilerImpl::BeginProfiling()
     {
         current = nullptr;
@@ -53,6 +281,39 @@ namespace zfw
         LeaveSection();
     }
 
+    size_t ProfilerImpl::GetNumStatsSections()
+    {
+        std::lock_guard<std::mutex> lg(statsMutex);
+        return statsSections.size();
+    }
+
+    bool ProfilerImpl::GetSectionStats(const char* section, ProfilerSectionStats_t* stats_out)
+    {
+        std::lock_guard<std::mutex> lg(statsMutex);
+
+        for (const auto& candidate : statsSections)
+        {
+            if (candidate->name == section)
+            {
+                p_GetStats(*candidate, stats_out);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool ProfilerImpl::GetSectionStatsByIndex(size_t index, ProfilerSectionStats_t* stats_out)
+    {
+        std::lock_guard<std::mutex> lg(statsMutex);
+
+        if (index >= statsSections.size())
+            return false;
+
+        p_GetStats(*statsSections[index], stats_out);
+        return true;
+    }
+
     void ProfilerImpl::EnterSection(ProfilingSection_t& section)
     {
         if (current)
@@ -79,6 +340,166 @@ namespace zfw
         current = current->parent;
     }
 
+    void ProfilerImpl::ResetStats()
+    {
+        std::lock_guard<std::mutex> lg(statsMutex);
+        statsSections.clear();
+    }
+
+    bool ProfilerImpl::WriteStatsCsv(OutputStream* output)
+    {
+        output->write("section,samples,min_ms,mean_ms,p95_ms,p99_ms,max_ms");
+
+        for (size_t i = 0; i < PROFILER_HISTOGRAM_BUCKETS - 1; i++)
+            output->write(sprintf_15(",<=%gms", s_histogramBucketLimitsMs[i]));
+
+        output->write(sprintf_15(",>%gms\n", s_histogramBucketLimitsMs[PROFILER_HISTOGRAM_BUCKETS - 2]));
+
+        const size_t numSections = GetNumStatsSections();
+
+        for (size_t i = 0; i < numSections; i++)
+        {
+            ProfilerSectionStats_t stats;
+
+            if (!GetSectionStatsByIndex(i, &stats))
+                break;
+
+            output->write(sprintf_255("%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f", stats.name, (unsigned long long) stats.numSamples,
+                    stats.minMs, stats.meanMs, stats.p95Ms, stats.p99Ms, stats.maxMs));
+
+            for (size_t j = 0; j < PROFILER_HISTOGRAM_BUCKETS; j++)
+                output->write(sprintf_15(",%llu", (unsigned long long) stats.histogram[j]));
+
+            output->write("\n");
+        }
+
+        return true;
+    }
+
+    bool ProfilerImpl::WriteChromeTrace(OutputStream* output, uint64_t lastMicros)
+    {
+        const uint64_t now = p_GetZoneTime();
+        const uint64_t since = (lastMicros * 1000 < now) ? now - lastMicros * 1000 : 0;
+
+        struct Event_t
+        {
+            const char* name;
+            uint64_t timeAndType;
+        };
+
+        std::vector<Event_t> events;
+        bool first = true;
+
+        output->write("{\"traceEvents\":[\n");
+
+        // Keeps threads from starting/renaming, not from recording
+        std::lock_guard<std::mutex> lg(s_zoneRingsMutex);
+
+        for (const auto& ring : s_zoneRings)
+        {
+            const uint64_t end = ring->writeIndex.load(std::memory_order_acquire);
+            const uint64_t begin = (end > ZONE_RING_SIZE) ? end - ZONE_RING_SIZE : 0;
+
+            events.clear();
+
+            for (uint64_t i = begin; i < end; i++)
+            {
+                const ZoneEvent_t& event = ring->events[i & (ZONE_RING_SIZE - 1)];
+                events.push_back(Event_t { event.name.load(std::memory_order_relaxed),
+                        event.timeAndType.load(std::memory_order_relaxed) });
+            }
+
+            // Anything the owner may have overwritten in the meantime is garbage
+            // (the slot following the newest event could be in the middle of being written)
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint64_t endAfter = ring->writeIndex.load(std::memory_order_relaxed);
+            uint64_t valid = begin;
+
+            if (endAfter + 1 > begin + ZONE_RING_SIZE)
+                valid = std::min(endAfter + 1 - ZONE_RING_SIZE, end);
+
+            output->write(sprintf_255("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                    first ? "" : ",\n", ring->threadID));
+            p_WriteJsonString(output, ring->threadName);
+            output->write("}}");
+            first = false;
+
+            // End events whose beginning has been lost (or precedes the window) would confuse the viewer.
+            // Zones nest and time only goes forward, so the skipped Begins are always the outermost ones.
+            int depth = 0, depthBeforeWindow = 0;
+
+            for (size_t i = (size_t)(valid - begin); i < events.size(); i++)
+            {
+                const uint64_t time = events[i].timeAndType >> 2;
+                const int type = (int)(events[i].timeAndType & 3);
+
+                if (type == kZoneBegin)
+                {
+                    depth++;
+
+                    if (time < since)
+                        depthBeforeWindow = depth;
+                }
+                else if (type == kZoneEnd)
+                {
+                    if (depth == 0)
+                        continue;
+
+                    depth--;
+
+                    if (depth < depthBeforeWindow)
+                    {
+                        depthBeforeWindow = depth;
+                        continue;
+                    }
+                }
+
+                if (time < since)
+                    continue;
+
+                const double ts = (double)(time - since) / 1000.0;
+
+                if (type == kZoneBegin)
+                {
+                    output->write(",\n{\"name\":");
+                    p_WriteJsonString(output, events[i].name);
+                    output->write(sprintf_255(",\"ph\":\"B\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}", ring->threadID, ts));
+                }
+                else if (type == kZoneEnd)
+                    output->write(sprintf_255(",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}", ring->threadID, ts));
+                else
+                    output->write(sprintf_255(",\n{\"name\":\"Frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+                            ring->threadID, ts));
+            }
+        }
+
+        output->write("\n]}\n");
+        return true;
+    }
+
+    void ProfilerImpl::p_GetStats(const StatsSection_t& section, ProfilerSectionStats_t* stats_out)
+    {
+        stats_out->name = section.name.c_str();
+        stats_out->numSamples = section.numSamples;
+        memcpy(stats_out->histogram, section.histogram, sizeof(stats_out->histogram));
+
+        const size_t count = (size_t) std::min<uint64_t>(section.numSamples, PROFILER_STATS_WINDOW);
+
+        std::vector<float> sorted(section.window, section.window + count);
+        std::sort(sorted.begin(), sorted.end());
+
+        float sum = 0.0f;
+
+        for (auto ms : sorted)
+            sum += ms;
+
+        stats_out->minMs = sorted.front();
+        stats_out->maxMs = sorted.back();
+        stats_out->meanMs = sum / count;
+        stats_out->p95Ms = sorted[(count - 1) * 95 / 100];
+        stats_out->p99Ms = sorted[(count - 1) * 99 / 100];
+    }
+
     void ProfilerImpl::p_PrintSectionProfile(ProfilingSection_t* section, int indent)
     {
         for (int i = 0; i < indent; i++)
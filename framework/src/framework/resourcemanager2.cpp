@@ -1,17 +1,24 @@
 
+#include <framework/jobsystem.hpp>
 #include <framework/resourcemanager2.hpp>
 #include <framework/system.hpp>
 
 #include <littl/List.hpp>
-#include <littl/String.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace zfw
 {
     using li::Allocator;
     using li::List;
-    using li::String;
 
 	static thread_local IResourceManager2* tls_scopedResourceManager = nullptr;
 
@@ -19,15 +26,78 @@ namespace zfw
     //  class declaration(s)
     // ====================================================================== //
 
+    typedef std::pair<TypeID, RecipeID_t> ResourceKey_t;
+
     struct Hasher
     {
         // musn't be static (is used as a template argument), but we don't want to pollute the zfw namespace
-        size_t operator()(const std::pair<TypeID, String>& value) const
+        size_t operator()(const ResourceKey_t& value) const
+        {
+            return value.first.hash_code() ^ (value.second * 0x9E3779B9u);
+        }
+    };
+
+    struct RecipeHasher
+    {
+        size_t operator()(const char* recipe) const
         {
-            return value.first.hash_code() ^ value.second.getHash();
+            // FNV-1a, 8 bytes at a time; recipes are long enough for the byte-wise version to show up in profiles
+            const size_t length = strlen(recipe);
+            uint64_t hash = 14695981039346656037ull ^ length;
+
+            size_t i = 0;
+
+            for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t))
+            {
+                uint64_t word;
+                memcpy(&word, recipe + i, sizeof(word));
+                hash = (hash ^ word) * 1099511628211ull;
+                hash ^= hash >> 32;
+            }
+
+            for (; i < length; i++)
+                hash = (hash ^ (uint8_t) recipe[i]) * 1099511628211ull;
+
+            return (size_t)(hash ^ (hash >> 32));
         }
     };
 
+    struct RecipeEquals
+    {
+        bool operator()(const char* a, const char* b) const
+        {
+            return strcmp(a, b) == 0;
+        }
+    };
+
+    class ResourceRequest : public IResourceRequest
+    {
+        public:
+            enum Stage_t { kStageQueued, kStagePreloading, kStagePreloaded, kStageDone, kStageFailed };
+
+            ResourceRequest(IResource2* res, const ResourceKey_t& key, size_t storage, bool isPrivate,
+                    IResource2::State_t targetState, int priority, uint64_t requestTime)
+                    : res(res), key(key), storage(storage), isPrivate(isPrivate), targetState(targetState),
+                    priority(priority), stage(kStageQueued), requestTime(requestTime)
+            {
+            }
+
+            virtual Status_t GetStatus() final override;
+            virtual IResource2* GetResource() final override { return (stage.load() == kStageDone) ? res : nullptr; }
+            virtual int GetPriority() final override { return priority.load(std::memory_order_relaxed); }
+            virtual void SetPriority(int priority) final override { this->priority.store(priority, std::memory_order_relaxed); }
+
+            IResource2* res;
+            ResourceKey_t key;
+            size_t storage;
+            bool isPrivate;
+            IResource2::State_t targetState;
+
+            std::atomic<int> priority;
+            std::atomic<int> stage;
+            uint64_t requestTime;
+    };
+
     class ResourceManager2 : public IResourceManager2
     {
         public:
@@ -39,6 +109,22 @@ namespace zfw
 
             // see GetResourceFlag_t for possible flags
             virtual IResource2* GetResource(const char* recipe, const TypeID& resourceClass, int flags) final override;
+            virtual IResource2* GetResourceByID(RecipeID_t recipe, const TypeID& resourceClass, int flags) final override;
+            virtual ResourceSlot_t* GetResourceSlot(RecipeID_t recipe, const TypeID& resourceClass, int flags) final override;
+
+            virtual RecipeID_t InternRecipe(const char* recipe) final override;
+            virtual const char* GetRecipeString(RecipeID_t recipe) final override { return recipes[recipe].recipe.c_str(); }
+
+            virtual shared_ptr<IResourceRequest> RequestResource(const char* recipe, const TypeID& resourceClass,
+                    int flags, int priority) final override;
+            virtual void ProcessRequests(uint64_t realizeBudgetMicros) final override;
+            virtual bool WaitForRequest(IResourceRequest* request) final override;
+            virtual void GetStreamingStats(ResourceStreamingStats_t* stats_out) final override;
+
+            virtual void SetMemoryBudget(size_t cpuBytes, size_t gpuBytes, uint32_t minIdleFrames) final override;
+            virtual void EnforceMemoryBudget() final override;
+            virtual void GetMemoryStats(ResourceMemoryStats_t* stats_out) final override;
+            virtual bool RestoreEvictedResource(ResourceSlot_t* slot) final override;
 
             virtual bool RegisterResourceProvider(const TypeID* resourceClasses, size_t numResourceClasses,
                     IResourceProvider2* provider) final override;
@@ -54,12 +140,18 @@ namespace zfw
             virtual bool MakeResourcesInSectionState(ResourceSection_t* sect, IResource2::State_t state, bool propagateError) final override;
 
         private:
+            struct RecipeEntry_t
+            {
+                std::string recipe;
+                uint32_t numResources;          // shared resources keyed by this recipe
+            };
+
             struct ResourceSectionStorage_t
             {
                 ResourceSection_t* key;
 
                 std::unordered_map<
-                        std::pair<TypeID, String>,
+                        ResourceKey_t,
                         IResource2*,
                         Hasher
                         > resources;
@@ -67,22 +159,81 @@ namespace zfw
                 List<IResource2*> privateResources;
             };
 
+            static void PreloadJob(void* userData) { static_cast<ResourceManager2*>(userData)->p_PreloadNextRequest(); }
+
             void p_ClearStorage(size_t storage);
             IResource2* p_CreateResource(const char* recipe, const TypeID& resourceClass, int flags);
+            void p_DestroyResource(IResource2* res);
+            void p_FinishAllRequests();
+            bool p_FinishRequest(shared_ptr<ResourceRequest> request);
+            void p_GetMemoryUsage(size_t* cpuBytes_out, size_t* gpuBytes_out);
+            IResource2* p_GetResource(RecipeID_t recipe, const TypeID& resourceClass, int flags, bool pin,
+                    bool* created_out);
             size_t p_GetStorageForSection(ResourceSection_t* key);
             bool p_MakeResourceCorrectState(IResource2* res);
             bool p_MakeResourcesInStorageState(size_t storage, IResource2::State_t state, bool propagateError);
+            void p_PreloadNextRequest();
+            void p_PreloadResourcesParallel(IJobSystem* jobSystem, const std::vector<IResource2*>& resources);
+            void p_ReleaseRecipeIfUnused(RecipeID_t recipe);
+            bool p_TransitionResource(IResource2* res, IResource2::State_t state, bool propagateError);
+            bool p_TryClaim(std::vector<shared_ptr<ResourceRequest>>& queue, ResourceRequest* request);
 
             ISystem* sys;
 
             IResource2::State_t targetState;
 
             ResourceSection_t* currentSection;
+            size_t currentStorage;
 
             List<ResourceSectionStorage_t, size_t, Allocator<ResourceSectionStorage_t>, li::ArrayOptions::noBoundsChecking> storages;
             std::unordered_map<TypeID, IResourceProvider2*> providers;
+
+            // recipe interning; keys point into recipes, which never moves its elements.
+            // Entries are recycled once no resource is keyed by them (see p_ReleaseRecipeIfUnused).
+            std::unordered_map<const char*, RecipeID_t, RecipeHasher, RecipeEquals> recipeIDs;
+            std::deque<RecipeEntry_t> recipes;
+            std::vector<RecipeID_t> freeRecipes;
+
+            // handles (see GetResourceSlot); deque for stable addresses
+            std::deque<ResourceSlot_t> slots;
+            std::vector<ResourceSlot_t*> freeSlots;
+            std::unordered_map<IResource2*, ResourceSlot_t*> slotsByResource;
+
+            // eviction (see SetMemoryBudget); restoring an evicted resource may only happen on this thread
+            std::thread::id ownerThread;
+            size_t cpuBudget, gpuBudget;
+            uint32_t minIdleFrames;
+            uint32_t frameNumber;
+            size_t numEvictedResources;
+            ResourceMemoryStats_t memoryStats;
+
+            // streaming (see RequestResource)
+            std::unordered_map<IResource2*, shared_ptr<ResourceRequest>> pendingRequests;
+
+            std::mutex preloadMutex;
+            std::vector<shared_ptr<ResourceRequest>> preloadQueue;
+
+            std::mutex realizeMutex;
+            std::vector<shared_ptr<ResourceRequest>> realizeQueue;
+
+            JobCounter_t preloadCounter;
+            ResourceStreamingStats_t stats;
     };
 
+    // ====================================================================== //
+    //  class ResourceRequest
+    // ====================================================================== //
+
+    IResourceRequest::Status_t ResourceRequest::GetStatus()
+    {
+        switch (stage.load())
+        {
+            case kStageDone:    return kReady;
+            case kStageFailed:  return kFailed;
+            default:            return kPending;
+        }
+    }
+
     // ====================================================================== //
     //  class ResourceManager2
     // ====================================================================== //
@@ -100,10 +251,38 @@ namespace zfw
         storages.addEmpty().key = nullptr;
 
         currentSection = nullptr;
+        currentStorage = 0;
+
+        stats = ResourceStreamingStats_t();
+
+        ownerThread = std::this_thread::get_id();
+        cpuBudget = 0;
+        gpuBudget = 0;
+        minIdleFrames = 0;
+        frameNumber = 0;
+        numEvictedResources = 0;
+        memoryStats = ResourceMemoryStats_t();
     }
 
     ResourceManager2::~ResourceManager2()
     {
+        // Cancel preloads that haven't started yet (their jobs will find the queue empty),
+        // let in-flight ones finish, but don't bother realizing anything
+        {
+            std::lock_guard<std::mutex> lg(preloadMutex);
+            preloadQueue.clear();
+        }
+
+        IJobSystem* jobSystem = sys->GetJobSystem();
+
+        if (jobSystem != nullptr)
+            jobSystem->WaitForCounter(&preloadCounter);
+
+        zombie_assert(preloadCounter.IsDone());
+
+        pendingRequests.clear();
+        realizeQueue.clear();
+
         for (size_t i = 0; i < storages.getLength(); i++)
             p_ClearStorage(i);
     }
@@ -116,38 +295,266 @@ namespace zfw
     void ResourceManager2::EnterResourceSection(ResourceSection_t* sect)
     {
         currentSection = sect;
+        currentStorage = p_GetStorageForSection(sect);
+    }
+
+    void ResourceManager2::EnforceMemoryBudget()
+    {
+        frameNumber++;
+        memoryStats.numEvictedLastFrame = 0;
+
+        for (const auto& entry : slotsByResource)
+        {
+            ResourceSlot_t* slot = entry.second;
+
+            if (slot->touched.exchange(false, std::memory_order_relaxed))
+            {
+                slot->lastUsedFrame = frameNumber;
+
+                // Asked for through GetIfResident, which can't restore it by itself.
+                // (Restoring doesn't re-bind, so no slots are added while we iterate.)
+                if (slot->evicted)
+                    RestoreEvictedResource(slot);
+            }
+        }
+
+        if (cpuBudget == 0 && gpuBudget == 0)
+            return;
+
+        size_t cpuBytes, gpuBytes;
+        p_GetMemoryUsage(&cpuBytes, &gpuBytes);
+
+        if ((cpuBudget == 0 || cpuBytes <= cpuBudget) && (gpuBudget == 0 || gpuBytes <= gpuBudget))
+            return;
+
+        std::vector<ResourceSlot_t*> candidates;
+
+        for (const auto& entry : slotsByResource)
+        {
+            ResourceSlot_t* slot = entry.second;
+
+            if (slot->pinned || frameNumber - slot->lastUsedFrame < minIdleFrames)
+                continue;
+
+            const auto state = slot->res->GetState();
+
+            if ((state == IResource2::PRELOADED || state == IResource2::REALIZED)
+                    && pendingRequests.find(slot->res) == pendingRequests.end())
+                candidates.push_back(slot);
+        }
+
+        std::sort(candidates.begin(), candidates.end(), [](const ResourceSlot_t* a, const ResourceSlot_t* b)
+        {
+            return a->lastUsedFrame < b->lastUsedFrame;
+        });
+
+        for (auto slot : candidates)
+        {
+            const bool overCpu = (cpuBudget != 0 && cpuBytes > cpuBudget);
+            const bool overGpu = (gpuBudget != 0 && gpuBytes > gpuBudget);
+
+            if (!overCpu && !overGpu)
+                break;
+
+            IResource2* res = slot->res;
+
+            // Dropping to PRELOADED only frees video memory
+            if (!overCpu && res->GetState() != IResource2::REALIZED)
+                continue;
+
+            size_t cpuBefore, gpuBefore, cpuAfter, gpuAfter;
+            res->GetMemoryUsage(&cpuBefore, &gpuBefore);
+
+            // Nothing to gain (e.g. a resource that doesn't report its usage)
+            if ((overCpu ? cpuBefore : 0) + (overGpu ? gpuBefore : 0) == 0)
+                continue;
+
+            if (!res->StateTransitionTo(overCpu ? IResource2::BOUND : IResource2::PRELOADED, this))
+                continue;
+
+            res->GetMemoryUsage(&cpuAfter, &gpuAfter);
+            cpuBytes -= std::min(cpuBytes, cpuBefore - std::min(cpuBefore, cpuAfter));
+            gpuBytes -= std::min(gpuBytes, gpuBefore - std::min(gpuBefore, gpuAfter));
+
+            if (!slot->evicted)
+            {
+                slot->evicted = true;
+                numEvictedResources++;
+            }
+
+            memoryStats.numEvictedLastFrame++;
+            memoryStats.numEvictedTotal++;
+        }
+    }
+
+    void ResourceManager2::GetMemoryStats(ResourceMemoryStats_t* stats_out)
+    {
+        *stats_out = memoryStats;
+        stats_out->cpuBudget = cpuBudget;
+        stats_out->gpuBudget = gpuBudget;
+
+        p_GetMemoryUsage(&stats_out->cpuBytes, &stats_out->gpuBytes);
     }
 
     IResource2* ResourceManager2::GetResource(const char* recipe, const TypeID& resourceClass, int flags)
     {
-        const auto key = std::pair<TypeID, String>(resourceClass, recipe);
+        return GetResourceByID(InternRecipe(recipe), resourceClass, flags);
+    }
+
+    IResource2* ResourceManager2::GetResourceByID(RecipeID_t recipe, const TypeID& resourceClass, int flags)
+    {
+        // The caller gets a raw pointer, which can't be tracked, so the resource must never be evicted
+        bool created;
+        return p_GetResource(recipe, resourceClass, flags, true, &created);
+    }
 
-        auto storage = p_GetStorageForSection(currentSection);
+    IResource2* ResourceManager2::p_GetResource(RecipeID_t recipe, const TypeID& resourceClass, int flags, bool pin,
+            bool* created_out)
+    {
+        const auto key = ResourceKey_t(resourceClass, recipe);
+
+        const auto storage = currentStorage;
         auto resourceEntry = storages[storage].resources.find(key);
         
         if (resourceEntry != storages[storage].resources.end())
-            return resourceEntry->second;
+        {
+            IResource2* res = resourceEntry->second;
+
+            // Still streaming in? Then we have to wait for it.
+            if (!pendingRequests.empty())
+            {
+                auto pending = pendingRequests.find(res);
+
+                if (pending != pendingRequests.end() && !WaitForRequest(pending->second.get()))
+                    return nullptr;
+            }
+
+            if (pin ? !slotsByResource.empty() : numEvictedResources > 0)
+            {
+                auto slot = slotsByResource.find(res);
+
+                if (slot != slotsByResource.end())
+                {
+                    if (slot->second->evicted && !RestoreEvictedResource(slot->second))
+                        return nullptr;
+
+                    if (pin)
+                        slot->second->pinned = true;
+                }
+            }
+
+            *created_out = false;
+            return res;
+        }
 
         zombie_assert((flags & kResourceNeverCreate) == 0);
         
-        unique_ptr<IResource2> res(p_CreateResource(recipe, resourceClass, flags));
+        unique_ptr<IResource2> res(p_CreateResource(GetRecipeString(recipe), resourceClass, flags));
         
-        if (!res/* || !p_MakeResourceCorrectState(res.get())*/)
-            return nullptr;
-
-        if (!p_MakeResourceCorrectState(res.get()))
+        if (!res || !p_MakeResourceCorrectState(res.get()))
+        {
             //sys->PrintError(g_essentials->GetErrorBuffer(), kLogError);
+            p_ReleaseRecipeIfUnused(recipe);
             return nullptr;
+        }
+
+        *created_out = true;
 
         if (!(flags & kResourcePrivate))
+        {
+            recipes[recipe].numResources++;
             return (storages[storage].resources[key] = res.release());
+        }
         else
+        {
+            // Private resources aren't looked up by recipe, so they don't keep it interned
+            p_ReleaseRecipeIfUnused(recipe);
             return (storages[storage].privateResources.addEmpty() = res.release());
+        }
+    }
+
+    ResourceSlot_t* ResourceManager2::GetResourceSlot(RecipeID_t recipe, const TypeID& resourceClass, int flags)
+    {
+        zombie_assert((flags & kResourcePrivate) == 0);
+
+        bool created;
+        IResource2* res = p_GetResource(recipe, resourceClass, flags, false, &created);
+
+        if (res == nullptr)
+            return nullptr;
+
+        auto& slot = slotsByResource[res];
+
+        if (slot == nullptr)
+        {
+            if (!freeSlots.empty())
+            {
+                slot = freeSlots.back();
+                freeSlots.pop_back();
+            }
+            else
+            {
+                slots.emplace_back();
+                slot = &slots.back();
+                slot->generation = 0;
+            }
+
+            slot->res = res;
+            slot->resMgr = this;
+            slot->lastUsedFrame = frameNumber;
+            slot->touched = false;
+            slot->evicted = false;
+
+            // If it existed before its first handle, it may have been handed out as a raw pointer already
+            slot->pinned = !created;
+        }
+
+        return slot;
+    }
+
+    void ResourceManager2::GetStreamingStats(ResourceStreamingStats_t* stats_out)
+    {
+        *stats_out = stats;
+
+        {
+            std::lock_guard<std::mutex> lg(realizeMutex);
+            stats_out->numQueuedForRealize = realizeQueue.size();
+        }
+
+        stats_out->numQueuedForPreload = pendingRequests.size() - stats_out->numQueuedForRealize;
+    }
+
+    RecipeID_t ResourceManager2::InternRecipe(const char* recipe)
+    {
+        auto it = recipeIDs.find(recipe);
+
+        if (it != recipeIDs.end())
+            return it->second;
+
+        RecipeID_t id;
+
+        if (!freeRecipes.empty())
+        {
+            id = freeRecipes.back();
+            freeRecipes.pop_back();
+            recipes[id].recipe = recipe;
+        }
+        else
+        {
+            id = static_cast<RecipeID_t>(recipes.size());
+            recipes.emplace_back();
+            recipes.back().recipe = recipe;
+        }
+
+        recipes[id].numResources = 0;
+        recipeIDs.emplace(recipes[id].recipe.c_str(), id);
+        return id;
     }
 
     void ResourceManager2::LeaveResourceSection()
     {
         currentSection = nullptr;
+        currentStorage = 0;
     }
 
     bool ResourceManager2::MakeAllResourcesState(IResource2::State_t state, bool propagateError)
@@ -170,14 +577,19 @@ namespace zfw
 
     void ResourceManager2::p_ClearStorage(size_t storage)
     {
+        p_FinishAllRequests();
+
         for (auto& resource : storages[storage].resources)
         {
-            delete resource.second;
+            p_DestroyResource(resource.second);
             resource.second = nullptr;
+
+            recipes[resource.first.second].numResources--;
+            p_ReleaseRecipeIfUnused(resource.first.second);
         }
 
         for (auto res : storages[storage].privateResources)
-            delete res;
+            p_DestroyResource(res);
         
         storages[storage].resources.clear();
         storages[storage].privateResources.clear();
@@ -203,6 +615,114 @@ namespace zfw
         return provider->second->CreateResource(this, resourceClass, recipe, flags);
     }
 
+    void ResourceManager2::p_DestroyResource(IResource2* res)
+    {
+        auto it = slotsByResource.find(res);
+
+        if (it != slotsByResource.end())
+        {
+            if (it->second->evicted)
+                numEvictedResources--;
+
+            // Invalidate any outstanding handles
+            it->second->res = nullptr;
+            it->second->generation++;
+            freeSlots.push_back(it->second);
+            slotsByResource.erase(it);
+        }
+
+        delete res;
+    }
+
+    void ResourceManager2::p_FinishAllRequests()
+    {
+        if (pendingRequests.empty())
+            return;
+
+        std::vector<shared_ptr<ResourceRequest>> requests;
+
+        for (const auto& pending : pendingRequests)
+            requests.push_back(pending.second);
+
+        for (const auto& request : requests)
+            WaitForRequest(request.get());
+    }
+
+    bool ResourceManager2::p_FinishRequest(shared_ptr<ResourceRequest> request)
+    {
+        IResource2* res = request->res;
+        pendingRequests.erase(res);
+
+        const uint64_t latency = sys->GetGlobalMicros() - request->requestTime;
+        stats.maxRequestLatencyMicros = std::max(stats.maxRequestLatencyMicros, latency);
+
+        if (res->StateTransitionTo(request->targetState, this))
+        {
+            request->stage.store(ResourceRequest::kStageDone);
+            return true;
+        }
+
+        sys->PrintError(g_essentials->GetErrorBuffer(), kLogError);
+
+        // Nobody has seen the resource yet (other than through this request), so drop it
+        auto& storage = storages[request->storage];
+
+        if (!request->isPrivate)
+        {
+            storage.resources.erase(request->key);
+            recipes[request->key.second].numResources--;
+            p_ReleaseRecipeIfUnused(request->key.second);
+        }
+        else
+            storage.privateResources.removeItem(res);
+
+        p_DestroyResource(res);
+        request->res = nullptr;
+        request->stage.store(ResourceRequest::kStageFailed);
+        return false;
+    }
+
+    void ResourceManager2::p_GetMemoryUsage(size_t* cpuBytes_out, size_t* gpuBytes_out)
+    {
+        size_t cpuBytes = 0, gpuBytes = 0, cpu, gpu;
+
+        // A worker may be in the middle of preloading a requested resource; don't look at it until it's done
+        auto isBeingPreloaded = [this](IResource2* res)
+        {
+            if (pendingRequests.empty())
+                return false;
+
+            auto pending = pendingRequests.find(res);
+            return pending != pendingRequests.end() && pending->second->stage.load() < ResourceRequest::kStagePreloaded;
+        };
+
+        for (size_t i = 0; i < storages.getLength(); i++)
+        {
+            for (const auto& resource : storages[i].resources)
+            {
+                if (isBeingPreloaded(resource.second))
+                    continue;
+
+                resource.second->GetMemoryUsage(&cpu, &gpu);
+                cpuBytes += cpu;
+                gpuBytes += gpu;
+            }
+
+            for (auto res : storages[i].privateResources)
+            {
+                if (isBeingPreloaded(res))
+                    continue;
+
+                res->GetMemoryUsage(&cpu, &gpu);
+                cpuBytes += cpu;
+                gpuBytes += gpu;
+            }
+        }
+
+        *cpuBytes_out = cpuBytes;
+        *gpuBytes_out = gpuBytes;
+    }
+
     size_t ResourceManager2::p_GetStorageForSection(ResourceSection_t* key)
     {
         for (size_t i = 0; i < storages.getLength(); i++)
@@ -234,25 +754,166 @@ namespace zfw
 
     bool ResourceManager2::p_MakeResourcesInStorageState(size_t storage, IResource2::State_t state, bool propagateError)
     {
+        // Workers must not touch resources while we transition them
+        p_FinishAllRequests();
+
+        // Take a snapshot; transitions may create new resources (which are brought to targetState on creation)
+        std::vector<IResource2*> resources;
+        resources.reserve(storages[storage].resources.size() + storages[storage].privateResources.getLength());
+
         for (auto& resource : storages[storage].resources)
-            if (!resource.second->StateTransitionTo(state, this))
-            {
-                if (propagateError)
-                    return false;
-                else
-                    sys->PrintError(g_essentials->GetErrorBuffer(), kLogError);
-            }
+            resources.push_back(resource.second);
 
         for (auto res : storages[storage].privateResources)
-            if (!res->StateTransitionTo(state, this))
+            resources.push_back(res);
+
+        IJobSystem* jobSystem = sys->GetJobSystem();
+
+        if (jobSystem != nullptr && (state == IResource2::PRELOADED || state == IResource2::REALIZED))
+            p_PreloadResourcesParallel(jobSystem, resources);
+
+        // Whatever is left (binding, realization, and any failed preloads) happens on this thread
+        for (auto res : resources)
+            if (!p_TransitionResource(res, state, propagateError))
+                return false;
+
+        return true;
+    }
+
+    void ResourceManager2::p_PreloadNextRequest()
+    {
+        shared_ptr<ResourceRequest> request;
+
+        {
+            std::lock_guard<std::mutex> lg(preloadMutex);
+
+            // May have been claimed by WaitForRequest in the meantime
+            if (preloadQueue.empty())
+                return;
+
+            auto best = std::max_element(preloadQueue.begin(), preloadQueue.end(),
+                    [](const shared_ptr<ResourceRequest>& a, const shared_ptr<ResourceRequest>& b)
+                    {
+                        return a->GetPriority() < b->GetPriority();
+                    });
+
+            request = move(*best);
+            preloadQueue.erase(best);
+            request->stage.store(ResourceRequest::kStagePreloading);
+        }
+
+        // On failure, the resource stays BOUND; the error will be reproduced & reported in p_FinishRequest
+        request->res->StateTransitionTo(IResource2::PRELOADED, this);
+
+        std::lock_guard<std::mutex> lg(realizeMutex);
+        request->stage.store(ResourceRequest::kStagePreloaded);
+        realizeQueue.push_back(move(request));
+    }
+
+    void ResourceManager2::p_PreloadResourcesParallel(IJobSystem* jobSystem, const std::vector<IResource2*>& resources)
+    {
+        std::vector<IResource2*> toPreload;
+
+        for (auto res : resources)
+        {
+            // BindDependencies can call back into the resource manager, so do it here.
+            // Errors are left to be reported by the serial pass.
+            if (res->GetState() == IResource2::CREATED)
+                res->StateTransitionTo(IResource2::BOUND, this);
+
+            if (res->GetState() == IResource2::BOUND)
+                toPreload.push_back(res);
+        }
+
+        if (toPreload.size() < 2)
+            return;
+
+        // Preload runs on worker threads; a resource that fails stays BOUND
+        // and will be retried (and its error reported) on the calling thread
+        jobSystem->ParallelFor(0, toPreload.size(), 1, [this, &toPreload](size_t i)
+        {
+            toPreload[i]->StateTransitionTo(IResource2::PRELOADED, this);
+        });
+    }
+
+    void ResourceManager2::p_ReleaseRecipeIfUnused(RecipeID_t recipe)
+    {
+        auto& entry = recipes[recipe];
+
+        if (entry.numResources != 0)
+            return;
+
+        recipeIDs.erase(entry.recipe.c_str());
+
+        // Don't hold on to the capacity of long recipes either
+        std::string().swap(entry.recipe);
+        freeRecipes.push_back(recipe);
+    }
+
+    bool ResourceManager2::p_TransitionResource(IResource2* res, IResource2::State_t state, bool propagateError)
+    {
+        if (!res->StateTransitionTo(state, this))
+        {
+            if (propagateError)
+                return false;
+            else
+                sys->PrintError(g_essentials->GetErrorBuffer(), kLogError);
+        }
+
+        return true;
+    }
+
+    bool ResourceManager2::p_TryClaim(std::vector<shared_ptr<ResourceRequest>>& queue, ResourceRequest* request)
+    {
+        auto it = std::find_if(queue.begin(), queue.end(), [request](const shared_ptr<ResourceRequest>& queued)
+        {
+            return queued.get() == request;
+        });
+
+        if (it == queue.end())
+            return false;
+
+        queue.erase(it);
+        return true;
+    }
+
+    void ResourceManager2::ProcessRequests(uint64_t realizeBudgetMicros)
+    {
+        stats.numRealizedLastFrame = 0;
+        stats.realizeMicrosLastFrame = 0;
+
+        const uint64_t start = sys->GetGlobalMicros();
+
+        for (;;)
+        {
+            // Always make some progress, even with a tiny budget
+            if (stats.numRealizedLastFrame > 0 && sys->GetGlobalMicros() - start >= realizeBudgetMicros)
+                break;
+
+            // Take requests one by one; realizing a resource might need to wait for another queued one
+            shared_ptr<ResourceRequest> request;
+
             {
-                if (propagateError)
-                    return false;
-                else
-                    sys->PrintError(g_essentials->GetErrorBuffer(), kLogError);
+                std::lock_guard<std::mutex> lg(realizeMutex);
+
+                if (realizeQueue.empty())
+                    break;
+
+                auto best = std::max_element(realizeQueue.begin(), realizeQueue.end(),
+                        [](const shared_ptr<ResourceRequest>& a, const shared_ptr<ResourceRequest>& b)
+                        {
+                            return a->GetPriority() < b->GetPriority();
+                        });
+
+                request = move(*best);
+                realizeQueue.erase(best);
             }
 
-        return true;
+            p_FinishRequest(move(request));
+            stats.numRealizedLastFrame++;
+        }
+
+        stats.realizeMicrosLastFrame = sys->GetGlobalMicros() - start;
     }
 
     bool ResourceManager2::RegisterResourceProvider(const TypeID* resourceClasses, size_t numResourceClasses,
@@ -272,6 +933,135 @@ namespace zfw
         return true;
     }
 
+    bool ResourceManager2::RestoreEvictedResource(ResourceSlot_t* slot)
+    {
+        if (!slot->evicted)
+            return true;
+
+        zombie_assert(std::this_thread::get_id() == ownerThread);
+
+        if (!slot->res->StateTransitionTo(targetState, this))
+        {
+            sys->PrintError(g_essentials->GetErrorBuffer(), kLogError);
+            return false;
+        }
+
+        slot->evicted = false;
+        slot->lastUsedFrame = frameNumber;
+        numEvictedResources--;
+        memoryStats.numRestoredTotal++;
+        return true;
+    }
+
+    shared_ptr<IResourceRequest> ResourceManager2::RequestResource(const char* recipe, const TypeID& resourceClass,
+            int flags, int priority)
+    {
+        const auto key = ResourceKey_t(resourceClass, InternRecipe(recipe));
+
+        const auto storage = currentStorage;
+        auto resourceEntry = storages[storage].resources.find(key);
+
+        if (resourceEntry != storages[storage].resources.end())
+        {
+            IResource2* res = resourceEntry->second;
+            auto pending = pendingRequests.find(res);
+
+            if (pending != pendingRequests.end())
+            {
+                if (pending->second->GetPriority() < priority)
+                    pending->second->SetPriority(priority);
+
+                return pending->second;
+            }
+
+            // Already resident; GetResource() on the request hands out a raw pointer, so pin it like GetResource does
+            auto slot = slotsByResource.find(res);
+
+            if (slot != slotsByResource.end())
+            {
+                if (slot->second->evicted && !RestoreEvictedResource(slot->second))
+                    return nullptr;
+
+                slot->second->pinned = true;
+            }
+
+            auto request = std::make_shared<ResourceRequest>(res, key, storage, false, targetState, priority, 0);
+            request->stage.store(ResourceRequest::kStageDone);
+            return request;
+        }
+
+        if (flags & kResourceNeverCreate)
+        {
+            p_ReleaseRecipeIfUnused(key.second);
+            return nullptr;
+        }
+
+        unique_ptr<IResource2> res(p_CreateResource(recipe, resourceClass, flags));
+
+        // BindDependencies can call back into the resource manager, so it has to happen right here
+        const auto target = targetState;
+        const bool needsPreload = (target == IResource2::PRELOADED || target == IResource2::REALIZED);
+
+        if (!res || !res->StateTransitionTo(needsPreload ? IResource2::BOUND : target, this))
+        {
+            p_ReleaseRecipeIfUnused(key.second);
+            return nullptr;
+        }
+
+        const bool isPrivate = (flags & kResourcePrivate) != 0;
+
+        if (!isPrivate)
+        {
+            storages[storage].resources[key] = res.get();
+            recipes[key.second].numResources++;
+        }
+        else
+        {
+            storages[storage].privateResources.add(res.get());
+            p_ReleaseRecipeIfUnused(key.second);
+        }
+
+        auto request = std::make_shared<ResourceRequest>(res.release(), key, storage, isPrivate, target, priority,
+                sys->GetGlobalMicros());
+
+        if (!needsPreload)
+        {
+            request->stage.store(ResourceRequest::kStageDone);
+            return request;
+        }
+
+        pendingRequests[request->res] = request;
+
+        IJobSystem* jobSystem = sys->GetJobSystem();
+
+        if (jobSystem != nullptr)
+        {
+            {
+                std::lock_guard<std::mutex> lg(preloadMutex);
+                preloadQueue.push_back(request);
+            }
+
+            // Each job picks up whatever is the most important request at the time it starts
+            jobSystem->Submit(Job_t{ &PreloadJob, this }, &preloadCounter);
+        }
+        else
+        {
+            // No workers; ProcessRequests will do the whole thing
+            std::lock_guard<std::mutex> lg(realizeMutex);
+            request->stage.store(ResourceRequest::kStagePreloaded);
+            realizeQueue.push_back(request);
+        }
+
+        return request;
+    }
+
+    void ResourceManager2::SetMemoryBudget(size_t cpuBytes, size_t gpuBytes, uint32_t minIdleFrames)
+    {
+        cpuBudget = cpuBytes;
+        gpuBudget = gpuBytes;
+        this->minIdleFrames = minIdleFrames;
+    }
+
     void ResourceManager2::UnregisterResourceProvider(IResourceProvider2* provider)
     {
         for (auto it = providers.begin(); it != providers.end();)
@@ -283,6 +1073,50 @@ namespace zfw
         }
     }
 
+    bool ResourceManager2::WaitForRequest(IResourceRequest* request_in)
+    {
+        auto request = static_cast<ResourceRequest*>(request_in);
+
+        if (request->stage.load() >= ResourceRequest::kStageDone)
+            return request->stage.load() == ResourceRequest::kStageDone;
+
+        // Keep the request alive while we work on it
+        auto pending = pendingRequests.find(request->res);
+        zombie_assert(pending != pendingRequests.end());
+        shared_ptr<ResourceRequest> keepAlive = pending->second;
+
+        const uint64_t start = sys->GetGlobalMicros();
+        bool claimed = false;
+
+        while (!claimed)
+        {
+            const int stage = request->stage.load();
+
+            if (stage == ResourceRequest::kStageQueued)
+            {
+                // Not picked up by a worker yet; do it ourselves
+                {
+                    std::lock_guard<std::mutex> lg(preloadMutex);
+                    claimed = p_TryClaim(preloadQueue, request);
+                }
+
+                if (claimed)
+                    request->res->StateTransitionTo(IResource2::PRELOADED, this);
+            }
+            else if (stage == ResourceRequest::kStagePreloaded)
+            {
+                std::lock_guard<std::mutex> lg(realizeMutex);
+                claimed = p_TryClaim(realizeQueue, request);
+            }
+            else
+                std::this_thread::yield();
+        }
+
+        stats.stallMicrosTotal += sys->GetGlobalMicros() - start;
+
+        return p_FinishRequest(move(keepAlive));
+    }
+
 	// ====================================================================== //
 	//  class ResourceManagerScope
 	// ====================================================================== //
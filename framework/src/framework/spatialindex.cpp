@@ -0,0 +1,320 @@
+#include <framework/spatialindex.hpp>
+
+#include <framework/utility/essentials.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace zfw
+{
+    // Cell coordinates are clamped to 21 bits each, so that a cell fits in 64 bits
+    static const int kCellRange = 1 << 20;
+
+    static int ToCell(float value, float invCellSize)
+    {
+        const float cell = value * invCellSize;
+
+        // Also catches NaN
+        if (!(cell >= -kCellRange))
+            return -kCellRange;
+        else if (cell > kCellRange - 1)
+            return kCellRange - 1;
+
+        // floor() without the library call; this runs for every moving entity on every tick
+        const int truncated = (int) cell;
+        return truncated - (cell < truncated ? 1 : 0);
+    }
+
+    static uint64_t MakeCell(int x, int y, int z)
+    {
+        return (uint64_t) (x + kCellRange)
+                | ((uint64_t) (y + kCellRange) << 21)
+                | ((uint64_t) (z + kCellRange) << 42);
+    }
+
+    static bool Overlaps(const Float3& min1, const Float3& max1, const Float3& min2, const Float3& max2)
+    {
+        return min1.x <= max2.x && max1.x >= min2.x
+                && min1.y <= max2.y && max1.y >= min2.y
+                && min1.z <= max2.z && max1.z >= min2.z;
+    }
+
+    static float DistanceSquared(const Float3& point, const Float3& min, const Float3& max)
+    {
+        float dist = 0.0f;
+
+        for (int i = 0; i < 3; i++)
+        {
+            if (point[i] < min[i])
+                dist += (min[i] - point[i]) * (min[i] - point[i]);
+            else if (point[i] > max[i])
+                dist += (point[i] - max[i]) * (point[i] - max[i]);
+        }
+
+        return dist;
+    }
+
+    static bool IntersectRay(const Float3& origin, const Float3& dir, const Float3& min, const Float3& max,
+            float maxT, float& t_out)
+    {
+        float t0 = 0.0f, t1 = maxT;
+
+        for (int i = 0; i < 3; i++)
+        {
+            if (dir[i] == 0.0f)
+            {
+                if (origin[i] < min[i] || origin[i] > max[i])
+                    return false;
+
+                continue;
+            }
+
+            float entry = (min[i] - origin[i]) / dir[i];
+            float exit = (max[i] - origin[i]) / dir[i];
+
+            if (entry > exit)
+                std::swap(entry, exit);
+
+            t0 = std::max(t0, entry);
+            t1 = std::min(t1, exit);
+
+            if (t0 > t1)
+                return false;
+        }
+
+        t_out = t0;
+        return true;
+    }
+
+    void SpatialIndex::Clear()
+    {
+        items.clear();
+        cells.clear();
+        large.clear();
+    }
+
+    void SpatialIndex::Insert(uint32_t key, const Float3& min, const Float3& max)
+    {
+        zombie_assert(!Contains(key));
+
+        if (key >= items.size())
+            items.resize(key + 1, Item_t { Float3(), Float3(), 0, 0, kNowhere });
+
+        items[key].min = min;
+        items[key].max = max;
+        p_File(key);
+    }
+
+    uint64_t SpatialIndex::p_GetCell(const Float3& pos) const
+    {
+        return MakeCell(ToCell(pos.x, invCellSize), ToCell(pos.y, invCellSize), ToCell(pos.z, invCellSize));
+    }
+
+    bool SpatialIndex::p_IsLarge(const Float3& min, const Float3& max) const
+    {
+        return max.x - min.x > cellSize || max.y - min.y > cellSize || max.z - min.z > cellSize;
+    }
+
+    void SpatialIndex::p_File(uint32_t key)
+    {
+        Item_t& item = items[key];
+
+        if (p_IsLarge(item.min, item.max))
+        {
+            item.where = kLarge;
+            item.indexInCell = (uint32_t) large.size();
+            large.push_back(key);
+        }
+        else
+        {
+            item.where = kInCell;
+            item.cell = p_GetCell((item.min + item.max) * 0.5f);
+
+            auto& cell = cells[item.cell];
+            item.indexInCell = (uint32_t) cell.size();
+            cell.push_back(key);
+        }
+    }
+
+    void SpatialIndex::p_Unfile(uint32_t key)
+    {
+        Item_t& item = items[key];
+
+        std::vector<uint32_t>* list;
+        auto it = cells.end();
+
+        if (item.where == kLarge)
+            list = &large;
+        else
+        {
+            it = cells.find(item.cell);
+            zombie_assert(it != cells.end());
+            list = &it->second;
+        }
+
+        // Fill the hole with the last key
+        const uint32_t moved = list->back();
+        (*list)[item.indexInCell] = moved;
+        items[moved].indexInCell = item.indexInCell;
+        list->pop_back();
+
+        if (it != cells.end() && list->empty())
+            cells.erase(it);
+
+        item.where = kNowhere;
+    }
+
+    void SpatialIndex::QueryAABB(const Float3& min, const Float3& max, std::vector<uint32_t>& keys) const
+    {
+        for (uint32_t key : large)
+        {
+            if (Overlaps(items[key].min, items[key].max, min, max))
+                keys.push_back(key);
+        }
+
+        if (cells.empty())
+            return;
+
+        auto visitCell = [&](const std::vector<uint32_t>& cell)
+        {
+            for (uint32_t key : cell)
+            {
+                if (Overlaps(items[key].min, items[key].max, min, max))
+                    keys.push_back(key);
+            }
+        };
+
+        // Anything filed under a cell may stick out of it by up to half a cell
+        const float margin = cellSize * 0.5f;
+        const int x0 = ToCell(min.x - margin, invCellSize), x1 = ToCell(max.x + margin, invCellSize);
+        const int y0 = ToCell(min.y - margin, invCellSize), y1 = ToCell(max.y + margin, invCellSize);
+        const int z0 = ToCell(min.z - margin, invCellSize), z1 = ToCell(max.z + margin, invCellSize);
+
+        // Huge queries are cheaper as a walk over the occupied cells
+        const double numCells = (double) (x1 - x0 + 1) * (y1 - y0 + 1) * (z1 - z0 + 1);
+
+        if (numCells > (double) cells.size())
+        {
+            for (const auto& cell : cells)
+                visitCell(cell.second);
+
+            return;
+        }
+
+        for (int z = z0; z <= z1; z++)
+            for (int y = y0; y <= y1; y++)
+                for (int x = x0; x <= x1; x++)
+                {
+                    auto it = cells.find(MakeCell(x, y, z));
+
+                    if (it != cells.end())
+                        visitCell(it->second);
+                }
+    }
+
+    void SpatialIndex::QueryRadius(const Float3& centre, float radius, std::vector<uint32_t>& keys) const
+    {
+        const size_t first = keys.size();
+        QueryAABB(centre - Float3(radius, radius, radius), centre + Float3(radius, radius, radius), keys);
+
+        // Drop the corners
+        size_t count = first;
+
+        for (size_t i = first; i < keys.size(); i++)
+        {
+            if (DistanceSquared(centre, items[keys[i]].min, items[keys[i]].max) <= radius * radius)
+                keys[count++] = keys[i];
+        }
+
+        keys.resize(count);
+    }
+
+    bool SpatialIndex::QueryRay(const Float3& origin, const Float3& dir, float maxDistance, uint32_t ignoreKey,
+            uint32_t& key_out, float& distance_out) const
+    {
+        const float length = std::sqrt(dir.x * dir.x + dir.y * dir.y + dir.z * dir.z);
+
+        if (!(length > 0.0f) || !(maxDistance >= 0.0f))
+            return false;
+
+        // Walk the ray in cell-sized steps, stopping as soon as the best hit lies within the part walked so far.
+        // Anything not found by then doesn't touch the walked part, so it can only be hit further along.
+        const float step = cellSize / length;
+
+        std::vector<uint32_t> candidates;
+        float best = maxDistance;
+        bool hit = false;
+
+        for (int i = 0; ; i++)
+        {
+            const float t0 = i * step;
+            const float t1 = std::min(t0 + step, maxDistance);
+            const Float3 p0 = origin + dir * t0, p1 = origin + dir * t1;
+
+            candidates.clear();
+            QueryAABB(glm::min(p0, p1), glm::max(p0, p1), candidates);
+
+            for (uint32_t key : candidates)
+            {
+                float t;
+
+                if (key != ignoreKey && IntersectRay(origin, dir, items[key].min, items[key].max, best, t)
+                        && (!hit || t < best))
+                {
+                    best = t;
+                    key_out = key;
+                    hit = true;
+                }
+            }
+
+            if ((hit && best <= t1) || t1 >= maxDistance)
+                break;
+        }
+
+        if (hit)
+            distance_out = best;
+
+        return hit;
+    }
+
+    void SpatialIndex::Remove(uint32_t key)
+    {
+        zombie_assert(Contains(key));
+
+        p_Unfile(key);
+    }
+
+    void SpatialIndex::SetCellSize(float cellSize)
+    {
+        zombie_assert(cellSize > 0.0f);
+
+        this->cellSize = cellSize;
+        this->invCellSize = 1.0f / cellSize;
+
+        cells.clear();
+        large.clear();
+
+        for (uint32_t key = 0; key < items.size(); key++)
+        {
+            if (items[key].where != kNowhere)
+                p_File(key);
+        }
+    }
+
+    void SpatialIndex::Update(uint32_t key, const Float3& min, const Float3& max)
+    {
+        zombie_assert(Contains(key));
+
+        Item_t& item = items[key];
+
+        item.min = min;
+        item.max = max;
+
+        // Common case: still in the same cell
+        if (item.where == kInCell && !p_IsLarge(min, max) && p_GetCell((min + max) * 0.5f) == item.cell)
+            return;
+
+        p_Unfile(key);
+        p_File(key);
+    }
+}
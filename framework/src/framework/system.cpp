@@ -7,6 +7,7 @@
 #include <framework/errorcheck.hpp>
 #include <framework/event.hpp>
 #include <framework/filesystem.hpp>
+#include <framework/jobsystem.hpp>
 #include <framework/mediacodechandler.hpp>
 #include <framework/modulehandler.hpp>
 #include <framework/nativedialogs.hpp>
@@ -37,6 +38,7 @@
 #include <reflection/basic_types.hpp>
 
 #include <cstdarg>
+#include <mutex>
 
 #if defined(_MSC_VER)
 #include <crtdbg.h>
@@ -127,13 +129,6 @@ namespace zfw
 
     static const int MAX_FRAME_TICKS = 10;  // (10 fps at tickrate 100)
 
-    struct LogEntry
-    {
-        uint64_t time;
-        LogType_t type;
-        char* line;
-    };
-
     static ErrorBuffer_t* s_eb;
 
     static int frameCounter;
@@ -150,13 +145,12 @@ namespace zfw
     static PerfTimer::Counter clock0;
     static time_t time0;
 
-    static li::List<LogEntry> log;
-
     static ProfilingSection_t profDrawScene = {"IScene::DrawFrame"};
     static ProfilingSection_t profOnFrame = {"IScene::OnFrame"};
     static ProfilingSection_t profOnTicks = {"IScene::OnTicks"};
-    static ProfilingSection_t profVideoHandler = {"VideoHandler"};
-    static ProfilingSection_t profVideoHandler2 = {"VideoHandler"};
+    static ProfilingSection_t profVideoHandler = {"VideoHandler::BeginFrame"};
+    static ProfilingSection_t profVideoHandler2 = {"VideoHandler::EndFrame"};
+    static const char* statsFrame = "Frame";
 
     // ====================================================================== //
     //  class declaration(s)
@@ -175,7 +169,7 @@ namespace zfw
             virtual void            AssertionFailResourceState(const char* resourceName, int actualState, int expectedState,
                                                                const char* functionName, const char* file, int line) override;
             virtual void            ErrorAbort() override;
-            virtual ErrorBuffer_t*  GetErrorBuffer() override { return s_eb; }
+            virtual ErrorBuffer_t*  GetErrorBuffer() override;
 
             // Available pre initialization
             virtual IVarSystem*         GetVarSystem() override { return varSystem.get(); }
@@ -185,6 +179,7 @@ namespace zfw
             // Core Handlers
             virtual IEntityHandler* GetEntityHandler(bool createIfNull) override;
             virtual IFileSystem*    GetFileSystem() override { return fsUnion->GetFileSystem(); }
+            virtual IJobSystem*     GetJobSystem() override { return jobSystem.get(); }
             virtual IMediaCodecHandler* GetMediaCodecHandler(bool createIfNull) override;
             virtual IModuleHandler* GetModuleHandler(bool createIfNull) override;
             virtual IFSUnion*       GetFSUnion() override { return fsUnion.get(); }
@@ -194,6 +189,8 @@ namespace zfw
             //virtual IModuleHandler* InitModuleHandler() override;
 
             virtual shared_ptr<IFileSystem> CreateStdFileSystem(const char* basePath, int access) override;
+            virtual shared_ptr<IFileSystem> CreateMappedFileSystem(const char* basePath, int access) override;
+            virtual shared_ptr<IFileSystem> CreatePackFileSystem(const char* path, int access) override;
 
 #ifdef ZOMBIE_WITH_BLEB
             virtual shared_ptr<IFileSystem> CreateBlebFileSystem(const char* path, int access) override;
@@ -262,7 +259,6 @@ namespace zfw
 #endif
 
         private:
-            void p_ClearLog();
 			bool p_Frame();
             void p_SetTickRate(int tickrate);
             double p_Update();
@@ -277,13 +273,18 @@ namespace zfw
             // core handlers
             shared_ptr<IEntityHandler> entityHandler;
             unique_ptr<IMediaCodecHandler> mediaCodecHandler;
+            std::once_flag mediaCodecHandlerOnce;       // resource preloading may ask from several workers at once
             shared_ptr<IModuleHandler> moduleHandler;
             unique_ptr<IFSUnion> fsUnion;
+            unique_ptr<IJobSystem> jobSystem;
             unique_ptr<IVarSystem> varSystem;
             unique_ptr<IVideoHandler> videoHandler;
 
             // synchronization
-            li::Mutex ioMutex, logMutex, stdoutMutex;
+            li::Mutex stdoutMutex;
+
+            // logging
+            unique_ptr<ILogRing> logRing;
 
             // profiling
             unique_ptr<Profiler> profiler;
@@ -292,18 +293,6 @@ namespace zfw
 
     static unique_ptr<System> s_sys;
 
-    static void DumpLog(OutputStream* stream)
-    {
-        iterate2 (i, log)
-        {
-            auto& entry = *i;
-
-            auto t = entry.time - clock0;
-            stream->write((const char*) sprintf_t<63>("%-10s[%5u.%04u] ", logTypeNames[entry.type], (int)(t / 1000000), (int)(t % 1000000) / 100));
-            stream->writeLine(entry.line);
-        }
-    }
-
     static const char* GetErrorName(int errorCode)
     {
         if (errorCode >= 0 && errorCode < MAX_EXCEPTION)
@@ -312,11 +301,83 @@ namespace zfw
             return "unknown_exception";
     }
 
-    const char* NormalizePath(const char* path)
+    // Collapses empty and '.' segments and resolves '..' where possible. Reentrant; the result is either
+    // 'path' itself (if already normal) or written into 'buffer'. Returns nullptr if the buffer is too small.
+    static const char* NormalizePath(const char* path, char* buffer, size_t bufferSize)
     {
-        // FIXME - SECURITY: Check & normalize path!
+        // FIXME - SECURITY: Check path!
+
+        const size_t pathLength = strlen(path);
+        const char* lastSegment = strrchr(path, '/');
+        lastSegment = (lastSegment != nullptr) ? lastSegment + 1 : path;
+
+        if (strstr(path, "//") == nullptr && strstr(path, "./") == nullptr
+                && strcmp(lastSegment, ".") != 0 && strcmp(lastSegment, "..") != 0)
+            return path;
+
+        const bool trailingSlash = (pathLength > 1 && path[pathLength - 1] == '/');
+        size_t length = 0;
+
+        if (*path == '/')
+        {
+            if (bufferSize < 2)
+                return nullptr;
+
+            buffer[length++] = '/';
+            path++;
+        }
+
+        const size_t rootLength = length;
+
+        while (*path != 0)
+        {
+            const char* end = strchr(path, '/');
+
+            if (end == nullptr)
+                end = path + strlen(path);
+
+            const size_t segmentLength = end - path;
+
+            // Start of the last segment written so far
+            size_t lastSegment = length;
+
+            while (lastSegment > rootLength && buffer[lastSegment - 1] != '/')
+                lastSegment--;
+
+            const bool lastIsDotDot = (length - lastSegment == 2 && buffer[lastSegment] == '.'
+                    && buffer[lastSegment + 1] == '.');
+
+            if (segmentLength == 0 || (segmentLength == 1 && path[0] == '.'))
+                ;
+            else if (segmentLength == 2 && path[0] == '.' && path[1] == '.' && length > rootLength && !lastIsDotDot)
+                length = (lastSegment > rootLength) ? lastSegment - 1 : rootLength;
+            else
+            {
+                const bool needSeparator = (length > rootLength);
+
+                if (length + needSeparator + segmentLength + 1 > bufferSize)
+                    return nullptr;
+
+                if (needSeparator)
+                    buffer[length++] = '/';
+
+                memcpy(buffer + length, path, segmentLength);
+                length += segmentLength;
+            }
+
+            path = (*end != 0) ? end + 1 : end;
+        }
 
-        return path;
+        if (trailingSlash && length > rootLength)
+        {
+            if (length + 2 > bufferSize)
+                return nullptr;
+
+            buffer[length++] = '/';
+        }
+
+        buffer[length] = 0;
+        return buffer;
     }
 
     // ====================================================================== //
@@ -355,6 +416,9 @@ namespace zfw
         clock0 = timer.getCurrentMicros();
         time(&time0);
 
+        if (logRing == nullptr)
+            logRing.reset(p_CreateLogRing(logTypeNames));
+
         Printf(kLogAlways, "Zombie Framework " ZOMBIE_BUILDNAME " " ZOMBIE_PLATFORM "-" ZOMBIE_BUILDTYPENAME);
         Printf(kLogAlways, "Copyright (c) 2012, 2013, 2014, 2016, 2018 Minexew Games; some rights reserved");
         Printf(kLogAlways, "Compiled using " li_compiled_using);
@@ -366,6 +430,9 @@ namespace zfw
         // Pre-Init
         varSystem.reset(p_CreateVarSystem(this));
         varSystem->SetVariable("sys_tickrate", "60", 0);
+        varSystem->SetVariable("sys_numworkers", "0", 0);
+        varSystem->SetVariable("sys_profilecsv", "", 0);
+        varSystem->SetVariable("sys_logfile", "", 0);
 
         if (!(flags & kSysNoInitFileSystem))
             fsUnion.reset(p_CreateFSUnion(s_eb));
@@ -381,11 +448,27 @@ namespace zfw
 
         //Var::SetStr("dev_breakkey", "0:0:0013:0045");
 
-        int sys_tickrate;
+        int sys_tickrate, sys_numworkers;
+        const char* sys_logfile;
 
         ErrorPassthru(varSystem->GetVariable("sys_tickrate", &sys_tickrate, IVarSystem::kVariableMustExist));
         p_SetTickRate(sys_tickrate);
 
+        ErrorPassthru(varSystem->GetVariable("sys_numworkers", &sys_numworkers, IVarSystem::kVariableMustExist));
+        jobSystem.reset(p_CreateJobSystem(this, sys_numworkers > 0 ? sys_numworkers : 0));
+
+        ErrorPassthru(varSystem->GetVariable("sys_logfile", &sys_logfile, IVarSystem::kVariableMustExist));
+
+        if (*sys_logfile != 0)
+        {
+            unique_ptr<OutputStream> logFile(OpenOutput(sys_logfile));
+
+            if (logFile != nullptr)
+                logRing->SetOutput(move(logFile));
+            else
+                Printf(kLogWarning, "System: failed to open log file '%s'", sys_logfile);
+        }
+
         profileFrame = -1;
         profiler.reset(Profiler::Create());
 
@@ -396,18 +479,52 @@ namespace zfw
 
     void System::Shutdown()
     {
+        // Completion callbacks of pending reads may still submit jobs
+        p_ShutdownAsyncIO();
+
+        // Workers may still reference any of the handlers below
+        jobSystem.reset();
+
         videoHandler.reset();
 
+        if (profiler != nullptr)
+        {
+            const char* profileCsvPath;
+
+            if (varSystem->GetVariable("sys_profilecsv", &profileCsvPath, 0) && profileCsvPath != nullptr
+                    && *profileCsvPath != 0)
+            {
+                unique_ptr<OutputStream> csv(OpenOutput(profileCsvPath));
+
+                if (csv != nullptr)
+                    profiler->WriteStatsCsv(csv.get());
+            }
+        }
+
         profiler.reset();
 
         entityHandler.reset();
         mediaCodecHandler.reset();
         moduleHandler.reset();
+
+        if (fsUnion != nullptr)
+        {
+            FSUnionCacheStats_t stats;
+            fsUnion->GetCacheStats(&stats);
+
+            const uint64_t lookups = stats.hits + stats.misses;
+
+            if (lookups != 0)
+                Printf(kLogInfo, "FSUnion: path cache hit rate %.1f%% (%llu lookups, %llu known missing, %llu invalidations)",
+                        stats.hits * 100.0 / lookups, (unsigned long long) lookups,
+                        (unsigned long long) stats.negativeHits, (unsigned long long) stats.invalidations);
+        }
+
+        // The log file lives in fsUnion; later messages only go to the in-memory history
+        logRing->SetOutput(nullptr);
         fsUnion.reset();
 
         varSystem.reset();
-
-        p_ClearLog();
     }
 
     void System::AssertionFail(const char* expr, const char* functionName, const char* file, int line,
@@ -450,11 +567,18 @@ namespace zfw
 
     bool System::CreateDirectoryRecursive(const char* path)
     {
-        const char* normalizedPath = NormalizePath(path);
+        char normalizeBuffer[FILENAME_MAX];
+        const char* normalizedPath = NormalizePath(path, normalizeBuffer, sizeof(normalizeBuffer));
+
+        if (normalizedPath == nullptr)
+            return ErrorBuffer::SetError3(EX_INVALID_ARGUMENT, 2,
+                    "desc", "Path too long",
+                    "path", path
+                    ), false;
 
         std::vector<char> buffer_(strlen(normalizedPath) + 1);
         char* buffer = &buffer_[0];
-        const char* path_end = path, * slash;
+        const char* path_end = normalizedPath, * slash;
 
         do
         {
@@ -462,13 +586,13 @@ namespace zfw
 
             if (slash != nullptr)
             {
-                memcpy(buffer, path, slash - path);
-                buffer[slash - path] = 0;
+                memcpy(buffer, normalizedPath, slash - normalizedPath);
+                buffer[slash - normalizedPath] = 0;
 
                 path_end = slash + 1;
             }
             else
-                strcpy(buffer, path);
+                strcpy(buffer, normalizedPath);
 
             unique_ptr<IDirectory> dir(fsUnion->GetFileSystem()->OpenDirectory(buffer, kDirectoryMayCreate));
 
@@ -514,6 +638,21 @@ namespace zfw
         return p_CreateStdFileSystem(s_eb, basePath, access);
     }
 
+    shared_ptr<IFileSystem> System::CreateMappedFileSystem(const char* basePath_in, int access)
+    {
+        auto basePath = FileName::getAbsolutePath(basePath_in);
+
+        if (!basePath.endsWith('/') && !basePath.endsWith('\\'))
+            basePath += UnicodeChar('/');
+
+        return p_CreateMappedFileSystem(s_eb, basePath, access);
+    }
+
+    shared_ptr<IFileSystem> System::CreatePackFileSystem(const char* path, int access)
+    {
+        return p_CreatePackFileSystem(s_eb, path, access);
+    }
+
     void System::DebugBreak(bool force)
     {
 #if defined(_MSC_VER)
@@ -595,7 +734,9 @@ namespace zfw
             errorReport.writeLine(".");
             errorReport.writeLine();
 
-            DumpLog(&errorReport);
+            if (logRing != nullptr)
+                logRing->DumpHistory(&errorReport);
+
             errorReport.close();
         }
 
@@ -732,7 +873,7 @@ namespace zfw
 
     void System::ErrorAbort()
     {
-        DisplayError(s_eb, true);
+        DisplayError(GetErrorBuffer(), true);
 
 #ifdef ZOMBIE_CTR
         while (!(hidKeysDown() & KEY_START))
@@ -803,6 +944,24 @@ namespace zfw
             AddFileSystem(fs, 100);
             return;
         }
+        else if (tokens[0] == "fs_mapped")
+        {
+            auto fs = CreateMappedFileSystem(tokens[1], kFSAccessStat | kFSAccessRead);
+            AddFileSystem(fs, 100);
+            return;
+        }
+        else if (tokens[0] == "fs_pack")
+        {
+            // fs_pack <path> [mountPoint]
+            auto fs = CreatePackFileSystem(tokens[1], kFSAccessStat | kFSAccessRead);
+
+            if (fs != nullptr)
+                fsUnion->AddFileSystem(move(fs), 100, tokens.size() > 2 ? tokens[2].c_str() : nullptr);
+            else
+                PrintError(s_eb, kLogError);
+
+            return;
+        }
 
         auto var = GetVarSystem();
 
@@ -820,6 +979,14 @@ namespace zfw
         return entityHandler.get();
     }
 
+    ErrorBuffer_t* System::GetErrorBuffer()
+    {
+        // Job workers have private error buffers
+        ErrorBuffer_t* eb = p_GetJobWorkerErrorBuffer();
+
+        return (eb != nullptr) ? eb : s_eb;
+    }
+
     uint64_t System::GetGlobalMicros()
     {
         return frameTimer->GetGlobalMicros();
@@ -827,21 +994,24 @@ namespace zfw
 
     IMediaCodecHandler* System::GetMediaCodecHandler(bool createIfNull)
     {
-        if (createIfNull && mediaCodecHandler == nullptr)
+        if (createIfNull)
         {
-            mediaCodecHandler.reset(p_CreateMediaCodecHandler());
+            std::call_once(mediaCodecHandlerOnce, [this]()
+            {
+                mediaCodecHandler.reset(p_CreateMediaCodecHandler());
 
-            // built-in codecs
+                // built-in codecs
 
-            mediaCodecHandler->RegisterEncoder(typeID<IPixmapEncoder>(), unique_ptr<IEncoder>(p_CreateBmpEncoder(this)));
+                mediaCodecHandler->RegisterEncoder(typeID<IPixmapEncoder>(), unique_ptr<IEncoder>(p_CreateBmpEncoder(this)));
 
 #ifdef ZOMBIE_WITH_JPEG
-            mediaCodecHandler->RegisterDecoder(typeID<IPixmapDecoder>(), unique_ptr<IDecoder>(p_CreateJfifDecoder()));
+                mediaCodecHandler->RegisterDecoder(typeID<IPixmapDecoder>(), unique_ptr<IDecoder>(p_CreateJfifDecoder()));
 #endif
 #ifdef ZOMBIE_WITH_LODEPNG
-            mediaCodecHandler->RegisterDecoder(typeID<IPixmapDecoder>(), unique_ptr<IDecoder>(p_CreateLodePngDecoder(this)));
-            mediaCodecHandler->RegisterEncoder(typeID<IPixmapEncoder>(), unique_ptr<IEncoder>(p_CreateLodePngEncoder(this)));
+                mediaCodecHandler->RegisterDecoder(typeID<IPixmapDecoder>(), unique_ptr<IDecoder>(p_CreateLodePngDecoder(this)));
+                mediaCodecHandler->RegisterEncoder(typeID<IPixmapEncoder>(), unique_ptr<IEncoder>(p_CreateLodePngEncoder(this)));
 #endif
+            });
         }
 
         return mediaCodecHandler.get();
@@ -882,24 +1052,15 @@ namespace zfw
         va_list args;
 
         va_start( args, format );
-        size_t length = vsnprintf( nullptr, 0, format, args );
-        va_end( args );
-        
-        va_start( args, format );
-        Logv(logType, format, args, length);
+        Logv(logType, format, args, 0);
         va_end( args );
     }
 
     void System::Logv(LogType_t logType, const char* format, va_list args, size_t length)
     {
-        li::CriticalSection lg(logMutex);
-
-        auto& entry = log.addEmpty();
-        entry.time = timer.getCurrentMicros();
-        entry.type = logType;
-
-        entry.line = (char *) malloc(length + 1);
-        vsnprintf( entry.line, length + 1, format, args );
+        // 'length' is not needed anymore; lines are formatted straight into the log ring
+        if (logRing != nullptr)
+            logRing->Logv(timer.getCurrentMicros() - clock0, logType, format, args);
     }
 
     bool System::OpenFileStream(const char* path, int flags,
@@ -909,9 +1070,15 @@ namespace zfw
     {
         ZFW_ASSERT(fsUnion != nullptr)
 
-        li::CriticalSection lg(ioMutex);
+        // No lock needed here; FSUnion and the file systems are safe for concurrent use
+        char normalizeBuffer[FILENAME_MAX];
+        const char* normalizedPath = NormalizePath(path, normalizeBuffer, sizeof(normalizeBuffer));
 
-        const char* normalizedPath = NormalizePath(path);
+        if (normalizedPath == nullptr)
+            return ErrorBuffer::SetError3(EX_INVALID_ARGUMENT, 2,
+                    "desc", "Path too long",
+                    "path", path
+                    ), false;
 
         return fsUnion->GetFileSystem()->OpenFileStream( normalizedPath, flags, is_out, os_out, io_out );
     }
@@ -934,14 +1101,6 @@ namespace zfw
         return os;
     }
 
-    void System::p_ClearLog()
-    {
-        iterate2(i, log)
-            free((*i).line);
-
-        log.clear();
-    }
-
 #ifdef ZOMBIE_EMSCRIPTEN
 	void System::p_EmscriptenFrame()
 	{
@@ -954,6 +1113,8 @@ namespace zfw
 	{
 		IVideoHandler* videoHandler = GetVideoHandler();
 
+		Profiler::MarkFrame();
+
 		if (frameCounter == profileFrame)
 			profiler->BeginProfiling();
 
@@ -987,9 +1148,16 @@ namespace zfw
 		if (frameCounter == profileFrame)
 			profiler->EnterSection(profVideoHandler);
 
+		const uint64_t frameStart = GetGlobalMicros();
+
+		Profiler::BeginZone(profVideoHandler.name);
 		videoHandler->BeginFrame();
 		videoHandler->ReceiveEvents();
 		videoHandler->BeginDrawFrame();
+		Profiler::EndZone();
+
+		uint64_t phaseStart = GetGlobalMicros();
+		profiler->AddSample(profVideoHandler.name, phaseStart - frameStart);
 
 		if (frameCounter == profileFrame)
 		{
@@ -997,7 +1165,13 @@ namespace zfw
 			profiler->EnterSection(profOnFrame);
 		}
 
+		Profiler::BeginZone(profOnFrame.name);
 		scene->OnFrame(p_Update());
+		Profiler::EndZone();
+
+		uint64_t phaseEnd = GetGlobalMicros();
+		profiler->AddSample(profOnFrame.name, phaseEnd - phaseStart);
+		phaseStart = phaseEnd;
 
 		if (frameCounter == profileFrame)
 		{
@@ -1006,7 +1180,15 @@ namespace zfw
 		}
 
 		if (tickAccum > 0)
+		{
+			Profiler::BeginZone(profOnTicks.name);
 			scene->OnTicks(tickAccum);
+			Profiler::EndZone();
+
+			phaseEnd = GetGlobalMicros();
+			profiler->AddSample(profOnTicks.name, phaseEnd - phaseStart);
+			phaseStart = phaseEnd;
+		}
 
 		if (frameCounter == profileFrame)
 		{
@@ -1014,7 +1196,13 @@ namespace zfw
 			profiler->EnterSection(profDrawScene);
 		}
 
+		Profiler::BeginZone(profDrawScene.name);
 		scene->DrawScene();
+		Profiler::EndZone();
+
+		phaseEnd = GetGlobalMicros();
+		profiler->AddSample(profDrawScene.name, phaseEnd - phaseStart);
+		phaseStart = phaseEnd;
 
 		if (frameCounter == profileFrame)
 		{
@@ -1022,8 +1210,14 @@ namespace zfw
 			profiler->EnterSection(profVideoHandler2);
 		}
 
+		Profiler::BeginZone(profVideoHandler2.name);
 		videoHandler->EndFrame(tickAccum);
 		tickAccum = 0;
+		Profiler::EndZone();
+
+		phaseEnd = GetGlobalMicros();
+		profiler->AddSample(profVideoHandler2.name, phaseEnd - phaseStart);
+		profiler->AddSample(statsFrame, phaseEnd - frameStart);
 
 		if (frameCounter == profileFrame)
 		{
@@ -1127,14 +1321,10 @@ namespace zfw
         int r = Printfv(logType, format, args);
         va_end(args);
         
-        va_start( args, format );
-        size_t length = vsnprintf( nullptr, 0, format, args );
-        va_end( args );
-        
         if (logType != kLogNever)
         {
             va_start(args, format);
-            Logv(logType, format, args, length);
+            Logv(logType, format, args, 0);
             va_end(args);
         }
 
@@ -0,0 +1,187 @@
+#include <framework/transformstore.hpp>
+
+#include <framework/utility/essentials.hpp>
+
+namespace zfw
+{
+    const uint32_t TransformStore::kInvalidHandle;
+
+    template <typename T>
+    static void MoveLast(std::vector<T>& vec, uint32_t i)
+    {
+        vec[i] = vec.back();
+        vec.pop_back();
+    }
+
+    static void MoveLast(std::vector<float>& x, std::vector<float>& y, std::vector<float>& z, uint32_t i)
+    {
+        MoveLast(x, i);
+        MoveLast(y, i);
+        MoveLast(z, i);
+    }
+
+    static void Resize(std::vector<float>& x, std::vector<float>& y, std::vector<float>& z, size_t count)
+    {
+        x.resize(count);
+        y.resize(count);
+        z.resize(count);
+    }
+
+    static void IntegrateAxis(float* pos, const float* speed, float delta, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+            pos[i] += speed[i] * delta;
+    }
+
+    uint32_t TransformStore::Allocate(ITransformStoreUser* user)
+    {
+        uint32_t handle;
+
+        if (!freeHandles.empty())
+        {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+        }
+        else
+        {
+            handle = (uint32_t) dense.size();
+            dense.push_back(0);
+        }
+
+        const uint32_t i = (uint32_t) users.size();
+        dense[handle] = i;
+
+        users.push_back(user);
+        handles.push_back(handle);
+        notify.push_back(0);
+        posMirror.push_back(nullptr);
+
+        for (Component_t* c : {&pos, &speed, &orientation, &localAabbMin, &localAabbMax})
+            Resize(c->x, c->y, c->z, i + 1);
+
+        // No bounding box until SetLocalAABB
+        p_Set(localAabbMin, i, Float3(1.0f, 1.0f, 1.0f));
+        p_Set(localAabbMax, i, Float3(-1.0f, -1.0f, -1.0f));
+
+        return handle;
+    }
+
+    void TransformStore::Clear()
+    {
+        for (Component_t* c : {&pos, &speed, &orientation, &localAabbMin, &localAabbMax})
+            Resize(c->x, c->y, c->z, 0);
+
+        users.clear();
+        handles.clear();
+        notify.clear();
+        numNotify = 0;
+        posMirror.clear();
+        numPosMirrors = 0;
+        dense.clear();
+        freeHandles.clear();
+    }
+
+    void TransformStore::Free(uint32_t handle)
+    {
+        zombie_assert(handle < dense.size() && dense[handle] != kInvalidHandle);
+
+        const uint32_t i = dense[handle];
+
+        // Fill the hole with the last element
+        for (Component_t* c : {&pos, &speed, &orientation, &localAabbMin, &localAabbMax})
+            MoveLast(c->x, c->y, c->z, i);
+
+        numNotify -= notify[i];
+        numPosMirrors -= (posMirror[i] != nullptr) ? 1 : 0;
+
+        MoveLast(users, i);
+        MoveLast(handles, i);
+        MoveLast(notify, i);
+        MoveLast(posMirror, i);
+
+        if (i < handles.size())
+            dense[handles[i]] = i;
+
+        dense[handle] = kInvalidHandle;
+        freeHandles.push_back(handle);
+    }
+
+    void TransformStore::Integrate(float delta)
+    {
+        Move(delta, nullptr);
+        NotifyMoved();
+    }
+
+    void TransformStore::Move(float delta, std::vector<uint32_t>* movedHandles)
+    {
+        const size_t count = users.size();
+
+        if (count == 0)
+            return;
+
+        // One plain loop per axis keeps every pass trivially vectorisable
+        IntegrateAxis(&pos.x[0], &speed.x[0], delta, count);
+        IntegrateAxis(&pos.y[0], &speed.y[0], delta, count);
+        IntegrateAxis(&pos.z[0], &speed.z[0], delta, count);
+
+        if (numPosMirrors != 0)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                if (posMirror[i] != nullptr)
+                    *posMirror[i] = p_Get(pos, (uint32_t) i);
+            }
+        }
+
+        if (movedHandles == nullptr)
+            return;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (speed.x[i] != 0.0f || speed.y[i] != 0.0f || speed.z[i] != 0.0f)
+                movedHandles->push_back(handles[i]);
+        }
+    }
+
+    void TransformStore::NotifyMoved()
+    {
+        if (numNotify == 0)
+            return;
+
+        // Collect first, so that callbacks can't disturb the iteration
+        moved.clear();
+
+        for (size_t i = 0; i < users.size(); i++)
+        {
+            if (notify[i] && (speed.x[i] != 0.0f || speed.y[i] != 0.0f || speed.z[i] != 0.0f))
+                moved.push_back(users[i]);
+        }
+
+        for (auto user : moved)
+            user->OnTransformMoved();
+    }
+
+    void TransformStore::SetLocalAABB(uint32_t handle, const Float3& min, const Float3& max)
+    {
+        const uint32_t i = dense[handle];
+
+        p_Set(localAabbMin, i, min);
+        p_Set(localAabbMax, i, max);
+    }
+
+    void TransformStore::SetPosMirror(uint32_t handle, Float3* mirror)
+    {
+        const uint32_t i = dense[handle];
+
+        numPosMirrors += ((mirror != nullptr) ? 1 : 0) - ((posMirror[i] != nullptr) ? 1 : 0);
+        posMirror[i] = mirror;
+    }
+
+    void TransformStore::SetMoveNotification(uint32_t handle, bool enable)
+    {
+        const uint32_t i = dense[handle];
+
+        numNotify += (enable ? 1 : 0) - notify[i];
+        notify[i] = enable ? 1 : 0;
+    }
+}
@@ -27,16 +27,27 @@ namespace zfw
                     int flags) override;
             //virtual bool UnbindVariable(const char* name, bool rememberValue) = 0;
 
+            virtual void OnBoundVariableChanged(const char* name) override;
+            virtual std::shared_ptr<ITypedVariable> GetTypedVariable(const char* name, std::type_index type,
+                    std::shared_ptr<ITypedVariable> (*create)(), int flags) override;
+
             virtual bool SerializeVariables(OutputStream* output, const char* outputNameOrNull, int flags,
                     const char** names, size_t numNames) override;
             virtual bool DeserializeVariables(InputStream* input, const char* inputNameOrNull, int flags,
                     const char** names, size_t numNames) override;
 
         private:
+            struct TypedVariable_t
+            {
+                std::shared_ptr<ITypedVariable> var;
+                std::type_index type;
+            };
+
             void p_SetErrorAlreadyBound(const char* name, const char* function);
             void p_SetErrorDoesntExist(const char* name, const char* function);
             void p_SetErrorNotBound(const char* name, const char* function);
             bool p_WriteToStream(OutputStream* output, const char* outputNameOrNull, const char* name, const char* value);
+            void p_UpdateTypedVariable(const string& key, const char* value);
 
             ISystem* sys;
 
@@ -44,6 +55,7 @@ namespace zfw
 
             std::unordered_map<string, string> unboundVars;
             std::unordered_map<string, reflection::ReflectedValue_t> boundVars;
+            std::unordered_map<string, TypedVariable_t> typedVars;     // kept in sync with the above
     };
 
     // ====================================================================== //
@@ -122,6 +134,14 @@ namespace zfw
             );
     }
 
+    void VarSystem::p_UpdateTypedVariable(const string& key, const char* value)
+    {
+        auto it = typedVars.find(key);
+
+        if (it != typedVars.end() && !it->second.var->SetFromString(value))
+            sys->Printf(kLogWarning, "Variable '%s': can't convert value '%s'", key.c_str(), value);
+    }
+
     void VarSystem::p_SetErrorDoesntExist(const char* name, const char* function)
     {
         ErrorBuffer::SetError3(errVariableNotSet, 3,
@@ -165,6 +185,10 @@ namespace zfw
             unboundVars.erase(it2);
         }
 
+        // The bound storage may have started out with a value of its own
+        if (!typedVars.empty())
+            p_UpdateTypedVariable(key, reflection::reflectToString(variable).c_str());
+
         return true;
     }
 
@@ -226,6 +250,50 @@ namespace zfw
         }
     }
 
+    std::shared_ptr<ITypedVariable> VarSystem::GetTypedVariable(const char* name, std::type_index type,
+            std::shared_ptr<ITypedVariable> (*create)(), int flags)
+    {
+        string key(name);
+
+        auto it = typedVars.find(key);
+
+        if (it != typedVars.end())
+        {
+            if (it->second.type != type)
+                return ErrorBuffer::SetError3(EX_INVALID_ARGUMENT, 3,
+                        "desc", sprintf_255("Variable '%s' is already accessed as a different type.", name),
+                        "variableName", name,
+                        "function", li_functionName
+                        ), nullptr;
+
+            return it->second.var;
+        }
+
+        const char* value;
+        const bool isSet = GetVariable(name, &value, flags & kVariableAccessFlagMask);
+
+        if (!isSet && (flags & kVariableAccessFlagMask))
+            return nullptr;
+
+        auto var = create();
+
+        if (isSet && !var->SetFromString(value))
+            sys->Printf(kLogWarning, "Variable '%s': can't convert value '%s'", name, value);
+
+        typedVars.emplace(key, TypedVariable_t { var, type });
+        return var;
+    }
+
+    void VarSystem::OnBoundVariableChanged(const char* name)
+    {
+        string key(name);
+
+        auto it = boundVars.find(key);
+
+        if (it != boundVars.end() && !typedVars.empty())
+            p_UpdateTypedVariable(key, reflection::reflectToString(it->second).c_str());
+    }
+
     bool VarSystem::SerializeVariables(OutputStream* output, const char* outputNameOrNull, int flags,
             const char** names, size_t numNames)
     {
@@ -275,6 +343,7 @@ namespace zfw
         {
             // Convert value to its native type
             zombie_assert(reflection::reflectFromString(it->second, value));
+            p_UpdateTypedVariable(key, value);
             return true;
         }
         else if (flags & kVariableMustBeBound)
@@ -294,6 +363,7 @@ namespace zfw
         else
             unboundVars[key] = string(value);
 
+        p_UpdateTypedVariable(key, value);
         return true;
     }
 }
@@ -26,7 +26,7 @@
 
 // Safety:              64-bit          SAFE
 // Safety:              endianness      UNTESTED SAFE
-// Safety:              multithread     SINGLETHREAD
+// Safety:              multithread     SINGLETHREAD (except reading section streams of read-only files)
 
 // Copyright:           Original code by Xeatheran Minexew, 2013
 
@@ -39,8 +39,24 @@
 
 #include <algorithm>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef ZOMBIE_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
-// TODO: optimize seek forward
 // TODO: mediafile corruption handling
 // TODO: prevent corruption from opening section multiple times
 
@@ -75,6 +91,23 @@ namespace
 
     // implementation-defined
     static const uint32_t SECT_DEFAULT_SIZE =           1024;
+    static const char* RECLAIMED_SECTION_NAME =         "media.ReclaimedSectors";
+
+    // BlockStream reads smaller than this are served from a read-ahead buffer
+    static const size_t READ_AHEAD_SIZE =               64 * 1024;
+
+    // new spans are sized after the block they extend (up to this limit),
+    // otherwise sections written in small pieces end up as chains of single sectors
+    static const uint64_t SPAN_GROWTH_LIMIT =           64 * 1024;
+
+    // ZLIB sections are stored as independently deflated chunks followed by a chunk index:
+    //   chunk[num_chunks]                      zlib streams, each inflating to chunk_size bytes (except the last one)
+    //   uint32_t compressed_size[num_chunks]
+    //   uint32_t chunk_size
+    //   uint32_t num_chunks
+    // data_length in the section entry holds the uncompressed length
+    static const uint32_t COMPRESSED_CHUNK_SIZE =       64 * 1024;
+    static const uint32_t COMPRESSED_CHUNK_MAX_SIZE =   16 * 1024 * 1024;
 
     static const char zeros[32] = { 0 };
 
@@ -123,8 +156,19 @@ namespace
             zmfSpan_t   curr_span;
             uint64_t    curr_span_in_stream, curr_span_pos;
 
+            // last span we were in; spans never move within the stream, so seeks can start from here
+            zmfSpan_t   hint_span;
+            uint64_t    hint_span_in_stream;
+
+            // read-ahead; holds stream bytes [pos - bufferLength, pos), bufferPos is the logical position within
+            std::vector<uint8_t> buffer;
+            size_t      bufferLength, bufferPos;
+
             bool AllocateSpan(zmfSpan_t* span, uint64_t sizeNeeded);
+            void DropBuffer();
             bool JumpToPos();
+            size_t ReadUnbuffered(void* out, size_t count);
+            bool ReadTag(zmfSpan_t* next_span);
             void SetCurrent(const zmfSpan_t* span);
 
         public:
@@ -141,14 +185,79 @@ namespace
 
             virtual const char* getErrorDesc() { return nullptr; }
 
-            virtual bool eof() override { return pos >= length; }
+            virtual bool eof() override { return getPos() >= length; }
             virtual void flush();
 
+            virtual uint64_t getPos() override { return pos - (bufferLength - bufferPos); }
+            virtual uint64_t getSize() override { return length; }
+            virtual bool setPos(uint64_t pos) override;
+
+            virtual size_t read(void* out, size_t length) override;
+            virtual size_t write(const void* in, size_t length) override;
+    };
+
+    class CompressedInputStream : public IOStream
+    {
+        protected:
+            unique_ptr<BlockStream> block;
+
+            uint64_t    length, pos;
+            uint32_t    chunkSize;
+
+            std::vector<uint64_t> chunkOffsets;     // num_chunks + 1 entries
+            std::vector<uint8_t> chunk, compressed;
+            uint64_t    currentChunk;
+
+            bool LoadChunk(uint64_t index);
+
+        public:
+            CompressedInputStream(unique_ptr<BlockStream>&& block, uint64_t length);
+
+            bool ReadIndex();
+
+            virtual bool finite() override { return true; }
+            virtual bool seekable() override { return true; }
+
+            virtual bool eof() override { return pos >= length; }
+
             virtual uint64_t getPos() override { return pos; }
             virtual uint64_t getSize() override { return length; }
             virtual bool setPos(uint64_t pos) override;
 
             virtual size_t read(void* out, size_t length) override;
+            virtual size_t write(const void* in, size_t length) override { return 0; }
+    };
+
+    class CompressedOutputStream : public IOStream
+    {
+        protected:
+            MediaFileImpl* mf;
+            unique_ptr<BlockStream> block;
+            uint64_t    data_length_offset;
+            int         level;
+
+            uint64_t    length;
+            bool        failed;
+
+            std::vector<uint32_t> chunkSizes;
+            std::vector<uint8_t> chunk, compressed;
+
+            bool WriteChunk();
+
+        public:
+            CompressedOutputStream(MediaFileImpl* mf, unique_ptr<BlockStream>&& block, uint64_t data_length_offset, int level);
+            virtual ~CompressedOutputStream();
+
+            virtual bool finite() override { return true; }
+            virtual bool seekable() override { return false; }
+
+            virtual bool eof() override { return true; }
+
+            virtual uint64_t getPos() override { return length; }
+            virtual uint64_t getSize() override { return length; }
+            virtual bool setPos(uint64_t pos) override { return pos == length; }
+
+            virtual size_t read(void* out, size_t length) override { return 0; }
             virtual size_t write(const void* in, size_t length) override;
     };
 
@@ -156,26 +265,56 @@ namespace
     {
         protected:
             friend class BlockStream;
+            friend class CompressedOutputStream;
 
             unique_ptr<IOStream> file;
             bool isReadOnly;
+
+            // all reads go through ReadAt, so that section streams don't share a file position;
+            // read-only files opened by name get a native handle for positional reads, otherwise
+            // 'file' is seeked & read under fileMutex
+#ifdef _WIN32
+            HANDLE nativeFile;
+#else
+            int nativeFile;
+#endif
+            std::mutex fileMutex;
             String errorDesc, tmpString;
             Array<char> data;
 
             // media file properties
             uint32_t bitstream;
             uint32_t sectorSize;
+            int compressionLevel;
 
             // control blocks
             unique_ptr<BlockStream> section_map;
             unique_ptr<IOStream> metadata, reclaimed_sects;
 
+            // sectors of discarded sections, reused by BlockStream::AllocateSpan;
+            // stored last-to-first, so that they're handed out in file order.
+            // Persisted in RECLAIMED_SECTION_NAME when the file is closed:
+            //   uint32_t num_spans
+            //   zmfSpan_t spans[num_spans]
+            std::vector<zmfSpan_t> freeSpans;
+
             bool InitMediaFile(size_t sectorSize);
             bool OpenMediaFile();
 
+            void OpenNativeFile(const char* fileName);
+            size_t ReadAt(uint64_t offset, void* out, size_t count);
+            bool ReadSpanTag(const zmfSpan_t& span, zmfSpan_t* next_span);
+            void ReclaimSpans(const zmfBlock_t& block);
+
+            // free list
+            void LoadFreeSpans();
+            int OpenReclaimedSection(bool readOnly);
+            void SaveFreeSpans();
+
             void ErrCorrupted() { errorDesc = "The media file is corrupted."; }
             void ErrLimit() { errorDesc = "A format limit was exceeded."; }
             void ErrReadOnly() { errorDesc = "The file is read-only."; }
+            void ErrUnsupported() { errorDesc = "The section uses an unsupported compression method."; }
             void ErrWrite() { errorDesc = "Failed to write data. (disk full?)"; }
 
             // metadata
@@ -190,8 +329,17 @@ namespace
             bool ReadSectionEntryData(uint16_t desc_len, uint16_t desc_len_padded,
                 char*& name, char*& desc);
 
-            IOStream* CreateSectionPriv(const char* name);
+            int FindSection(const char* name, uint64_t& entryPos, uint16_t& desc_len, uint8_t compression[4],
+                    uint64_t& data_length, zmfBlock_t& block);
+
+            // section map index (name -> entry offset in section_map), built when the file is opened
+            std::unordered_map<std::string, uint64_t> sectionIndex;
+
+            bool BuildSectionIndex();
+            IOStream* CreateSectionPriv(const char* name, bool compressed);
             IOStream* OpenSectionPriv(const char* name);
+            IOStream* OpenSectionPriv(uint64_t entryPos, const uint8_t compression[4], uint64_t data_length,
+                    const zmfBlock_t& block);
 
         public:
             MediaFileImpl();
@@ -206,16 +354,19 @@ namespace
             virtual int IterateMetadata(IMetadataEntryListener* listener) override;
             virtual bool SetMetadata(const char* key, const char* value) override;
 
-            virtual IOStream* CreateSection(const char* name) override { return CreateSectionPriv(name); }
+            virtual IOStream* CreateSection(const char* name) override { return CreateSectionPriv(name, compressionLevel > 0); }
             virtual int IterateSections(ISectionEntryListener* listener) override;
             virtual IOStream* OpenOrCreateSection(const char* name) override;
             virtual IOStream* OpenSection(const char* name) override { return OpenSectionPriv(name); }
 
             virtual const char* GetBitstreamType() override;
             virtual const char* GetErrorDesc() override { return errorDesc.c_str(); }
-            virtual uint64_t GetFileSize() override { return file->getSize(); }
+            virtual uint64_t GetFileSize() override;
             virtual uint32_t GetSectorSize() override { return sectorSize; }
             virtual bool SetSectorSize(uint32_t sectorSize) override;
+
+            virtual int GetCompressionLevel() override { return compressionLevel; }
+            virtual bool SetCompressionLevel(int level) override;
     };
 
     BlockStream::BlockStream(MediaFileImpl* mf, bool readOnly,
@@ -229,6 +380,11 @@ namespace
 
         updateDesc = false;
 
+        curr_span.sect_first = 0;
+        hint_span.sect_first = 0;
+        bufferLength = 0;
+        bufferPos = 0;
+
         setPos(0);
     }
 
@@ -239,11 +395,33 @@ namespace
 
     bool BlockStream::AllocateSpan(zmfSpan_t* span, uint64_t sizeNeeded)
     {
+        const uint64_t sect_count = (sizeNeeded + mf->sectorSize - 1) / mf->sectorSize;
+
+        // sectors of discarded sections come first; a shorter span is fine, the block will simply chain on
+        if (!mf->freeSpans.empty())
+        {
+            zmfSpan_t& free = mf->freeSpans.back();
+            span->sect_first = free.sect_first;
+
+            if (free.sect_count > sect_count)
+            {
+                span->sect_count = (uint32_t) sect_count;
+                free.sect_first += (uint32_t) sect_count;
+                free.sect_count -= (uint32_t) sect_count;
+            }
+            else
+            {
+                span->sect_count = free.sect_count;
+                mf->freeSpans.pop_back();
+            }
+
+            return true;
+        }
+
         const uint64_t fileSize = mf->file->getSize();
 
         // always round up to next sector
         const uint64_t sect_first = (fileSize + mf->sectorSize - 1) / mf->sectorSize;
-        const uint64_t sect_count = (sizeNeeded + mf->sectorSize - 1) / mf->sectorSize;
 
         if (sect_first > UINT32_MAX || sect_count > UINT32_MAX)
             return false;
@@ -251,12 +429,24 @@ namespace
         span->sect_first = (uint32_t) sect_first;
         span->sect_count = (uint32_t) sect_count;
 
-        mf->file->setPos(span->sect_first * mf->sectorSize + mf->sectorSize - 1);
+        // reserve the whole span by writing its very last byte
+        mf->file->setPos(((uint64_t) span->sect_first + span->sect_count) * mf->sectorSize - 1);
         mf->file->writeLE<uint8_t>(0);
 
         return true;
     }
 
+    void BlockStream::DropBuffer()
+    {
+        // move the raw position back to where the reader actually is
+        const uint64_t readerPos = getPos();
+
+        bufferLength = 0;
+        bufferPos = 0;
+
+        setPos(readerPos);
+    }
+
     void BlockStream::flush()
     {
         // if block length has changed, we need to update its description
@@ -272,11 +462,19 @@ namespace
 
     bool BlockStream::JumpToPos()
     {
-        // this is highly unoptimal right now (and possibly broken)
-        // we're always starting from the block beginning and going span-by-span
+        // walk the span chain, starting from the last span we've been in if it's not past 'pos'
+        // (forward seeks then only cost as many tag reads as there are spans being skipped)
 
-        SetCurrent(&first_span);
-        curr_span_in_stream = 0;
+        if (IsValid(hint_span) && hint_span_in_stream <= pos)
+        {
+            SetCurrent(&hint_span);
+            curr_span_in_stream = hint_span_in_stream;
+        }
+        else
+        {
+            SetCurrent(&first_span);
+            curr_span_in_stream = 0;
+        }
 
         if (pos > length)
             return false;
@@ -304,9 +502,7 @@ namespace
             zmfSpan_t next_span;
 
             // read the tag for next span
-            if (!mf->file->setPos(curr_span.sect_first * mf->sectorSize + bytesInSpan)
-                || !mf->file->readLE<uint32_t>(&next_span.sect_first)
-                || !mf->file->readLE<uint32_t>(&next_span.sect_count))
+            if (!ReadTag(&next_span))
                 return false;
 
             SetCurrent(&next_span);
@@ -317,9 +513,48 @@ namespace
     }
 
     size_t BlockStream::read(void* out, size_t count)
+    {
+        uint8_t* buffer_out = reinterpret_cast<uint8_t*>(out);
+
+        size_t read_total = 0;
+
+        while (count > 0)
+        {
+            if (bufferPos < bufferLength)
+            {
+                const size_t n = std::min(count, bufferLength - bufferPos);
+                memcpy(buffer_out, &buffer[bufferPos], n);
+
+                bufferPos += n;
+                buffer_out += n;
+                count -= n;
+                read_total += n;
+                continue;
+            }
+
+            // buffer exhausted, the raw position is where the reader is
+            bufferLength = 0;
+            bufferPos = 0;
+
+            if (count >= READ_AHEAD_SIZE)
+                return read_total + ReadUnbuffered(buffer_out, count);
+
+            if (buffer.empty())
+                buffer.resize(READ_AHEAD_SIZE);
+
+            bufferLength = ReadUnbuffered(&buffer[0], (size_t) std::min<uint64_t>(READ_AHEAD_SIZE, length - pos));
+
+            if (bufferLength == 0)
+                break;
+        }
+
+        return read_total;
+    }
+
+    size_t BlockStream::ReadUnbuffered(void* out, size_t count)
     {
         // clamp read length
-        if (count > pos + length)
+        if (count > length - pos)
             count = (size_t)(length - pos);
 
         if (count == 0)
@@ -347,8 +582,7 @@ namespace
             {
                 // all the remaining data to be read is within the current span
 
-                mf->file->setPos(curr_span.sect_first * mf->sectorSize + curr_span_pos);
-                auto read = mf->file->read(buffer_out, count);
+                auto read = mf->ReadAt((uint64_t) curr_span.sect_first * mf->sectorSize + curr_span_pos, buffer_out, count);
 
                 curr_span_pos += read;
                 pos += read;
@@ -364,8 +598,8 @@ namespace
                 // are there ANY more data in this span? if so, read it
                 if (remainingBytesInSpan > 0)
                 {
-                    mf->file->setPos(curr_span.sect_first * mf->sectorSize + curr_span_pos);
-                    auto read = mf->file->read(buffer_out, (size_t) remainingBytesInSpan);
+                    auto read = mf->ReadAt((uint64_t) curr_span.sect_first * mf->sectorSize + curr_span_pos,
+                            buffer_out, (size_t) remainingBytesInSpan);
 
                     curr_span_pos += read;
                     pos += read;
@@ -377,14 +611,11 @@ namespace
                     buffer_out += read;
                     count -= read;
                 }
-                else
-                    mf->file->setPos(curr_span.sect_first * mf->sectorSize + curr_span_pos + remainingBytesInSpan);
 
                 zmfSpan_t next_span;
 
                 // read the tag for next span
-                if (!mf->file->readLE<uint32_t>(&next_span.sect_first)
-                    || !mf->file->readLE<uint32_t>(&next_span.sect_count))
+                if (!ReadTag(&next_span))
                     return read_total;
 
                 if (!CanJumpTo(curr_span, next_span))
@@ -397,13 +628,22 @@ namespace
         }
     }
 
+    bool BlockStream::ReadTag(zmfSpan_t* next_span)
+    {
+        return mf->ReadSpanTag(curr_span, next_span);
+    }
+
     void BlockStream::ReadDesc(const zmfBlock_t* desc)
     {
         length = desc->length;
         first_span = desc->first_span;
 
         pos = 0;
+        curr_span.sect_first = 0;
         curr_span_in_stream = 0;
+        hint_span.sect_first = 0;
+        bufferLength = 0;
+        bufferPos = 0;
     }
 
     bool BlockStream::ReadDesc(InputStream* file)
@@ -414,7 +654,11 @@ namespace
             return false;
 
         pos = 0;
+        curr_span.sect_first = 0;
         curr_span_in_stream = 0;
+        hint_span.sect_first = 0;
+        bufferLength = 0;
+        bufferPos = 0;
 
         return true;
     }
@@ -431,6 +675,22 @@ namespace
         if (pos > length)
             return false;
 
+        // within the read-ahead buffer?
+        if (bufferLength != 0 && pos >= this->pos - bufferLength && pos <= this->pos)
+        {
+            bufferPos = (size_t)(pos - (this->pos - bufferLength));
+            return true;
+        }
+
+        bufferLength = 0;
+        bufferPos = 0;
+
+        if (IsValid(curr_span))
+        {
+            hint_span = curr_span;
+            hint_span_in_stream = curr_span_in_stream;
+        }
+
         // don't do any actual seeking; just change the internal pointer
         // and invalidate current span
         this->pos = pos;
@@ -444,6 +704,9 @@ namespace
         if (isReadOnly || count == 0)
             return 0;
 
+        if (bufferLength != 0)
+            DropBuffer();
+
         const uint8_t* buffer_in = reinterpret_cast<const uint8_t*>(in);
 
         size_t written_total = 0;
@@ -575,7 +838,7 @@ namespace
                     zmfSpan_t new_span;
 
                     // allocate a new span
-                    if (!AllocateSpan(&new_span, count))
+                    if (!AllocateSpan(&new_span, std::max<uint64_t>(count, std::min<uint64_t>(length, SPAN_GROWTH_LIMIT))))
                         return written_total;
 
                     // write chaining tag
@@ -612,9 +875,203 @@ namespace
         return true;
     }
 
+#ifdef ZOMBIE_WITH_ZLIB
+    CompressedInputStream::CompressedInputStream(unique_ptr<BlockStream>&& block, uint64_t length)
+            : block(std::move(block)), length(length)
+    {
+        pos = 0;
+        chunkSize = 0;
+        currentChunk = UINT64_MAX;
+    }
+
+    bool CompressedInputStream::LoadChunk(uint64_t index)
+    {
+        const uint64_t compressedSize = chunkOffsets[index + 1] - chunkOffsets[index];
+        const uLongf chunkLength = (uLongf) std::min<uint64_t>(chunkSize, length - index * chunkSize);
+
+        compressed.resize((size_t) compressedSize);
+        chunk.resize(chunkSize);
+
+        // like BlockStream, this doesn't touch the media file's errorDesc (we might be on another thread)
+        if (!block->setPos(chunkOffsets[index])
+                || block->read(&compressed[0], (size_t) compressedSize) != compressedSize)
+            return false;
+
+        uLongf inflatedLength = chunkLength;
+
+        if (uncompress(&chunk[0], &inflatedLength, &compressed[0], (uLong) compressedSize) != Z_OK
+                || inflatedLength != chunkLength)
+            return false;
+
+        currentChunk = index;
+        return true;
+    }
+
+    size_t CompressedInputStream::read(void* out, size_t count)
+    {
+        uint8_t* buffer_out = reinterpret_cast<uint8_t*>(out);
+
+        size_t read_total = 0;
+
+        while (count > 0 && pos < length)
+        {
+            const uint64_t index = pos / chunkSize;
+
+            if (index != currentChunk && !LoadChunk(index))
+                break;
+
+            const size_t offset = (size_t)(pos - index * chunkSize);
+            const size_t available = (size_t) std::min<uint64_t>(chunkSize - offset, length - pos);
+            const size_t n = std::min(count, available);
+
+            memcpy(buffer_out, &chunk[offset], n);
+
+            buffer_out += n;
+            count -= n;
+            pos += n;
+            read_total += n;
+        }
+
+        return read_total;
+    }
+
+    bool CompressedInputStream::ReadIndex()
+    {
+        const uint64_t blockLength = block->getSize();
+        uint32_t num_chunks;
+
+        if (blockLength < 8
+                || !block->setPos(blockLength - 8)
+                || !block->readLE<uint32_t>(&chunkSize)
+                || !block->readLE<uint32_t>(&num_chunks))
+            return false;
+
+        if (chunkSize == 0 || chunkSize > COMPRESSED_CHUNK_MAX_SIZE
+                || num_chunks != length / chunkSize + (length % chunkSize != 0 ? 1 : 0)
+                || (uint64_t) num_chunks * 4 > blockLength - 8)
+            return false;
+
+        const uint64_t indexOffset = blockLength - 8 - (uint64_t) num_chunks * 4;
+        const uLong maxCompressedSize = compressBound(chunkSize);
+
+        if (!block->setPos(indexOffset))
+            return false;
+
+        chunkOffsets.resize(num_chunks + 1);
+        chunkOffsets[0] = 0;
+
+        for (uint32_t i = 0; i < num_chunks; i++)
+        {
+            uint32_t compressed_size;
+
+            if (!block->readLE<uint32_t>(&compressed_size) || compressed_size > maxCompressedSize)
+                return false;
+
+            chunkOffsets[i + 1] = chunkOffsets[i] + compressed_size;
+        }
+
+        return chunkOffsets[num_chunks] == indexOffset;
+    }
+
+    bool CompressedInputStream::setPos(uint64_t pos)
+    {
+        if (pos > length)
+            return false;
+
+        // the chunk is only inflated once something is actually read from it
+        this->pos = pos;
+        return true;
+    }
+
+    CompressedOutputStream::CompressedOutputStream(MediaFileImpl* mf, unique_ptr<BlockStream>&& block,
+            uint64_t data_length_offset, int level)
+            : mf(mf), block(std::move(block)), data_length_offset(data_length_offset), level(level)
+    {
+        length = 0;
+        failed = false;
+
+        chunk.reserve(COMPRESSED_CHUNK_SIZE);
+    }
+
+    CompressedOutputStream::~CompressedOutputStream()
+    {
+        if (!chunk.empty())
+            WriteChunk();
+
+        // append chunk index
+        if (!failed)
+        {
+            for (auto compressed_size : chunkSizes)
+                if (!block->writeLE<uint32_t>(compressed_size))
+                    failed = true;
+
+            if (!block->writeLE<uint32_t>(COMPRESSED_CHUNK_SIZE)
+                    || !block->writeLE<uint32_t>((uint32_t) chunkSizes.size()))
+                failed = true;
+        }
+
+        // block desc is updated by BlockStream itself, but data_length must hold the uncompressed length
+        block.reset();
+
+        if (!failed)
+            mf->section_map->setPos(data_length_offset) && mf->section_map->writeLE<uint64_t>(length);
+    }
+
+    bool CompressedOutputStream::WriteChunk()
+    {
+        uLongf compressedSize = compressBound((uLong) chunk.size());
+        compressed.resize(compressedSize);
+
+        if (compress2(&compressed[0], &compressedSize, &chunk[0], (uLong) chunk.size(), level) != Z_OK
+                || block->write(&compressed[0], compressedSize) != compressedSize)
+        {
+            failed = true;
+            return mf->ErrWrite(), false;
+        }
+
+        chunkSizes.push_back((uint32_t) compressedSize);
+        chunk.clear();
+        return true;
+    }
+
+    size_t CompressedOutputStream::write(const void* in, size_t count)
+    {
+        if (failed)
+            return 0;
+
+        const uint8_t* buffer_in = reinterpret_cast<const uint8_t*>(in);
+
+        size_t written_total = 0;
+
+        while (count > 0)
+        {
+            const size_t n = std::min<size_t>(count, COMPRESSED_CHUNK_SIZE - chunk.size());
+
+            chunk.insert(chunk.end(), buffer_in, buffer_in + n);
+
+            if (chunk.size() == COMPRESSED_CHUNK_SIZE && !WriteChunk())
+                return written_total;
+
+            buffer_in += n;
+            count -= n;
+            length += n;
+            written_total += n;
+        }
+
+        return written_total;
+    }
+#endif
+
     MediaFileImpl::MediaFileImpl()
     {
         sectorSize = 1024;
+        compressionLevel = 0;
+
+#ifdef _WIN32
+        nativeFile = INVALID_HANDLE_VALUE;
+#else
+        nativeFile = -1;
+#endif
     }
 
     MediaFileImpl::~MediaFileImpl()
@@ -624,15 +1081,71 @@ namespace
 
     void MediaFileImpl::Close()
     {
+        if (file != nullptr && !isReadOnly)
+            SaveFreeSpans();
+
         metadata.reset();
         reclaimed_sects.reset();
+        freeSpans.clear();
 
         section_map.reset();
+        sectionIndex.clear();
+
+#ifdef _WIN32
+        if (nativeFile != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(nativeFile);
+            nativeFile = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (nativeFile >= 0)
+        {
+            close(nativeFile);
+            nativeFile = -1;
+        }
+#endif
 
         file.reset();
     }
 
-    IOStream* MediaFileImpl::CreateSectionPriv(const char* name)
+    bool MediaFileImpl::BuildSectionIndex()
+    {
+        char *rd_name, *rd_desc;
+
+        sectionIndex.clear();
+
+        for (section_map->rewind(); !section_map->eof(); )
+        {
+            uint16_t desc_len, desc_len_padded, name_crc16;
+            uint8_t compression[4];
+            uint64_t data_length;
+            zmfBlock_t block;
+
+            auto entryPos = section_map->getPos();
+            int valid = ReadSectionEntryHeader(desc_len, desc_len_padded, name_crc16, compression, data_length, block);
+
+            if (valid < 0)
+                return false;
+
+            if (!valid)
+            {
+                if (!section_map->seek(desc_len_padded))
+                    return false;
+
+                continue;
+            }
+
+            if (!ReadSectionEntryData(desc_len, desc_len_padded, rd_name, rd_desc))
+                return false;
+
+            // first entry wins, same as a linear search would
+            sectionIndex.emplace(rd_name, entryPos);
+        }
+
+        return true;
+    }
+
+    IOStream* MediaFileImpl::CreateSectionPriv(const char* name, bool compressed)
     {
         // TODO: What if we detect corruption?
 
@@ -648,6 +1161,11 @@ namespace
         if (new_desc_len > SECTION_DESC_MAX_LENGTH)
             return ErrLimit(), nullptr;
 
+#ifndef ZOMBIE_WITH_ZLIB
+        if (compressed)
+            return ErrUnsupported(), nullptr;
+#endif
+
         for (section_map->rewind(); !section_map->eof(); )
         {
             uint16_t desc_len, desc_len_padded, name_crc16;
@@ -681,14 +1199,17 @@ namespace
                 return ErrCorrupted(), nullptr;
         }
 
+        const uint64_t entryPos = section_map->getPos();
+
         if (!section_map->writeLE<uint16_t>((uint16_t) new_desc_len)
                 || !section_map->writeLE<uint16_t>(new_name_crc16)
-                || section_map->write(NO_COMPRESSION, 4) != 4
+                || section_map->write(compressed ? ZLIB_COMPRESSION : NO_COMPRESSION, 4) != 4
                 || !section_map->writeLE<uint64_t>(0))
             return ErrWrite(), nullptr;
 
+        // for compressed sections, data_length is not the block length; CompressedOutputStream will update it
         uint64_t pos = section_map->getPos();
-        unique_ptr<BlockStream> stream(new BlockStream(this, false, section_map.get(), pos, pos - 8));
+        unique_ptr<BlockStream> stream(new BlockStream(this, false, section_map.get(), pos, compressed ? 0 : pos - 8));
 
         if (!stream->WriteDesc(section_map.get()))
             return nullptr;
@@ -696,6 +1217,13 @@ namespace
         section_map->write(new_desc, new_desc.getNumBytes());
         section_map->write(zeros, new_desc_len_padded - new_desc_len);
 
+        sectionIndex.emplace(name, entryPos);
+
+#ifdef ZOMBIE_WITH_ZLIB
+        if (compressed)
+            return new CompressedOutputStream(this, std::move(stream), pos - 8, compressionLevel);
+#endif
+
         return stream.release();
     }
 
@@ -709,6 +1237,13 @@ namespace
         return tmpString;
     }
 
+    uint64_t MediaFileImpl::GetFileSize()
+    {
+        std::lock_guard<std::mutex> lock(fileMutex);
+
+        return file->getSize();
+    }
+
     const char* MediaFileImpl::GetMetadata(const char* key)
     {
         class Iterator : public IMetadataEntryListener
@@ -764,6 +1299,39 @@ namespace
         return true;
     }
 
+    void MediaFileImpl::LoadFreeSpans()
+    {
+        if (OpenReclaimedSection(true) <= 0)
+            return;
+
+        const uint64_t numSectors = (file->getSize() + sectorSize - 1) / sectorSize;
+        uint32_t num_spans;
+
+        if (!reclaimed_sects->rewind() || !reclaimed_sects->readLE<uint32_t>(&num_spans) || num_spans > numSectors)
+            return;
+
+        std::vector<zmfSpan_t> spans(num_spans);
+
+        for (auto& span : spans)
+        {
+            if (!reclaimed_sects->readLE<uint32_t>(&span.sect_first)
+                    || !reclaimed_sects->readLE<uint32_t>(&span.sect_count))
+                return;
+
+            // as in ReclaimSpans, a damaged list costs some space, but never hands out sectors in use
+            if (span.sect_first == 0 || span.sect_count == 0
+                    || (uint64_t) span.sect_first + span.sect_count > numSectors)
+                return;
+        }
+
+        // until SaveFreeSpans runs, the stored list is empty; if we never get there, the sectors leak
+        // instead of being handed out a second time by the next session
+        if (!reclaimed_sects->rewind() || !reclaimed_sects->writeLE<uint32_t>(0))
+            return;
+
+        freeSpans = std::move(spans);
+    }
+
     int MediaFileImpl::IterateMetadata(IMetadataEntryListener* listener)
     {
         char *rd_key, *rd_value;
@@ -861,7 +1429,14 @@ namespace
         };
 
         OpenFilePriv of(fileName);
-        return Open(&of, readOnly, canCreate);
+
+        if (!Open(&of, readOnly, canCreate))
+            return false;
+
+        if (readOnly)
+            OpenNativeFile(fileName);
+
+        return true;
     }
 
     bool MediaFileImpl::Open(zshared::IOpenFile* iof, bool readOnly, bool canCreate)
@@ -972,9 +1547,26 @@ namespace
         // TODO: Verify sect_size, ctlsect
         sectorSize = sect_size;
 
+        if (!BuildSectionIndex())
+            return ErrCorrupted(), false;
+
+        if (!isReadOnly)
+            LoadFreeSpans();
+
         return true;
     }
 
+    void MediaFileImpl::OpenNativeFile(const char* fileName)
+    {
+        // failure is fine, ReadAt will fall back to the shared stream
+#ifdef _WIN32
+        nativeFile = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL, nullptr);
+#else
+        nativeFile = open(fileName, O_RDONLY);
+#endif
+    }
+
     int MediaFileImpl::OpenMetadataSection(bool readOnly)
     {
         if (metadata != nullptr)
@@ -988,61 +1580,229 @@ namespace
         if (readOnly)
             return 0;
 
-        metadata.reset(CreateSectionPriv(METADATA_SECTION_NAME));
+        metadata.reset(CreateSectionPriv(METADATA_SECTION_NAME, false));
 
         return (metadata != nullptr) ? 1 : -1;
     }
 
+    int MediaFileImpl::OpenReclaimedSection(bool readOnly)
+    {
+        if (reclaimed_sects != nullptr)
+            return 1;
+
+        reclaimed_sects.reset(OpenSectionPriv(RECLAIMED_SECTION_NAME));
+
+        if (reclaimed_sects != nullptr)
+            return 1;
+
+        if (readOnly)
+            return 0;
+
+        reclaimed_sects.reset(CreateSectionPriv(RECLAIMED_SECTION_NAME, false));
+
+        return (reclaimed_sects != nullptr) ? 1 : -1;
+    }
+
+    int MediaFileImpl::FindSection(const char* name, uint64_t& entryPos, uint16_t& desc_len, uint8_t compression[4],
+            uint64_t& data_length, zmfBlock_t& block)
+    {
+        auto it = sectionIndex.find(name);
+
+        if (it == sectionIndex.end())
+            return 0;
+
+        uint16_t desc_len_padded, name_crc16;
+        entryPos = it->second;
+
+        if (!section_map->setPos(entryPos)
+                || ReadSectionEntryHeader(desc_len, desc_len_padded, name_crc16, compression, data_length, block) <= 0)
+            return ErrCorrupted(), -1;
+
+        return 1;
+    }
+
     IOStream* MediaFileImpl::OpenOrCreateSection(const char* name)
     {
-        IOStream* section = OpenSectionPriv(name);
+        uint64_t entryPos;
+        uint16_t desc_len;
+        uint8_t compression[4];
+        uint64_t data_length;
+        zmfBlock_t block;
 
-        if (section == nullptr)
-            section = CreateSectionPriv(name);
+        int rc = FindSection(name, entryPos, desc_len, compression, data_length, block);
 
-        return section;
+        if (rc < 0)
+            return nullptr;
+
+        if (rc > 0)
+        {
+            if (isReadOnly || (compressionLevel == 0 && memcmp(compression, NO_COMPRESSION, 4) == 0))
+                return OpenSectionPriv(entryPos, compression, data_length, block);
+
+            // compressed sections can't be modified in place, so the old entry is discarded
+            // and the section is written anew (its slot in the section map gets reused right away,
+            // and its sectors by the new data, in this session or a later one). The entry's block desc is cleared, since the sectors
+            // it points to are about to belong to someone else.
+            ReclaimSpans(block);
+
+            if (!section_map->setPos(entryPos)
+                    || !section_map->writeLE<uint16_t>(0x8000 | desc_len)
+                    || !section_map->setPos(entryPos + 16)
+                    || section_map->write(zeros, sizeof(zmfBlock_t)) != sizeof(zmfBlock_t))
+                return ErrWrite(), nullptr;
+
+            sectionIndex.erase(name);
+        }
+
+        return CreateSectionPriv(name, compressionLevel > 0);
     }
 
     IOStream* MediaFileImpl::OpenSectionPriv(const char* name)
     {
-        char *rd_name, *rd_desc;
+        uint64_t entryPos;
+        uint16_t desc_len;
+        uint8_t compression[4];
+        uint64_t data_length;
+        zmfBlock_t block;
 
-        const uint16_t new_name_crc16 = zshared::crc16_ccitt((const uint8_t*) name, strlen(name));
+        if (FindSection(name, entryPos, desc_len, compression, data_length, block) <= 0)
+            return nullptr;
 
-        for (section_map->rewind(); !section_map->eof(); )
+        return OpenSectionPriv(entryPos, compression, data_length, block);
+    }
+
+    IOStream* MediaFileImpl::OpenSectionPriv(uint64_t entryPos, const uint8_t compression[4], uint64_t data_length,
+            const zmfBlock_t& block)
+    {
+        if (memcmp(compression, NO_COMPRESSION, 4) == 0)
         {
-            uint16_t desc_len, desc_len_padded, name_crc16;
-            uint8_t compression[4];
-            uint64_t data_length;
-            zmfBlock_t block;
+            unique_ptr<BlockStream> stream(new BlockStream(this, isReadOnly, section_map.get(), entryPos + 16, entryPos + 8));
+            stream->ReadDesc(&block);
+            return stream.release();
+        }
 
-            int valid = ReadSectionEntryHeader(desc_len, desc_len_padded, name_crc16, compression, data_length, block);
+#ifdef ZOMBIE_WITH_ZLIB
+        if (memcmp(compression, ZLIB_COMPRESSION, 4) == 0)
+        {
+            unique_ptr<BlockStream> stream(new BlockStream(this, true, section_map.get(), entryPos + 16));
+            stream->ReadDesc(&block);
 
-            if (valid < 0)
-                return nullptr;
+            unique_ptr<CompressedInputStream> compressed(new CompressedInputStream(std::move(stream), data_length));
 
-            if (!valid)
+            if (!compressed->ReadIndex())
+                return ErrCorrupted(), nullptr;
+
+            return compressed.release();
+        }
+#endif
+
+        return ErrUnsupported(), nullptr;
+    }
+
+    size_t MediaFileImpl::ReadAt(uint64_t offset, void* out, size_t count)
+    {
+#ifdef _WIN32
+        if (nativeFile != INVALID_HANDLE_VALUE)
+        {
+            uint8_t* buffer_out = reinterpret_cast<uint8_t*>(out);
+            size_t read_total = 0;
+
+            while (read_total < count)
             {
-                if (!section_map->seek(desc_len_padded))
-                    return nullptr;
+                OVERLAPPED overlapped = {};
+                overlapped.Offset = (DWORD) offset;
+                overlapped.OffsetHigh = (DWORD)(offset >> 32);
 
-                continue;
+                DWORD read;
+                const DWORD toRead = (DWORD) std::min<size_t>(count - read_total, 0x40000000);
+
+                if (!ReadFile(nativeFile, buffer_out + read_total, toRead, &read, &overlapped) || read == 0)
+                    break;
+
+                offset += read;
+                read_total += read;
             }
 
-            if (!ReadSectionEntryData(desc_len, desc_len_padded, rd_name, rd_desc))
-                return nullptr;
+            return read_total;
+        }
+#else
+        if (nativeFile >= 0)
+        {
+            uint8_t* buffer_out = reinterpret_cast<uint8_t*>(out);
+            size_t read_total = 0;
 
-            if (name_crc16 == new_name_crc16 && strcmp(rd_name, name) == 0)
+            while (read_total < count)
             {
-                auto pos = section_map->getPos() - desc_len_padded - 32;
+                const ssize_t read = pread(nativeFile, buffer_out + read_total, count - read_total, (off_t) offset);
+
+                if (read < 0 && errno == EINTR)
+                    continue;
 
-                unique_ptr<BlockStream> stream(new BlockStream(this, isReadOnly, section_map.get(), pos + 16, pos + 8));
-                stream->ReadDesc(&block);
-                return stream.release();
+                if (read <= 0)
+                    break;
+
+                offset += read;
+                read_total += read;
             }
+
+            return read_total;
         }
+#endif
+
+        std::lock_guard<std::mutex> lock(fileMutex);
 
-        return nullptr;
+        if (!file->setPos(offset))
+            return 0;
+
+        return file->read(out, count);
+    }
+
+    bool MediaFileImpl::ReadSpanTag(const zmfSpan_t& span, zmfSpan_t* next_span)
+    {
+        uint8_t tag[8];
+
+        if (ReadAt(((uint64_t) span.sect_first + span.sect_count) * sectorSize - 8, tag, 8) != 8)
+            return false;
+
+        next_span->sect_first = tag[0] | (tag[1] << 8) | (tag[2] << 16) | ((uint32_t) tag[3] << 24);
+        next_span->sect_count = tag[4] | (tag[5] << 8) | (tag[6] << 16) | ((uint32_t) tag[7] << 24);
+        return true;
+    }
+
+    void MediaFileImpl::ReclaimSpans(const zmfBlock_t& block)
+    {
+        const uint64_t numSectors = (file->getSize() + sectorSize - 1) / sectorSize;
+
+        std::vector<zmfSpan_t> spans;
+        zmfSpan_t span = block.first_span;
+        uint64_t span_in_stream = 0;
+
+        // walk the chain like BlockStream::JumpToPos does: a span ends with a tag unless it holds the rest of the block
+        while (span_in_stream < block.length)
+        {
+            // a damaged chain is left alone rather than risk handing out sectors which belong to another block
+            if (span.sect_first == 0 || span.sect_count == 0
+                    || (uint64_t) span.sect_first + span.sect_count > numSectors
+                    || spans.size() >= numSectors)
+                return;
+
+            spans.push_back(span);
+
+            const uint64_t bytesInSpan = (uint64_t) span.sect_count * sectorSize;
+
+            if (span_in_stream + bytesInSpan >= block.length)
+                break;
+
+            zmfSpan_t next_span;
+
+            if (!ReadSpanTag(span, &next_span))
+                return;
+
+            span_in_stream += bytesInSpan - 8;
+            span = next_span;
+        }
+
+        freeSpans.insert(freeSpans.end(), spans.rbegin(), spans.rend());
     }
 
     bool MediaFileImpl::ReadMetadataEntryData(uint16_t data_len, uint16_t data_len_padded,
@@ -1218,6 +1978,56 @@ namespace
         return true;
     }
 
+    void MediaFileImpl::SaveFreeSpans()
+    {
+        if (freeSpans.empty() && sectionIndex.find(RECLAIMED_SECTION_NAME) == sectionIndex.end())
+            return;
+
+        if (OpenReclaimedSection(false) <= 0)
+            return;
+
+        // growing the section can take sectors from the free list itself, in which case the list is written again;
+        // the second pass is never longer than the first, so it fits in the sectors which are already allocated
+        std::vector<zmfSpan_t> spans;
+
+        do
+        {
+            spans = freeSpans;
+
+            if (!reclaimed_sects->rewind() || !reclaimed_sects->writeLE<uint32_t>((uint32_t) spans.size()))
+                return;
+
+            for (const auto& span : spans)
+            {
+                if (!reclaimed_sects->writeLE<uint32_t>(span.sect_first)
+                        || !reclaimed_sects->writeLE<uint32_t>(span.sect_count))
+                    return;
+            }
+        }
+        while (spans.size() != freeSpans.size()
+                || (!spans.empty() && memcmp(&spans[0], &freeSpans[0], spans.size() * sizeof(zmfSpan_t)) != 0));
+    }
+
+    bool MediaFileImpl::SetCompressionLevel(int level)
+    {
+        if (level < 0 || level > 9)
+        {
+            errorDesc = "Compression level must be between 0 and 9, inclusive.";
+            return false;
+        }
+
+#ifndef ZOMBIE_WITH_ZLIB
+        if (level > 0)
+        {
+            errorDesc = "Compressed sections are not supported in this build.";
+            return false;
+        }
+#endif
+
+        this->compressionLevel = level;
+        return true;
+    }
+
     bool MediaFileImpl::SetSectorSize(uint32_t sectorSize)
     {
         if (sectorSize < SECT_MIN_SIZE || sectorSize > SECT_MAX_SIZE)
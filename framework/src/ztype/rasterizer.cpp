@@ -17,11 +17,36 @@ namespace ztype
         FT_Done_FreeType(library);
     }
 
+    static bool InitFreeType()
+    {
+        if (library == nullptr)
+        {
+            if (FT_Init_FreeType(&library) != 0)
+                return false;
+
+            atexit(ExitFreeType);
+        }
+
+        return true;
+    }
+
+    static bool SetPixelSize(FT_Face face, int pxsize)
+    {
+        if (FT_Set_Pixel_Sizes(face, 0, pxsize) != 0)
+        {
+            FT_Done_Face(face);
+            return false;
+        }
+
+        return true;
+    }
+
     class RasterizerImpl : public Rasterizer
     {
         private:
             FT_Face face;
             uint8_t* bufferToRelease;
+            std::unique_ptr<InputStream> streamToRelease;
 
             FaceMetrics faceMetrics;
 
@@ -29,15 +54,15 @@ namespace ztype
             GlyphMetrics metrics;
 
         public:
-            RasterizerImpl(FT_Face face, uint8_t* bufferToRelease);
+            RasterizerImpl(FT_Face face, uint8_t* bufferToRelease, std::unique_ptr<InputStream>&& streamToRelease = nullptr);
             virtual ~RasterizerImpl();
 
             virtual bool GetChar(uint32_t cp, int flags, const GlyphBitmap** bitmap_ptr, const GlyphMetrics** metrics_ptr) override;
             virtual const FaceMetrics* GetMetrics() override { return &faceMetrics; }
     };
 
-    RasterizerImpl::RasterizerImpl(FT_Face face, uint8_t* bufferToRelease)
-            : face(face), bufferToRelease(bufferToRelease)
+    RasterizerImpl::RasterizerImpl(FT_Face face, uint8_t* bufferToRelease, std::unique_ptr<InputStream>&& streamToRelease)
+            : face(face), bufferToRelease(bufferToRelease), streamToRelease(std::move(streamToRelease))
     {
         faceMetrics.ascent =        (int16_t)(face->size->metrics.ascender >> 6);
         faceMetrics.descent =       (int16_t)(face->size->metrics.descender >> 6);
@@ -111,15 +136,8 @@ namespace ztype
     {
         int error;
 
-        if (library == nullptr)
-        {
-            error = FT_Init_FreeType( &library );
-
-            if ( error )
-                return nullptr;
-
-            atexit(ExitFreeType);
-        }
+        if (!InitFreeType())
+            return nullptr;
 
         FT_Face face;
         error = FT_New_Face( library, ttfFile, 0, &face );
@@ -133,7 +151,8 @@ namespace ztype
             return nullptr;
         }
 
-        error = FT_Set_Pixel_Sizes(face, 0, pxsize);
+        if (!SetPixelSize(face, pxsize))
+            return nullptr;
 
         return new RasterizerImpl(face, nullptr);
     }
@@ -147,15 +166,8 @@ namespace ztype
         if (size == 0 || size > (size_t) ~(size_t) 0)
             return nullptr;
 
-        if (library == nullptr)
-        {
-            error = FT_Init_FreeType( &library );
-
-            if ( error )
-                return nullptr;
-
-            atexit(ExitFreeType);
-        }
+        if (!InitFreeType())
+            return nullptr;
 
         uint8_t* bytes = Allocator<uint8_t>::allocate((size_t) size);
 
@@ -182,8 +194,34 @@ namespace ztype
             return nullptr;
         }
 
-        error = FT_Set_Pixel_Sizes(face, 0, pxsize);
+        if (!SetPixelSize(face, pxsize))
+        {
+            Allocator<uint8_t>::release(bytes);
+            return nullptr;
+        }
 
         return new RasterizerImpl(face, bytes);
     }
+
+    Rasterizer* Rasterizer::Create(const void* ttfData, size_t size, int pxsize, std::unique_ptr<InputStream>&& owner)
+    {
+        int error;
+
+        if (ttfData == nullptr || size == 0)
+            return nullptr;
+
+        if (!InitFreeType())
+            return nullptr;
+
+        FT_Face face;
+        error = FT_New_Memory_Face( library, static_cast<const FT_Byte*>(ttfData), (FT_Long) size, 0, &face );
+
+        if ( error )
+            return nullptr;
+
+        if (!SetPixelSize(face, pxsize))
+            return nullptr;
+
+        return new RasterizerImpl(face, nullptr, std::move(owner));
+    }
 }
@@ -26,58 +26,12 @@ namespace ntile
 
         if (copyOld)
         {
-            WorldBlock* p_block = &blocks[0];
-
-            for (int by = 0; by < copyOffset.y; by++)
-                for (int bx = 0; bx < worldSize.x; bx++)
-                {
-                    li::constructPointer(&p_block->entities);
-                    p_block++;
-                }
-
             for (int by = 0; by < old_worldSize.y; by++)
-            {
-                WorldBlock* oldBlocks = &old_blocks[by * old_worldSize.x];
-                WorldBlock* p_newBlocks = &blocks[(by + copyOffset.y) * worldSize.x];
-
-                for (int bx = 0; bx < copyOffset.x; bx++)
-                {
-                    li::constructPointer(&p_newBlocks->entities);
-                    p_newBlocks++;
-                }
-
-                Allocator<WorldBlock>::move(p_newBlocks, oldBlocks, old_worldSize.x);
-                p_newBlocks += old_worldSize.x;
-
-                for (int bx = copyOffset.x + old_worldSize.x; bx < worldSize.x; bx++)
-                {
-                    li::constructPointer(&p_newBlocks->entities);
-                    p_newBlocks++;
-                }
-            }
-
-            p_block += old_worldSize.y * worldSize.x;
-
-            for (int by = old_worldSize.y + copyOffset.y; by < worldSize.y; by++)
-                for (int bx = 0; bx < worldSize.x; bx++)
-                {
-                    li::constructPointer(&p_block->entities);
-                    p_block++;
-                }
+                Allocator<WorldBlock>::move(&blocks[(by + copyOffset.y) * worldSize.x + copyOffset.x],
+                        &old_blocks[by * old_worldSize.x], old_worldSize.x);
 
             Allocator<WorldTile>::release(old_blocks);
         }
-        else
-        {
-            WorldBlock* p_block = &blocks[0];
-
-            for (int by = 0; by < worldSize.y; by++)
-                for (int bx = 0; bx < worldSize.x; bx++)
-                {
-                    li::constructPointer(&p_block->entities);
-                    p_block++;
-                }
-        }
     }
 
     void Blocks::GenerateTiles(WorldBlock* block)
@@ -266,8 +220,6 @@ namespace ntile
         for (int by = 0; by < worldSize.y; by++)
             for (int bx = 0; bx < worldSize.x; bx++)
             {
-                li::destructPointer(&p_block->entities);
-
                 p_block->vertexBuf.reset();
 
                 p_block++;
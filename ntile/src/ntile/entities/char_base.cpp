@@ -6,7 +6,8 @@ namespace ntile
 {
 namespace entities
 {
-    char_base::char_base(Int3& pos, float angle) : angle(angle)
+    char_base::char_base(Int3& pos, float angle) : model(nullptr), angle(angle), movementListener(nullptr),
+            transformStore(nullptr)
     {
         this->pos = pos;
     }
@@ -44,12 +45,68 @@ namespace entities
         return false;
     }
 
-    void char_base::SetPos(const Float3& pos)
+    void char_base::OnTransformAttach(TransformStore* store, uint32_t handle)
     {
+        transformStore = store;
+        transform = handle;
+
+        store->SetPos(handle, pos);
+        store->SetSpeed(handle, speed);
+        store->SetOrientation(handle, orientation);
+        store->SetPosMirror(handle, &pos);
+
+        // The world indexes the bounding box kept in the store
+        Float3 min, max;
+
+        if (model != nullptr && GetAABB(min, max))
+            store->SetLocalAABB(handle, min - pos, max - pos);
+
+        // Every notification is a virtual call; only a listener following the movement needs them
+        store->SetMoveNotification(handle, movementListener != nullptr && movementListener->FollowsMovement(this));
+    }
+
+    void char_base::OnTransformMoved()
+    {
+        // 'pos' has been updated by the store already; the world moves us by 'speed' per tick
         if (movementListener)
-            movementListener->OnSetPos(this, this->pos, pos);
+            movementListener->OnMove(this, pos - speed, pos);
+    }
+
+    void char_base::SetMovementListener(IEntityMovementListener* listener)
+    {
+        movementListener = listener;
+
+        if (transformStore != nullptr)
+            transformStore->SetMoveNotification(transform, listener != nullptr && listener->FollowsMovement(this));
+    }
 
+    void char_base::SetOrientation(const Float3& orientation)
+    {
+        this->orientation = orientation;
+
+        if (transformStore != nullptr)
+            transformStore->SetOrientation(transform, orientation);
+    }
+
+    void char_base::SetPos(const Float3& pos)
+    {
+        // Listeners see the entity at its new position already
+        const Float3 oldPos = this->pos;
         this->pos = pos;
+
+        if (transformStore != nullptr)
+            transformStore->SetPos(transform, pos);
+
+        if (movementListener)
+            movementListener->OnSetPos(this, oldPos, this->pos);
+    }
+
+    void char_base::SetSpeed(const Float3& speed)
+    {
+        this->speed = speed;
+
+        if (transformStore != nullptr)
+            transformStore->SetSpeed(transform, speed);
     }
 }
 }
@@ -61,14 +61,9 @@ namespace entities
 #ifdef ENABLE_ANIMATION
         model->AnimationTick();
 
-        if (t != 0)
-        {
-            const Float3 newPos = pos + speed;
-
-            SetPos(newPos);
-
-            t--;
-        }
+        // The world moves us by 'speed' after every tick; stop once the step is complete
+        if (t != 0 && --t == 0)
+            SetSpeed(Float3());
 
         if (t == 0)
         {
@@ -103,7 +98,7 @@ namespace entities
                 }
 
                 // Move for 16 ticks
-                speed = (newPos - pos) * (1.0f / 16);
+                SetSpeed((newPos - pos) * (1.0f / 16));
                 t = 16;
 
                 auto anim = model->GetAnimationByName((lastAnim == 0) ? "step" : "step2");
@@ -7,6 +7,7 @@
 
 #include <framework/abstractentity.hpp>
 #include <framework/pointentity.hpp>
+#include <framework/transformstore.hpp>
 
 #include <littl/cfx2.hpp>
 #include <littl/HashMap.hpp>
@@ -24,6 +25,11 @@ namespace ntile
     {
         public:
             virtual void OnSetPos(IPointEntity* pe, const Float3& oldPos, const Float3& newPos) = 0;
+
+            // Per-tick movement done by the world's TransformStore; the world has already updated the entity's bounds.
+            // Only delivered if FollowsMovement returns true (one virtual call per moving entity per tick)
+            virtual bool FollowsMovement(IPointEntity* pe) { return false; }
+            virtual void OnMove(IPointEntity* pe, const Float3& oldPos, const Float3& newPos) {}
     };
 
     class ICommonEntity
@@ -41,7 +47,7 @@ namespace ntile
 {
 namespace entities
 {
-    class char_base : public PointEntityBase, public ICommonEntity
+    class char_base : public PointEntityBase, public ICommonEntity, public ITransformStoreUser
     {
         protected:
             IModel* model;
@@ -55,20 +61,32 @@ namespace entities
         
             IEntityMovementListener* movementListener;
 
+            // Movement is integrated by the world (pos and speed above mirror the store;
+            // the store writes 'pos' back itself, so GetPos never has to touch it)
+            TransformStore* transformStore;
+            uint32_t transform;
+
             char_base(Int3& pos, float angle);
 
             virtual void Draw(const UUID_t* modeOrNull) override;
         
         public:
-            char_base() { model = nullptr; movementListener = nullptr; }
+            char_base() { model = nullptr; movementListener = nullptr; transformStore = nullptr; }
 
             virtual bool GetAABB(Float3& min, Float3& max) override;
             virtual bool GetAABBForPos(const Float3& newPos, Float3& min, Float3& max) override;
 
             const glm::mat4x4& GetModelView() { return modelView; }
 
-            virtual void SetMovementListener(IEntityMovementListener* listener) override { movementListener = listener; }
+            virtual void SetMovementListener(IEntityMovementListener* listener) override;
+            virtual void SetOrientation(const Float3& orientation) override;
             virtual void SetPos(const Float3& pos) override;
+            virtual void SetSpeed(const Float3& speed) override;
+
+            // zfw.ITransformStoreUser
+            virtual void OnTransformAttach(TransformStore* store, uint32_t handle) override;
+            virtual void OnTransformDetach() override { transformStore = nullptr; }
+            virtual void OnTransformMoved() override;
     };
 
     class char_player : public char_base
@@ -105,10 +105,12 @@ namespace entities
 
     void prop_base::SetPos(const Float3& pos)
     {
-        if (movementListener)
-            movementListener->OnSetPos(this, this->pos, pos);
-
+        // Listeners see the entity at its new position already
+        const Float3 oldPos = this->pos;
         this->pos = pos;
+
+        if (movementListener)
+            movementListener->OnSetPos(this, oldPos, this->pos);
     }
 
     SERIALIZE_BEGIN_2(prop_base)
@@ -38,6 +38,12 @@ namespace ntile
 
     static const char bindingsFileName[] = "ntile.bindings";
 
+    // per-frame time slice for realizing streamed-in resources (see IResourceManager2::ProcessRequests)
+    static const uint64_t realizeBudgetMicros = 2000;
+
+    // resources must go unused for this long before being evicted to stay within res_cpubudget/res_gpubudget
+    static const uint32_t evictionMinIdleFrames = 300;
+
     static const VertexAttrib worldVertexAttribs[] =
     {
         {0,     "pos",      ATTRIB_INT_3},
@@ -176,8 +182,11 @@ namespace ntile
         ieh->Register("abstract_base",      &CreateInstance<entities::abstract_base>);
         ieh->RegisterExternal("ntile/entities/spawn_player", 0);
 
-        ieh->Register("prop_base",          &CreateInstance<entities::prop_base>);
-        ieh->Register("prop_treasurechest", &CreateInstance<entities::prop_treasurechest>);
+        // Props are placed by the hundred, so they come from pools (as do the classes derived below)
+        ieh->Register("prop_base",          &CreateInstance<entities::prop_base>,
+                &CreatePooledInstance<entities::prop_base>);
+        ieh->Register("prop_treasurechest", &CreateInstance<entities::prop_treasurechest>,
+                &CreatePooledInstance<entities::prop_treasurechest>);
         //Entity::Register("prop_tree",           &entities::prop_tree::Create);
         //ieh->Register("water_body",         &CreateInstance<entities::water_body>);
         ieh->RegisterExternal("ntile/entities/door_base", 0);
@@ -269,11 +278,17 @@ namespace ntile
         world.reset(new EntityWorld(g_sys));
         world->AddEntityFilter(this);
 
+        // Nearby-entity and collision queries span little more than a block
+        world->GetSpatialIndex()->SetCellSize(TILES_IN_BLOCK_H * TILE_SIZE_H);
+
         ambient.Init(daytime);
 
         for (size_t i = 0; i < li_lengthof(controlVarNames); i++)
             var->BindVariable(controlVarNames[i], reflection::ReflectedValue_t(controls[i]), IVarSystem::kReadWrite, 0);
 
+        var->GetVariableHandle("res_cpubudget", &res_cpubudget, 0);
+        var->GetVariableHandle("res_gpubudget", &res_gpubudget, 0);
+
 #ifndef ZOMBIE_CTR
         controls[Controls::screenshot] = Vkey_t {VKEY_KEY, -1, KEY_PRINTSCREEN, 0};
         controls[Controls::profiler] = Vkey_t {VKEY_KEY, -1, 'p', 0};
@@ -450,7 +465,7 @@ namespace ntile
 
             // pick for entities
             world->IterateEntities([](IEntity* ent) {
-                const uint32_t pickingColour = 0xFF800000 | (ent->GetID());
+                const uint32_t pickingColour = 0xFF800000 | EntityWorld::GetEntityIndex(ent->GetID());
                 ir->SetColourv((const uint8_t*) &pickingColour);
 
                 ent->Draw(&DRAW_ENT_PICKING);
@@ -465,7 +480,7 @@ namespace ntile
             }
             else if (sample != 0xFFFFFFFF)
             {
-                mouseEntity = world->GetEntityByID(sample & 0x7FFFFF);
+                mouseEntity = world->GetEntityByIndex(sample & 0x7FFFFF);
             }
         }
 #endif
@@ -620,6 +635,12 @@ namespace ntile
         ir->SetColour(RGBA_COLOUR(255, 0, 0));
         ir->DrawRect(Int3(198, 1 + 2, 0), Int2(1, 4));
 #endif
+        // Everything drawn this frame has been touched by now
+        const int cpuBudgetMiB = res_cpubudget.IsValid() ? std::max(res_cpubudget.Get(), 0) : 0;
+        const int gpuBudgetMiB = res_gpubudget.IsValid() ? std::max(res_gpubudget.Get(), 0) : 0;
+        g_res->SetMemoryBudget((size_t) cpuBudgetMiB << 20, (size_t) gpuBudgetMiB << 20, evictionMinIdleFrames);
+        g_res->EnforceMemoryBudget();
+
         if (profiler)
             profiler->LeaveSection();
     }
@@ -720,11 +741,6 @@ namespace ntile
         if (pe == nullptr)
             return true;
 
-        Short2 blockXY = WorldToBlockXY(Float2(ent->GetPos()));
-
-        if (blockXY.x >= 0 && blockXY.y >= 0 && blockXY.x < worldSize.x && blockXY.y < worldSize.y)
-            blocks[blockXY.y * worldSize.x + blockXY.x].entities.add(pe);
-
         ICommonEntity* ice = dynamic_cast<ICommonEntity*>(ent);
 
         if (ice != nullptr)
@@ -735,6 +751,8 @@ namespace ntile
 
     void GameScreen::OnFrame(double delta)
     {
+        g_res->ProcessRequests(realizeBudgetMicros);
+
         MessageHeader* msg;
 
         while ((msg = g_msgQueue->Retrieve(Timeout(0))) != nullptr)
@@ -849,6 +867,7 @@ namespace ntile
                             break;
 
                         controls[setControlsIndex] = ev->input.vkey;
+                        g_sys->GetVarSystem()->OnBoundVariableChanged(controlVarNames[setControlsIndex]);
                         //Sys::printk("Bound: %s", Event::FormatVkey(ev->vkey.vk));
                         setControlsIndex++;
 
@@ -879,6 +898,12 @@ namespace ntile
                     if (Vkey::Test(ev->input, controls[Controls::profiler]) && (ev->input.flags & VKEY_PRESSED))
                     {
                         g_sys->ProfileFrame(g_sys->GetFrameCounter() + 1);
+
+                        // Also grab the last few seconds, in case we've just seen a hitch
+                        unique_ptr<OutputStream> trace(g_sys->OpenOutput("ntile_trace.json"));
+
+                        if (trace)
+                            g_sys->GetProfiler()->WriteChromeTrace(trace.get(), 5 * 1000000);
                     }
 
                     if (Vkey::Test(ev->input, controls[Controls::start]) && (ev->input.flags & VKEY_PRESSED))
@@ -1024,49 +1049,22 @@ namespace ntile
 
     void GameScreen::OnRemoveEntity(EntityWorld* world, IEntity* ent)
     {
+        if (playerNearestEntity != nullptr && playerNearestEntity->GetEntity() == ent)
+            playerNearestEntity = nullptr;
     }
 
-    void GameScreen::OnSetPos(IPointEntity* pe, const Float3& oldPos, const Float3& newPos) 
+    void GameScreen::OnMove(IPointEntity* pe, const Float3& oldPos, const Float3& newPos)
     {
-        const Short2 oldBucket = WorldToBlockXY(Float2(oldPos));
-        const Short2 newBucket = WorldToBlockXY(Float2(newPos));
-
-        if (oldBucket != newBucket)
-        {
-            if (oldBucket.x >= 0 && oldBucket.y >= 0 && oldBucket.x < worldSize.x && oldBucket.y < worldSize.y)
-                blocks[oldBucket.y * worldSize.x + oldBucket.x].entities.removeItem(pe);
-
-            if (newBucket.x >= 0 && newBucket.y >= 0 && newBucket.x < worldSize.x && newBucket.y < worldSize.y)
-                blocks[newBucket.y * newBucket.x + newBucket.x].entities.add(pe);
-        }
-
         if (pe == player.get())
-        {
-            IPointEntity* nearestEntity = nullptr;
-
-            static const float MAX_DIST = 24.0f;
-            float nearestEntityDist = MAX_DIST;
-
-            for (int by = std::max(newBucket.y - 1, 0); by < newBucket.y + 1 && by < worldSize.y; by++)
-                for (int bx = std::max(newBucket.x - 1, 0); bx < newBucket.x + 1 && bx < worldSize.x; bx++)
-                {
-                    for (const auto& ent : blocks[by * worldSize.x + bx].entities)
-                    {
-                        if (ent == pe)
-                            continue;
-
-                        const float dist = glm::length(newPos - ent->GetEntity()->GetPos());
+            p_UpdatePlayerNearestEntity(newPos);
+    }
 
-                        if (dist < nearestEntityDist && dist < MAX_DIST)
-                        {
-                            nearestEntityDist = dist;
-                            nearestEntity = ent;
-                        }
-                    }
-                }
+    void GameScreen::OnSetPos(IPointEntity* pe, const Float3& oldPos, const Float3& newPos) 
+    {
+        world->UpdateEntityBounds(pe->GetEntity());
 
-            playerNearestEntity = nearestEntity;
-        }
+        if (pe == player.get())
+            p_UpdatePlayerNearestEntity(newPos);
     }
 
     void GameScreen::OnTicks(int ticks)
@@ -1139,6 +1137,33 @@ namespace ntile
         }
     }
 
+    void GameScreen::p_UpdatePlayerNearestEntity(const Float3& playerPos)
+    {
+        IPointEntity* nearestEntity = nullptr;
+
+        static const float MAX_DIST = 24.0f;
+        float nearestEntityDist = MAX_DIST;
+
+        std::vector<IEntity*> nearby;
+        world->QueryRadius(playerPos, MAX_DIST, nearby);
+
+        for (IEntity* ent : nearby)
+        {
+            if (ent == player.get())
+                continue;
+
+            const float dist = glm::length(playerPos - ent->GetPos());
+
+            if (dist < nearestEntityDist && dist < MAX_DIST)
+            {
+                nearestEntityDist = dist;
+                nearestEntity = dynamic_cast<IPointEntity*>(ent);
+            }
+        }
+
+        playerNearestEntity = nearestEntity;
+    }
+
     void GameScreen::SetupWorldLighting(const glm::mat4x4& modelView, Float3& backgroundColour)
     {
         Float3 sun_ambient;
@@ -1196,7 +1221,7 @@ namespace ntile
 
         player = std::make_shared<entities::char_player>(Int3(worldSize * Int2(128, 128), 0), 0.0f);
         player->Init();
-        player->SetCollisionHandler(std::make_shared<WorldCollisionHandler>());
+        player->SetCollisionHandler(std::make_shared<WorldCollisionHandler>(world.get()));
         world->AddEntity(player);
 
 #ifndef ZOMBIE_CTR
@@ -8,6 +8,7 @@
 #include <framework/entityworld.hpp>
 #include <framework/resourcemanager2.hpp>
 #include <framework/system.hpp>
+#include <framework/varsystem.hpp>
 
 #ifdef ZOMBIE_STUDIO
 #include <framework/bleb/studiobleb.hpp>
@@ -53,7 +54,13 @@ namespace ntile
     class WorldCollisionHandler : public ICollisionHandler
     {
         public:
+            WorldCollisionHandler(EntityWorld* world) : world(world) {}
+
             virtual bool CollideMovementTo(IPointEntity* pe, const Float3& pos, Float3& newPos) override;
+
+        private:
+            EntityWorld* world;
+            std::vector<IEntity*> nearby;
     };
 
     class GameScreen
@@ -70,6 +77,7 @@ namespace ntile
 
             // Resource Management
             ResourceSection_t sectPrivate, sectEntities;
+            VarHandle<int> res_cpubudget, res_gpubudget;    // in MiB; 0 = unlimited
 
             // Blocks & world
             unique_ptr<EntityWorld> world;
@@ -152,6 +160,7 @@ namespace ntile
             bool StartGame();
 
             void p_LogResourceError();
+            void p_UpdatePlayerNearestEntity(const Float3& playerPos);
 
             ///////////////////////////////////////
             void DrawBlocks(bool picking, Int2 highlight);
@@ -203,6 +212,8 @@ namespace ntile
             virtual void OnRemoveEntity(EntityWorld* world, IEntity* ent) override;
 
             virtual void OnSetPos(IPointEntity* pe, const Float3& oldPos, const Float3& newPos) override;
+            virtual bool FollowsMovement(IPointEntity* pe) override { return pe == player.get(); }
+            virtual void OnMove(IPointEntity* pe, const Float3& oldPos, const Float3& newPos) override;
 
             // ntile::IGameScreen
             virtual IResourceManager2* GetResourceManager() override { return g_res.get(); }
@@ -161,7 +161,9 @@ namespace ntile
 
     int GameScreen::Edit_SaveMap()
     {
-        const char* map = g_sys->GetVarSystem()->GetVariableOrEmptyString("map");
+        auto var = g_sys->GetVarSystem();
+
+        const char* map = var->GetVariableOrEmptyString("map");
 
         unique_ptr<zshared::MediaFile> mapFile(zshared::MediaFile::Create());
 
@@ -169,6 +171,12 @@ namespace ntile
         if (!mapFile->Open(&of, false, true))
             return EX_WRITE_ERR;
 
+        // Map sections are rewritten as a whole, so they can be compressed (opt-in; 1..9)
+        const int compression = var->GetVariableOrDefault<int>("map_compression", 0);
+
+        if (compression != 0 && !mapFile->SetCompressionLevel(compression))
+            g_sys->Printf(kLogWarning, "Saving map uncompressed: %s", mapFile->GetErrorDesc());
+
         mapFile->SetMetadata("media.authored_using", "name=" APP_TITLE ",version=" APP_VERSION ",vendor=" APP_VENDOR);
 
         // ntile.MapBlocks
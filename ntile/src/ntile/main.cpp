@@ -66,6 +66,9 @@ namespace ntile
         //fsUnion->AddFileSystem(Sys::CreateStdFileSystem("AppData_nanotile",  FS_READ | FS_WRITE | FS_CREATE),   1000);
         fsUnion->AddFileSystem(g_sys->CreateStdFileSystem(".", kFSAccessStat | kFSAccessRead), 200);
         fsUnion->AddFileSystem(g_sys->CreateBlebFileSystem("ntile1.bleb", kFSAccessStat | kFSAccessRead), 200);
+        // Assets packed with tools/packer (input=ntile/assets/ntile) are optional; loose files are used otherwise
+        if (auto pack = g_sys->CreatePackFileSystem("ntile.pack", kFSAccessStat | kFSAccessRead))
+            fsUnion->AddFileSystem(move(pack), 200, "ntile/");
 		fsUnion->AddFileSystem(g_sys->CreateStdFileSystem("NtileWritable", kFSAccessAll), 500);
 
         g_sys->ParseArgs1(argc, argv);
@@ -162,6 +162,8 @@ namespace n3d
                 return DefaultStateTransitionTo(this, targetState, resMgr);
             }
 
+            virtual void GetMemoryUsage(size_t* cpuBytes_out, size_t* gpuBytes_out) final override;
+
         private:
             State_t state;
 
@@ -283,6 +285,8 @@ namespace n3d
                 return DefaultStateTransitionTo(this, targetState, resMgr);
             }
 
+            virtual void GetMemoryUsage(size_t* cpuBytes_out, size_t* gpuBytes_out) final override;
+
             void Bind();
             //void SetAlignment(int alignment) { this->alignment = alignment; }
 
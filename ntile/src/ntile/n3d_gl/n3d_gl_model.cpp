@@ -28,6 +28,17 @@ namespace n3d
         }
     }
 
+    void GLModel::GetMemoryUsage(size_t* cpuBytes_out, size_t* gpuBytes_out)
+    {
+        size_t gpuBytes = 0;
+
+        for (const auto& mesh : meshes)
+            gpuBytes += (size_t) mesh.count * mesh.format->GetVertexSize();
+
+        *cpuBytes_out = mdl1.size();
+        *gpuBytes_out = gpuBytes;
+    }
+
     Mesh* GLModel::GetMeshByIndex(unsigned int index)
     {
         if (index < meshes.size())
@@ -67,6 +78,10 @@ namespace n3d
         if (meshes.size())
             return true;
 
+        // The vertex data is dropped once uploaded, so coming back from eviction (Unrealize) means reading it again
+        if (mdl1.empty() && !Preload(resMgr))
+            return false;
+
         auto vf = glr->GetModelVertexFormat();
 
         const size_t vertexSize = vf->GetVertexSize();
@@ -37,6 +37,15 @@ namespace n3d
         gl.BindTexture0(tex);
         glTexEnvf(GL_TEXTURE_FILTER_CONTROL, GL_TEXTURE_LOD_BIAS, lodBias);
     }
+
+    void GLTexture::GetMemoryUsage(size_t* cpuBytes_out, size_t* gpuBytes_out)
+    {
+        *cpuBytes_out = pm.pixelData.size();
+
+        // always uploaded as RGBA8 (see GetOpenGLTextureFormat); a full mip chain adds about a third
+        const size_t level0 = (size_t) size.x * size.y * 4;
+        *gpuBytes_out = (tex != 0) ? ((numMipmaps > 1) ? level0 * 4 / 3 : level0) : 0;
+    }
     
     bool GLTexture::InitLevel(int level, const Pixmap_t& pm)
     {
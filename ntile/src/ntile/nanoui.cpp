@@ -18,7 +18,7 @@ namespace ntile
         g_res->Resource(&font,          "path=ntile/font/thin,size=2");
 
         auto var = g_sys->GetVarSystem();
-        var->GetVariable("bind_attack", &button, 0);
+        var->GetVariableHandle("bind_attack", &button, 0);
 
         return true;
     }
@@ -4,6 +4,7 @@
 
 #include <framework/datamodel.hpp>
 #include <framework/event.hpp>
+#include <framework/varsystem.hpp>
 
 #include <littl/String.hpp>
 
@@ -46,7 +47,7 @@ namespace ntile
             Dialog_t dialogStack[kMaxDialogs];
             size_t numDialogs;
 
-            Vkey_t button;
+            VarHandle<Vkey_t> button;
             n3d::IFont* font;
     };
 }
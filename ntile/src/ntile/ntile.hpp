@@ -64,8 +64,6 @@ namespace ntile
         unique_ptr<IVertexBuffer> vertexBuf;
         uint32_t pickingColour;
 
-        List<IPointEntity*> entities;
-
         // 2k
         WorldTile tiles[TILES_IN_BLOCK_V][TILES_IN_BLOCK_H];
     };
@@ -14,24 +14,22 @@ namespace ntile
         if (!pe->GetAABBForPos(newPos, min, max))
             return true;
 
-        const Short2 blockXY = WorldToBlockXY(Float2(newPos));
+        nearby.clear();
+        world->QueryAABB(min, max, nearby);
 
-        for (int by = std::max(blockXY.y - 1, 0); by < blockXY.y + 1 && by < worldSize.y; by++)
-            for (int bx = std::max(blockXY.x - 1, 0); bx < blockXY.x + 1 && bx < worldSize.x; bx++)
-            {
-                Float3 ent_bbox[2];
+        for (IEntity* ent : nearby)
+        {
+            IPointEntity* i = dynamic_cast<IPointEntity*>(ent);
+            Float3 ent_bbox[2];
 
-                iterate2 (i, blocks[by * worldSize.x + bx].entities)
-                {
-                    if (i == pe || !i->GetAABB(ent_bbox[0], ent_bbox[1]))
-                        continue;
+            if (i == pe || !i->GetAABB(ent_bbox[0], ent_bbox[1]))
+                continue;
 
-                    if (min.x < ent_bbox[1].x && ent_bbox[0].x < max.x
-                            && min.y < ent_bbox[1].y && ent_bbox[0].y < max.y
-                            && min.z < ent_bbox[1].z && ent_bbox[0].z < max.z)
-                        return false;
-                }
-            }
+            if (min.x < ent_bbox[1].x && ent_bbox[0].x < max.x
+                    && min.y < ent_bbox[1].y && ent_bbox[0].y < max.y
+                    && min.z < ent_bbox[1].z && ent_bbox[0].z < max.z)
+                return false;
+        }
 
         static const float HEIGHT_THRESHOLD = 8.0f;
 
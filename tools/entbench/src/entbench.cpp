@@ -0,0 +1,243 @@
+#include <framework/entityworld.hpp>
+#include <framework/errorbuffer.hpp>
+#include <framework/system.hpp>
+#include <framework/varsystem.hpp>
+#include <framework/utility/params.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#define APP_TITLE       "entbench"
+
+namespace entbench
+{
+    using namespace zfw;
+
+    struct Options
+    {
+        unsigned int entities = 100000;
+        unsigned int lookups = 1000000;
+        unsigned int ticks = 10;
+    };
+
+    class BenchEntity : public IEntity
+    {
+        public:
+            virtual void OnTick() override { ticks++; }
+
+            virtual int GetID() const override { return id; }
+            virtual void SetID(int entID) override { id = entID; }
+            virtual const char* GetName() override { return "bench"; }
+            virtual const Float3& GetPos() override { return pos; }
+            virtual void SetPos(const Float3& pos) override { this->pos = pos; }
+
+            unsigned int ticks = 0;
+
+        private:
+            int id = -1;
+            Float3 pos;
+    };
+
+    class Stopwatch
+    {
+        public:
+            Stopwatch() : start(std::chrono::steady_clock::now()) {}
+
+            double Lap()
+            {
+                const auto now = std::chrono::steady_clock::now();
+                const double ms = std::chrono::duration<double, std::milli>(now - start).count();
+                start = now;
+                return ms;
+            }
+
+        private:
+            std::chrono::steady_clock::time_point start;
+    };
+
+    static ErrorBuffer_t* g_eb;
+    static ISystem* g_sys;
+
+    static bool SysInit(int argc, char** argv)
+    {
+        ErrorBuffer::Create(g_eb);
+
+        g_sys = CreateSystem();
+
+        if (!g_sys->Init(g_eb, kSysNonInteractive))
+            return false;
+
+        auto var = g_sys->GetVarSystem();
+        var->SetVariable("appName", "Entbench", 0);
+
+        if (!g_sys->Startup())
+            return false;
+
+        return true;
+    }
+
+    static void SysShutdown()
+    {
+        g_sys->Shutdown();
+    }
+
+    static void Report(const char* what, double ms, unsigned int count, const char* unit)
+    {
+        printf("%-32s %10.3f ms  %8.1f ns/%s\n", what, ms, ms * 1.0e6 / count, unit);
+    }
+
+    // IDs of removed entities must never resolve again, not even after their slots have been reused
+    static unsigned int CountStale(EntityWorld* world, const std::vector<int>& removedIDs)
+    {
+        unsigned int stale = 0;
+
+        for (int entID : removedIDs)
+        {
+            if (world->GetEntityByID(entID) != nullptr)
+                stale++;
+        }
+
+        return stale;
+    }
+
+    static void AddEntities(EntityWorld* world, unsigned int count, std::vector<int>& ids)
+    {
+        for (unsigned int i = 0; i < count; i++)
+        {
+            auto ent = std::make_shared<BenchEntity>();
+            world->AddEntity(ent);
+            ids.push_back(ent->GetID());
+        }
+    }
+
+    static bool Run(const Options& options)
+    {
+        EntityWorld world(g_sys);
+        std::mt19937 rng(1);
+
+        std::vector<int> ids, removedIDs;
+        ids.reserve(options.entities);
+
+        Stopwatch stopwatch;
+
+        AddEntities(&world, options.entities, ids);
+        Report("AddEntity", stopwatch.Lap(), options.entities, "entity");
+
+        uintptr_t checksum = 0;
+
+        for (unsigned int i = 0; i < options.lookups; i++)
+            checksum += (uintptr_t) world.GetEntityByID(ids[rng() % ids.size()]);
+
+        Report("GetEntityByID", stopwatch.Lap(), options.lookups, "lookup");
+
+        for (unsigned int i = 0; i < options.ticks; i++)
+            world.OnTick();
+
+        Report("OnTick", stopwatch.Lap(), options.ticks * options.entities, "entity");
+
+        // Remove half of the entities in random order, then refill the world, reusing their slots
+        const unsigned int numRemoved = options.entities / 2;
+        stopwatch.Lap();
+
+        for (unsigned int i = 0; i < numRemoved; i++)
+        {
+            const size_t index = rng() % ids.size();
+            world.RemoveEntity(world.GetEntityByID(ids[index]));
+
+            removedIDs.push_back(ids[index]);
+            ids[index] = ids.back();
+            ids.pop_back();
+        }
+
+        if (numRemoved > 0)
+            Report("RemoveEntity", stopwatch.Lap(), numRemoved, "entity");
+
+        AddEntities(&world, numRemoved, ids);
+        stopwatch.Lap();
+
+        world.RemoveAllEntities(false);
+        Report("RemoveAllEntities", stopwatch.Lap(), options.entities, "entity");
+
+        removedIDs.insert(removedIDs.end(), ids.begin(), ids.end());
+        ids.clear();
+
+        AddEntities(&world, options.entities, ids);
+        Report("AddEntity (reused slots)", stopwatch.Lap(), options.entities, "entity");
+
+        const unsigned int stale = CountStale(&world, removedIDs);
+
+        printf("\n%u entities, %u removed IDs, %u stale  (%llx)\n", (unsigned int) world.GetNumEntities(),
+                (unsigned int) removedIDs.size(), stale, (unsigned long long) checksum);
+
+        world.RemoveAllEntities(false);
+
+        if (stale != 0)
+        {
+            fprintf(stderr, "Removed entity IDs resolved to new entities.\n");
+            return false;
+        }
+
+        return true;
+    }
+
+    static bool Set(Options& options, const char* key, const char* value)
+    {
+        if (strcmp(key, "entities") == 0)
+            options.entities = (unsigned int) strtoul(value, nullptr, 0);
+        else if (strcmp(key, "lookups") == 0)
+            options.lookups = (unsigned int) strtoul(value, nullptr, 0);
+        else if (strcmp(key, "ticks") == 0)
+            options.ticks = (unsigned int) strtoul(value, nullptr, 0);
+        else
+            return false;
+
+        return true;
+    }
+
+    static bool ParseOptions(Options& options, int argc, char** argv)
+    {
+        const char* key, *value;
+
+        for (int i = 1; i < argc; i++)
+        {
+            const char* p_params = argv[i];
+
+            while (Params::Next(p_params, key, value))
+            {
+                if (!Set(options, key, value))
+                    fprintf(stderr, "Warning: ignored unknown option `%s`\n", key);
+            }
+        }
+
+        return true;
+    }
+
+    extern "C" int main(int argc, char** argv)
+    {
+        Options options;
+        int rc = 0;
+
+        ParseOptions(options, argc, argv);
+
+        if (options.entities == 0 || options.entities > EntityWorld::kMaxEntities || options.lookups == 0)
+        {
+            fprintf(stderr, "usage: " APP_TITLE " [entities=100000] [lookups=1000000] [ticks=10]\n\n"
+                            "times adding, looking up, ticking and removing entities of an EntityWorld,\n"
+                            "and checks that IDs of removed entities stay invalid\n\n");
+            return -1;
+        }
+
+        if (!SysInit(argc, argv) || !Run(options))
+        {
+            g_sys->DisplayError(g_eb, true);
+            rc = -1;
+        }
+
+        SysShutdown();
+
+        return rc;
+    }
+}
@@ -0,0 +1,304 @@
+
+#include <framework/utility/params.hpp>
+#include <framework/utility/util.hpp>
+
+#include <zshared/mediafile2.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define APP_TITLE       "mediabench"
+
+namespace mediabench
+{
+    using namespace zfw;
+
+    // ntile.MapBlocks layout, as read by ntile's GameScreen::LoadMap
+    enum
+    {
+        BLOCK_WORLD = 0x00,
+        BLOCK_SHIROI_OUTSIDE = 0x10,
+
+        TILE_DATA_SIZE = 16 * 16 * 8,
+    };
+
+    struct Options
+    {
+        std::string file;
+        bool generate = false;
+        unsigned int size = 256;
+        unsigned int sections = 300;
+        int compression = 0;
+        unsigned int lookups = 10000;
+        unsigned int resave = 0;
+    };
+
+    class Stopwatch
+    {
+        public:
+            Stopwatch() : start(std::chrono::steady_clock::now()) {}
+
+            double Lap()
+            {
+                const auto now = std::chrono::steady_clock::now();
+                const double ms = std::chrono::duration<double, std::milli>(now - start).count();
+                start = now;
+                return ms;
+            }
+
+        private:
+            std::chrono::steady_clock::time_point start;
+    };
+
+    static bool Fail(zshared::MediaFile* mf, const char* what)
+    {
+        fprintf(stderr, "%s: %s\n", what, mf->GetErrorDesc());
+        return false;
+    }
+
+    static bool WriteMapBlocks(zshared::MediaFile* mf, li::IOStream* mapBlocks, const Options& options)
+    {
+        if (mapBlocks == nullptr)
+            return Fail(mf, "ntile.MapBlocks");
+
+        mapBlocks->writeLE<uint16_t>(options.size);
+        mapBlocks->writeLE<uint16_t>(options.size);
+
+        std::vector<uint8_t> tiles(TILE_DATA_SIZE);
+
+        for (unsigned int i = 0; i < options.size * options.size; i++)
+        {
+            // Every 4th block is a full world block with tile data
+            if (i % 4 == 0)
+            {
+                for (size_t j = 0; j < tiles.size(); j++)
+                    tiles[j] = (uint8_t)((i + j) % 8 == 0 ? i ^ j : j % 8);
+
+                if (!mapBlocks->writeLE<uint16_t>(BLOCK_WORLD)
+                        || mapBlocks->write(&tiles[0], tiles.size()) != tiles.size())
+                    return Fail(mf, "write");
+            }
+            else
+            {
+                if (!mapBlocks->writeLE<uint16_t>(BLOCK_SHIROI_OUTSIDE)
+                        || !mapBlocks->writeLE<int16_t>(0) || !mapBlocks->writeLE<int16_t>(0))
+                    return Fail(mf, "write");
+            }
+        }
+
+        return true;
+    }
+
+    static bool Generate(const Options& options)
+    {
+        remove(options.file.c_str());
+
+        unique_ptr<zshared::MediaFile> mf(zshared::MediaFile::Create());
+
+        if (!mf->Open(options.file.c_str(), false, true))
+            return Fail(mf.get(), "Open");
+
+        if (!mf->SetCompressionLevel(options.compression))
+            return Fail(mf.get(), "SetCompressionLevel");
+
+        mf->SetMetadata("media.authored_using", "name=" APP_TITLE);
+
+        // Filler sections, so that lookups have something to search through
+        for (unsigned int i = 0; i < options.sections; i++)
+        {
+            unique_ptr<li::IOStream> section(mf->CreateSection(sprintf_255("bench.Filler%u", i)));
+
+            if (section == nullptr || !section->writeLE<uint32_t>(i))
+                return Fail(mf.get(), "CreateSection");
+        }
+
+        unique_ptr<li::IOStream> mapBlocks(mf->CreateSection("ntile.MapBlocks"));
+
+        if (!WriteMapBlocks(mf.get(), mapBlocks.get(), options))
+            return false;
+
+        mapBlocks.reset();
+
+        printf("%s: %ux%u blocks, %u filler sections, %llu bytes\n", options.file.c_str(), options.size, options.size,
+                options.sections, (unsigned long long) mf->GetFileSize());
+        return true;
+    }
+
+    // Same access pattern as GameScreen::Edit_SaveMap; the file size must settle after the first save
+    static bool Resave(const Options& options)
+    {
+        for (unsigned int i = 0; i < options.resave; i++)
+        {
+            Stopwatch stopwatch;
+            unique_ptr<zshared::MediaFile> mf(zshared::MediaFile::Create());
+
+            if (!mf->Open(options.file.c_str(), false, false))
+                return Fail(mf.get(), "Open");
+
+            if (!mf->SetCompressionLevel(options.compression))
+                return Fail(mf.get(), "SetCompressionLevel");
+
+            unique_ptr<li::IOStream> mapBlocks(mf->OpenOrCreateSection("ntile.MapBlocks"));
+
+            if (!WriteMapBlocks(mf.get(), mapBlocks.get(), options))
+                return false;
+
+            mapBlocks.reset();
+
+            printf("%-32s %10.3f ms  (%llu bytes)\n", sprintf_255("save #%u", i + 1), stopwatch.Lap(),
+                    (unsigned long long) mf->GetFileSize());
+        }
+
+        printf("\n");
+        return true;
+    }
+
+    static bool Run(const Options& options)
+    {
+        class SectionNames : public zshared::ISectionEntryListener
+        {
+            public:
+                std::vector<std::string> names;
+
+                virtual int OnSectionEntry(uint16_t name_crc16, const char* name, const char* desc,
+                        const uint8_t compression[4], uint64_t data_length, uint64_t compressed_length) override
+                {
+                    names.emplace_back(name);
+                    return 1;
+                }
+        };
+
+        Stopwatch stopwatch;
+        unique_ptr<zshared::MediaFile> mf(zshared::MediaFile::Create());
+
+        if (!mf->Open(options.file.c_str(), true, false))
+            return Fail(mf.get(), "Open");
+
+        printf("%-32s %10.3f ms\n", "open", stopwatch.Lap());
+
+        SectionNames sectionNames;
+        mf->IterateSections(&sectionNames);
+
+        stopwatch.Lap();
+
+        for (unsigned int i = 0; i < options.lookups && !sectionNames.names.empty(); i++)
+        {
+            const auto& name = sectionNames.names[i % sectionNames.names.size()];
+            unique_ptr<li::IOStream> section(mf->OpenSection(name.c_str()));
+
+            if (section == nullptr)
+                return Fail(mf.get(), name.c_str());
+        }
+
+        printf("%-32s %10.3f ms  (%u lookups, %u sections)\n", "OpenSection", stopwatch.Lap(),
+                options.lookups, (unsigned int) sectionNames.names.size());
+
+        // Same access pattern as GameScreen::LoadMap
+        unique_ptr<li::IOStream> mapBlocks(mf->OpenSection("ntile.MapBlocks"));
+
+        if (mapBlocks == nullptr)
+        {
+            printf("(no ntile.MapBlocks section)\n");
+            return true;
+        }
+
+        uint16_t map_w, map_h;
+
+        if (!mapBlocks->readLE<uint16_t>(&map_w) || !mapBlocks->readLE<uint16_t>(&map_h))
+            return Fail(mf.get(), "ntile.MapBlocks");
+
+        std::vector<uint8_t> tiles(TILE_DATA_SIZE);
+
+        for (unsigned int i = 0; i < (unsigned int) map_w * map_h; i++)
+        {
+            uint16_t type;
+
+            if (!mapBlocks->readLE<uint16_t>(&type))
+                return Fail(mf.get(), "ntile.MapBlocks");
+
+            if (type == BLOCK_WORLD)
+            {
+                if (mapBlocks->read(&tiles[0], tiles.size()) != tiles.size())
+                    return Fail(mf.get(), "ntile.MapBlocks");
+            }
+            else if (type == BLOCK_SHIROI_OUTSIDE)
+            {
+                int16_t minElev, maxElev;
+
+                if (!mapBlocks->readLE<int16_t>(&minElev) || !mapBlocks->readLE<int16_t>(&maxElev))
+                    return Fail(mf.get(), "ntile.MapBlocks");
+            }
+        }
+
+        printf("%-32s %10.3f ms  (%ux%u blocks, %llu bytes)\n", "load ntile.MapBlocks", stopwatch.Lap(),
+                map_w, map_h, (unsigned long long) mapBlocks->getSize());
+        return true;
+    }
+
+    static bool Set(Options& options, const char* key, const char* value)
+    {
+        if (strcmp(key, "compression") == 0)
+            options.compression = (int) strtol(value, nullptr, 0);
+        else if (strcmp(key, "file") == 0)
+            options.file = value;
+        else if (strcmp(key, "generate") == 0)
+            options.generate = Util::ParseBool(value);
+        else if (strcmp(key, "lookups") == 0)
+            options.lookups = (unsigned int) strtoul(value, nullptr, 0);
+        else if (strcmp(key, "resave") == 0)
+            options.resave = (unsigned int) strtoul(value, nullptr, 0);
+        else if (strcmp(key, "sections") == 0)
+            options.sections = (unsigned int) strtoul(value, nullptr, 0);
+        else if (strcmp(key, "size") == 0)
+            options.size = (unsigned int) strtoul(value, nullptr, 0);
+        else
+            return false;
+
+        return true;
+    }
+
+    static bool ParseOptions(Options& options, int argc, char** argv)
+    {
+        const char* key, *value;
+
+        for (int i = 1; i < argc; i++)
+        {
+            const char* p_params = argv[i];
+
+            while (Params::Next(p_params, key, value))
+            {
+                if (!Set(options, key, value))
+                    fprintf(stderr, "Warning: ignored unknown option `%s`\n", key);
+            }
+        }
+
+        return true;
+    }
+
+    extern "C" int main(int argc, char** argv)
+    {
+        Options options;
+
+        ParseOptions(options, argc, argv);
+
+        if (options.file.empty() || options.size == 0 || options.size > 0xFFFF)
+        {
+            fprintf(stderr, "usage: " APP_TITLE " file=<map.zmf> [lookups=10000]\n"
+                            "       " APP_TITLE " file=<map.zmf> generate=1 [size=256] [sections=300] [compression=0]\n"
+                            "       " APP_TITLE " file=<map.zmf> resave=10 [size=256] [compression=6]\n\n"
+                            "times opening the media file, section lookups and an ntile-style map load;\n"
+                            "resave rewrites ntile.MapBlocks in place, like the map editor does, and prints the file size\n\n");
+            return -1;
+        }
+
+        if (options.generate && !Generate(options))
+            return -1;
+
+        if (options.resave > 0 && !Resave(options))
+            return -1;
+
+        return Run(options) ? 0 : -1;
+    }
+}
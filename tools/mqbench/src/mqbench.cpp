@@ -0,0 +1,166 @@
+
+#include <framework/messagequeue.hpp>
+#include <framework/utility/params.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define APP_TITLE       "mqbench"
+
+namespace mqbench
+{
+    using namespace zfw;
+
+    enum { BENCH_MESSAGE = 1 };
+
+    DECL_MESSAGE(BenchMessage, BENCH_MESSAGE)
+    {
+        int producer;
+        int seq;
+        unique_ptr<std::string> payload;    // some messages own memory, like real event messages do
+    };
+
+    struct Options
+    {
+        unsigned int messages = 400000;
+        unsigned int maxProducers = 16;
+        unsigned int batch = 64;
+        unsigned int rounds = 5;
+    };
+
+    static double Run(MessageQueue* msgQueue, unsigned int numProducers, unsigned int perProducer, unsigned int batch)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> producers;
+
+        for (unsigned int p = 0; p < numProducers; p++)
+        {
+            producers.emplace_back([msgQueue, p, perProducer]()
+            {
+                for (unsigned int i = 0; i < perProducer; i++)
+                {
+                    MessageConstruction<BenchMessage> msg(msgQueue);
+                    msg->producer = p;
+                    msg->seq = i;
+
+                    if (i % 100 == 0)
+                        msg->payload.reset(new std::string("a payload too long for the small string buffer"));
+                }
+            });
+        }
+
+        std::vector<int> nextSeq(numProducers, 0);
+        std::vector<MessageHeader*> messages(batch);
+
+        for (size_t received = 0; received < (size_t) numProducers * perProducer; )
+        {
+            const size_t count = msgQueue->RetrieveBatch(&messages[0], batch, li::Timeout(-1));
+
+            for (size_t i = 0; i < count; i++)
+            {
+                auto msg = messages[i]->Data<BenchMessage>();
+
+                // Messages of a single producer must arrive in order
+                if (messages[i]->type != BENCH_MESSAGE || msg->seq != nextSeq[msg->producer]++)
+                {
+                    fprintf(stderr, "message out of order (producer %d, seq %d)\n", msg->producer, msg->seq);
+                    exit(-1);
+                }
+
+                messages[i]->Release();
+            }
+
+            received += count;
+        }
+
+        for (auto& producer : producers)
+            producer.join();
+
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Best of several rounds, to filter out scheduler noise
+    static double Best(MessageQueue* (*create)(), const Options& options, unsigned int numProducers)
+    {
+        double best = 0.0;
+
+        for (unsigned int round = 0; round < options.rounds; round++)
+        {
+            unique_ptr<MessageQueue> msgQueue(create());
+            const double ms = Run(msgQueue.get(), numProducers, options.messages / numProducers, options.batch);
+
+            if (round == 0 || ms < best)
+                best = ms;
+        }
+
+        return best;
+    }
+
+    static bool Set(Options& options, const char* key, const char* value)
+    {
+        if (strcmp(key, "batch") == 0)
+            options.batch = (unsigned int) strtoul(value, nullptr, 0);
+        else if (strcmp(key, "messages") == 0)
+            options.messages = (unsigned int) strtoul(value, nullptr, 0);
+        else if (strcmp(key, "producers") == 0)
+            options.maxProducers = (unsigned int) strtoul(value, nullptr, 0);
+        else if (strcmp(key, "rounds") == 0)
+            options.rounds = (unsigned int) strtoul(value, nullptr, 0);
+        else
+            return false;
+
+        return true;
+    }
+
+    static bool ParseOptions(Options& options, int argc, char** argv)
+    {
+        const char* key, *value;
+
+        for (int i = 1; i < argc; i++)
+        {
+            const char* p_params = argv[i];
+
+            while (Params::Next(p_params, key, value))
+            {
+                if (!Set(options, key, value))
+                    fprintf(stderr, "Warning: ignored unknown option `%s`\n", key);
+            }
+        }
+
+        return true;
+    }
+
+    extern "C" int main(int argc, char** argv)
+    {
+        Options options;
+
+        ParseOptions(options, argc, argv);
+
+        if (options.messages == 0 || options.maxProducers == 0 || options.batch == 0 || options.rounds == 0)
+        {
+            fprintf(stderr, "usage: " APP_TITLE " [messages=400000] [producers=16] [batch=64] [rounds=5]\n\n"
+                            "times posting messages from 1..producers threads to one consumer,\n"
+                            "with the double-buffered and the lock-free MessageQueue (best of rounds)\n\n");
+            return -1;
+        }
+
+        printf("%u messages, %u hardware threads\n\n", options.messages, std::thread::hardware_concurrency());
+        printf("%-10s %16s %16s %16s\n", "producers", "double-buffered", "lock-free", "speedup");
+
+        for (unsigned int numProducers = 1; numProducers <= options.maxProducers; numProducers *= 2)
+        {
+            const double doubleBufferedMs = Best(&MessageQueue::CreateDoubleBuffered, options, numProducers);
+            const double lockFreeMs = Best(&MessageQueue::Create, options, numProducers);
+
+            printf("%-10u %13.1f ms %13.1f ms %15.2fx\n", numProducers, doubleBufferedMs, lockFreeMs,
+                    doubleBufferedMs / lockFreeMs);
+        }
+
+        return 0;
+    }
+}
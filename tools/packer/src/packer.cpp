@@ -0,0 +1,300 @@
+
+#include <framework/errorbuffer.hpp>
+#include <framework/errorcheck.hpp>
+#include <framework/filesystem.hpp>
+#include <framework/packfile.hpp>
+#include <framework/system.hpp>
+#include <framework/varsystem.hpp>
+#include <framework/utility/params.hpp>
+#include <framework/utility/util.hpp>
+
+#include <littl/File.hpp>
+
+#include <algorithm>
+#include <ctime>
+#include <vector>
+
+#define APP_TITLE       "packer"
+
+namespace packer
+{
+    using namespace zfw;
+
+    struct Options
+    {
+        std::string input, output;
+        unsigned int alignment = kPackDefaultAlignment;
+        bool verbose = false;
+    };
+
+    struct File_t
+    {
+        std::string path;
+        uint64_t size;
+    };
+
+    static ErrorBuffer_t* g_eb;
+    static ISystem* g_sys;
+
+    static bool SysInit(int argc, char** argv)
+    {
+        ErrorBuffer::Create(g_eb);
+
+        g_sys = CreateSystem();
+
+        if (!g_sys->Init(g_eb, kSysNonInteractive))
+            return false;
+
+        auto var = g_sys->GetVarSystem();
+        var->SetVariable("appName", "Packer", 0);
+
+        if (!g_sys->Startup())
+            return false;
+
+        return true;
+    }
+
+    static void SysShutdown()
+    {
+        g_sys->Shutdown();
+    }
+
+    static bool CollectFiles(IFileSystem* fs, const std::string& dirPath, std::vector<File_t>& files)
+    {
+        unique_ptr<IDirectory> dir(fs->OpenDirectory(dirPath.c_str(), 0));
+
+        if (dir == nullptr)
+            return false;
+
+        while (const char* name = dir->ReadDir())
+        {
+            const std::string path = dirPath.empty() ? name : dirPath + "/" + name;
+
+            FSStat_t stat;
+            ErrorCheck(fs->Stat(path.c_str(), &stat));
+
+            if (stat.isDirectory)
+                ErrorCheck(CollectFiles(fs, path, files));
+            else
+                files.emplace_back(File_t { path, stat.sizeInBytes });
+        }
+
+        return true;
+    }
+
+    static uint64_t Align(uint64_t offset, uint64_t alignment)
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    static bool WritePadding(li::File* file, uint64_t count)
+    {
+        static const uint8_t zeros[256] = {};
+
+        while (count > 0)
+        {
+            const size_t chunk = (size_t) std::min<uint64_t>(count, sizeof(zeros));
+
+            if (file->write(zeros, chunk) != chunk)
+                return false;
+
+            count -= chunk;
+        }
+
+        return true;
+    }
+
+    static bool Pack(const Options& options)
+    {
+        auto fs = g_sys->CreateStdFileSystem(options.input.c_str(), kFSAccessStat | kFSAccessRead);
+
+        std::vector<File_t> files;
+        ErrorCheck(CollectFiles(fs.get(), "", files));
+
+        // Sorted entries keep directories contiguous (FileSystemPack relies on this for listing)
+        std::sort(files.begin(), files.end(), [](const File_t& a, const File_t& b) { return a.path < b.path; });
+
+        const uint32_t numEntries = (uint32_t) files.size();
+        uint32_t numBuckets = 16;
+
+        while (numBuckets < 2 * numEntries)
+            numBuckets *= 2;
+
+        // Build the index
+        PackHeader_t header = {};
+        memcpy(header.magic, kPackMagic, sizeof(kPackMagic));
+        header.version = kPackVersion;
+        header.alignment = options.alignment;
+        header.numEntries = numEntries;
+        header.numBuckets = numBuckets;
+        header.timestamp = (int64_t) time(nullptr);
+
+        std::vector<uint32_t> buckets(numBuckets, kPackEmptyBucket);
+        std::vector<PackEntry_t> entries(numEntries);
+        std::string strings;
+
+        for (uint32_t i = 0; i < numEntries; i++)
+        {
+            PackEntry_t& entry = entries[i];
+            entry.size = files[i].size;
+            entry.pathHash = HashPackPath(files[i].path.c_str(), files[i].path.length());
+            entry.nameOffset = (uint32_t) strings.length();
+            entry.nameLength = (uint32_t) files[i].path.length();
+            entry.flags = 0;
+
+            strings += files[i].path;
+
+            uint32_t bucket = entry.pathHash & (numBuckets - 1);
+
+            while (buckets[bucket] != kPackEmptyBucket)
+                bucket = (bucket + 1) & (numBuckets - 1);
+
+            buckets[bucket] = i;
+        }
+
+        header.bucketsOffset = sizeof(PackHeader_t);
+        header.entriesOffset = Align(header.bucketsOffset + numBuckets * sizeof(uint32_t), alignof(PackEntry_t));
+        header.stringsOffset = header.entriesOffset + numEntries * sizeof(PackEntry_t);
+        header.stringsSize = strings.length();
+
+        uint64_t offset = Align(header.stringsOffset + header.stringsSize, options.alignment);
+
+        for (auto& entry : entries)
+        {
+            entry.offset = offset;
+            offset = Align(offset + entry.size, options.alignment);
+        }
+
+        // Write everything out
+        unique_ptr<li::File> file(li::File::open(options.output.c_str(), "wb"));
+
+        if (!file)
+            return ErrorBuffer::SetError2(g_eb, EX_ACCESS_DENIED, 1,
+                "desc", sprintf_255("Failed to open output file %s.", options.output.c_str())
+            ), false;
+
+        ErrorCheck(file->write(&header, sizeof(header)) == sizeof(header));
+        ErrorCheck(file->write(&buckets[0], numBuckets * sizeof(uint32_t)) == numBuckets * sizeof(uint32_t));
+        ErrorCheck(WritePadding(file.get(), header.entriesOffset - (header.bucketsOffset + numBuckets * sizeof(uint32_t))));
+
+        if (numEntries > 0)
+            ErrorCheck(file->write(&entries[0], numEntries * sizeof(PackEntry_t)) == numEntries * sizeof(PackEntry_t));
+
+        ErrorCheck(file->write(strings.c_str(), strings.length()) == strings.length());
+
+        uint64_t pos = header.stringsOffset + header.stringsSize;
+        std::vector<uint8_t> buffer(256 * 1024);
+
+        for (uint32_t i = 0; i < numEntries; i++)
+        {
+            ErrorCheck(WritePadding(file.get(), entries[i].offset - pos));
+
+            InputStream* is;
+
+            if (!fs->OpenFileStream(files[i].path.c_str(), 0, &is, nullptr, nullptr))
+                return false;
+
+            unique_ptr<InputStream> input(is);
+            uint64_t remaining = entries[i].size;
+
+            while (remaining > 0)
+            {
+                const size_t count = input->read(&buffer[0], (size_t) std::min<uint64_t>(remaining, buffer.size()));
+
+                if (count == 0)
+                    return ErrorBuffer::SetError2(g_eb, EX_IO_ERROR, 1,
+                        "desc", sprintf_255("File %s changed while packing.", files[i].path.c_str())
+                    ), false;
+
+                ErrorCheck(file->write(&buffer[0], count) == count);
+                remaining -= count;
+            }
+
+            pos = entries[i].offset + entries[i].size;
+
+            if (options.verbose)
+                printf("%10llu  %s\n", (unsigned long long) entries[i].size, files[i].path.c_str());
+        }
+
+        printf("%s: %u files, %llu bytes\n", options.output.c_str(), numEntries, (unsigned long long) pos);
+        return true;
+    }
+
+    static bool Set(Options& options, const char* key, const char* value)
+    {
+        if (strcmp(key, "alignment") == 0)
+            options.alignment = (unsigned int) strtoul(value, nullptr, 0);
+        else if (strcmp(key, "input") == 0)
+            options.input = value;
+        else if (strcmp(key, "output") == 0)
+            options.output = value;
+        else if (strcmp(key, "verbose") == 0)
+            options.verbose = Util::ParseBool(value);
+        else
+            return false;
+
+        return true;
+    }
+
+    static bool ParseOptions(Options& options, const char* p_params)
+    {
+        const char* key, *value;
+
+        if (!p_params || p_params[0] == '#')
+            return false;
+
+        while (Params::Next(p_params, key, value))
+        {
+            if (!Set(options, key, value))
+                fprintf(stderr, "Warning: ignored unknown option `%s`\n", key);
+        }
+
+        return true;
+    }
+
+    template <typename Options>
+    static bool ParseOptions(Options& options, int argc, char** argv)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            if (argv[i][0] == '+')
+            {
+                unique_ptr<li::File> file(li::File::open(argv[i] + 1));
+
+                while (!file->eof())
+                    ParseOptions(options, file->readLine().c_str());
+            }
+            else
+                ParseOptions(options, argv[i]);
+        }
+
+        return true;
+    }
+
+    extern "C" int main(int argc, char** argv)
+    {
+        Options options;
+        int rc = 0;
+
+        ParseOptions(options, argc, argv);
+
+        if (options.input.empty() || options.output.empty()
+                || options.alignment == 0 || (options.alignment & (options.alignment - 1)) != 0)
+        {
+            fprintf(stderr, "usage: " APP_TITLE " [+config ...] input=<directory> output=<file>\n"
+                            "       [alignment=4096] [verbose=1]\n\n"
+                            "mount the result with fs_pack <file> [mountPoint]\n\n");
+            return -1;
+        }
+
+        if (!SysInit(argc, argv) || !Pack(options))
+        {
+            g_sys->DisplayError(g_eb, true);
+            rc = -1;
+        }
+
+        SysShutdown();
+
+        return rc;
+    }
+}
@@ -0,0 +1,249 @@
+
+#include <framework/errorbuffer.hpp>
+#include <framework/resource.hpp>
+#include <framework/resourcemanager2.hpp>
+#include <framework/system.hpp>
+#include <framework/varsystem.hpp>
+#include <framework/utility/params.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define APP_TITLE       "resbench"
+
+namespace resbench
+{
+    using namespace zfw;
+
+    struct Options
+    {
+        unsigned int resources = 1000;
+        unsigned int sections = 8;
+        unsigned int lookups = 1000000;
+    };
+
+    // Does nothing but exist, so that only the lookups are measured
+    class BenchResource : public IResource2
+    {
+        public:
+            virtual void* Cast(const TypeID& resourceClass) final override { return DefaultCast(this, resourceClass); }
+            virtual State_t GetState() const final override { return state; }
+
+            virtual bool StateTransitionTo(State_t targetState, IResourceManager2* resMgr) final override
+            {
+                state = targetState;
+                return true;
+            }
+
+        private:
+            State_t state = CREATED;
+    };
+
+    class BenchProvider : public IResourceProvider2
+    {
+        public:
+            virtual IResource2* CreateResource(IResourceManager2* res, const TypeID& resourceClass,
+                    const char* recipe, int flags) override
+            {
+                return new BenchResource();
+            }
+    };
+
+    class Stopwatch
+    {
+        public:
+            Stopwatch() : start(std::chrono::steady_clock::now()) {}
+
+            double Lap()
+            {
+                const auto now = std::chrono::steady_clock::now();
+                const double ms = std::chrono::duration<double, std::milli>(now - start).count();
+                start = now;
+                return ms;
+            }
+
+        private:
+            std::chrono::steady_clock::time_point start;
+    };
+
+    static ErrorBuffer_t* g_eb;
+    static ISystem* g_sys;
+
+    static bool SysInit(int argc, char** argv)
+    {
+        ErrorBuffer::Create(g_eb);
+
+        g_sys = CreateSystem();
+
+        if (!g_sys->Init(g_eb, kSysNonInteractive))
+            return false;
+
+        auto var = g_sys->GetVarSystem();
+        var->SetVariable("appName", "Resbench", 0);
+
+        if (!g_sys->Startup())
+            return false;
+
+        return true;
+    }
+
+    static void SysShutdown()
+    {
+        g_sys->Shutdown();
+    }
+
+    static void Report(const char* what, double ms, const Options& options, uintptr_t checksum)
+    {
+        printf("%-32s %10.3f ms  %8.1f ns/lookup  (%llx)\n", what, ms, ms * 1.0e6 / options.lookups,
+                (unsigned long long) checksum);
+    }
+
+    static bool Run(const Options& options)
+    {
+        unique_ptr<IResourceManager2> resMgr(g_sys->CreateResourceManager2());
+
+        BenchProvider provider;
+        const TypeID resourceClass = typeID<BenchResource>();
+        resMgr->RegisterResourceProvider(&resourceClass, 1, &provider);
+
+        // Resources live in the last section, so that finding the section storage isn't free either
+        std::vector<ResourceSection_t> sections(options.sections);
+
+        for (auto& section : sections)
+        {
+            section = ResourceSection_t { "bench", 0, 0 };
+            resMgr->EnterResourceSection(&section);
+            resMgr->LeaveResourceSection();
+        }
+
+        resMgr->EnterResourceSection(&sections.back());
+
+        // Typical texture paths, as passed to Resource<T>::ByPath
+        std::vector<std::string> paths, recipes;
+
+        for (unsigned int i = 0; i < options.resources; i++)
+        {
+            char path[256];
+            snprintf(path, sizeof(path), "ntile/worldtex/tile_%04u_diffuse.png", i);
+            paths.emplace_back(path);
+
+            char recipe[256];
+            Params::BuildIntoBuffer(recipe, sizeof(recipe), 1, "path", path);
+            recipes.emplace_back(recipe);
+        }
+
+        Stopwatch stopwatch;
+
+        for (const auto& path : paths)
+        {
+            if (resMgr->GetResourceByPath<BenchResource>(path.c_str(), IResourceManager2::kResourceRequired) == nullptr)
+                return false;
+        }
+
+        printf("%-32s %10.3f ms  (%u resources, %u sections)\n\n", "create", stopwatch.Lap(),
+                options.resources, options.sections);
+
+        uintptr_t checksum = 0;
+
+        for (unsigned int i = 0; i < options.lookups; i++)
+            checksum += (uintptr_t) resMgr->GetResourceByPath<BenchResource>(
+                    paths[i % paths.size()].c_str(), IResourceManager2::kResourceRequired);
+
+        Report("GetResourceByPath", stopwatch.Lap(), options, checksum);
+        checksum = 0;
+
+        for (unsigned int i = 0; i < options.lookups; i++)
+            checksum += (uintptr_t) resMgr->GetResource<BenchResource>(
+                    recipes[i % recipes.size()].c_str(), IResourceManager2::kResourceRequired);
+
+        Report("GetResource", stopwatch.Lap(), options, checksum);
+
+        std::vector<RecipeID_t> ids;
+        std::vector<ResourceHandle<BenchResource>> handles;
+
+        for (unsigned int i = 0; i < options.resources; i++)
+        {
+            ids.push_back(resMgr->InternRecipe(recipes[i].c_str()));
+            handles.push_back(resMgr->GetResourceHandleByPath<BenchResource>(paths[i].c_str(),
+                    IResourceManager2::kResourceRequired));
+        }
+
+        stopwatch.Lap();
+        checksum = 0;
+
+        for (unsigned int i = 0; i < options.lookups; i++)
+            checksum += (uintptr_t) resMgr->GetResourceByID(ids[i % ids.size()], resourceClass,
+                    IResourceManager2::kResourceRequired);
+
+        Report("GetResourceByID", stopwatch.Lap(), options, checksum);
+        checksum = 0;
+
+        for (unsigned int i = 0; i < options.lookups; i++)
+            checksum += (uintptr_t) handles[i % handles.size()].Get();
+
+        Report("ResourceHandle::Get", stopwatch.Lap(), options, checksum);
+
+        resMgr->LeaveResourceSection();
+        return true;
+    }
+
+    static bool Set(Options& options, const char* key, const char* value)
+    {
+        if (strcmp(key, "lookups") == 0)
+            options.lookups = (unsigned int) strtoul(value, nullptr, 0);
+        else if (strcmp(key, "resources") == 0)
+            options.resources = (unsigned int) strtoul(value, nullptr, 0);
+        else if (strcmp(key, "sections") == 0)
+            options.sections = (unsigned int) strtoul(value, nullptr, 0);
+        else
+            return false;
+
+        return true;
+    }
+
+    static bool ParseOptions(Options& options, int argc, char** argv)
+    {
+        const char* key, *value;
+
+        for (int i = 1; i < argc; i++)
+        {
+            const char* p_params = argv[i];
+
+            while (Params::Next(p_params, key, value))
+            {
+                if (!Set(options, key, value))
+                    fprintf(stderr, "Warning: ignored unknown option `%s`\n", key);
+            }
+        }
+
+        return true;
+    }
+
+    extern "C" int main(int argc, char** argv)
+    {
+        Options options;
+        int rc = 0;
+
+        ParseOptions(options, argc, argv);
+
+        if (options.resources == 0 || options.sections == 0 || options.lookups == 0)
+        {
+            fprintf(stderr, "usage: " APP_TITLE " [resources=1000] [sections=8] [lookups=1000000]\n\n"
+                            "times resource lookups by path, by recipe, by recipe ID and through handles\n\n");
+            return -1;
+        }
+
+        if (!SysInit(argc, argv) || !Run(options))
+        {
+            g_sys->DisplayError(g_eb, true);
+            rc = -1;
+        }
+
+        SysShutdown();
+
+        return rc;
+    }
+}